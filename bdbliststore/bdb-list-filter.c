@@ -0,0 +1,883 @@
+#define _GNU_SOURCE /* memmem */
+
+#include "bdb-list-filter.h"
+
+#include <glib.h>
+#include <string.h>
+
+static void tree_model_init (GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_EXTENDED (BdbListFilter, bdb_list_filter, G_TYPE_OBJECT, 0,
+                        G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL, tree_model_init));
+
+#define LIST_FILTER_PRIVATE(o)              \
+	(G_TYPE_INSTANCE_GET_PRIVATE ((o),  \
+	BDB_TYPE_LIST_FILTER,               \
+	BdbListFilterPrivate))
+
+/* rows per bulk read, and per batch of results handed to the main loop */
+#define SCAN_CHUNK 16384
+
+typedef struct _BdbListFilterPrivate BdbListFilterPrivate;
+typedef struct _ScanJob              ScanJob;
+typedef struct _ScanChunk            ScanChunk;
+
+typedef struct
+{
+	gchar             *text;      /* NULL matches every row */
+	gsize              text_len;
+	BdbListFilterMode  mode;
+	gint               column;
+} Pattern;
+
+/*
+ * Rows are shown in the order they are stored in, whatever the sort
+ * column of the store.  Without a pattern the filter passes every row
+ * through; otherwise it holds the storage indices of the matching rows,
+ * 4 bytes per match, and row n is simply matches[n].
+ */
+struct _BdbListFilterPrivate
+{
+	gint          stamp;
+	BdbListStore *store;
+	gulong        inserted_id;
+	gulong        changed_id;
+	gulong        deleted_id;
+
+	Pattern       pattern;
+	guint         n_all;       /* rows announced while passing through */
+	GArray       *matches;     /* ascending storage indices */
+
+	GThreadPool  *pool;        /* NULL scans synchronously */
+	volatile gint gen;         /* bumped to cancel the running scan */
+	gboolean      scanning;
+	guint         scan_end;    /* the running scan stops before this index */
+	guint         delivered;   /* results below this index are merged */
+	GHashTable   *dirty;       /* rows changed past delivered while scanning */
+
+	guint         n_unresolved; /* deletions from a sorted store, see below */
+	guint         refilter_id;
+};
+
+/*
+ * A scan of the whole store, owned by the worker until its last chunk
+ * is delivered.  It carries its own copy of the pattern so the worker
+ * never looks at the filter's private data besides gen.
+ */
+struct _ScanJob
+{
+	BdbListFilter *self;       /* reference held until done */
+	BdbListStore  *store;
+	gint           gen;
+	Pattern        pattern;
+	guint          end;
+	gboolean       sync;
+};
+
+struct _ScanChunk
+{
+	ScanJob  *job;
+	guint     first;
+	guint     last;
+	GArray   *matches;
+	gboolean  done;
+};
+
+static gboolean
+record_matches (BdbListStore  *store,
+                const Pattern *pattern,
+                const guint8  *record,
+                gsize          size)
+{
+	const guint8 *data;
+	gsize         len;
+
+	if (!(data = bdb_list_store_record_get_data (store, record, size,
+	                                             pattern->column, &len)))
+		return FALSE;
+
+	if (pattern->mode == BDB_LIST_FILTER_PREFIX)
+		return len >= pattern->text_len &&
+		       memcmp (data, pattern->text, pattern->text_len) == 0;
+
+	/* glibc's memmem is a vectorized two-way search */
+	return memmem (data, len, pattern->text, pattern->text_len) != NULL;
+}
+
+static gboolean
+scan_func (BdbListStore *store,
+           guint         index,
+           const guint8 *data,
+           gsize         size,
+           gpointer      user_data)
+{
+	ScanChunk *chunk = user_data;
+
+	if (record_matches (store, &chunk->job->pattern, data, size))
+		g_array_append_val (chunk->matches, index);
+
+	return TRUE;
+}
+
+typedef struct
+{
+	const Pattern *pattern;
+	gboolean       matches;
+} MatchOne;
+
+static gboolean
+match_one_func (BdbListStore *store,
+                guint         index,
+                const guint8 *data,
+                gsize         size,
+                gpointer      user_data)
+{
+	MatchOne *one = user_data;
+
+	one->matches = record_matches (store, one->pattern, data, size);
+
+	return FALSE;
+}
+
+static gboolean
+row_matches (BdbListFilterPrivate *priv, guint index)
+{
+	MatchOne one = { &priv->pattern, FALSE };
+
+	bdb_list_store_fetch_range (priv->store, index, 1, match_one_func, &one);
+
+	return one.matches;
+}
+
+static void
+iter_set (BdbListFilterPrivate *priv,
+          GtkTreeIter          *iter,
+          guint                 position,
+          guint                 index)
+{
+	iter->stamp = priv->stamp;
+	iter->user_data = GUINT_TO_POINTER (position);
+	iter->user_data2 = GUINT_TO_POINTER (index);
+}
+
+/* binary search, returns where index is or would be inserted */
+static guint
+match_find (GArray *matches, guint index, gboolean *found)
+{
+	guint lo = 0;
+	guint hi = matches->len;
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+
+		if (g_array_index (matches, guint, mid) < index)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*found = lo < matches->len && g_array_index (matches, guint, lo) == index;
+
+	return lo;
+}
+
+static void
+match_insert (BdbListFilter *self, guint index)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (self);
+	GtkTreeIter           iter;
+	GtkTreePath          *path;
+	gboolean              found;
+	guint                 position;
+
+	position = match_find (priv->matches, index, &found);
+	if (found)
+		return;
+
+	g_array_insert_val (priv->matches, position, index);
+
+	iter_set (priv, &iter, position, index);
+	path = gtk_tree_path_new_from_indices (position, -1);
+	gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, &iter);
+	gtk_tree_path_free (path);
+}
+
+static void
+match_remove (BdbListFilter *self, guint index)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (self);
+	GtkTreePath          *path;
+	gboolean              found;
+	guint                 position;
+
+	position = match_find (priv->matches, index, &found);
+	if (!found)
+		return;
+
+	g_array_remove_index (priv->matches, position);
+
+	path = gtk_tree_path_new_from_indices (position, -1);
+	gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+	gtk_tree_path_free (path);
+}
+
+/* re-evaluates a single row against the pattern */
+static void
+match_update (BdbListFilter *self, guint index)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (self);
+	GtkTreeIter           iter;
+	GtkTreePath          *path;
+	gboolean              found;
+	guint                 position;
+
+	if (!row_matches (priv, index)) {
+		match_remove (self, index);
+		return;
+	}
+
+	position = match_find (priv->matches, index, &found);
+	if (!found) {
+		match_insert (self, index);
+		return;
+	}
+
+	iter_set (priv, &iter, position, index);
+	path = gtk_tree_path_new_from_indices (position, -1);
+	gtk_tree_model_row_changed (GTK_TREE_MODEL (self), path, &iter);
+	gtk_tree_path_free (path);
+}
+
+static void
+scan_job_free (ScanJob *job)
+{
+	g_object_unref (job->self);
+	g_object_unref (job->store);
+	g_free (job->pattern.text);
+	g_slice_free (ScanJob, job);
+}
+
+static gboolean
+scan_deliver (gpointer data)
+{
+	ScanChunk            *chunk = data;
+	ScanJob              *job   = chunk->job;
+	BdbListFilter        *self  = job->self;
+	BdbListFilterPrivate *priv  = LIST_FILTER_PRIVATE (self);
+	GArray               *recheck;
+	GHashTableIter        hiter;
+	gpointer              key;
+	guint                 i;
+
+	if (job->gen == priv->gen) {
+		for (i = 0; i < chunk->matches->len; i++) {
+			guint index = g_array_index (chunk->matches, guint, i);
+
+			if (!g_hash_table_lookup (priv->dirty, GUINT_TO_POINTER (index + 1)))
+				match_insert (self, index);
+		}
+
+		/* the worker may have read these before they changed */
+		recheck = g_array_new (FALSE, FALSE, sizeof (guint));
+		g_hash_table_iter_init (&hiter, priv->dirty);
+		while (g_hash_table_iter_next (&hiter, &key, NULL)) {
+			guint index = GPOINTER_TO_UINT (key) - 1;
+
+			if (index < chunk->last) {
+				g_array_append_val (recheck, index);
+				g_hash_table_iter_remove (&hiter);
+			}
+		}
+
+		priv->delivered = chunk->last;
+		if (chunk->done)
+			priv->scanning = FALSE;
+
+		for (i = 0; i < recheck->len; i++)
+			match_update (self, g_array_index (recheck, guint, i));
+		g_array_free (recheck, TRUE);
+	}
+
+	if (chunk->done)
+		scan_job_free (job);
+	g_array_free (chunk->matches, TRUE);
+	g_slice_free (ScanChunk, chunk);
+
+	return FALSE;
+}
+
+static void
+scan_worker (gpointer data, gpointer user_data)
+{
+	ScanJob              *job  = data;
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (job->self);
+	ScanChunk            *chunk;
+	guint                 first = 0;
+	gboolean              done;
+
+	do {
+		chunk = g_slice_new0 (ScanChunk);
+		chunk->job = job;
+		chunk->first = first;
+		chunk->last = MIN (first + SCAN_CHUNK, job->end);
+		chunk->matches = g_array_new (FALSE, FALSE, sizeof (guint));
+
+		if (g_atomic_int_get (&priv->gen) == job->gen)
+			bdb_list_store_fetch_range (job->store, first, chunk->last - first,
+			                            scan_func, chunk);
+		else
+			chunk->last = job->end;
+
+		first = chunk->last;
+		done = chunk->done = first >= job->end;
+
+		/* the job, and with it the last reference, goes with the final chunk */
+		if (job->sync)
+			scan_deliver (chunk);
+		else
+			g_idle_add (scan_deliver, chunk);
+	} while (!done);
+}
+
+static gboolean
+store_is_threaded (BdbListStore *store)
+{
+	DB       *db = bdb_list_store_get_db (store);
+	DB_ENV   *env;
+	u_int32_t flags = 0;
+
+	if (!g_thread_supported ())
+		return FALSE;
+
+	/* a mapped snapshot is read-only */
+	if (bdb_list_store_is_snapshot (store))
+		return TRUE;
+
+	if (db == NULL)
+		return FALSE;
+
+	if (db->get_open_flags (db, &flags) != 0 || !(flags & DB_THREAD))
+		return FALSE;
+
+	env = db->get_env (db);
+
+	return env == NULL || (env->get_open_flags (env, &flags) == 0 && (flags & DB_THREAD));
+}
+
+static void
+scan_start (BdbListFilter *self)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (self);
+	ScanJob              *job;
+
+	job = g_slice_new0 (ScanJob);
+	job->self = g_object_ref (self);
+	job->store = g_object_ref (priv->store);
+	job->gen = priv->gen;
+	job->pattern = priv->pattern;
+	job->pattern.text = g_strdup (priv->pattern.text);
+	job->end = gtk_tree_model_iter_n_children (GTK_TREE_MODEL (priv->store), NULL);
+
+	priv->scanning = TRUE;
+	priv->scan_end = job->end;
+	priv->delivered = 0;
+	g_hash_table_remove_all (priv->dirty);
+
+	if (!priv->pool && store_is_threaded (priv->store))
+		priv->pool = g_thread_pool_new (scan_worker, NULL, 1, FALSE, NULL);
+
+	if (priv->pool) {
+		g_thread_pool_push (priv->pool, job, NULL);
+	}
+	else {
+		job->sync = TRUE;
+		scan_worker (job, NULL);
+	}
+}
+
+/*
+ * Drops the current result and builds it again: every row is announced
+ * as deleted, then matches come back in as the scan delivers them.  While
+ * passing through only the row count is adjusted at the end, the views
+ * redraw the shifted rows because of the row-deleted anyway.
+ */
+static void
+refilter (BdbListFilter *self)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (self);
+	GtkTreeIter           iter;
+	GtkTreePath          *path;
+	guint                 n_rows;
+
+	g_atomic_int_inc (&priv->gen);
+	priv->scanning = FALSE;
+	priv->n_unresolved = 0;
+
+	while (priv->matches->len > 0) {
+		g_array_set_size (priv->matches, priv->matches->len - 1);
+		path = gtk_tree_path_new_from_indices (priv->matches->len, -1);
+		gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+		gtk_tree_path_free (path);
+	}
+
+	if (priv->pattern.text) {
+		while (priv->n_all > 0) {
+			path = gtk_tree_path_new_from_indices (--priv->n_all, -1);
+			gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+			gtk_tree_path_free (path);
+		}
+		scan_start (self);
+		return;
+	}
+
+	n_rows = gtk_tree_model_iter_n_children (GTK_TREE_MODEL (priv->store), NULL);
+
+	while (priv->n_all > n_rows) {
+		path = gtk_tree_path_new_from_indices (--priv->n_all, -1);
+		gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+		gtk_tree_path_free (path);
+	}
+	while (priv->n_all < n_rows) {
+		iter_set (priv, &iter, priv->n_all, priv->n_all);
+		path = gtk_tree_path_new_from_indices (priv->n_all++, -1);
+		gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, &iter);
+		gtk_tree_path_free (path);
+	}
+}
+
+static gboolean
+refilter_idle (gpointer data)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (data);
+
+	priv->refilter_id = 0;
+	if (priv->n_unresolved > 0)
+		refilter (BDB_LIST_FILTER (data));
+
+	return FALSE;
+}
+
+static void
+child_row_changed (GtkTreeModel  *child,
+                   GtkTreePath   *child_path,
+                   GtkTreeIter   *child_iter,
+                   BdbListFilter *self)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (self);
+	guint                 index = bdb_list_store_iter_get_index (priv->store, child_iter);
+	GtkTreeIter           iter;
+	GtkTreePath          *path;
+
+	if (!priv->pattern.text) {
+		if (index >= priv->n_all)
+			return;
+		iter_set (priv, &iter, index, index);
+		path = gtk_tree_path_new_from_indices (index, -1);
+		gtk_tree_model_row_changed (GTK_TREE_MODEL (self), path, &iter);
+		gtk_tree_path_free (path);
+		return;
+	}
+
+	if (priv->scanning && index >= priv->delivered && index < priv->scan_end) {
+		g_hash_table_insert (priv->dirty, GUINT_TO_POINTER (index + 1), GINT_TO_POINTER (TRUE));
+		return;
+	}
+
+	match_update (self, index);
+}
+
+static void
+child_row_inserted (GtkTreeModel  *child,
+                    GtkTreePath   *child_path,
+                    GtkTreeIter   *child_iter,
+                    BdbListFilter *self)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (self);
+	guint                 index = bdb_list_store_iter_get_index (priv->store, child_iter);
+	guint                 n_rows = gtk_tree_model_iter_n_children (child, NULL);
+	GtkTreeIter           iter;
+	GtkTreePath          *path;
+
+	/*
+	 * Rows are only ever appended, so a row inserted before the end is a
+	 * sorted store moving a row after an edit: it announces the move as a
+	 * deletion followed by this insertion of the same row.
+	 */
+	if (priv->n_unresolved > 0 && index + 1 < n_rows) {
+		priv->n_unresolved--;
+		child_row_changed (child, child_path, child_iter, self);
+		return;
+	}
+
+	/*
+	 * A sorted store announces appended rows in sorted order, not in the
+	 * order they were stored.  Announce every row up to this one so ours
+	 * stay in storage order; the later signals for them find them here.
+	 */
+	if (!priv->pattern.text) {
+		if (index < priv->n_all) {
+			child_row_changed (child, child_path, child_iter, self);
+			return;
+		}
+		while (priv->n_all <= index) {
+			iter_set (priv, &iter, priv->n_all, priv->n_all);
+			path = gtk_tree_path_new_from_indices (priv->n_all++, -1);
+			gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, &iter);
+			gtk_tree_path_free (path);
+		}
+		return;
+	}
+
+	if (priv->scanning && index < priv->scan_end) {
+		g_hash_table_insert (priv->dirty, GUINT_TO_POINTER (index + 1), GINT_TO_POINTER (TRUE));
+		return;
+	}
+
+	if (row_matches (priv, index))
+		match_insert (self, index);
+}
+
+static void
+child_row_deleted (GtkTreeModel  *child,
+                   GtkTreePath   *child_path,
+                   BdbListFilter *self)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (self);
+	guint                 index = gtk_tree_path_get_indices (child_path)[0];
+	GtkTreePath          *path;
+	gboolean              found;
+	guint                 position, i;
+
+	/*
+	 * A sorted store only tells us the sorted position of the row, not
+	 * where it was stored.  Wait for a matching re-insertion (a move) and
+	 * rebuild from scratch if none comes.
+	 */
+	if (gtk_tree_sortable_get_sort_column_id (GTK_TREE_SORTABLE (child), NULL, NULL)) {
+		priv->n_unresolved++;
+		if (!priv->refilter_id)
+			priv->refilter_id = g_idle_add (refilter_idle, self);
+		return;
+	}
+
+	if (!priv->pattern.text) {
+		if (index >= priv->n_all)
+			return;
+		priv->n_all--;
+		path = gtk_tree_path_new_from_indices (index, -1);
+		gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+		gtk_tree_path_free (path);
+		return;
+	}
+
+	/* every row after it moved up, which a running scan cannot follow */
+	if (priv->scanning) {
+		refilter (self);
+		return;
+	}
+
+	position = match_find (priv->matches, index, &found);
+	for (i = found ? position + 1 : position; i < priv->matches->len; i++)
+		g_array_index (priv->matches, guint, i)--;
+
+	if (found)
+		match_remove (self, index);
+}
+
+static void
+bdb_list_filter_dispose (GObject *object)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (object);
+
+	if (priv->store) {
+		g_signal_handler_disconnect (priv->store, priv->inserted_id);
+		g_signal_handler_disconnect (priv->store, priv->changed_id);
+		g_signal_handler_disconnect (priv->store, priv->deleted_id);
+		g_object_unref (priv->store);
+		priv->store = NULL;
+	}
+
+	if (priv->refilter_id) {
+		g_source_remove (priv->refilter_id);
+		priv->refilter_id = 0;
+	}
+
+	G_OBJECT_CLASS (bdb_list_filter_parent_class)->dispose (object);
+}
+
+static void
+bdb_list_filter_finalize (GObject *object)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (object);
+
+	/* running scans hold a reference, so the pool is idle by now */
+	if (priv->pool)
+		g_thread_pool_free (priv->pool, TRUE, TRUE);
+
+	g_free (priv->pattern.text);
+	g_array_free (priv->matches, TRUE);
+	g_hash_table_destroy (priv->dirty);
+
+	G_OBJECT_CLASS (bdb_list_filter_parent_class)->finalize (object);
+}
+
+static void
+bdb_list_filter_class_init (BdbListFilterClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	g_type_class_add_private (klass, sizeof (BdbListFilterPrivate));
+
+	object_class->dispose  = bdb_list_filter_dispose;
+	object_class->finalize = bdb_list_filter_finalize;
+}
+
+static GtkTreeModelFlags
+get_flags (GtkTreeModel *tree_model)
+{
+	return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gint
+get_n_rows (BdbListFilterPrivate *priv)
+{
+	return priv->pattern.text ? priv->matches->len : priv->n_all;
+}
+
+static gboolean
+iter_nth_child (GtkTreeModel *tree_model,
+                GtkTreeIter  *iter,
+                GtkTreeIter  *parent,
+                gint          n)
+{
+	g_return_val_if_fail (BDB_IS_LIST_FILTER (tree_model), FALSE);
+
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (tree_model);
+
+	if (parent || n < 0 || n >= get_n_rows (priv))
+		return FALSE;
+
+	iter_set (priv, iter, n, priv->pattern.text ? g_array_index (priv->matches, guint, n) : n);
+
+	return TRUE;
+}
+
+static gboolean
+get_iter (GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path)
+{
+	if (gtk_tree_path_get_depth (path) != 1)
+		return FALSE;
+
+	return iter_nth_child (tree_model, iter, NULL, gtk_tree_path_get_indices (path)[0]);
+}
+
+static gint
+get_n_columns (GtkTreeModel *tree_model)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (tree_model);
+	return gtk_tree_model_get_n_columns (GTK_TREE_MODEL (priv->store));
+}
+
+static GType
+get_column_type (GtkTreeModel *tree_model, gint index)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (tree_model);
+	return gtk_tree_model_get_column_type (GTK_TREE_MODEL (priv->store), index);
+}
+
+static gboolean
+iter_next (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (tree_model);
+	g_return_val_if_fail (iter->stamp == priv->stamp, FALSE);
+
+	return iter_nth_child (tree_model, iter, NULL, GPOINTER_TO_UINT (iter->user_data) + 1);
+}
+
+static void
+get_value (GtkTreeModel *tree_model,
+           GtkTreeIter  *iter,
+           gint          column,
+           GValue       *value)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (tree_model);
+	g_return_if_fail (iter->stamp == priv->stamp);
+
+	GtkTreeIter child;
+
+	if (!bdb_list_store_get_iter_at_index (priv->store, &child,
+	                                       GPOINTER_TO_UINT (iter->user_data2))) {
+		g_value_init (value, get_column_type (tree_model, column));
+		return;
+	}
+
+	gtk_tree_model_get_value (GTK_TREE_MODEL (priv->store), &child, column, value);
+}
+
+static gboolean
+iter_children (GtkTreeModel *tree_model,
+               GtkTreeIter  *iter,
+               GtkTreeIter  *parent)
+{
+	if (parent)
+		return FALSE;
+	return iter_nth_child (tree_model, iter, NULL, 0);
+}
+
+static gboolean
+iter_has_child (GtkTreeModel *tree_model,
+                GtkTreeIter  *iter)
+{
+	return FALSE;
+}
+
+static gint
+iter_n_children (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	if (iter)
+		return 0;
+	return get_n_rows (LIST_FILTER_PRIVATE (tree_model));
+}
+
+static gboolean
+iter_parent (GtkTreeModel *tree_model,
+             GtkTreeIter  *iter,
+             GtkTreeIter  *parent)
+{
+	return FALSE;
+}
+
+static GtkTreePath*
+get_path (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (tree_model);
+	g_return_val_if_fail (iter->stamp == priv->stamp, NULL);
+
+	return gtk_tree_path_new_from_indices (GPOINTER_TO_UINT (iter->user_data), -1);
+}
+
+static void
+tree_model_init (GtkTreeModelIface *iface)
+{
+	iface->get_flags       = get_flags;
+	iface->get_iter        = get_iter;
+	iface->get_n_columns   = get_n_columns;
+	iface->get_column_type = get_column_type;
+	iface->iter_next       = iter_next;
+	iface->iter_nth_child  = iter_nth_child;
+	iface->get_value       = get_value;
+	iface->iter_children   = iter_children;
+	iface->iter_has_child  = iter_has_child;
+	iface->iter_n_children = iter_n_children;
+	iface->iter_parent     = iter_parent;
+	iface->get_path        = get_path;
+}
+
+static void
+bdb_list_filter_init (BdbListFilter *self)
+{
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (self);
+
+	priv->stamp = g_random_int ();
+	priv->matches = g_array_new (FALSE, FALSE, sizeof (guint));
+	priv->dirty = g_hash_table_new (g_direct_hash, g_direct_equal);
+}
+
+/**
+ * bdb_list_filter_new:
+ * @store: the #BdbListStore to filter
+ * @column: a string or blob column of @store to match against
+ *
+ * Creates a model showing the rows of @store whose @column matches the
+ * text given to bdb_list_filter_set_text().  Matching scans the raw
+ * records with bulk reads, on a worker thread if the database was opened
+ * with DB_THREAD, and matches appear as they are found.  Rows are shown
+ * in the order they are stored, regardless of the sorting of @store.
+ *
+ * Returns: a new #BdbListFilter passing every row through.
+ **/
+BdbListFilter*
+bdb_list_filter_new (BdbListStore *store, gint column)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (store), NULL);
+	g_return_val_if_fail (column >= 0 &&
+	                      column < gtk_tree_model_get_n_columns (GTK_TREE_MODEL (store)), NULL);
+
+	BdbListFilter        *self = g_object_new (BDB_TYPE_LIST_FILTER, NULL);
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (self);
+
+	priv->store = g_object_ref (store);
+	priv->pattern.column = column;
+	priv->n_all = gtk_tree_model_iter_n_children (GTK_TREE_MODEL (store), NULL);
+
+	priv->inserted_id = g_signal_connect (store, "row-inserted",
+	                                      G_CALLBACK (child_row_inserted), self);
+	priv->changed_id  = g_signal_connect (store, "row-changed",
+	                                      G_CALLBACK (child_row_changed), self);
+	priv->deleted_id  = g_signal_connect (store, "row-deleted",
+	                                      G_CALLBACK (child_row_deleted), self);
+
+	return self;
+}
+
+BdbListStore*
+bdb_list_filter_get_store (BdbListFilter *self)
+{
+	g_return_val_if_fail (BDB_IS_LIST_FILTER (self), NULL);
+	return LIST_FILTER_PRIVATE (self)->store;
+}
+
+/**
+ * bdb_list_filter_set_text:
+ * @self: A #BdbListFilter
+ * @text: text to look for, or %NULL or "" to show every row
+ * @mode: whether @text may appear anywhere or must start the value
+ *
+ * Changes the filter.  A scan that is still running is cancelled, all
+ * rows are removed from the model and the matches of the new scan are
+ * inserted as they are found.  Matching compares bytes, so it is case
+ * sensitive.
+ **/
+void
+bdb_list_filter_set_text (BdbListFilter     *self,
+                          const gchar       *text,
+                          BdbListFilterMode  mode)
+{
+	g_return_if_fail (BDB_IS_LIST_FILTER (self));
+
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (self);
+
+	if (text && *text == '\0')
+		text = NULL;
+
+	if (g_strcmp0 (text, priv->pattern.text) == 0 && mode == priv->pattern.mode)
+		return;
+
+	g_free (priv->pattern.text);
+	priv->pattern.text = g_strdup (text);
+	priv->pattern.text_len = text ? strlen (text) : 0;
+	priv->pattern.mode = mode;
+
+	refilter (self);
+}
+
+gboolean
+bdb_list_filter_is_scanning (BdbListFilter *self)
+{
+	g_return_val_if_fail (BDB_IS_LIST_FILTER (self), FALSE);
+	return LIST_FILTER_PRIVATE (self)->scanning;
+}
+
+void
+bdb_list_filter_convert_iter_to_child_iter (BdbListFilter *self,
+                                            GtkTreeIter   *child_iter,
+                                            GtkTreeIter   *filter_iter)
+{
+	g_return_if_fail (BDB_IS_LIST_FILTER (self));
+
+	BdbListFilterPrivate *priv = LIST_FILTER_PRIVATE (self);
+	g_return_if_fail (filter_iter->stamp == priv->stamp);
+
+	bdb_list_store_get_iter_at_index (priv->store, child_iter,
+	                                  GPOINTER_TO_UINT (filter_iter->user_data2));
+}
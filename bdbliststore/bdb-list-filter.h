@@ -0,0 +1,69 @@
+#ifndef __BDB_LIST_FILTER_H__
+#define __BDB_LIST_FILTER_H__
+
+#include <glib-object.h>
+#include <gtk/gtktreemodel.h>
+
+#include "bdb-list-store.h"
+
+G_BEGIN_DECLS
+
+#define BDB_TYPE_LIST_FILTER bdb_list_filter_get_type()
+
+#define BDB_LIST_FILTER(obj) ( \
+	G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+	BDB_TYPE_LIST_FILTER, \
+	BdbListFilter))
+
+#define BDB_LIST_FILTER_CLASS(klass) ( \
+	G_TYPE_CHECK_CLASS_CAST ((klass), \
+	BDB_TYPE_LIST_FILTER, \
+	BdbListFilterClass))
+
+#define BDB_IS_LIST_FILTER(obj) ( \
+	G_TYPE_CHECK_INSTANCE_TYPE ((obj), \
+	BDB_TYPE_LIST_FILTER))
+
+#define BDB_IS_LIST_FILTER_CLASS(klass) ( \
+	G_TYPE_CHECK_CLASS_TYPE ((klass), \
+	BDB_TYPE_LIST_FILTER))
+
+#define BDB_LIST_FILTER_GET_CLASS(obj) ( \
+	G_TYPE_INSTANCE_GET_CLASS ((obj), \
+	BDB_TYPE_LIST_FILTER, \
+	BdbListFilterClass))
+
+typedef struct _BdbListFilter      BdbListFilter;
+typedef struct _BdbListFilterClass BdbListFilterClass;
+
+typedef enum
+{
+	BDB_LIST_FILTER_SUBSTRING,
+	BDB_LIST_FILTER_PREFIX
+} BdbListFilterMode;
+
+struct _BdbListFilter
+{
+	GObject parent;
+};
+
+struct _BdbListFilterClass
+{
+	GObjectClass parent_class;
+};
+
+GType          bdb_list_filter_get_type    (void);
+BdbListFilter* bdb_list_filter_new         (BdbListStore      *store,
+                                            gint               column);
+BdbListStore*  bdb_list_filter_get_store   (BdbListFilter     *self);
+void           bdb_list_filter_set_text    (BdbListFilter     *self,
+                                            const gchar       *text,
+                                            BdbListFilterMode  mode);
+gboolean       bdb_list_filter_is_scanning (BdbListFilter     *self);
+void           bdb_list_filter_convert_iter_to_child_iter (BdbListFilter *self,
+                                                           GtkTreeIter   *child_iter,
+                                                           GtkTreeIter   *filter_iter);
+
+G_END_DECLS
+
+#endif /* __BDB_LIST_FILTER_H__ */
@@ -1,16 +1,23 @@
 #include "bdb-list-store.h"
+#include "bdb-record.h"
+#include "gb-frame-source.h"
 
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <stdio.h>
 #include <string.h>
 
 #define CLEAR_DBT(dbt)   (memset(&(dbt), 0, sizeof(dbt)))
 #define FREE_DBT(dbt)    if ((dbt.flags & (DB_DBT_MALLOC|DB_DBT_REALLOC)) && \
                               dbt.data != NULL) { g_free(dbt.data); dbt.data = NULL; }
 
-static void tree_model_init (GtkTreeModelIface *iface);
+static void tree_model_init    (GtkTreeModelIface    *iface);
+static void tree_sortable_init (GtkTreeSortableIface *iface);
 
 G_DEFINE_TYPE_EXTENDED (BdbListStore, bdb_list_store, G_TYPE_OBJECT, 0,
-                        G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL, tree_model_init));
+                        G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL, tree_model_init)
+                        G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_SORTABLE, tree_sortable_init));
 
 #define LIST_STORE_PRIVATE(o)              \
 	(G_TYPE_INSTANCE_GET_PRIVATE ((o), \
@@ -19,24 +26,217 @@ G_DEFINE_TYPE_EXTENDED (BdbListStore, bdb_list_store, G_TYPE_OBJECT, 0,
 
 #define BDB_QUARK (g_quark_from_static_string("bdb-list-store"))
 
+#define DEFAULT_CACHE_PAGES  32
+#define DEFAULT_PAGE_SIZE    64
+#define BULK_BUFFER_SIZE     (64 * 1024)
+#define SCRATCH_BUFFER_SIZE  1024
+#define WRITE_RETRIES        3
+#define PREFETCH_RETRIES     3
+
+enum
+{
+	PROP_0,
+	PROP_MPOOL_CACHE_SIZE,
+	PROP_MPOOL_PAGE_SIZE,
+	PROP_MPOOL_HITS,
+	PROP_MPOOL_MISSES,
+	PROP_MPOOL_HIT_RATIO,
+	PROP_MPOOL_EVICTIONS,
+	PROP_STATIC_STRINGS
+};
+
 typedef struct _BdbListStorePrivate BdbListStorePrivate;
+typedef struct _BdbPage             BdbPage;
+typedef struct _PrefetchRequest     PrefetchRequest;
+
+typedef gboolean (*BdbRowFunc) (db_recno_t    recno,
+                                const guint8 *data,
+                                gsize         size,
+                                gpointer      user_data);
+
+/* DB_MULTIPLE buffers must be a multiple of 1024 bytes */
+typedef struct
+{
+	guint8  *data;
+	guint32  len;
+} BdbBulkBuffer;
+
+/*
+ * A page is a window of page_size consecutive records, read with a single
+ * cursor walk.  Records are packed back to back in data, each followed by
+ * a nul byte so string columns can be handed out in place.
+ */
+struct _BdbPage
+{
+	guint    index;   /* (first recno - 1) / page_size */
+	guint    n_rows;
+	guint32 *offsets; /* n_rows + 1 offsets into data */
+	guint8  *data;
+	GList    link;    /* position within the lru queue */
+};
 
 struct _BdbListStorePrivate
 {
-	gint      stamp;
-	GType     g_type;
-	DB       *dbp;
-	gboolean  dirty;
-	gint      n_keys;
+	gint        stamp;
+	gint        n_columns;    /* 0 for a plain string record per row */
+	GType      *column_types;
+	DB         *dbp;
+	gboolean    owns_db;      /* opened by bdb_list_store_open() */
+	gint        n_keys;       /* exact, kept up to date by our own writes */
+
+	GHashTable *pages;        /* page index -> BdbPage */
+	GQueue      lru;          /* most recently used page at the head */
+	guint       max_pages;
+	guint       page_size;
+	guint64     cache_hits;
+	guint64     cache_misses;
+
+	BdbBulkBuffer bulk;       /* scratch for DB_MULTIPLE_KEY reads */
+	BdbBulkBuffer scratch;    /* DB_DBT_USERMEM target of get_record() */
+	gboolean      static_strings;
+	volatile gint cache_gen;  /* bumped whenever cached rows go stale */
+
+	DB_TXN     *batch_txn;    /* NULL outside of a batch, or without txns */
+	GThread    *batch_thread; /* the thread batch_txn belongs to */
+	guint       batch_depth;
+	guint       batch_count;  /* rows appended but not yet announced */
+	gboolean    batch_failed;
+
+	GThreadPool  *prefetch_pool;
+	BdbBulkBuffer prefetch_bulk;   /* owned by the prefetch thread */
+	GHashTable   *prefetching;     /* page index -> PrefetchRequest */
+	GHashTable   *prefetch_failed; /* page index -> failed reads at prefetch_failed_gen */
+	gint          prefetch_failed_gen;
+	guint         prefetch_margin;
+	volatile gint visible_first;
+	volatile gint visible_last;
+
+	gint          sort_column_id;
+	GtkSortType   sort_order;
+	DB           *sort_db;         /* sort key -> recno, NULL when unsorted */
+	gint          sort_n_rows;     /* entries in sort_db */
+	gint          sort_gen;        /* bumped whenever sorted positions move */
+	GByteArray   *sort_key;        /* scratch for building sort keys */
+	BdbBulkBuffer sort_buf;        /* scratch for keys read back from sort_db */
+
+	GThread      *wb_thread;       /* NULL unless write-behind is enabled */
+	GMutex       *wb_lock;         /* protects the wb_ fields up to wb_error */
+	GCond        *wb_cond;
+	GHashTable   *wb_pending;      /* recno -> GByteArray, the next group */
+	GHashTable   *wb_writing;      /* the group owned by the writer, or NULL */
+	gboolean      wb_committed;    /* wb_writing is done and waits to be reaped */
+	gboolean      wb_failed;       /* ... but did not make it to disk */
+	gboolean      wb_quit;
+	GError       *wb_error;        /* first failure since the last flush */
+	GHashTable   *wb_dirty;        /* recnos still owed a row-changed */
+	gboolean      wb_announce;     /* wb_dirty or the visible range changed */
+	guint         wb_fps;
+	guint         wb_frame_id;
+
+	GMappedFile   *snapshot;       /* read-only mode, instead of dbp */
+	const guint8  *snap_data;      /* start of the mapping */
+	const guint64 *snap_offsets;   /* n_keys + 1 record offsets */
+	gsize          snap_length;
+
+	volatile gpointer generation;  /* the current BdbGeneration */
+	volatile gint  gen_readers;    /* threads within generation_get() */
+	GSList        *gen_retired;    /* replaced generations, see generation_publish() */
+	guint32        cursor_flags;   /* DB_TXN_SNAPSHOT for a DB_MULTIVERSION database */
+};
+
+/*
+ * What other threads may know about the store without taking a lock: the
+ * row count and stamp as of the last write the main loop announced,
+ * tagged with a serial that grows with every such write.  A generation is
+ * never changed once published, a new one replaces it with a pointer swap.
+ */
+typedef struct
+{
+	guint serial;
+	gint  stamp;
+	gint  n_rows;
+} BdbGeneration;
+
+struct _BdbListStoreReader
+{
+	BdbListStore  *store;
+	DB_TXN        *txn;      /* DB_TXN_SNAPSHOT, NULL for a mapped snapshot */
+	guint          serial;
+	guint          n_rows;
+	BdbBulkBuffer  bulk;
 };
 
+/*
+ * Statistics of the environment's shared memory pool.  They cover every
+ * database in the environment, which is the point when several stores
+ * share one cache.
+ */
+static gboolean
+mpool_stat (BdbListStorePrivate *priv, DB_MPOOL_STAT *stat)
+{
+	DB_ENV        *env;
+	DB_MPOOL_STAT *gsp = NULL;
+	gint           ret;
+	
+	memset (stat, 0, sizeof *stat);
+	
+	if (!priv->dbp || !(env = priv->dbp->get_env (priv->dbp)))
+		return FALSE;
+	
+	if ((ret = env->memp_stat (env, &gsp, NULL, 0)) != 0) {
+		g_warning ("memp_stat: %s", db_strerror (ret));
+		return FALSE;
+	}
+	
+	*stat = *gsp;
+	g_free (gsp);
+	
+	return TRUE;
+}
+
 static void
 bdb_list_store_get_property (GObject    *object,
                               guint       property_id,
                               GValue     *value,
                               GParamSpec *pspec)
 {
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (object);
+	DB_MPOOL_STAT        stat;
+	u_int32_t            page_size = 0;
+	
 	switch (property_id) {
+	case PROP_MPOOL_CACHE_SIZE:
+		mpool_stat (priv, &stat);
+		g_value_set_uint64 (value, (guint64)stat.st_gbytes * 1024 * 1024 * 1024 + stat.st_bytes);
+		break;
+	case PROP_MPOOL_PAGE_SIZE:
+		if (priv->dbp)
+			priv->dbp->get_pagesize (priv->dbp, &page_size);
+		g_value_set_uint (value, page_size);
+		break;
+	case PROP_MPOOL_HITS:
+		mpool_stat (priv, &stat);
+		g_value_set_uint64 (value, stat.st_cache_hit);
+		break;
+	case PROP_MPOOL_MISSES:
+		mpool_stat (priv, &stat);
+		g_value_set_uint64 (value, stat.st_cache_miss);
+		break;
+	case PROP_MPOOL_HIT_RATIO:
+		mpool_stat (priv, &stat);
+		if (stat.st_cache_hit + stat.st_cache_miss > 0)
+			g_value_set_double (value, (gdouble)stat.st_cache_hit /
+			                           ((gdouble)stat.st_cache_hit + stat.st_cache_miss));
+		else
+			g_value_set_double (value, 1.0);
+		break;
+	case PROP_MPOOL_EVICTIONS:
+		mpool_stat (priv, &stat);
+		g_value_set_uint64 (value, (guint64)stat.st_ro_evict + stat.st_rw_evict);
+		break;
+	case PROP_STATIC_STRINGS:
+		g_value_set_boolean (value, priv->static_strings);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
@@ -49,427 +249,3919 @@ bdb_list_store_set_property (GObject      *object,
 			      GParamSpec   *pspec)
 {
 	switch (property_id) {
+	case PROP_STATIC_STRINGS:
+		bdb_list_store_set_static_strings (BDB_LIST_STORE (object),
+		                                   g_value_get_boolean (value));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
 }
 
+/*
+ * Walks up to n_rows records starting at recno using bulk retrieval, so a
+ * whole run of records comes back from a single c_get into bulk->data.
+ * func receives pointers into that buffer; they are only valid for the
+ * duration of the callback.  Returns the number of rows handed out.
+ */
+static guint
+read_range (BdbListStorePrivate *priv,
+            DB_TXN              *txn,
+            BdbBulkBuffer       *bulk,
+            db_recno_t           recno,
+            guint                n_rows,
+            BdbRowFunc           func,
+            gpointer             user_data)
+{
+	DBC        *dbc = NULL;
+	DBT         key, data;
+	guint       n_read = 0;
+	guint32     flags = DB_SET | DB_MULTIPLE_KEY;
+	gboolean    done = FALSE;
+	gint        ret;
+
+	/* outside of a transaction, read the last committed version without locking */
+	if ((ret = priv->dbp->cursor (priv->dbp, txn, &dbc,
+	                              txn ? 0 : priv->cursor_flags)) != 0) {
+		g_warning ("read_range: %s", db_strerror (ret));
+		return 0;
+	}
+
+	if (bulk->data == NULL) {
+		bulk->len = BULK_BUFFER_SIZE;
+		bulk->data = g_malloc (bulk->len);
+	}
+
+	CLEAR_DBT (key);
+	CLEAR_DBT (data);
+
+	key.data = &recno;
+	key.size = sizeof (db_recno_t);
+	key.ulen = key.size;
+	key.flags = DB_DBT_USERMEM;
+
+	while (!done && n_read < n_rows) {
+		data.data = bulk->data;
+		data.ulen = bulk->len;
+		data.flags = DB_DBT_USERMEM;
+
+		ret = dbc->c_get (dbc, &key, &data, flags);
+
+		if (ret == DB_BUFFER_SMALL) {
+			/* a single record larger than the buffer */
+			bulk->len = (data.size + 1023) & ~1023;
+			bulk->data = g_realloc (bulk->data, bulk->len);
+			continue;
+		}
+		else if (ret != 0) {
+			if (ret != DB_NOTFOUND)
+				g_warning ("read_range: %s", db_strerror (ret));
+			break;
+		}
+
+		guint8     *p;
+		db_recno_t  rec;
+		void       *rdata;
+		u_int32_t   rlen;
+
+		for (DB_MULTIPLE_INIT (p, &data); n_read < n_rows;) {
+			DB_MULTIPLE_RECNO_NEXT (p, &data, rec, rdata, rlen);
+			if (p == NULL)
+				break;
+			n_read++;
+			if (!func (rec, rdata, rlen, user_data)) {
+				done = TRUE;
+				break;
+			}
+		}
+
+		flags = DB_NEXT | DB_MULTIPLE_KEY;
+	}
+
+	dbc->c_close (dbc);
+
+	return n_read;
+}
+
 static void
-bdb_list_store_dispose (GObject *object)
+page_free (gpointer data)
 {
-	if (G_OBJECT_CLASS (bdb_list_store_parent_class)->dispose)
-		G_OBJECT_CLASS (bdb_list_store_parent_class)->dispose (object);
+	BdbPage *page = data;
+
+	g_free (page->offsets);
+	g_free (page->data);
+	g_slice_free (BdbPage, page);
 }
 
 static void
-bdb_list_store_finalize (GObject *object)
+cache_drop_page (BdbListStorePrivate *priv, BdbPage *page)
 {
-	G_OBJECT_CLASS (bdb_list_store_parent_class)->finalize (object);
+	g_queue_unlink (&priv->lru, &page->link);
+	g_hash_table_remove (priv->pages, GUINT_TO_POINTER (page->index));
 }
 
 static void
-bdb_list_store_class_init (BdbListStoreClass *klass)
+cache_invalidate_from (BdbListStorePrivate *priv, db_recno_t recno)
 {
-	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	GHashTableIter  iter;
+	BdbPage        *page;
+	guint           first = (recno - 1) / priv->page_size;
 
-	g_type_class_add_private (klass, sizeof (BdbListStorePrivate));
+	g_atomic_int_inc (&priv->cache_gen);
 
-	object_class->get_property = bdb_list_store_get_property;
-	object_class->set_property = bdb_list_store_set_property;
-	object_class->dispose      = bdb_list_store_dispose;
-	object_class->finalize     = bdb_list_store_finalize;
+	g_hash_table_iter_init (&iter, priv->pages);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer*)&page)) {
+		if (page->index >= first) {
+			g_queue_unlink (&priv->lru, &page->link);
+			g_hash_table_iter_remove (&iter);
+		}
+	}
 }
 
-static gint
-get_n_keys (BdbListStore *self)
+static void
+cache_invalidate_row (BdbListStorePrivate *priv, db_recno_t recno)
 {
-	g_return_val_if_fail (BDB_IS_LIST_STORE (self), 0);
-	
-	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
-	if (!priv->dirty)
-		return priv->n_keys;
-	
-	g_return_val_if_fail (priv->dbp != NULL, 0);
-	
-	DB_BTREE_STAT *stat;
-	if (priv->dbp->stat (priv->dbp, NULL, &stat, DB_FAST_STAT) == 0) {
-		priv->n_keys = stat->bt_nkeys;
-		priv->dirty = FALSE;
-	}
-	
-	g_free (stat);
-	
-	return priv->n_keys;
+	BdbPage *page;
+
+	g_atomic_int_inc (&priv->cache_gen);
+
+	page = g_hash_table_lookup (priv->pages,
+	                            GUINT_TO_POINTER ((recno - 1) / priv->page_size));
+	if (page)
+		cache_drop_page (priv, page);
 }
 
-static GtkTreeModelFlags
-get_flags (GtkTreeModel *tree_model)
+static void
+cache_clear (BdbListStorePrivate *priv)
 {
-	return GTK_TREE_MODEL_LIST_ONLY;
+	g_atomic_int_inc (&priv->cache_gen);
+	g_hash_table_remove_all (priv->pages);
+	g_queue_init (&priv->lru);
 }
 
+typedef struct
+{
+	BdbPage    *page;
+	GByteArray *buf;
+} PageFill;
+
 static gboolean
-get_iter (GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path)
+page_fill_func (db_recno_t    recno,
+                const guint8 *data,
+                gsize         size,
+                gpointer      user_data)
 {
-	g_return_val_if_fail (BDB_IS_LIST_STORE (tree_model), FALSE);
-	
-	BdbListStorePrivate *priv    = LIST_STORE_PRIVATE (tree_model);
-	gint                *indices = gtk_tree_path_get_indices (path);
-	gint                 depth   = gtk_tree_path_get_depth (path);
-	
-	if (depth == 0)
-		return FALSE;
-	
-	gint n_keys = get_n_keys (BDB_LIST_STORE (tree_model));
-	if (n_keys <= indices[0])
-		return FALSE;
-	
-	iter->stamp = priv->stamp;
-	iter->user_data = GINT_TO_POINTER (indices[0] + 1);
-	
+	PageFill *fill = user_data;
+
+	fill->page->offsets[fill->page->n_rows++] = fill->buf->len;
+	g_byte_array_append (fill->buf, data, size);
+	g_byte_array_append (fill->buf, (guint8*)"", 1);
+
 	return TRUE;
 }
 
-static gint
-get_n_columns (GtkTreeModel *tree_model)
+/*
+ * Reads page index straight from the database.  Only touches priv->dbp, so
+ * it is safe to call from the prefetch thread with its own bulk buffer.
+ */
+static BdbPage*
+page_read (BdbListStorePrivate *priv,
+           DB_TXN              *txn,
+           BdbBulkBuffer       *bulk,
+           guint                index,
+           guint                page_size)
 {
-	return 1;
+	PageFill fill;
+
+	fill.buf = g_byte_array_new ();
+	fill.page = g_slice_new0 (BdbPage);
+	fill.page->index = index;
+	fill.page->offsets = g_new (guint32, page_size + 1);
+	fill.page->link.data = fill.page;
+
+	read_range (priv, txn, bulk, index * page_size + 1, page_size,
+	            page_fill_func, &fill);
+
+	fill.page->offsets[fill.page->n_rows] = fill.buf->len;
+	fill.page->data = g_byte_array_free (fill.buf, FALSE);
+
+	if (fill.page->n_rows == 0) {
+		page_free (fill.page);
+		return NULL;
+	}
+
+	return fill.page;
 }
 
-static GType
-get_column_type (GtkTreeModel *tree_model, gint index)
+static void
+cache_insert_page (BdbListStorePrivate *priv, BdbPage *page)
+{
+	while (g_hash_table_size (priv->pages) >= priv->max_pages)
+		cache_drop_page (priv, g_queue_peek_tail (&priv->lru));
+
+	g_hash_table_insert (priv->pages, GUINT_TO_POINTER (page->index), page);
+	g_queue_push_head_link (&priv->lru, &page->link);
+}
+
+/*
+ * Returns the cached page index, reading it in on a miss when fill is set.
+ */
+static BdbPage*
+cache_get_page (BdbListStorePrivate *priv, guint index, gboolean fill)
 {
-	return G_TYPE_STRING;
-	//return LIST_STORE_PRIVATE (tree_model)->g_type;
+	BdbPage *page;
+
+	page = g_hash_table_lookup (priv->pages, GUINT_TO_POINTER (index));
+
+	if (page) {
+		priv->cache_hits++;
+		g_queue_unlink (&priv->lru, &page->link);
+		g_queue_push_head_link (&priv->lru, &page->link);
+		return page;
+	}
+
+	priv->cache_misses++;
+
+	if (fill && (page = page_read (priv, priv->batch_txn, &priv->bulk,
+	                               index, priv->page_size)))
+		cache_insert_page (priv, page);
+
+	return page;
 }
 
 static gboolean
-iter_next (GtkTreeModel *tree_model, GtkTreeIter *iter)
+page_get_row (BdbPage       *page,
+              guint          row,
+              const guint8 **data,
+              gsize         *size)
 {
-	g_return_val_if_fail (BDB_IS_LIST_STORE (tree_model), FALSE);
-	
-	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (tree_model);
-	g_return_val_if_fail (iter->stamp == priv->stamp, FALSE);
-	
-	gint n_keys = get_n_keys (BDB_LIST_STORE (tree_model));
-	gint next = GPOINTER_TO_INT (iter->user_data) + 1;
-	
-	if (n_keys < next)
+	if (row >= page->n_rows)
 		return FALSE;
-	
-	iter->user_data = GINT_TO_POINTER (next);
-	
+
+	*data = page->data + page->offsets[row];
+	*size = page->offsets[row + 1] - page->offsets[row] - 1;
+
 	return TRUE;
 }
 
+/*
+ * Locates the record for recno within the page cache, reading the page
+ * around it on a miss.  The returned data belongs to the cache and stays
+ * valid until the next call into the store.
+ */
 static gboolean
-iter_nth_child (GtkTreeModel *tree_model,
-                GtkTreeIter *iter,
-		GtkTreeIter *parent,
-		gint n)
+cache_lookup (BdbListStorePrivate  *priv,
+              db_recno_t            recno,
+              const guint8        **data,
+              gsize                *size)
 {
-	g_return_val_if_fail (BDB_IS_LIST_STORE (tree_model), FALSE);
-	
-	if (parent)
-		return FALSE;
-	
-	gint n_keys = 0;
-	if ((n_keys = get_n_keys (BDB_LIST_STORE (tree_model))) <= n)
+	BdbPage *page;
+
+	if (!(page = cache_get_page (priv, (recno - 1) / priv->page_size, TRUE)))
 		return FALSE;
-	
-	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (tree_model);
-	
-	iter->stamp = priv->stamp;
-	iter->user_data = GINT_TO_POINTER (n);
-	
-	return TRUE;
+
+	return page_get_row (page, (recno - 1) % priv->page_size, data, size);
 }
 
-static void
-get_value (GtkTreeModel *tree_model,
-	   GtkTreeIter  *iter,
-           gint          column,
-	   GValue       *value)
+struct _PrefetchRequest
 {
-	g_return_if_fail (BDB_IS_LIST_STORE (tree_model));
-	
-	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (tree_model);
-	g_return_if_fail (priv->stamp == iter->stamp);
-	
-	DBT key, data;
-	db_recno_t keydata;
-	DB_TXN *txn = NULL;
-	gint ret;
-	gint flags = 0;
-	
-	CLEAR_DBT (key);
-	CLEAR_DBT (data);
-	
-	keydata = GPOINTER_TO_INT (iter->user_data);
-	key.data = &keydata;
-	data.flags = DB_DBT_MALLOC;
-	
-	if ((ret = priv->dbp->get (priv->dbp, txn, &key, &data, flags)) != 0) {
-		g_warning ("get_value: %s", db_strerror (ret));
-		return;
-	}
-	
-	g_value_init (value, G_TYPE_STRING);
-	g_value_set_string (value, data.data);
-	
-	FREE_DBT (key);
-	FREE_DBT (data);
-}
+	BdbListStore *self;         /* reference held until completion */
+	guint         index;
+	guint         page_size;
+	gint          gen;          /* cache_gen when queued */
+	volatile gint placeholders; /* views were handed placeholder rows */
+	gboolean      read;         /* the worker went to disk for it */
+	BdbPage      *page;         /* result, filled in by the worker */
+};
 
-static gboolean
-iter_children (GtkTreeModel *tree_model,
-               GtkTreeIter  *iter,
-               GtkTreeIter  *parent)
+/* how often reading page index failed since the cached rows last changed */
+static guint
+prefetch_failures (BdbListStorePrivate *priv, guint index)
 {
-	return FALSE;
+	if (priv->prefetch_failed_gen != g_atomic_int_get (&priv->cache_gen)) {
+		g_hash_table_remove_all (priv->prefetch_failed);
+		priv->prefetch_failed_gen = g_atomic_int_get (&priv->cache_gen);
+	}
+
+	return GPOINTER_TO_UINT (g_hash_table_lookup (priv->prefetch_failed,
+	                                              GUINT_TO_POINTER (index)));
 }
 
 static gboolean
-iter_has_child (GtkTreeModel *tree_model,
-                GtkTreeIter  *iter)
+prefetch_wanted (BdbListStorePrivate *priv, PrefetchRequest *req)
 {
-	return FALSE;
-}
+	gint first = g_atomic_int_get (&priv->visible_first) - priv->prefetch_margin;
+	gint last = g_atomic_int_get (&priv->visible_last) + priv->prefetch_margin;
+	gint page_first = req->index * req->page_size;
+	gint page_last = page_first + req->page_size - 1;
 
-static int
-iter_n_children (GtkTreeModel *tree_model, GtkTreeIter *iter)
-{
-	g_return_val_if_fail (BDB_IS_LIST_STORE (tree_model), 0);
-	if (iter)
-		return 0;
-	return get_n_keys (BDB_LIST_STORE (tree_model));
+	if (req->gen != g_atomic_int_get (&priv->cache_gen))
+		return FALSE;
+
+	/* rows handed out as placeholders must always arrive */
+	return g_atomic_int_get (&req->placeholders) ||
+	       (page_last >= first && page_first <= last);
 }
 
 static gboolean
-iter_parent (GtkTreeModel *tree_model,
-             GtkTreeIter  *iter,
-             GtkTreeIter  *parent)
+prefetch_complete (gpointer data)
 {
+	PrefetchRequest     *req  = data;
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (req->self);
+	GtkTreeIter          iter;
+	GtkTreePath         *path;
+	db_recno_t           recno;
+	gint                 n_rows = req->page_size;
+	guint                failures;
+
+	if (g_hash_table_lookup (priv->prefetching, GUINT_TO_POINTER (req->index)) == req)
+		g_hash_table_remove (priv->prefetching, GUINT_TO_POINTER (req->index));
+
+	if (req->page &&
+	    req->gen == g_atomic_int_get (&priv->cache_gen) &&
+	    req->page_size == priv->page_size &&
+	    !g_hash_table_lookup (priv->pages, GUINT_TO_POINTER (req->index)))
+	{
+		n_rows = req->page->n_rows;
+		cache_insert_page (priv, req->page);
+		req->page = NULL;
+		g_hash_table_remove (priv->prefetch_failed, GUINT_TO_POINTER (req->index));
+	}
+	else if (req->read && !req->page &&
+	         req->gen == g_atomic_int_get (&priv->cache_gen) &&
+	         req->page_size == priv->page_size)
+	{
+		/*
+		 * The page is gone or unreadable.  The announcement below makes the
+		 * views queue it again, after a few tries get_value() stops doing
+		 * that and falls back to reading the rows itself.
+		 */
+		failures = prefetch_failures (priv, req->index) + 1;
+		g_hash_table_insert (priv->prefetch_failed, GUINT_TO_POINTER (req->index),
+		                     GUINT_TO_POINTER (failures));
+
+		if (failures >= PREFETCH_RETRIES)
+			g_warning ("prefetch: could not read page %u", req->index);
+	}
+
+	/*
+	 * Let views re-read the rows they got placeholders for.  If the page
+	 * went stale in the meantime, or the worker skipped it before it was
+	 * asked for placeholders, the re-read simply queues it again.
+	 */
+	if (g_atomic_int_get (&req->placeholders)) {
+		recno = req->index * req->page_size + 1;
+		iter.stamp = priv->stamp;
+		iter.user_data2 = NULL;
+
+		/* when sorted the rows of a page are scattered over the view */
+		for (; n_rows > 0 && recno <= priv->n_keys; n_rows--, recno++) {
+			iter.user_data = GINT_TO_POINTER (recno);
+			if ((path = gtk_tree_model_get_path (GTK_TREE_MODEL (req->self), &iter))) {
+				gtk_tree_model_row_changed (GTK_TREE_MODEL (req->self), path, &iter);
+				gtk_tree_path_free (path);
+			}
+		}
+	}
+
+	if (req->page)
+		page_free (req->page);
+	g_object_unref (req->self);
+	g_slice_free (PrefetchRequest, req);
+
 	return FALSE;
 }
 
-static GtkTreePath*
-get_path (GtkTreeModel *tree_model, GtkTreeIter *iter)
+static void
+prefetch_worker (gpointer data, gpointer user_data)
 {
-	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (tree_model);
-	g_return_val_if_fail (priv->stamp == iter->stamp, NULL);
-	
-	gint index = GPOINTER_TO_INT (iter->user_data);
-	return gtk_tree_path_new_from_indices (index - 1, -1);
+	PrefetchRequest     *req  = data;
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (req->self);
+
+	if (prefetch_wanted (priv, req)) {
+		req->page = page_read (priv, NULL, &priv->prefetch_bulk,
+		                       req->index, req->page_size);
+		req->read = TRUE;
+	}
+
+	g_idle_add_full (G_PRIORITY_HIGH_IDLE, prefetch_complete, req, NULL);
 }
 
+/*
+ * Queues page index for the prefetch thread.  placeholders must be known
+ * before the request is pushed, the worker may pick it up right away.
+ */
 static void
-tree_model_init (GtkTreeModelIface *iface)
+prefetch_queue (BdbListStore *self, guint index, gboolean placeholders)
 {
-	iface->get_flags       = get_flags;
-	iface->get_iter        = get_iter;
-	iface->get_n_columns   = get_n_columns;
-	iface->get_column_type = get_column_type;
-	iface->iter_next       = iter_next;
-	iface->iter_nth_child  = iter_nth_child;
-	iface->get_value       = get_value;
-	iface->iter_children   = iter_children;
-	iface->iter_has_child  = iter_has_child;
-	iface->iter_n_children = iter_n_children;
-	iface->iter_parent     = iter_parent;
-	iface->get_path        = get_path;
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	PrefetchRequest     *req;
+
+	if ((req = g_hash_table_lookup (priv->prefetching, GUINT_TO_POINTER (index))) &&
+	    req->gen == g_atomic_int_get (&priv->cache_gen))
+	{
+		if (placeholders)
+			g_atomic_int_set (&req->placeholders, TRUE);
+		return;
+	}
+
+	req = g_slice_new0 (PrefetchRequest);
+	req->self = g_object_ref (self);
+	req->index = index;
+	req->page_size = priv->page_size;
+	req->gen = g_atomic_int_get (&priv->cache_gen);
+	req->placeholders = placeholders;
+
+	g_hash_table_insert (priv->prefetching, GUINT_TO_POINTER (index), req);
+	g_thread_pool_push (priv->prefetch_pool, req, NULL);
 }
 
 static void
-bdb_list_store_init (BdbListStore *self)
+prefetch_range (BdbListStore *self, gint first, gint last)
 {
 	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
-	
-	priv->stamp = g_random_int ();
+	guint                index;
+
+	if (last < first || last < 0)
+		return;
+
+	for (index = MAX (first, 0) / priv->page_size;
+	     index <= (guint)last / priv->page_size;
+	     index++)
+	{
+		if (!g_hash_table_lookup (priv->pages, GUINT_TO_POINTER (index)))
+			prefetch_queue (self, index, FALSE);
+	}
+}
+
+static void
+write_free (gpointer data)
+{
+	g_byte_array_free (data, TRUE);
+}
+
+static GHashTable*
+write_table_new (void)
+{
+	return g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, write_free);
+}
+
+/* the latest queued version of a row, see write_behind_queue() */
+static gboolean
+write_behind_lookup (BdbListStorePrivate  *priv,
+                     db_recno_t            recno,
+                     const guint8        **record,
+                     gsize                *size)
+{
+	GByteArray *buf;
+	
+	if (!priv->wb_thread)
+		return FALSE;
+	
+	g_mutex_lock (priv->wb_lock);
+	buf = g_hash_table_lookup (priv->wb_pending, GUINT_TO_POINTER (recno));
+	if (!buf && priv->wb_writing)
+		buf = g_hash_table_lookup (priv->wb_writing, GUINT_TO_POINTER (recno));
+	g_mutex_unlock (priv->wb_lock);
+	
+	if (!buf)
+		return FALSE;
+	
+	/* queued records carry a nul byte past their end like page rows */
+	*record = buf->data;
+	*size = buf->len - 1;
+	
+	return TRUE;
+}
+
+/*
+ * A snapshot, as written by bdb_list_store_export_snapshot(), is a flat
+ * file laid out like one huge BdbPage:
+ *
+ *   SnapshotHeader
+ *   guint32 fundamental type of each column
+ *   padding up to 8 bytes
+ *   guint64 offsets[n_rows + 1], from the start of the file
+ *   the records, back to back, each followed by a nul byte
+ *
+ * Once mapped a row is two loads from the offset table away.  Like the
+ * records themselves everything is in host byte order.
+ */
+#define SNAPSHOT_MAGIC "BDBSNAP1"
+
+typedef struct
+{
+	gchar   magic[8];
+	guint32 byte_order;
+	guint32 n_rows;
+	guint32 n_columns;  /* 0 for a plain string record per row */
+	guint32 reserved;
+} SnapshotHeader;
+
+static gsize
+snapshot_table_offset (guint n_columns)
+{
+	return (sizeof (SnapshotHeader) + n_columns * sizeof (guint32) + 7) & ~(gsize)7;
+}
+
+static gboolean
+snapshot_get_row (BdbListStorePrivate  *priv,
+                  db_recno_t            recno,
+                  const guint8        **record,
+                  gsize                *size)
+{
+	guint64 start, end;
+	
+	if (recno < 1 || recno > (db_recno_t)priv->n_keys)
+		return FALSE;
+	
+	start = priv->snap_offsets[recno - 1];
+	end = priv->snap_offsets[recno];
+	
+	if (start >= end || end > priv->snap_length)
+		return FALSE;
+	
+	*record = priv->snap_data + start;
+	*size = end - start - 1;
+	
+	return TRUE;
+}
+
+/*
+ * Fetches the raw record for recno, from the snapshot in read-only mode,
+ * from the write-behind queue if it is there, from the page cache when
+ * enabled and otherwise into the store's scratch buffer.  Either way the
+ * data is only valid until the next read, and it is always followed by a
+ * nul byte.
+ */
+static gboolean
+get_record (BdbListStorePrivate  *priv,
+            db_recno_t            recno,
+            const guint8        **record,
+            gsize                *size)
+{
+	DBT key, data;
+	gint ret;
+	
+	if (priv->snapshot)
+		return snapshot_get_row (priv, recno, record, size);
+	
+	if (write_behind_lookup (priv, recno, record, size))
+		return TRUE;
+	
+	if (priv->max_pages > 0)
+		return cache_lookup (priv, recno, record, size);
+	
+	if (priv->scratch.data == NULL) {
+		priv->scratch.len = SCRATCH_BUFFER_SIZE;
+		priv->scratch.data = g_malloc (priv->scratch.len);
+	}
+	
+	CLEAR_DBT (key);
+	CLEAR_DBT (data);
+	
+	key.data = &recno;
+	key.size = sizeof (db_recno_t);
+	
+	for (;;) {
+		/* keep one byte back for the terminator */
+		data.data = priv->scratch.data;
+		data.ulen = priv->scratch.len - 1;
+		data.flags = DB_DBT_USERMEM;
+		
+		ret = priv->dbp->get (priv->dbp, priv->batch_txn, &key, &data, 0);
+		if (ret != DB_BUFFER_SMALL)
+			break;
+		
+		priv->scratch.len = (data.size + 1 + 1023) & ~1023;
+		priv->scratch.data = g_realloc (priv->scratch.data, priv->scratch.len);
+	}
+	
+	if (ret != 0) {
+		if (ret != DB_NOTFOUND)
+			g_warning ("get_record: %s", db_strerror (ret));
+		return FALSE;
+	}
+	
+	priv->scratch.data[data.size] = '\0';
+	*record = data.data;
+	*size = data.size;
+	
+	return TRUE;
+}
+
+/*
+ * Sorting.  Berkeley DB refuses to associate a secondary index with a
+ * DB_RENUMBER primary, so the store maintains its own: an in-memory
+ * DB_BTREE with DB_RECNUM from sort key to primary recno.  DB_RECNUM
+ * keeps subtree counts, so both the n-th entry and the position of an
+ * entry are O(log n) lookups and nothing is copied into memory.
+ *
+ * Sort keys are built so that the default lexical btree comparison
+ * orders them: numbers big-endian with the sign bit flipped (all bits for
+ * negative doubles), strings as their collation key and blobs with nul
+ * bytes escaped, each after a byte telling NULL from empty.  The primary
+ * recno follows big-endian, so equal values keep the order of the primary
+ * and every key is unique.
+ */
+static void
+sort_key_build (BdbListStorePrivate *priv,
+                const guint8        *record,
+                gsize                size,
+                db_recno_t           recno,
+                GByteArray          *key)
+{
+	gint          column = priv->sort_column_id;
+	GType         type = priv->column_types ? priv->column_types[column] : G_TYPE_STRING;
+	const guint8 *data = NULL;
+	guint32       len = 0;
+	guint32       be;
+	
+	g_byte_array_set_size (key, 0);
+	
+	if (priv->column_types && !bdb_record_type_is_variable (type)) {
+		gint64  i = 0;
+		gdouble d = 0.0;
+		guint64 u;
+		
+		if ((column + 1) * BDB_RECORD_SLOT_SIZE <= size) {
+			memcpy (&i, record + column * BDB_RECORD_SLOT_SIZE, sizeof i);
+			memcpy (&d, record + column * BDB_RECORD_SLOT_SIZE, sizeof d);
+		}
+		
+		switch (G_TYPE_FUNDAMENTAL (type)) {
+		case G_TYPE_FLOAT:
+		case G_TYPE_DOUBLE:
+			memcpy (&u, &d, sizeof u);
+			if (u & G_GUINT64_CONSTANT (0x8000000000000000))
+				u = ~u;
+			else
+				u ^= G_GUINT64_CONSTANT (0x8000000000000000);
+			break;
+		case G_TYPE_UINT:
+		case G_TYPE_ULONG:
+		case G_TYPE_UINT64:
+			u = (guint64)i;
+			break;
+		default:
+			u = (guint64)i ^ G_GUINT64_CONSTANT (0x8000000000000000);
+		}
+		
+		u = GUINT64_TO_BE (u);
+		g_byte_array_append (key, (guint8*)&u, sizeof u);
+	}
+	else {
+		if (!priv->column_types) {
+			const guint8 *nul = memchr (record, 0, size);
+			data = record;
+			len = nul ? nul - record : size;
+		}
+		else if (!bdb_record_get_slice (record, size, column, &data, &len)) {
+			data = NULL;
+		}
+		
+		if (data == NULL) {
+			g_byte_array_append (key, (guint8*)"", 1);
+		}
+		else if (type == G_TYPE_BYTE_ARRAY) {
+			guint32 i;
+			
+			g_byte_array_append (key, (guint8*)"\1", 1);
+			for (i = 0; i < len; i++) {
+				g_byte_array_append (key, data + i, 1);
+				if (data[i] == 0)
+					g_byte_array_append (key, (guint8*)"\377", 1);
+			}
+			g_byte_array_append (key, (guint8*)"\0\0", 2);
+		}
+		else {
+			gchar *collate = g_utf8_collate_key ((const gchar*)data, len);
+			
+			g_byte_array_append (key, (guint8*)"\1", 1);
+			g_byte_array_append (key, (guint8*)collate, strlen (collate) + 1);
+			g_free (collate);
+		}
+	}
+	
+	be = GUINT32_TO_BE (recno);
+	g_byte_array_append (key, (guint8*)&be, sizeof be);
+}
+
+static DB*
+sort_index_open (BdbListStorePrivate *priv)
+{
+	DB  *sdb = NULL;
+	gint ret;
+	
+	if ((ret = db_create (&sdb, priv->dbp->get_env (priv->dbp), 0)) != 0) {
+		g_warning ("sort_index_open: %s", db_strerror (ret));
+		return NULL;
+	}
+	
+	sdb->set_flags (sdb, DB_RECNUM);
+	
+	/* no file name, the index only lives in the environment's cache */
+	if ((ret = sdb->open (sdb, NULL, NULL, NULL, DB_BTREE, DB_CREATE, 0)) != 0) {
+		g_warning ("sort_index_open: %s", db_strerror (ret));
+		sdb->close (sdb, 0);
+		return NULL;
+	}
+	
+	return sdb;
+}
+
+static void
+sort_index_close (BdbListStorePrivate *priv)
+{
+	if (priv->sort_db) {
+		priv->sort_db->close (priv->sort_db, 0);
+		priv->sort_db = NULL;
+	}
+	
+	priv->sort_n_rows = 0;
+	priv->sort_gen++;
+}
+
+static gboolean
+sort_index_put (BdbListStorePrivate *priv,
+                db_recno_t           recno,
+                const guint8        *record,
+                gsize                size)
+{
+	DBT key, data;
+	gint ret;
+	
+	sort_key_build (priv, record, size, recno, priv->sort_key);
+	
+	CLEAR_DBT (key);
+	CLEAR_DBT (data);
+	
+	key.data = priv->sort_key->data;
+	key.size = priv->sort_key->len;
+	data.data = &recno;
+	data.size = sizeof (db_recno_t);
+	
+	ret = priv->sort_db->put (priv->sort_db, NULL, &key, &data, DB_NOOVERWRITE);
+	
+	if (ret == DB_KEYEXIST)
+		return TRUE;
+	if (ret != 0) {
+		g_warning ("sort_index_put: %s", db_strerror (ret));
+		return FALSE;
+	}
+	
+	priv->sort_n_rows++;
+	priv->sort_gen++;
+	
+	return TRUE;
+}
+
+static gboolean
+sort_index_del (BdbListStorePrivate *priv,
+                db_recno_t           recno,
+                const guint8        *record,
+                gsize                size)
+{
+	DBT key;
+	gint ret;
+	
+	sort_key_build (priv, record, size, recno, priv->sort_key);
+	
+	CLEAR_DBT (key);
+	key.data = priv->sort_key->data;
+	key.size = priv->sort_key->len;
+	
+	if ((ret = priv->sort_db->del (priv->sort_db, NULL, &key, 0)) != 0) {
+		if (ret != DB_NOTFOUND)
+			g_warning ("sort_index_del: %s", db_strerror (ret));
+		return FALSE;
+	}
+	
+	priv->sort_n_rows--;
+	priv->sort_gen++;
+	
+	return TRUE;
+}
+
+/* adds or removes the entry for the row as it currently is on disk */
+static gboolean
+sort_index_update_row (BdbListStorePrivate *priv, db_recno_t recno, gboolean add)
+{
+	const guint8 *record;
+	gsize         size;
+	gboolean      ok;
+	
+	if (!get_record (priv, recno, &record, &size))
+		return FALSE;
+	
+	if (add)
+		ok = sort_index_put (priv, recno, record, size);
+	else
+		ok = sort_index_del (priv, recno, record, size);
+	
+	return ok;
+}
+
+static gboolean
+sort_index_fill_func (db_recno_t    recno,
+                      const guint8 *data,
+                      gsize         size,
+                      gpointer      user_data)
+{
+	return sort_index_put (user_data, recno, data, size);
+}
+
+/* indexes records first to first + n_rows - 1 with bulk reads */
+static void
+sort_index_fill (BdbListStorePrivate *priv, DB_TXN *txn, db_recno_t first, guint n_rows)
+{
+	if (n_rows > 0)
+		read_range (priv, txn, &priv->bulk, first, n_rows, sort_index_fill_func, priv);
+}
+
+static gboolean
+sort_index_build (BdbListStorePrivate *priv, guint n_rows)
+{
+	sort_index_close (priv);
+	
+	if (!(priv->sort_db = sort_index_open (priv)))
+		return FALSE;
+	
+	sort_index_fill (priv, priv->batch_txn, 1, n_rows);
+	
+	return TRUE;
+}
+
+static gboolean
+sort_index_shift_func (db_recno_t    recno,
+                       const guint8 *data,
+                       gsize         size,
+                       gpointer      user_data)
+{
+	BdbListStorePrivate *priv = user_data;
+	
+	/* the key ends in the recno, which the delete renumbered down by one */
+	sort_index_del (priv, recno + 1, data, size);
+	return sort_index_put (priv, recno, data, size);
+}
+
+/*
+ * After the row at recno was deleted, rekeys the rows that moved down to
+ * take its place; the rows before it keep their entries.  Walking upwards
+ * each new key only ever takes the slot the previous step freed.
+ */
+static void
+sort_index_shift (BdbListStorePrivate *priv, db_recno_t recno, guint n_rows)
+{
+	if (recno <= n_rows)
+		read_range (priv, priv->batch_txn, &priv->bulk, recno,
+		            n_rows - recno + 1, sort_index_shift_func, priv);
+}
+
+/*
+ * Cursor get on the sort index handing back the primary recno.  For
+ * DB_SET_RECNO index is the 1-based entry to move to.  Keys are read
+ * into sort_buf, which grows as needed.
+ */
+static gint
+sort_index_get (BdbListStorePrivate *priv,
+                DBC                 *dbc,
+                u_int32_t            flags,
+                db_recno_t           index,
+                db_recno_t          *recno)
+{
+	DBT key, data;
+	gint ret;
+	
+	if (priv->sort_buf.len < sizeof (db_recno_t)) {
+		priv->sort_buf.len = 256;
+		priv->sort_buf.data = g_realloc (priv->sort_buf.data, priv->sort_buf.len);
+	}
+	
+	for (;;) {
+		CLEAR_DBT (key);
+		CLEAR_DBT (data);
+		
+		if (flags == DB_SET_RECNO) {
+			memcpy (priv->sort_buf.data, &index, sizeof index);
+			key.size = sizeof index;
+		}
+		key.data = priv->sort_buf.data;
+		key.ulen = priv->sort_buf.len;
+		key.flags = DB_DBT_USERMEM;
+		
+		data.data = recno;
+		data.ulen = sizeof (db_recno_t);
+		data.flags = DB_DBT_USERMEM;
+		
+		ret = dbc->c_get (dbc, &key, &data, flags);
+		if (ret != DB_BUFFER_SMALL || key.size <= priv->sort_buf.len)
+			return ret;
+		
+		priv->sort_buf.len = key.size;
+		priv->sort_buf.data = g_realloc (priv->sort_buf.data, priv->sort_buf.len);
+	}
+}
+
+/* the view position of the 1-based index entry, and the other way round */
+static gint
+sort_index_flip (BdbListStorePrivate *priv, gint index)
+{
+	return priv->sort_order == GTK_SORT_ASCENDING ? index : priv->sort_n_rows + 1 - index;
+}
+
+/* the row at a view position, 0 if there is none */
+static db_recno_t
+position_to_recno (BdbListStorePrivate *priv, gint position)
+{
+	DBC       *dbc;
+	db_recno_t recno = 0;
+	
+	if (position < 0 || position >= priv->n_keys)
+		return 0;
+	if (!priv->sort_db)
+		return position + 1;
+	
+	if (priv->sort_db->cursor (priv->sort_db, NULL, &dbc, 0) != 0)
+		return 0;
+	
+	if (sort_index_get (priv, dbc, DB_SET_RECNO,
+	                    sort_index_flip (priv, position + 1), &recno) != 0)
+		recno = 0;
+	
+	dbc->c_close (dbc);
+	
+	return recno;
+}
+
+/* the view position of a row, -1 if it is not in the sort index */
+static gint
+recno_to_position (BdbListStorePrivate *priv, db_recno_t recno)
+{
+	const guint8 *record;
+	gsize         size;
+	DBC          *dbc;
+	DBT           key, data;
+	db_recno_t    index = 0;
+	gint          ret;
+	
+	if (!priv->sort_db)
+		return recno - 1;
+	
+	if (!get_record (priv, recno, &record, &size))
+		return -1;
+	
+	sort_key_build (priv, record, size, recno, priv->sort_key);
+	
+	if (priv->sort_db->cursor (priv->sort_db, NULL, &dbc, 0) != 0)
+		return -1;
+	
+	CLEAR_DBT (key);
+	CLEAR_DBT (data);
+	
+	key.data = priv->sort_key->data;
+	key.size = priv->sort_key->len;
+	data.data = &index;
+	data.ulen = sizeof (db_recno_t);
+	data.flags = DB_DBT_USERMEM;
+	
+	if ((ret = dbc->c_get (dbc, &key, &data, DB_SET)) == 0)
+		ret = dbc->c_get (dbc, &key, &data, DB_GET_RECNO);
+	
+	dbc->c_close (dbc);
+	
+	if (ret != 0)
+		return -1;
+	
+	return sort_index_flip (priv, index) - 1;
+}
+
+/*
+ * Returns the view position of every row, indexed by recno - 1, with a
+ * single walk over the sort index.
+ */
+static gint*
+sort_index_positions (BdbListStorePrivate *priv)
+{
+	DBC       *dbc;
+	db_recno_t recno;
+	gint      *positions;
+	gint       index = 0;
+	gint       i;
+	
+	positions = g_new (gint, priv->n_keys);
+	for (i = 0; i < priv->n_keys; i++)
+		positions[i] = i;
+	
+	if (priv->sort_db->cursor (priv->sort_db, NULL, &dbc, 0) != 0)
+		return positions;
+	
+	while (sort_index_get (priv, dbc, DB_NEXT, 0, &recno) == 0) {
+		index++;
+		if (recno > 0 && recno <= (db_recno_t)priv->n_keys)
+			positions[recno - 1] = sort_index_flip (priv, index) - 1;
+	}
+	
+	dbc->c_close (dbc);
+	
+	return positions;
+}
+
+/*
+ * Sorted positions of an iter are remembered in user_data2 for as long as
+ * sort_gen does not change.
+ */
+static void
+iter_set (BdbListStorePrivate *priv,
+          GtkTreeIter         *iter,
+          db_recno_t           recno,
+          gint                 position)
+{
+	iter->stamp = priv->stamp;
+	iter->user_data = GINT_TO_POINTER (recno);
+	iter->user_data2 = GINT_TO_POINTER (position + 1);
+	iter->user_data3 = GINT_TO_POINTER (priv->sort_gen);
+}
+
+static gint
+iter_get_position (BdbListStorePrivate *priv, GtkTreeIter *iter)
+{
+	db_recno_t recno = GPOINTER_TO_INT (iter->user_data);
+	
+	if (!priv->sort_db)
+		return recno - 1;
+	
+	if (iter->user_data2 && GPOINTER_TO_INT (iter->user_data3) == priv->sort_gen)
+		return GPOINTER_TO_INT (iter->user_data2) - 1;
+	
+	return recno_to_position (priv, recno);
+}
+
+static gboolean
+db_is_transactional (DB *db)
+{
+	DB_ENV   *env = db->get_env (db);
+	u_int32_t env_flags = 0;
+	u_int32_t db_flags = 0;
+	
+	if (env == NULL || env->get_open_flags (env, &env_flags) != 0)
+		return FALSE;
+	if (db->get_open_flags (db, &db_flags) != 0)
+		return FALSE;
+	
+	return (env_flags & DB_INIT_TXN) && (db_flags & DB_AUTO_COMMIT);
+}
+
+/* whether the handles may be used from another thread */
+static gboolean
+db_is_threaded (DB *db)
+{
+	DB_ENV   *env = db->get_env (db);
+	u_int32_t flags = 0;
+	
+	if (db->get_open_flags (db, &flags) != 0 || !(flags & DB_THREAD))
+		return FALSE;
+	
+	return !env || (env->get_open_flags (env, &flags) == 0 && (flags & DB_THREAD));
+}
+
+static void
+generation_free (gpointer data, gpointer user_data)
+{
+	g_slice_free (BdbGeneration, data);
+}
+
+/*
+ * Copies the current generation.  A reader only ever holds the pointer
+ * while gen_readers counts it, so a publisher that sees no readers after
+ * the swap knows nobody can reach the replaced generations any more.
+ */
+static void
+generation_get (BdbListStorePrivate *priv, BdbGeneration *copy)
+{
+	BdbGeneration *gen;
+	
+	g_atomic_int_inc (&priv->gen_readers);
+	gen = g_atomic_pointer_get (&priv->generation);
+	*copy = *gen;
+	g_atomic_int_add (&priv->gen_readers, -1);
+}
+
+/* main loop only, after the write is committed and before it is announced */
+static void
+generation_publish (BdbListStorePrivate *priv)
+{
+	BdbGeneration *old = g_atomic_pointer_get (&priv->generation);
+	BdbGeneration *gen = g_slice_new (BdbGeneration);
+	
+	gen->serial = old ? old->serial + 1 : 1;
+	gen->stamp = priv->stamp;
+	gen->n_rows = priv->n_keys;
+	
+	g_atomic_pointer_set (&priv->generation, gen);
+	
+	if (old)
+		priv->gen_retired = g_slist_prepend (priv->gen_retired, old);
+	
+	/* otherwise the next publish tries again */
+	if (g_atomic_int_get (&priv->gen_readers) == 0) {
+		g_slist_foreach (priv->gen_retired, generation_free, NULL);
+		g_slist_free (priv->gen_retired);
+		priv->gen_retired = NULL;
+	}
+}
+
+/*
+ * Write-behind.  With it enabled set_valuesv() only queues the new record
+ * in wb_pending, where further sets of the same row replace it.  The
+ * writer thread takes the whole queue as wb_writing and puts it in a
+ * single transaction, then waits for the frame source to reap the group
+ * on the main loop: reaping drops the rows' cached pages and lets the
+ * writer take the next group, so groups are at most one frame apart.
+ * Until then get_record() finds the rows in the queue, which keeps reads
+ * consistent with the writes.  Each frame also emits a single row-changed
+ * per dirty row within the visible range; the rest wait until they
+ * scroll into view or the queue is flushed.
+ */
+static gint
+recno_compare (gconstpointer a, gconstpointer b)
+{
+	db_recno_t ra = *(const db_recno_t*)a;
+	db_recno_t rb = *(const db_recno_t*)b;
+	
+	return ra < rb ? -1 : ra > rb;
+}
+
+/* runs in the writer thread; rows go out in recno order to stay sequential */
+static gint
+write_group (BdbListStorePrivate *priv, GHashTable *group)
+{
+	DB_ENV         *env = priv->dbp->get_env (priv->dbp);
+	DB_TXN         *txn = NULL;
+	GArray         *recnos;
+	GHashTableIter  iter;
+	gpointer        key_p;
+	GByteArray     *buf;
+	DBT             key, data;
+	db_recno_t      recno;
+	gint            ret = 0;
+	guint           i, tries;
+	
+	recnos = g_array_sized_new (FALSE, FALSE, sizeof (db_recno_t),
+	                            g_hash_table_size (group));
+	g_hash_table_iter_init (&iter, group);
+	while (g_hash_table_iter_next (&iter, &key_p, NULL)) {
+		recno = GPOINTER_TO_UINT (key_p);
+		g_array_append_val (recnos, recno);
+	}
+	g_array_sort (recnos, recno_compare);
+	
+	for (tries = 0; tries < WRITE_RETRIES; tries++) {
+		if (db_is_transactional (priv->dbp) &&
+		    (ret = env->txn_begin (env, NULL, &txn, 0)) != 0)
+			break;
+		
+		for (i = 0; ret == 0 && i < recnos->len; i++) {
+			recno = g_array_index (recnos, db_recno_t, i);
+			buf = g_hash_table_lookup (group, GUINT_TO_POINTER (recno));
+			
+			CLEAR_DBT (key);
+			CLEAR_DBT (data);
+			key.data = &recno;
+			key.size = sizeof (db_recno_t);
+			data.data = buf->data;
+			data.size = buf->len - 1;
+			
+			ret = priv->dbp->put (priv->dbp, txn, &key, &data, 0);
+		}
+		
+		if (txn == NULL)
+			break;
+		
+		/* durability is left to bdb_list_store_sync() */
+		if (ret == 0) {
+			ret = txn->commit (txn, DB_TXN_NOSYNC);
+			break;
+		}
+		
+		txn->abort (txn);
+		txn = NULL;
+		
+		if (ret != DB_LOCK_DEADLOCK)
+			break;
+		ret = 0;
+	}
+	
+	g_array_free (recnos, TRUE);
+	
+	return ret;
+}
+
+static gpointer
+write_behind_thread (gpointer data)
+{
+	BdbListStorePrivate *priv = data;
+	GHashTable          *group;
+	gint                 ret;
+	
+	g_mutex_lock (priv->wb_lock);
+	
+	for (;;) {
+		while (!priv->wb_quit &&
+		       (priv->wb_writing || g_hash_table_size (priv->wb_pending) == 0))
+			g_cond_wait (priv->wb_cond, priv->wb_lock);
+		
+		if (priv->wb_quit)
+			break;
+		
+		group = priv->wb_writing = priv->wb_pending;
+		priv->wb_pending = write_table_new ();
+		g_mutex_unlock (priv->wb_lock);
+		
+		ret = write_group (priv, group);
+		
+		g_mutex_lock (priv->wb_lock);
+		if (ret != 0) {
+			priv->wb_failed = TRUE;
+			if (!priv->wb_error)
+				priv->wb_error = g_error_new (BDB_QUARK, 0, "Cannot write rows: %s",
+				                              db_strerror (ret));
+		}
+		priv->wb_committed = TRUE;
+		g_cond_broadcast (priv->wb_cond);
+	}
+	
+	g_mutex_unlock (priv->wb_lock);
+	
+	return NULL;
+}
+
+/* hands a committed group back to the main loop */
+static void
+write_behind_reap (BdbListStorePrivate *priv)
+{
+	GHashTable     *group = NULL;
+	GHashTableIter  iter;
+	gpointer        key;
+	gboolean        failed = FALSE;
+	
+	g_mutex_lock (priv->wb_lock);
+	if (priv->wb_committed) {
+		group = priv->wb_writing;
+		failed = priv->wb_failed;
+		priv->wb_writing = NULL;
+		priv->wb_committed = FALSE;
+		priv->wb_failed = FALSE;
+		g_cond_broadcast (priv->wb_cond);
+	}
+	g_mutex_unlock (priv->wb_lock);
+	
+	if (!group)
+		return;
+	
+	g_hash_table_iter_init (&iter, group);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		cache_invalidate_row (priv, GPOINTER_TO_UINT (key));
+		/* the rows went back to what is on disk */
+		if (failed) {
+			g_hash_table_replace (priv->wb_dirty, key, key);
+			priv->wb_announce = TRUE;
+		}
+	}
+	
+	g_hash_table_destroy (group);
+	
+	if (!failed)
+		generation_publish (priv);
+}
+
+/* blocks until everything queued so far is committed and reaped */
+static void
+write_behind_wait (BdbListStorePrivate *priv)
+{
+	g_mutex_lock (priv->wb_lock);
+	
+	while (priv->wb_writing || g_hash_table_size (priv->wb_pending) > 0) {
+		if (priv->wb_committed) {
+			g_mutex_unlock (priv->wb_lock);
+			write_behind_reap (priv);
+			g_mutex_lock (priv->wb_lock);
+		}
+		else {
+			g_cond_wait (priv->wb_cond, priv->wb_lock);
+		}
+	}
+	
+	g_mutex_unlock (priv->wb_lock);
+}
+
+/* emits row-changed for dirty rows, all of them or the visible ones */
+static void
+write_behind_announce (BdbListStore *self, gboolean all)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	GHashTableIter       hash_iter;
+	GtkTreeIter          iter;
+	GtkTreePath         *path;
+	GArray              *rows;
+	gpointer             key;
+	db_recno_t           recno;
+	gint                 first, last, position;
+	guint                i;
+	
+	priv->wb_announce = FALSE;
+	
+	if (g_hash_table_size (priv->wb_dirty) == 0)
+		return;
+	
+	first = g_atomic_int_get (&priv->visible_first);
+	last = g_atomic_int_get (&priv->visible_last);
+	
+	/* without a visible range there is nothing to hold back for */
+	if (last < first)
+		all = TRUE;
+	
+	/* collected first, handlers may well set more values */
+	rows = g_array_new (FALSE, FALSE, sizeof (db_recno_t));
+	g_hash_table_iter_init (&hash_iter, priv->wb_dirty);
+	while (g_hash_table_iter_next (&hash_iter, &key, NULL)) {
+		recno = GPOINTER_TO_UINT (key);
+		position = recno <= (db_recno_t)priv->n_keys ? recno_to_position (priv, recno) : -1;
+		
+		if (position < 0) {
+			g_hash_table_iter_remove (&hash_iter);
+		}
+		else if (all || (position >= first && position <= last)) {
+			g_array_append_val (rows, recno);
+			g_hash_table_iter_remove (&hash_iter);
+		}
+	}
+	
+	for (i = 0; i < rows->len; i++) {
+		recno = g_array_index (rows, db_recno_t, i);
+		if ((position = recno_to_position (priv, recno)) < 0)
+			continue;
+		
+		iter_set (priv, &iter, recno, position);
+		path = gtk_tree_path_new_from_indices (position, -1);
+		gtk_tree_model_row_changed (GTK_TREE_MODEL (self), path, &iter);
+		gtk_tree_path_free (path);
+	}
+	
+	g_array_free (rows, TRUE);
+}
+
+static gboolean
+write_behind_frame (gpointer data)
+{
+	BdbListStore        *self = data;
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	gboolean             busy;
+	
+	write_behind_reap (priv);
+	
+	if (priv->wb_announce)
+		write_behind_announce (self, FALSE);
+	
+	g_mutex_lock (priv->wb_lock);
+	busy = priv->wb_writing || g_hash_table_size (priv->wb_pending) > 0;
+	g_mutex_unlock (priv->wb_lock);
+	
+	if (busy)
+		return TRUE;
+	
+	priv->wb_frame_id = 0;
+	return FALSE;
+}
+
+static void
+write_behind_schedule (BdbListStore *self)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	
+	/* the source holds no reference, finalize removes it */
+	if (!priv->wb_frame_id)
+		priv->wb_frame_id = gb_frame_source_add (priv->wb_fps, write_behind_frame, self);
+}
+
+static gboolean
+write_behind_queue (BdbListStore *self,
+                    db_recno_t    recno,
+                    gconstpointer record,
+                    gsize         size)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	GByteArray          *buf;
+	
+	buf = g_byte_array_sized_new (size + 1);
+	g_byte_array_append (buf, record, size);
+	g_byte_array_append (buf, (guint8*)"", 1);
+	
+	g_mutex_lock (priv->wb_lock);
+	g_hash_table_replace (priv->wb_pending, GUINT_TO_POINTER (recno), buf);
+	g_cond_broadcast (priv->wb_cond);
+	g_mutex_unlock (priv->wb_lock);
+	
+	g_hash_table_replace (priv->wb_dirty, GUINT_TO_POINTER (recno),
+	                      GUINT_TO_POINTER (recno));
+	priv->wb_announce = TRUE;
+	write_behind_schedule (self);
+	
+	return TRUE;
+}
+
+/*
+ * Writes out the queue ahead of anything that renumbers rows or reads
+ * the database behind get_record()'s back.  Errors are kept for the next
+ * bdb_list_store_flush().
+ */
+static void
+write_behind_flush (BdbListStore *self)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	
+	if (!priv->wb_thread)
+		return;
+	
+	write_behind_wait (priv);
+	write_behind_announce (self, TRUE);
+}
+
+static void
+write_behind_stop (BdbListStorePrivate *priv)
+{
+	write_behind_wait (priv);
+	
+	g_mutex_lock (priv->wb_lock);
+	priv->wb_quit = TRUE;
+	g_cond_broadcast (priv->wb_cond);
+	g_mutex_unlock (priv->wb_lock);
+	
+	g_thread_join (priv->wb_thread);
+	priv->wb_thread = NULL;
+	
+	if (priv->wb_frame_id) {
+		g_source_remove (priv->wb_frame_id);
+		priv->wb_frame_id = 0;
+	}
+	
+	g_hash_table_destroy (priv->wb_pending);
+	g_hash_table_destroy (priv->wb_dirty);
+	g_mutex_free (priv->wb_lock);
+	g_cond_free (priv->wb_cond);
+	if (priv->wb_error)
+		g_error_free (priv->wb_error);
+	
+	priv->wb_pending = NULL;
+	priv->wb_dirty = NULL;
+	priv->wb_lock = NULL;
+	priv->wb_cond = NULL;
+	priv->wb_error = NULL;
+}
+
+static void
+bdb_list_store_dispose (GObject *object)
+{
+	if (G_OBJECT_CLASS (bdb_list_store_parent_class)->dispose)
+		G_OBJECT_CLASS (bdb_list_store_parent_class)->dispose (object);
+}
+
+static void
+bdb_list_store_finalize (GObject *object)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (object);
+
+	/* before the handles it writes through go away */
+	if (priv->wb_thread)
+		write_behind_stop (priv);
+	
+	if (priv->prefetch_pool)
+		g_thread_pool_free (priv->prefetch_pool, FALSE, TRUE);
+	g_free (priv->prefetch_bulk.data);
+	g_hash_table_destroy (priv->prefetching);
+	g_hash_table_destroy (priv->prefetch_failed);
+	
+	sort_index_close (priv);
+	g_byte_array_free (priv->sort_key, TRUE);
+	g_free (priv->sort_buf.data);
+	
+	if (priv->owns_db)
+		priv->dbp->close (priv->dbp, 0);
+	if (priv->snapshot)
+		g_mapped_file_free (priv->snapshot);
+	
+	cache_clear (priv);
+	g_hash_table_destroy (priv->pages);
+	g_free (priv->bulk.data);
+	g_free (priv->scratch.data);
+	g_free (priv->column_types);
+	
+	g_slist_foreach (priv->gen_retired, generation_free, NULL);
+	g_slist_free (priv->gen_retired);
+	generation_free (priv->generation, NULL);
+
+	G_OBJECT_CLASS (bdb_list_store_parent_class)->finalize (object);
+}
+
+static void
+bdb_list_store_class_init (BdbListStoreClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	g_type_class_add_private (klass, sizeof (BdbListStorePrivate));
+
+	object_class->get_property = bdb_list_store_get_property;
+	object_class->set_property = bdb_list_store_set_property;
+	object_class->dispose      = bdb_list_store_dispose;
+	object_class->finalize     = bdb_list_store_finalize;
+	
+	/* all read on demand from memp_stat, there is no change notification */
+	g_object_class_install_property (object_class,
+	                                 PROP_MPOOL_CACHE_SIZE,
+	                                 g_param_spec_uint64 ("mpool-cache-size",
+	                                                      "Memory Pool Cache Size",
+	                                                      "Size in bytes of the environment's shared cache",
+	                                                      0, G_MAXUINT64, 0,
+	                                                      G_PARAM_READABLE));
+	g_object_class_install_property (object_class,
+	                                 PROP_MPOOL_PAGE_SIZE,
+	                                 g_param_spec_uint ("mpool-page-size",
+	                                                    "Memory Pool Page Size",
+	                                                    "Page size of the database",
+	                                                    0, G_MAXUINT, 0,
+	                                                    G_PARAM_READABLE));
+	g_object_class_install_property (object_class,
+	                                 PROP_MPOOL_HITS,
+	                                 g_param_spec_uint64 ("mpool-hits",
+	                                                      "Memory Pool Hits",
+	                                                      "Pages found in the shared cache",
+	                                                      0, G_MAXUINT64, 0,
+	                                                      G_PARAM_READABLE));
+	g_object_class_install_property (object_class,
+	                                 PROP_MPOOL_MISSES,
+	                                 g_param_spec_uint64 ("mpool-misses",
+	                                                      "Memory Pool Misses",
+	                                                      "Pages read in from disk",
+	                                                      0, G_MAXUINT64, 0,
+	                                                      G_PARAM_READABLE));
+	g_object_class_install_property (object_class,
+	                                 PROP_MPOOL_HIT_RATIO,
+	                                 g_param_spec_double ("mpool-hit-ratio",
+	                                                      "Memory Pool Hit Ratio",
+	                                                      "Fraction of page requests served from the shared cache",
+	                                                      0.0, 1.0, 1.0,
+	                                                      G_PARAM_READABLE));
+	g_object_class_install_property (object_class,
+	                                 PROP_MPOOL_EVICTIONS,
+	                                 g_param_spec_uint64 ("mpool-evictions",
+	                                                      "Memory Pool Evictions",
+	                                                      "Clean and dirty pages evicted from the shared cache",
+	                                                      0, G_MAXUINT64, 0,
+	                                                      G_PARAM_READABLE));
+	g_object_class_install_property (object_class,
+	                                 PROP_STATIC_STRINGS,
+	                                 g_param_spec_boolean ("static-strings",
+	                                                       "Static Strings",
+	                                                       "Hand out string values that point into the store instead of copies",
+	                                                       FALSE,
+	                                                       G_PARAM_READWRITE));
+}
+
+/*
+ * Asks the database for the number of records.  For DB_RECNO the fast
+ * stat is exact, but it still walks into the btree and allocates, so it
+ * only runs on attach and bdb_list_store_resync(); everything else uses
+ * the count maintained by the mutators.
+ */
+static gint
+count_keys (BdbListStorePrivate *priv)
+{
+	DB_BTREE_STAT *stat = NULL;
+	gint           ret;
+	gint           n_keys = -1;
+	
+	if ((ret = priv->dbp->stat (priv->dbp, NULL, &stat, DB_FAST_STAT)) == 0)
+		n_keys = stat->bt_nkeys;
+	else
+		g_warning ("count_keys: %s", db_strerror (ret));
+	
+	g_free (stat);
+	
+	return n_keys;
+}
+
+static gint
+get_n_keys (BdbListStore *self)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), 0);
+	return LIST_STORE_PRIVATE (self)->n_keys;
+}
+
+static GtkTreeModelFlags
+get_flags (GtkTreeModel *tree_model)
+{
+	return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gboolean
+get_iter (GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (tree_model), FALSE);
+	
+	BdbListStorePrivate *priv    = LIST_STORE_PRIVATE (tree_model);
+	gint                *indices = gtk_tree_path_get_indices (path);
+	gint                 depth   = gtk_tree_path_get_depth (path);
+	
+	if (depth == 0)
+		return FALSE;
+	
+	gint n_keys = get_n_keys (BDB_LIST_STORE (tree_model));
+	if (n_keys <= indices[0])
+		return FALSE;
+	
+	db_recno_t recno = position_to_recno (priv, indices[0]);
+	if (recno == 0)
+		return FALSE;
+	
+	iter_set (priv, iter, recno, indices[0]);
+	
+	return TRUE;
+}
+
+static gint
+get_n_columns (GtkTreeModel *tree_model)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (tree_model);
+	return priv->column_types ? priv->n_columns : 1;
+}
+
+static GType
+get_column_type (GtkTreeModel *tree_model, gint index)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (tree_model);
+	
+	if (!priv->column_types)
+		return G_TYPE_STRING;
+	
+	g_return_val_if_fail (index >= 0 && index < priv->n_columns, G_TYPE_INVALID);
+	return priv->column_types[index];
+}
+
+static gboolean
+iter_next (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (tree_model), FALSE);
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (tree_model);
+	g_return_val_if_fail (iter->stamp == priv->stamp, FALSE);
+	
+	gint n_keys = get_n_keys (BDB_LIST_STORE (tree_model));
+	gint position = iter_get_position (priv, iter);
+	
+	if (position < 0 || n_keys <= position + 1)
+		return FALSE;
+	
+	db_recno_t recno = position_to_recno (priv, position + 1);
+	if (recno == 0)
+		return FALSE;
+	
+	iter_set (priv, iter, recno, position + 1);
+	
+	return TRUE;
+}
+
+static gboolean
+iter_nth_child (GtkTreeModel *tree_model,
+                GtkTreeIter *iter,
+		GtkTreeIter *parent,
+		gint n)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (tree_model), FALSE);
+	
+	if (parent)
+		return FALSE;
+	
+	gint n_keys = 0;
+	if ((n_keys = get_n_keys (BDB_LIST_STORE (tree_model))) <= n)
+		return FALSE;
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (tree_model);
+	
+	db_recno_t recno = position_to_recno (priv, n);
+	if (recno == 0)
+		return FALSE;
+	
+	iter_set (priv, iter, recno, n);
+	
+	return TRUE;
+}
+
+static void
+get_value (GtkTreeModel *tree_model,
+	   GtkTreeIter  *iter,
+           gint          column,
+	   GValue       *value)
+{
+	g_return_if_fail (BDB_IS_LIST_STORE (tree_model));
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (tree_model);
+	g_return_if_fail (priv->stamp == iter->stamp);
+	g_return_if_fail (column >= 0 && column < get_n_columns (tree_model));
+	
+	db_recno_t    recno = GPOINTER_TO_INT (iter->user_data);
+	const guint8 *record;
+	gsize         size;
+	
+	/*
+	 * With a prefetcher the main loop never waits on the disk: a row that
+	 * is not cached yet comes back empty and row-changed follows once the
+	 * prefetch thread has read its page.
+	 */
+	if (priv->snapshot) {
+		if (!snapshot_get_row (priv, recno, &record, &size)) {
+			g_value_init (value, get_column_type (tree_model, column));
+			return;
+		}
+	}
+	else if (priv->prefetch_pool && priv->max_pages > 0 && !priv->batch_depth &&
+	         !write_behind_lookup (priv, recno, &record, &size) &&
+	         prefetch_failures (priv, (recno - 1) / priv->page_size) < PREFETCH_RETRIES)
+	{
+		guint    index = (recno - 1) / priv->page_size;
+		BdbPage *page = cache_get_page (priv, index, FALSE);
+		
+		if (!page || !page_get_row (page, (recno - 1) % priv->page_size, &record, &size)) {
+			if (!page)
+				prefetch_queue (BDB_LIST_STORE (tree_model), index, TRUE);
+			g_value_init (value, get_column_type (tree_model, column));
+			return;
+		}
+	}
+	else if (!get_record (priv, recno, &record, &size)) {
+		g_warning ("get_value: no record %u", recno);
+		g_value_init (value, get_column_type (tree_model, column));
+		return;
+	}
+	
+	if (priv->column_types) {
+		bdb_record_get_value (priv->column_types, record, size, column,
+		                      priv->static_strings, value);
+	}
+	else {
+		g_value_init (value, G_TYPE_STRING);
+		if (priv->static_strings)
+			g_value_set_static_string (value, (const gchar*)record);
+		else
+			g_value_set_string (value, (const gchar*)record);
+	}
+}
+
+static gboolean
+iter_children (GtkTreeModel *tree_model,
+               GtkTreeIter  *iter,
+               GtkTreeIter  *parent)
+{
+	return FALSE;
+}
+
+static gboolean
+iter_has_child (GtkTreeModel *tree_model,
+                GtkTreeIter  *iter)
+{
+	return FALSE;
+}
+
+static int
+iter_n_children (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (tree_model), 0);
+	if (iter)
+		return 0;
+	return get_n_keys (BDB_LIST_STORE (tree_model));
+}
+
+static gboolean
+iter_parent (GtkTreeModel *tree_model,
+             GtkTreeIter  *iter,
+             GtkTreeIter  *parent)
+{
+	return FALSE;
+}
+
+static GtkTreePath*
+get_path (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (tree_model);
+	g_return_val_if_fail (priv->stamp == iter->stamp, NULL);
+	
+	gint position = iter_get_position (priv, iter);
+	if (position < 0)
+		return NULL;
+	
+	return gtk_tree_path_new_from_indices (position, -1);
+}
+
+static void
+tree_model_init (GtkTreeModelIface *iface)
+{
+	iface->get_flags       = get_flags;
+	iface->get_iter        = get_iter;
+	iface->get_n_columns   = get_n_columns;
+	iface->get_column_type = get_column_type;
+	iface->iter_next       = iter_next;
+	iface->iter_nth_child  = iter_nth_child;
+	iface->get_value       = get_value;
+	iface->iter_children   = iter_children;
+	iface->iter_has_child  = iter_has_child;
+	iface->iter_n_children = iter_n_children;
+	iface->iter_parent     = iter_parent;
+	iface->get_path        = get_path;
+}
+
+static gboolean
+get_sort_column_id (GtkTreeSortable *sortable,
+                    gint            *sort_column_id,
+                    GtkSortType     *order)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (sortable);
+	
+	if (sort_column_id)
+		*sort_column_id = priv->sort_column_id;
+	if (order)
+		*order = priv->sort_order;
+	
+	return priv->sort_column_id != GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID &&
+	       priv->sort_column_id != GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID;
+}
+
+/*
+ * Rebuilds the sort index for the new column and tells views how the rows
+ * moved with a single rows-reordered.
+ */
+static void
+set_sort_column_id (GtkTreeSortable *sortable,
+                    gint             sort_column_id,
+                    GtkSortType      order)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (sortable);
+	
+	if (sort_column_id == priv->sort_column_id && order == priv->sort_order)
+		return;
+	
+	if (sort_column_id == GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID) {
+		g_warning ("BdbListStore has no default sort function");
+		return;
+	}
+	if (priv->snapshot && sort_column_id != GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID) {
+		g_warning ("BdbListStore snapshots cannot be sorted");
+		return;
+	}
+	if (sort_column_id != GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID)
+		g_return_if_fail (sort_column_id >= 0 &&
+		                  sort_column_id < get_n_columns (GTK_TREE_MODEL (sortable)));
+	
+	gint        *old_positions = NULL;
+	gint        *new_positions = NULL;
+	gint        *new_order;
+	GtkTreePath *path;
+	gint         i;
+	
+	/* the index is built from the rows on disk */
+	write_behind_flush (BDB_LIST_STORE (sortable));
+	
+	if (priv->sort_db && priv->n_keys > 0)
+		old_positions = sort_index_positions (priv);
+	
+	sort_index_close (priv);
+	priv->sort_column_id = sort_column_id;
+	priv->sort_order = order;
+	
+	if (priv->dbp && sort_column_id >= 0 && sort_index_build (priv, priv->n_keys) &&
+	    priv->n_keys > 0)
+		new_positions = sort_index_positions (priv);
+	
+	if (old_positions || new_positions) {
+		new_order = g_new (gint, priv->n_keys);
+		for (i = 0; i < priv->n_keys; i++)
+			new_order[new_positions ? new_positions[i] : i] = old_positions ? old_positions[i] : i;
+		
+		path = gtk_tree_path_new ();
+		gtk_tree_model_rows_reordered (GTK_TREE_MODEL (sortable), path, NULL, new_order);
+		gtk_tree_path_free (path);
+		
+		g_free (new_order);
+	}
+	
+	g_free (old_positions);
+	g_free (new_positions);
+	
+	gtk_tree_sortable_sort_column_changed (sortable);
+}
+
+static void
+set_sort_func (GtkTreeSortable        *sortable,
+               gint                    sort_column_id,
+               GtkTreeIterCompareFunc  func,
+               gpointer                data,
+               GDestroyNotify          destroy)
+{
+	g_warning ("BdbListStore sorts by column value and does not support sort functions");
+	
+	if (destroy)
+		destroy (data);
+}
+
+static void
+set_default_sort_func (GtkTreeSortable        *sortable,
+                       GtkTreeIterCompareFunc  func,
+                       gpointer                data,
+                       GDestroyNotify          destroy)
+{
+	set_sort_func (sortable, GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID,
+	               func, data, destroy);
+}
+
+static gboolean
+has_default_sort_func (GtkTreeSortable *sortable)
+{
+	return FALSE;
+}
+
+static void
+tree_sortable_init (GtkTreeSortableIface *iface)
+{
+	iface->get_sort_column_id    = get_sort_column_id;
+	iface->set_sort_column_id    = set_sort_column_id;
+	iface->set_sort_func         = set_sort_func;
+	iface->set_default_sort_func = set_default_sort_func;
+	iface->has_default_sort_func = has_default_sort_func;
+}
+
+static void
+bdb_list_store_init (BdbListStore *self)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	
+	priv->stamp = g_random_int ();
 	priv->n_keys = 0;
-	priv->dirty = TRUE;
+	
+	priv->pages = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+	                                     NULL, page_free);
+	g_queue_init (&priv->lru);
+	priv->max_pages = DEFAULT_CACHE_PAGES;
+	priv->page_size = DEFAULT_PAGE_SIZE;
+	
+	priv->prefetching = g_hash_table_new (g_direct_hash, g_direct_equal);
+	priv->prefetch_failed = g_hash_table_new (g_direct_hash, g_direct_equal);
+	priv->visible_last = -1;
+	
+	priv->sort_column_id = GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID;
+	priv->sort_order = GTK_SORT_ASCENDING;
+	priv->sort_key = g_byte_array_new ();
+	
+	generation_publish (priv);
+}
+
+BdbListStore*
+bdb_list_store_new (void)
+{
+	return g_object_new (BDB_TYPE_LIST_STORE, NULL);
+}
+
+BdbListStore*
+bdb_list_store_newv (gint n_columns, GType *types)
+{
+	BdbListStore *self = bdb_list_store_new ();
+	bdb_list_store_set_column_types (self, n_columns, types);
+	return self;
+}
+
+/**
+ * bdb_list_store_set_column_types:
+ * @self: A #BdbListStore
+ * @n_columns: number of columns
+ * @types: the #GType of each column
+ *
+ * Switches the store from a single string per row to typed columns packed
+ * into a binary record.  Supported are booleans, integers, floating point,
+ * strings and #GByteArray blobs.  This decides how records on disk are
+ * read, so it must match the database and be called before the store is
+ * attached to a view.
+ **/
+void
+bdb_list_store_set_column_types (BdbListStore *self,
+                                 gint          n_columns,
+                                 GType        *types)
+{
+	g_return_if_fail (BDB_IS_LIST_STORE (self));
+	g_return_if_fail (n_columns > 0);
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	g_return_if_fail (priv->column_types == NULL);
+	
+	gint i;
+	
+	for (i = 0; i < n_columns; i++) {
+		if (!bdb_record_type_is_supported (types[i])) {
+			g_warning ("bdb_list_store_set_column_types: unsupported type %s",
+			           g_type_name (types[i]));
+			return;
+		}
+	}
+	
+	priv->n_columns = n_columns;
+	priv->column_types = g_memdup (types, n_columns * sizeof (GType));
+	cache_clear (priv);
+}
+
+DB*
+bdb_list_store_get_db (BdbListStore *self)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), NULL);
+	return LIST_STORE_PRIVATE (self)->dbp;
+}
+
+gboolean
+bdb_list_store_set_db (BdbListStore *self, DB *db, GError **error)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), FALSE);
+	g_return_val_if_fail (db != NULL, FALSE);
+	
+	if (db->type != DB_RECNO) {
+		if (error && *error == NULL)
+			*error = g_error_new_literal (BDB_QUARK, 0, "DB must be of type DB_RECNO");
+		return FALSE;
+	}
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	
+	if (priv->dbp != NULL || priv->snapshot != NULL) {
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Cannot set db twice");
+		return FALSE;
+	}
+	
+	guint flags = 0;
+	gint ret = 0;
+	
+	if ((ret = db->get_flags (db, &flags)) != 0) {
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Cannot retrieve db flags");
+		return FALSE;
+	}
+	
+	if (!(flags & DB_RENUMBER)) {
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Please alter DB with db->set_flags(DB_RENUMBER)");
+		return FALSE;
+	}
+	
+	priv->dbp = db;
+	priv->n_keys = MAX (count_keys (priv), 0);
+	
+	if (db->get_open_flags (db, &flags) == 0 && (flags & DB_MULTIVERSION))
+		priv->cursor_flags = DB_TXN_SNAPSHOT;
+	
+	if (priv->sort_column_id >= 0)
+		sort_index_build (priv, priv->n_keys);
+	
+	generation_publish (priv);
+	
+	return TRUE;
+}
+
+/**
+ * bdb_list_store_create_env:
+ * @home: environment home directory
+ * @cache_size: size of the shared memory pool in bytes, 0 for the default
+ * @flags: additional DB_ENV->open flags, such as DB_PRIVATE
+ * @error: location for a #GError or %NULL
+ *
+ * Creates, or joins if one already exists in @home, a transactional
+ * environment opened with DB_THREAD, as the store's batches and
+ * prefetcher want it.  The memory pool is shared by every database in
+ * the environment, so several stores can be tuned with a single cache
+ * size.  The cache size of an existing environment cannot be changed.
+ *
+ * Returns: the environment, to be closed by the caller after all stores
+ * using it are gone, or %NULL on error.
+ **/
+DB_ENV*
+bdb_list_store_create_env (const gchar  *home,
+                           guint64       cache_size,
+                           guint32       flags,
+                           GError      **error)
+{
+	DB_ENV *env = NULL;
+	gint    ret;
+	
+	if ((ret = db_env_create (&env, 0)) != 0) {
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Cannot create environment: %s",
+			                      db_strerror (ret));
+		return NULL;
+	}
+	
+	if (cache_size > 0 &&
+	    (ret = env->set_cachesize (env, cache_size / (1024 * 1024 * 1024),
+	                               cache_size % (1024 * 1024 * 1024), 1)) != 0)
+	{
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Cannot set cache size: %s",
+			                      db_strerror (ret));
+		env->close (env, 0);
+		return NULL;
+	}
+	
+	flags |= DB_CREATE | DB_INIT_LOCK | DB_INIT_LOG | DB_INIT_MPOOL | DB_INIT_TXN | DB_THREAD;
+	
+	if ((ret = env->open (env, home, flags, 0)) != 0) {
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Cannot open environment: %s",
+			                      db_strerror (ret));
+		env->close (env, 0);
+		return NULL;
+	}
+	
+	return env;
+}
+
+/**
+ * bdb_list_store_open:
+ * @self: A #BdbListStore
+ * @env: the environment, see bdb_list_store_create_env()
+ * @file: database file name within @env, or %NULL for an in-memory one
+ * @page_size: database page size in bytes, 0 for the default
+ * @error: location for a #GError or %NULL
+ *
+ * Opens, or creates, a DB_RECNO database with DB_RENUMBER set in @env
+ * and attaches it to the store, which closes it again when finalized.
+ * @page_size only applies when the database is created; larger pages
+ * hold more rows per read, smaller ones waste less cache on random
+ * access.  In a transactional environment the database is opened with
+ * DB_MULTIVERSION, so reads from other threads never block writes; the
+ * copies of pages being written take up some of the cache.
+ **/
+gboolean
+bdb_list_store_open (BdbListStore  *self,
+                     DB_ENV        *env,
+                     const gchar   *file,
+                     guint32        page_size,
+                     GError       **error)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), FALSE);
+	g_return_val_if_fail (env != NULL, FALSE);
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	DB                  *dbp = NULL;
+	u_int32_t            env_flags = 0;
+	u_int32_t            flags = DB_CREATE | DB_THREAD;
+	gint                 ret;
+	
+	if ((ret = db_create (&dbp, env, 0)) != 0) {
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Cannot create database: %s",
+			                      db_strerror (ret));
+		return FALSE;
+	}
+	
+	dbp->set_flags (dbp, DB_RENUMBER);
+	
+	if (page_size > 0 && (ret = dbp->set_pagesize (dbp, page_size)) != 0) {
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Invalid page size %u: %s",
+			                      page_size, db_strerror (ret));
+		dbp->close (dbp, 0);
+		return FALSE;
+	}
+	
+	/* writers copy pages instead of waiting for readers, see bdb_list_store_reader_new() */
+	if (env->get_open_flags (env, &env_flags) == 0 && (env_flags & DB_INIT_TXN))
+		flags |= DB_AUTO_COMMIT | DB_MULTIVERSION;
+	
+	if ((ret = dbp->open (dbp, NULL, file, NULL, DB_RECNO, flags, 0)) != 0) {
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Cannot open %s: %s",
+			                      file ? file : "database", db_strerror (ret));
+		dbp->close (dbp, 0);
+		return FALSE;
+	}
+	
+	if (!bdb_list_store_set_db (self, dbp, error)) {
+		dbp->close (dbp, 0);
+		return FALSE;
+	}
+	
+	priv->owns_db = TRUE;
+	
+	return TRUE;
+}
+
+typedef struct
+{
+	FILE    *file;
+	guint64 *offsets;
+	guint64  pos;
+	guint    n_rows;
+} SnapshotWrite;
+
+static gboolean
+snapshot_write_func (db_recno_t    recno,
+                     const guint8 *data,
+                     gsize         size,
+                     gpointer      user_data)
+{
+	SnapshotWrite *sw = user_data;
+	
+	sw->offsets[sw->n_rows++] = sw->pos;
+	fwrite (data, 1, size, sw->file);
+	fputc ('\0', sw->file);
+	sw->pos += size + 1;
+	
+	return !ferror (sw->file);
+}
+
+/**
+ * bdb_list_store_export_snapshot:
+ * @self: A #BdbListStore
+ * @filename: file to write
+ * @error: location for a #GError or %NULL
+ *
+ * Writes every row, in storage order, to a flat file that
+ * bdb_list_store_open_snapshot() can map.  The file is written next to
+ * @filename and renamed over it once complete.
+ **/
+gboolean
+bdb_list_store_export_snapshot (BdbListStore  *self,
+                                const gchar   *filename,
+                                GError       **error)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), FALSE);
+	g_return_val_if_fail (filename != NULL, FALSE);
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	g_return_val_if_fail (priv->dbp != NULL, FALSE);
+	g_return_val_if_fail (priv->batch_depth == 0, FALSE);
+	
+	SnapshotHeader header;
+	SnapshotWrite  sw;
+	gsize          table_offset;
+	gchar         *tmp;
+	gint           i;
+	gboolean       ok;
+	
+	write_behind_flush (self);
+	
+	tmp = g_strconcat (filename, ".tmp", NULL);
+	if (!(sw.file = g_fopen (tmp, "wb"))) {
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Cannot create %s: %s",
+			                      tmp, g_strerror (errno));
+		g_free (tmp);
+		return FALSE;
+	}
+	
+	errno = 0;
+	memset (&header, 0, sizeof header);
+	memcpy (header.magic, SNAPSHOT_MAGIC, sizeof header.magic);
+	header.byte_order = G_BYTE_ORDER;
+	header.n_rows = priv->n_keys;
+	header.n_columns = priv->n_columns;
+	
+	table_offset = snapshot_table_offset (priv->n_columns);
+	sw.offsets = g_new (guint64, header.n_rows + 1);
+	sw.pos = table_offset + (header.n_rows + 1) * sizeof (guint64);
+	sw.n_rows = 0;
+	
+	/* records first, the offset table is only known afterwards */
+	ok = fseek (sw.file, sw.pos, SEEK_SET) == 0 &&
+	     read_range (priv, NULL, &priv->bulk, 1, header.n_rows,
+	                 snapshot_write_func, &sw) == header.n_rows;
+	
+	if (ok) {
+		sw.offsets[sw.n_rows] = sw.pos;
+		
+		ok = fseek (sw.file, 0, SEEK_SET) == 0 &&
+		     fwrite (&header, sizeof header, 1, sw.file) == 1;
+		
+		for (i = 0; ok && i < priv->n_columns; i++) {
+			guint32 type = G_TYPE_FUNDAMENTAL (priv->column_types[i]);
+			ok = fwrite (&type, sizeof type, 1, sw.file) == 1;
+		}
+		
+		ok = ok && fseek (sw.file, table_offset, SEEK_SET) == 0 &&
+		     fwrite (sw.offsets, sizeof (guint64), header.n_rows + 1, sw.file) == header.n_rows + 1;
+	}
+	
+	if (fclose (sw.file) != 0)
+		ok = FALSE;
+	
+	if (ok && g_rename (tmp, filename) != 0)
+		ok = FALSE;
+	
+	if (!ok) {
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Cannot write %s: %s",
+			                      filename, errno ? g_strerror (errno) : "short read");
+		g_unlink (tmp);
+	}
+	
+	g_free (sw.offsets);
+	g_free (tmp);
+	
+	return ok;
+}
+
+/**
+ * bdb_list_store_open_snapshot:
+ * @self: A #BdbListStore
+ * @filename: a file written by bdb_list_store_export_snapshot()
+ * @error: location for a #GError or %NULL
+ *
+ * Maps a snapshot read-only and shows it instead of a database.  The
+ * store must have the column types the snapshot was exported with and no
+ * database.  Rows are read straight from the mapping, without the page
+ * cache and without calls into Berkeley DB, leaving residency to the
+ * kernel's page cache.  The store cannot be modified or sorted.
+ **/
+gboolean
+bdb_list_store_open_snapshot (BdbListStore  *self,
+                              const gchar   *filename,
+                              GError       **error)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), FALSE);
+	g_return_val_if_fail (filename != NULL, FALSE);
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	
+	GMappedFile          *mapped;
+	const guint8         *data;
+	const SnapshotHeader *header;
+	const guint64        *offsets;
+	const guint32        *types;
+	gsize                 length;
+	gsize                 table_offset;
+	gint                  i;
+	
+	if (priv->dbp != NULL || priv->snapshot != NULL) {
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Cannot set db twice");
+		return FALSE;
+	}
+	
+	if (!(mapped = g_mapped_file_new (filename, FALSE, error)))
+		return FALSE;
+	
+	data = (const guint8*)g_mapped_file_get_contents (mapped);
+	length = g_mapped_file_get_length (mapped);
+	header = (const SnapshotHeader*)data;
+	
+	if (length < sizeof *header ||
+	    memcmp (header->magic, SNAPSHOT_MAGIC, sizeof header->magic) != 0 ||
+	    header->byte_order != G_BYTE_ORDER)
+	{
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "%s is not a snapshot", filename);
+		g_mapped_file_free (mapped);
+		return FALSE;
+	}
+	
+	table_offset = snapshot_table_offset (header->n_columns);
+	types = (const guint32*)(data + sizeof *header);
+	offsets = (const guint64*)(data + table_offset);
+	
+	if (table_offset + ((gsize)header->n_rows + 1) * sizeof (guint64) > length ||
+	    offsets[header->n_rows] > length)
+	{
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Snapshot %s is truncated", filename);
+		g_mapped_file_free (mapped);
+		return FALSE;
+	}
+	
+	for (i = 0; header->n_columns == (guint32)priv->n_columns && i < priv->n_columns; i++)
+		if (types[i] != G_TYPE_FUNDAMENTAL (priv->column_types[i]))
+			break;
+	
+	if (header->n_columns != (guint32)priv->n_columns || i < priv->n_columns) {
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Snapshot %s has other columns than the store",
+			                      filename);
+		g_mapped_file_free (mapped);
+		return FALSE;
+	}
+	
+	priv->snapshot = mapped;
+	priv->snap_data = data;
+	priv->snap_offsets = offsets;
+	priv->snap_length = length;
+	priv->n_keys = header->n_rows;
+	
+	generation_publish (priv);
+	
+	return TRUE;
+}
+
+gboolean
+bdb_list_store_is_snapshot (BdbListStore *self)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), FALSE);
+	
+	return LIST_STORE_PRIVATE (self)->snapshot != NULL;
+}
+
+static gboolean
+append_record (BdbListStore  *self,
+               gconstpointer  record,
+               gsize          size,
+               db_recno_t    *recno)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	
+	DBT key, data;
+	gint ret;
+	
+	CLEAR_DBT (key);
+	CLEAR_DBT (data);
+	
+	*recno = 0;
+	key.data = recno;
+	key.size = sizeof (db_recno_t);
+	key.ulen = key.size;
+	key.flags = DB_DBT_USERMEM;
+	
+	data.data = (void*)record;
+	data.size = size;
+	data.ulen = size;
+	data.flags = DB_DBT_USERMEM;
+	
+	if ((ret = priv->dbp->put (priv->dbp, priv->batch_txn, &key, &data, DB_APPEND)) != 0) {
+		g_warning ("bdb_list_store_append: %s", db_strerror (ret));
+		if (priv->batch_depth)
+			priv->batch_failed = TRUE;
+		return FALSE;
+	}
+	
+	cache_invalidate_row (priv, *recno);
+	
+	return TRUE;
+}
+
+void
+bdb_list_store_append (BdbListStore *self, GtkTreeIter *iter)
+{
+	g_return_if_fail (BDB_IS_LIST_STORE (self));
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	db_recno_t recno;
+	gboolean ok;
+	
+	if (priv->column_types) {
+		guint8 *record = g_malloc0 (priv->n_columns * BDB_RECORD_SLOT_SIZE);
+		ok = append_record (self, record, priv->n_columns * BDB_RECORD_SLOT_SIZE, &recno);
+		g_free (record);
+	}
+	else {
+		ok = append_record (self, "", 1, &recno);
+	}
+	
+	if (!ok)
+		return;
+	
+	iter_set (priv, iter, recno, -1);
+	
+	/* announced in one pass by bdb_list_store_end_batch() */
+	if (priv->batch_depth) {
+		priv->batch_count++;
+		return;
+	}
+	
+	priv->n_keys++;
+	if (priv->sort_db)
+		sort_index_update_row (priv, recno, TRUE);
+	
+	generation_publish (priv);
+	
+	GtkTreePath *path = gtk_tree_model_get_path (GTK_TREE_MODEL (self), iter);
+	gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, iter);
+	gtk_tree_path_free (path);
+}
+
+static gboolean
+put_record (BdbListStore *self,
+            db_recno_t    recno,
+            gconstpointer record,
+            gsize         size)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	
+	DBT key, data;
+	gint ret;
+	
+	CLEAR_DBT (key);
+	CLEAR_DBT (data);
+	
+	key.data = &recno;
+	key.size = sizeof (db_recno_t);
+	key.ulen = key.size;
+	key.flags = DB_DBT_USERMEM;
+	
+	data.data = (void*)record;
+	data.size = size;
+	data.ulen = size;
+	data.flags = DB_DBT_USERMEM;
+	
+	ret = priv->dbp->put (priv->dbp, priv->batch_txn, &key, &data, 0);
+	cache_invalidate_row (priv, recno);
+	
+	if (ret != 0) {
+		g_warning ("bdb_list_store_set_value: %s", db_strerror (ret));
+		if (priv->batch_depth)
+			priv->batch_failed = TRUE;
+		return FALSE;
+	}
+	
+	return TRUE;
+}
+
+void
+bdb_list_store_set_value (BdbListStore *self,
+                          GtkTreeIter *iter,
+                          gint column,
+                          GValue *value)
+{
+	bdb_list_store_set_valuesv (self, iter, &column, value, 1);
+}
+
+/**
+ * bdb_list_store_set_valuesv:
+ * @self: A #BdbListStore
+ * @iter: row to modify
+ * @columns: column numbers to change
+ * @values: new values, converted to the column types if needed
+ * @n_values: length of @columns and @values
+ *
+ * Sets several columns of a row with a single record write.
+ **/
+void
+bdb_list_store_set_valuesv (BdbListStore *self,
+                            GtkTreeIter  *iter,
+                            gint         *columns,
+                            GValue       *values,
+                            gint          n_values)
+{
+	g_return_if_fail (BDB_IS_LIST_STORE (self));
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	g_return_if_fail (priv->stamp == iter->stamp);
+	g_return_if_fail (priv->dbp != NULL);
+	
+	db_recno_t recno = GPOINTER_TO_INT (iter->user_data);
+	gboolean   resort = FALSE;
+	gint       old_position = -1;
+	gint       position;
+	gboolean   queued;
+	gboolean   ok;
+	gint       i;
+	
+	if (!priv->column_types) {
+		g_return_if_fail (n_values == 1 && columns[0] == 0);
+		g_return_if_fail (G_VALUE_HOLDS_STRING (&values[0]));
+	}
+	else {
+		for (i = 0; i < n_values; i++)
+			g_return_if_fail (columns[i] >= 0 && columns[i] < priv->n_columns);
+	}
+	
+	/* rows of a running batch get indexed when the batch ends */
+	if (priv->sort_db && recno <= (db_recno_t)priv->n_keys) {
+		for (i = 0; i < n_values; i++)
+			if (columns[i] == priv->sort_column_id)
+				resort = TRUE;
+	}
+	
+	/*
+	 * Rows that move are written straight away, after whatever is still
+	 * queued for them.  So is everything within a batch, which begins
+	 * with an empty queue.
+	 */
+	queued = priv->wb_thread && !priv->batch_depth && !resort;
+	
+	if (resort) {
+		write_behind_flush (self);
+		old_position = iter_get_position (priv, iter);
+		sort_index_update_row (priv, recno, FALSE);
+	}
+	
+	if (!priv->column_types) {
+		const gchar *str = g_value_get_string (&values[0]);
+		if (str == NULL)
+			str = "";
+		if (queued)
+			ok = write_behind_queue (self, recno, str, strlen (str) + 1);
+		else
+			ok = put_record (self, recno, str, strlen (str) + 1);
+	}
+	else {
+		GValue       *converted = g_new0 (GValue, n_values);
+		const guint8 *old = NULL;
+		gsize         old_size = 0;
+		guint8       *record;
+		gsize         size;
+		
+		for (i = 0; i < n_values; i++) {
+			g_value_init (&converted[i], priv->column_types[columns[i]]);
+			if (!g_value_transform (&values[i], &converted[i]))
+				g_warning ("bdb_list_store_set_valuesv: cannot convert %s to %s",
+				           g_type_name (G_VALUE_TYPE (&values[i])),
+				           g_type_name (priv->column_types[columns[i]]));
+		}
+		
+		if (n_values < priv->n_columns)
+			get_record (priv, recno, &old, &old_size);
+		
+		record = bdb_record_encode (priv->column_types, priv->n_columns,
+		                            old, old_size, columns, converted,
+		                            n_values, &size);
+		
+		if (queued)
+			ok = write_behind_queue (self, recno, record, size);
+		else
+			ok = put_record (self, recno, record, size);
+		g_free (record);
+		
+		for (i = 0; i < n_values; i++)
+			g_value_unset (&converted[i]);
+		g_free (converted);
+	}
+	
+	if (resort)
+		sort_index_update_row (priv, recno, TRUE);
+	
+	/* queued rows are announced by the next frame */
+	if (!ok || queued)
+		return;
+	
+	/* rows appended within the batch have not been announced yet */
+	if (priv->batch_depth && recno > priv->n_keys)
+		return;
+	
+	if (!priv->batch_depth)
+		generation_publish (priv);
+	
+	/*
+	 * A row that moved is announced as deleted and inserted rather than
+	 * with rows-reordered, which would cost an array over all rows.
+	 */
+	if (resort && (position = recno_to_position (priv, recno)) != old_position &&
+	    position >= 0 && old_position >= 0)
+	{
+		GtkTreePath *moved;
+		
+		sort_index_update_row (priv, recno, FALSE);
+		priv->n_keys--;
+		moved = gtk_tree_path_new_from_indices (old_position, -1);
+		gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), moved);
+		gtk_tree_path_free (moved);
+		
+		sort_index_update_row (priv, recno, TRUE);
+		priv->n_keys++;
+		iter_set (priv, iter, recno, position);
+		moved = gtk_tree_path_new_from_indices (position, -1);
+		gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), moved, iter);
+		gtk_tree_path_free (moved);
+		return;
+	}
+	
+	GtkTreePath *path = gtk_tree_model_get_path (GTK_TREE_MODEL (self), iter);
+	if (path == NULL)
+		return;
+	
+	gtk_tree_model_row_changed (GTK_TREE_MODEL (self), path, iter);
+	gtk_tree_path_free (path);
+}
+
+gboolean
+bdb_list_store_remove (BdbListStore *self, GtkTreeIter *iter)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	g_return_val_if_fail (priv->stamp == iter->stamp, FALSE);
+	g_return_val_if_fail (priv->dbp != NULL, FALSE);
+	g_return_val_if_fail (priv->batch_depth == 0, FALSE);
+	
+	DBT key;
+	DB_TXN *txn = NULL;
+	gint ret = 0;
+	gint flags = 0;
+	GtkTreePath *path;
+	
+	/* the queue is keyed by recnos that are about to shift */
+	write_behind_flush (self);
+	
+	CLEAR_DBT (key);
+	
+	db_recno_t recno = GPOINTER_TO_INT (iter->user_data);
+	key.data = &recno;
+	key.size = sizeof (db_recno_t);
+	key.ulen = key.size;
+	key.flags = DB_DBT_USERMEM;
+	
+	if ((path = get_path (GTK_TREE_MODEL (self), iter)) == NULL)
+		return FALSE;
+	
+	/* its key is built from the record, which is about to go */
+	if (priv->sort_db)
+		sort_index_update_row (priv, recno, FALSE);
+	
+	if ((ret = priv->dbp->del (priv->dbp, txn, &key, flags)) != 0) {
+		g_warning ("Could not remove row %u: %s", recno, db_strerror (ret));
+		if (priv->sort_db)
+			sort_index_update_row (priv, recno, TRUE);
+		gtk_tree_path_free (path);
+		return TRUE;
+	}
+	
+	priv->n_keys--;
+	cache_invalidate_from (priv, recno);
+	
+	/* renumbering moved every later row, their index keys hold the old recno */
+	if (priv->sort_db)
+		sort_index_shift (priv, recno, priv->n_keys);
+	
+	generation_publish (priv);
+	
+	gint     position = gtk_tree_path_get_indices (path)[0];
+	gboolean is_valid = FALSE;
+	
+	/* the iter moves on to the row taking the removed one's place */
+	if (position < priv->n_keys) {
+		iter_set (priv, iter, position_to_recno (priv, position), position);
+		is_valid = TRUE;
+	}
+	else {
+		iter->stamp = 0;
+		iter->user_data = NULL;
+	}
+	
+	gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+	gtk_tree_path_free (path);
+	
+	FREE_DBT (key);
+	
+	return is_valid;
+}
+
+void
+bdb_list_store_set_cache_size (BdbListStore *self,
+                               guint         n_pages,
+                               guint         page_size)
+{
+	g_return_if_fail (BDB_IS_LIST_STORE (self));
+	g_return_if_fail (page_size > 0);
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	
+	cache_clear (priv);
+	priv->max_pages = n_pages;
+	priv->page_size = page_size;
+}
+
+void
+bdb_list_store_get_cache_stats (BdbListStore *self,
+                                guint64      *hits,
+                                guint64      *misses)
+{
+	g_return_if_fail (BDB_IS_LIST_STORE (self));
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	
+	if (hits)
+		*hits = priv->cache_hits;
+	if (misses)
+		*misses = priv->cache_misses;
+}
+
+void
+bdb_list_store_reset_cache_stats (BdbListStore *self)
+{
+	g_return_if_fail (BDB_IS_LIST_STORE (self));
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	
+	priv->cache_hits = 0;
+	priv->cache_misses = 0;
+}
+
+/*
+ * With static strings, string values from gtk_tree_model_get_value() point
+ * straight into the page cache (or the scratch buffer when the cache is
+ * off) rather than holding a copy, so reading a row allocates nothing.
+ * Such a value is only good until the next call into the store, or with
+ * write-behind the next frame; copy it if it has to live longer.
+ * gtk_tree_model_get() always copies, and cell renderers copy what they
+ * are given, so a GtkTreeView is safe either way.
+ */
+void
+bdb_list_store_set_static_strings (BdbListStore *self,
+                                   gboolean      static_strings)
+{
+	g_return_if_fail (BDB_IS_LIST_STORE (self));
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	
+	static_strings = static_strings != FALSE;
+	if (priv->static_strings == static_strings)
+		return;
+	
+	priv->static_strings = static_strings;
+	g_object_notify (G_OBJECT (self), "static-strings");
+}
+
+typedef struct
+{
+	BdbListStore          *self;
+	BdbListStoreFetchFunc  func;
+	gpointer               user_data;
+} FetchRange;
+
+static gboolean
+fetch_range_func (db_recno_t    recno,
+                  const guint8 *data,
+                  gsize         size,
+                  gpointer      user_data)
+{
+	FetchRange *fetch = user_data;
+
+	return fetch->func (fetch->self, recno - 1, data, size, fetch->user_data);
+}
+
+/**
+ * bdb_list_store_fetch_range:
+ * @self: A #BdbListStore
+ * @first: index of the first row to fetch
+ * @n_rows: maximum number of rows to fetch
+ * @func: called for each row, return %FALSE to stop
+ * @user_data: data for @func
+ *
+ * Reads a contiguous range of rows using Berkeley DB bulk retrieval and
+ * hands each one to @func as a pointer into the bulk buffer, without
+ * copying.  The data is only valid for the duration of the callback and
+ * is not guaranteed to be nul-terminated.  Rows are read in the order
+ * they are stored, whatever the sort column; @first and the index passed
+ * to @func are storage indices, see bdb_list_store_get_iter_at_index().
+ *
+ * May be called from other threads if the database was opened with
+ * DB_THREAD.  Only the thread that began a batch reads through it.  With
+ * DB_MULTIVERSION each bulk read sees the last committed version without
+ * taking locks; use a #BdbListStoreReader for one version across calls.
+ *
+ * Returns: the number of rows handed to @func.
+ **/
+guint
+bdb_list_store_fetch_range (BdbListStore          *self,
+                            guint                  first,
+                            guint                  n_rows,
+                            BdbListStoreFetchFunc  func,
+                            gpointer               user_data)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), 0);
+	g_return_val_if_fail (func != NULL, 0);
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	g_return_val_if_fail (priv->dbp != NULL || priv->snapshot != NULL, 0);
+	
+	FetchRange    fetch = { self, func, user_data };
+	BdbBulkBuffer bulk  = { NULL, 0 };
+	DB_TXN       *txn   = NULL;
+	const guint8 *data;
+	gsize         size;
+	guint         n_read;
+	
+	if (n_rows == 0)
+		return 0;
+	
+	/* the mapping is read-only, any thread can walk it */
+	if (priv->snapshot) {
+		for (n_read = 0; n_read < n_rows; n_read++) {
+			if (!snapshot_get_row (priv, first + n_read + 1, &data, &size))
+				break;
+			if (!func (self, first + n_read, data, size, user_data))
+				return n_read + 1;
+		}
+		return n_read;
+	}
+	
+	if (priv->batch_txn && priv->batch_thread == g_thread_self ())
+		txn = priv->batch_txn;
+	
+	/* not priv->bulk, func may well call back into the store */
+	n_read = read_range (priv, txn, &bulk, first + 1, n_rows,
+	                     fetch_range_func, &fetch);
+	g_free (bulk.data);
+	
+	return n_read;
+}
+
+/**
+ * bdb_list_store_get_generation:
+ * @self: A #BdbListStore
+ * @n_rows: return location for the number of rows, or %NULL
+ *
+ * Returns the serial of the last write the store has committed, along
+ * with the number of rows as of that write, without locking.  Safe to
+ * call from any thread; the serial grows with every write, so a result
+ * computed by another thread can be checked for staleness against it.
+ *
+ * Returns: the current generation's serial.
+ **/
+guint
+bdb_list_store_get_generation (BdbListStore *self, gint *n_rows)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), 0);
+	
+	BdbGeneration gen;
+	
+	generation_get (LIST_STORE_PRIVATE (self), &gen);
+	
+	if (n_rows)
+		*n_rows = gen.n_rows;
+	
+	return gen.serial;
+}
+
+/* the highest recno is the row count, as of the reader's snapshot */
+static gint
+reader_count_rows (BdbListStorePrivate *priv, DB_TXN *txn)
+{
+	DBC        *dbc;
+	DBT         key, data;
+	db_recno_t  recno = 0;
+	gint        ret;
+	
+	if ((ret = priv->dbp->cursor (priv->dbp, txn, &dbc, 0)) != 0)
+		return -1;
+	
+	CLEAR_DBT (key);
+	CLEAR_DBT (data);
+	
+	key.data = &recno;
+	key.ulen = sizeof recno;
+	key.flags = DB_DBT_USERMEM;
+	data.flags = DB_DBT_USERMEM | DB_DBT_PARTIAL;
+	
+	ret = dbc->c_get (dbc, &key, &data, DB_LAST);
+	dbc->c_close (dbc);
+	
+	if (ret == DB_NOTFOUND)
+		return 0;
+	
+	return ret == 0 ? (gint)recno : -1;
+}
+
+/**
+ * bdb_list_store_reader_new:
+ * @self: A #BdbListStore
+ * @error: location for a #GError or %NULL
+ *
+ * Pins the current version of the rows for a reader on another thread,
+ * such as a background indexer.  The reader works within a DB_TXN_SNAPSHOT
+ * transaction: it takes no read locks and sees none of the writes that
+ * commit after it was created, while those writes go ahead without
+ * waiting for it.  The database must have been opened with
+ * DB_MULTIVERSION, as bdb_list_store_open() does in a transactional
+ * environment, or be a mapped snapshot.
+ *
+ * A reader belongs to the thread that created it.  Its generation tells
+ * whether anything changed since: when it still equals
+ * bdb_list_store_get_generation() on the main loop, the reader saw
+ * exactly what the views show, queued write-behind rows aside.
+ *
+ * Returns: a new reader, free with bdb_list_store_reader_free(), or
+ * %NULL on error.
+ **/
+BdbListStoreReader*
+bdb_list_store_reader_new (BdbListStore *self, GError **error)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), NULL);
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	g_return_val_if_fail (priv->dbp != NULL || priv->snapshot != NULL, NULL);
+	
+	BdbListStoreReader *reader;
+	BdbGeneration       gen;
+	DB_ENV             *env;
+	DB_TXN             *txn = NULL;
+	gint                n_rows;
+	gint                ret;
+	
+	/* before the transaction, so the serial is never newer than the rows */
+	generation_get (priv, &gen);
+	n_rows = gen.n_rows;
+	
+	if (!priv->snapshot) {
+		if (!(priv->cursor_flags & DB_TXN_SNAPSHOT)) {
+			if (error && *error == NULL)
+				*error = g_error_new (BDB_QUARK, 0,
+				                      "Readers need a database opened with DB_MULTIVERSION");
+			return NULL;
+		}
+		
+		env = priv->dbp->get_env (priv->dbp);
+		
+		if ((ret = env->txn_begin (env, NULL, &txn, DB_TXN_SNAPSHOT)) != 0) {
+			if (error && *error == NULL)
+				*error = g_error_new (BDB_QUARK, 0, "Cannot begin transaction: %s",
+				                      db_strerror (ret));
+			return NULL;
+		}
+		
+		if ((n_rows = reader_count_rows (priv, txn)) < 0) {
+			txn->abort (txn);
+			if (error && *error == NULL)
+				*error = g_error_new (BDB_QUARK, 0, "Cannot count rows");
+			return NULL;
+		}
+	}
+	
+	reader = g_slice_new0 (BdbListStoreReader);
+	reader->store = g_object_ref (self);
+	reader->txn = txn;
+	reader->serial = gen.serial;
+	reader->n_rows = n_rows;
+	
+	return reader;
+}
+
+/**
+ * bdb_list_store_reader_get_generation:
+ * @reader: A #BdbListStoreReader
+ *
+ * Returns: the serial of the generation @reader was created in, see
+ * bdb_list_store_get_generation().
+ **/
+guint
+bdb_list_store_reader_get_generation (BdbListStoreReader *reader)
+{
+	g_return_val_if_fail (reader != NULL, 0);
+	return reader->serial;
+}
+
+/**
+ * bdb_list_store_reader_get_n_rows:
+ * @reader: A #BdbListStoreReader
+ *
+ * Returns: the number of rows in the version @reader sees.
+ **/
+guint
+bdb_list_store_reader_get_n_rows (BdbListStoreReader *reader)
+{
+	g_return_val_if_fail (reader != NULL, 0);
+	return reader->n_rows;
+}
+
+/**
+ * bdb_list_store_reader_fetch_range:
+ * @reader: A #BdbListStoreReader
+ * @first: storage index of the first row to fetch
+ * @n_rows: maximum number of rows to fetch
+ * @func: called for each row, return %FALSE to stop
+ * @user_data: data for @func
+ *
+ * Like bdb_list_store_fetch_range(), but every call sees the same version
+ * of the rows, whatever was written in between.
+ *
+ * Returns: the number of rows handed to @func.
+ **/
+guint
+bdb_list_store_reader_fetch_range (BdbListStoreReader    *reader,
+                                   guint                  first,
+                                   guint                  n_rows,
+                                   BdbListStoreFetchFunc  func,
+                                   gpointer               user_data)
+{
+	g_return_val_if_fail (reader != NULL, 0);
+	g_return_val_if_fail (func != NULL, 0);
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (reader->store);
+	FetchRange           fetch = { reader->store, func, user_data };
+	
+	if (first >= reader->n_rows)
+		return 0;
+	
+	n_rows = MIN (n_rows, reader->n_rows - first);
+	
+	if (reader->txn == NULL)
+		return bdb_list_store_fetch_range (reader->store, first, n_rows, func, user_data);
+	
+	return read_range (priv, reader->txn, &reader->bulk, first + 1, n_rows,
+	                   fetch_range_func, &fetch);
+}
+
+/**
+ * bdb_list_store_reader_free:
+ * @reader: A #BdbListStoreReader
+ *
+ * Ends the reader's transaction, releasing the page versions kept for it.
+ **/
+void
+bdb_list_store_reader_free (BdbListStoreReader *reader)
+{
+	g_return_if_fail (reader != NULL);
+	
+	/* nothing was written, committing just ends the snapshot */
+	if (reader->txn)
+		reader->txn->commit (reader->txn, 0);
+	
+	g_free (reader->bulk.data);
+	g_object_unref (reader->store);
+	g_slice_free (BdbListStoreReader, reader);
+}
+
+/**
+ * bdb_list_store_record_get_data:
+ * @self: A #BdbListStore
+ * @record: a raw record, as handed out by bdb_list_store_fetch_range()
+ * @size: size of @record
+ * @column: a string or blob column
+ * @len: return location for the length of the data
+ *
+ * Locates the bytes of a string or blob column within a raw record
+ * without copying, for callers scanning with bdb_list_store_fetch_range().
+ * Strings are not guaranteed to be nul-terminated.  Safe to call from
+ * any thread.
+ *
+ * Returns: a pointer into @record, or %NULL for a NULL value.
+ **/
+const guint8*
+bdb_list_store_record_get_data (BdbListStore *self,
+                                const guint8 *record,
+                                gsize         size,
+                                gint          column,
+                                gsize        *len)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), NULL);
+	g_return_val_if_fail (len != NULL, NULL);
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	const guint8        *data;
+	guint32              slice_len;
+	
+	*len = 0;
+	
+	if (!priv->column_types) {
+		const guint8 *nul = memchr (record, 0, size);
+		g_return_val_if_fail (column == 0, NULL);
+		*len = nul ? nul - record : size;
+		return record;
+	}
+	
+	g_return_val_if_fail (column >= 0 && column < priv->n_columns, NULL);
+	g_return_val_if_fail (bdb_record_type_is_variable (priv->column_types[column]), NULL);
+	
+	if (!bdb_record_get_slice (record, size, column, &data, &slice_len))
+		return NULL;
+	
+	*len = slice_len;
+	
+	return data;
+}
+
+/**
+ * bdb_list_store_get_iter_at_index:
+ * @self: A #BdbListStore
+ * @iter: the iter to fill in
+ * @index: storage index of the row, its recno - 1
+ *
+ * Looks up a row by where it is stored rather than by its position in
+ * the (possibly sorted) model.
+ *
+ * Returns: %TRUE if @index exists.
+ **/
+gboolean
+bdb_list_store_get_iter_at_index (BdbListStore *self,
+                                  GtkTreeIter  *iter,
+                                  guint         index)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), FALSE);
+	g_return_val_if_fail (iter != NULL, FALSE);
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	
+	if (index >= (guint)priv->n_keys)
+		return FALSE;
+	
+	iter_set (priv, iter, index + 1, -1);
+	
+	return TRUE;
 }
 
-BdbListStore*
-bdb_list_store_new (void)
+/**
+ * bdb_list_store_iter_get_index:
+ * @self: A #BdbListStore
+ * @iter: a valid iter
+ *
+ * Returns: the storage index of the row @iter points to.
+ **/
+guint
+bdb_list_store_iter_get_index (BdbListStore *self, GtkTreeIter *iter)
 {
-	return g_object_new (BDB_TYPE_LIST_STORE, NULL);
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), 0);
+	g_return_val_if_fail (LIST_STORE_PRIVATE (self)->stamp == iter->stamp, 0);
+	
+	return GPOINTER_TO_INT (iter->user_data) - 1;
 }
 
-DB*
-bdb_list_store_get_db (BdbListStore *self)
+typedef struct
 {
-	g_return_val_if_fail (BDB_IS_LIST_STORE (self), NULL);
-	return LIST_STORE_PRIVATE (self)->dbp;
+	gint       position;
+	db_recno_t recno;
+} SortedRow;
+
+static gint
+sorted_row_compare (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	return ((const SortedRow*)a)->position - ((const SortedRow*)b)->position;
+}
+
+/*
+ * Announces the rows of a finished batch of a sorted store.  They are
+ * indexed first, then announced in order of their final positions so that
+ * every row-inserted lands where the row will stay.
+ */
+static void
+sort_announce_rows (BdbListStore *self)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	db_recno_t           first = priv->n_keys + 1;
+	guint                n_rows = priv->batch_count;
+	SortedRow           *rows;
+	GtkTreeIter          iter;
+	GtkTreePath         *path;
+	guint                i;
+	
+	priv->batch_count = 0;
+	sort_index_fill (priv, NULL, first, n_rows);
+	
+	rows = g_new (SortedRow, n_rows);
+	for (i = 0; i < n_rows; i++) {
+		rows[i].recno = first + i;
+		rows[i].position = recno_to_position (priv, first + i);
+	}
+	g_qsort_with_data (rows, n_rows, sizeof (SortedRow), sorted_row_compare, NULL);
+	
+	for (i = 0; i < n_rows; i++) {
+		gint position = rows[i].position;
+		
+		priv->n_keys++;
+		if (position < 0 || position >= priv->n_keys)
+			position = priv->n_keys - 1;
+		
+		iter_set (priv, &iter, rows[i].recno, position);
+		path = gtk_tree_path_new_from_indices (position, -1);
+		gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, &iter);
+		gtk_tree_path_free (path);
+	}
+	
+	g_free (rows);
 }
 
+/**
+ * bdb_list_store_begin_batch:
+ * @self: A #BdbListStore
+ * @error: location for a #GError or %NULL
+ *
+ * Starts a batch of edits.  Until the matching bdb_list_store_end_batch()
+ * all appends and sets go through a single transaction (if the database
+ * was opened with DB_AUTO_COMMIT in a transactional environment) and
+ * newly appended rows are not announced to views.  Batches nest; rows
+ * may not be removed while one is open.
+ **/
 gboolean
-bdb_list_store_set_db (BdbListStore *self, DB *db, GError **error)
+bdb_list_store_begin_batch (BdbListStore *self, GError **error)
 {
 	g_return_val_if_fail (BDB_IS_LIST_STORE (self), FALSE);
-	g_return_val_if_fail (db != NULL, FALSE);
 	
-	if (db->type != DB_RECNO) {
-		if (error && *error == NULL)
-			*error = g_error_new_literal (BDB_QUARK, 0, "DB must be of type DB_RECNO");
-		return FALSE;
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	g_return_val_if_fail (priv->dbp != NULL, FALSE);
+	
+	gint ret;
+	
+	if (priv->batch_depth > 0) {
+		priv->batch_depth++;
+		return TRUE;
 	}
 	
+	/* a batch writes synchronously, on top of the queue */
+	write_behind_flush (self);
+	
+	priv->batch_depth++;
+	priv->batch_count = 0;
+	priv->batch_failed = FALSE;
+	priv->batch_thread = g_thread_self ();
+	
+	if (db_is_transactional (priv->dbp)) {
+		DB_ENV *env = priv->dbp->get_env (priv->dbp);
+		
+		if ((ret = env->txn_begin (env, NULL, &priv->batch_txn, 0)) != 0) {
+			priv->batch_depth = 0;
+			if (error && *error == NULL)
+				*error = g_error_new (BDB_QUARK, 0, "Cannot begin transaction: %s",
+				                      db_strerror (ret));
+			return FALSE;
+		}
+	}
+	
+	return TRUE;
+}
+
+/**
+ * bdb_list_store_end_batch:
+ * @self: A #BdbListStore
+ * @error: location for a #GError or %NULL
+ *
+ * Ends a batch started with bdb_list_store_begin_batch().  When the
+ * outermost batch ends the transaction is committed and the appended
+ * rows are announced with row-inserted in a single pass.  If any write
+ * within the batch failed the transaction is aborted instead and %FALSE
+ * is returned.
+ **/
+gboolean
+bdb_list_store_end_batch (BdbListStore *self, GError **error)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), FALSE);
+	
 	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	g_return_val_if_fail (priv->batch_depth > 0, FALSE);
+	
+	GtkTreeIter  iter;
+	GtkTreePath *path;
+	gint         n_keys;
+	gint         ret = 0;
+	guint        i;
+	
+	if (--priv->batch_depth > 0)
+		return TRUE;
 	
-	if (priv->dbp != NULL) {
+	if (priv->batch_failed) {
 		if (error && *error == NULL)
-			*error = g_error_new (BDB_QUARK, 0, "Cannot set db twice");
-		return FALSE;
+			*error = g_error_new (BDB_QUARK, 0, "A write within the batch failed");
+		
+		if (priv->batch_txn) {
+			priv->batch_txn->abort (priv->batch_txn);
+			priv->batch_txn = NULL;
+			priv->batch_count = 0;
+			cache_clear (priv);
+			/* index entries of rows set within the batch were rolled back too */
+			if (priv->sort_db)
+				sort_index_build (priv, priv->n_keys);
+			return FALSE;
+		}
+		/* without a transaction the rows that made it are still there */
 	}
 	
-	guint flags = 0;
-	gint ret = 0;
+	if (priv->batch_txn) {
+		ret = priv->batch_txn->commit (priv->batch_txn, 0);
+		priv->batch_txn = NULL;
+		if (ret != 0) {
+			priv->batch_count = 0;
+			cache_clear (priv);
+			if (priv->sort_db)
+				sort_index_build (priv, priv->n_keys);
+			if (error && *error == NULL)
+				*error = g_error_new (BDB_QUARK, 0, "Cannot commit batch: %s",
+				                      db_strerror (ret));
+			return FALSE;
+		}
+	}
 	
-	if ((ret = db->get_flags (db, &flags)) != 0) {
-		if (error && *error == NULL)
-			*error = g_error_new (BDB_QUARK, 0, "Cannot retrieve db flags");
+	/* the rows count as there once committed, whenever they are announced */
+	n_keys = priv->n_keys;
+	priv->n_keys += priv->batch_count;
+	generation_publish (priv);
+	priv->n_keys = n_keys;
+	
+	if (priv->batch_count == 0)
+		return !priv->batch_failed;
+	
+	if (priv->sort_db) {
+		sort_announce_rows (self);
+		return !priv->batch_failed;
+	}
+	
+	iter.stamp = priv->stamp;
+	iter.user_data2 = NULL;
+	path = gtk_tree_path_new_from_indices (priv->n_keys, -1);
+	
+	for (i = 0; i < priv->batch_count; i++) {
+		priv->n_keys++;
+		iter.user_data = GINT_TO_POINTER (priv->n_keys);
+		gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, &iter);
+		gtk_tree_path_next (path);
+	}
+	
+	gtk_tree_path_free (path);
+	priv->batch_count = 0;
+	
+	return !priv->batch_failed;
+}
+
+/**
+ * bdb_list_store_append_many:
+ * @self: A #BdbListStore
+ * @strv: rows to append
+ * @n_rows: number of rows in @strv, or -1 if @strv is %NULL terminated
+ * @error: location for a #GError or %NULL
+ *
+ * Appends many rows within a single batch.
+ **/
+gboolean
+bdb_list_store_append_many (BdbListStore  *self,
+                            const gchar  **strv,
+                            gint           n_rows,
+                            GError       **error)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), FALSE);
+	g_return_val_if_fail (strv != NULL, FALSE);
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	g_return_val_if_fail (!priv->column_types ||
+	                      G_TYPE_FUNDAMENTAL (priv->column_types[0]) == G_TYPE_STRING,
+	                      FALSE);
+	
+	db_recno_t recno;
+	GValue     value = { 0, };
+	gint       column = 0;
+	gboolean   ok;
+	gint       i;
+	
+	if (!bdb_list_store_begin_batch (self, error))
 		return FALSE;
+	
+	g_value_init (&value, G_TYPE_STRING);
+	
+	for (i = 0; n_rows < 0 ? strv[i] != NULL : i < n_rows; i++) {
+		if (priv->column_types) {
+			guint8 *record;
+			gsize   size;
+			
+			g_value_set_static_string (&value, strv[i]);
+			record = bdb_record_encode (priv->column_types, priv->n_columns,
+			                            NULL, 0, &column, &value, 1, &size);
+			ok = append_record (self, record, size, &recno);
+			g_free (record);
+		}
+		else {
+			ok = append_record (self, strv[i], strlen (strv[i]) + 1, &recno);
+		}
+		
+		if (!ok)
+			break;
+		priv->batch_count++;
 	}
 	
-	if (!(flags & DB_RENUMBER)) {
+	g_value_unset (&value);
+	
+	return bdb_list_store_end_batch (self, error);
+}
+
+/**
+ * bdb_list_store_enable_prefetch:
+ * @self: A #BdbListStore
+ * @margin: number of rows to read ahead on either side of the visible range
+ * @error: location for a #GError or %NULL
+ *
+ * Moves page reads for views off the main loop.  A worker thread reads
+ * the pages around the range given to bdb_list_store_set_visible_range(),
+ * get_value returns empty placeholder values for rows that are not
+ * cached yet and row-changed is emitted for them once they arrive.  The
+ * database (and its environment) must be opened with DB_THREAD, and
+ * g_thread_init() must have been called.
+ **/
+gboolean
+bdb_list_store_enable_prefetch (BdbListStore  *self,
+                                guint          margin,
+                                GError       **error)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), FALSE);
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	g_return_val_if_fail (priv->dbp != NULL, FALSE);
+	
+	priv->prefetch_margin = margin;
+	
+	if (priv->prefetch_pool)
+		return TRUE;
+	
+	if (!db_is_threaded (priv->dbp)) {
 		if (error && *error == NULL)
-			*error = g_error_new (BDB_QUARK, 0, "Please alter DB with db->set_flags(DB_RENUMBER)");
+			*error = g_error_new (BDB_QUARK, 0, "Prefetching requires a DB opened with DB_THREAD");
 		return FALSE;
 	}
 	
-	priv->dbp = db;
+	/* a single thread keeps the reads sequential on disk */
+	priv->prefetch_pool = g_thread_pool_new (prefetch_worker, NULL, 1, FALSE, error);
 	
-	return TRUE;
+	return priv->prefetch_pool != NULL;
 }
 
 void
-bdb_list_store_append (BdbListStore *self, GtkTreeIter *iter)
+bdb_list_store_disable_prefetch (BdbListStore *self)
 {
 	g_return_if_fail (BDB_IS_LIST_STORE (self));
 	
 	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
 	
-	DBT key, data;
-	DB_TXN *txn = NULL;
-	db_recno_t recno;
-	gint ret;
+	if (!priv->prefetch_pool)
+		return;
 	
-	CLEAR_DBT (key);
-	CLEAR_DBT (data);
+	/* outstanding requests still complete on the main loop */
+	g_thread_pool_free (priv->prefetch_pool, FALSE, TRUE);
+	priv->prefetch_pool = NULL;
+}
+
+/* the pages of the rows at view positions first to last of a sorted store */
+static void
+prefetch_sorted (BdbListStore *self, gint first, gint last)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	db_recno_t           recno;
+	guint                index;
 	
-	recno = 0;
-	key.data = &recno;
-	key.size = sizeof (db_recno_t);
-	key.ulen = key.size;
-	key.flags = DB_DBT_USERMEM;
+	first = MAX (first, 0);
+	last = MIN (last, priv->n_keys - 1);
 	
-	data.data = "";
-	data.size = sizeof (char);
-	data.ulen = strlen ("") + 1;
-	data.flags = DB_DBT_USERMEM;
+	for (; first <= last; first++) {
+		recno = position_to_recno (priv, first);
+		index = (recno - 1) / priv->page_size;
+		
+		if (recno && !g_hash_table_lookup (priv->pages, GUINT_TO_POINTER (index)))
+			prefetch_queue (self, index, FALSE);
+	}
+}
+
+/**
+ * bdb_list_store_set_visible_range:
+ * @self: A #BdbListStore
+ * @first: index of the first visible row
+ * @last: index of the last visible row
+ *
+ * Tells the prefetcher which rows a view is showing, typically from
+ * gtk_tree_view_get_visible_range() whenever the view scrolls.  Pages in
+ * the range are queued first, then the read-ahead margin.  Queued pages
+ * that scrolled away before the worker reached them are skipped.
+ **/
+void
+bdb_list_store_set_visible_range (BdbListStore *self,
+                                  gint          first,
+                                  gint          last)
+{
+	g_return_if_fail (BDB_IS_LIST_STORE (self));
 	
-	if ((ret = priv->dbp->put (priv->dbp, txn, &key, &data, DB_APPEND)) != 0)
-		g_warning ("bdb_list_store_append: %s", db_strerror (ret));
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	gint                 margin = priv->prefetch_margin;
 	
-	priv->dirty = TRUE;
+	g_atomic_int_set (&priv->visible_first, first);
+	g_atomic_int_set (&priv->visible_last, last);
 	
-	iter->stamp = priv->stamp;
-	iter->user_data = GINT_TO_POINTER (get_n_keys (self));
+	/* dirty rows scrolling into view are owed their row-changed */
+	if (priv->wb_thread && g_hash_table_size (priv->wb_dirty) > 0) {
+		priv->wb_announce = TRUE;
+		write_behind_schedule (self);
+	}
 	
-	FREE_DBT (key);
-	FREE_DBT (data);
+	if (!priv->prefetch_pool || priv->max_pages == 0 || priv->batch_depth)
+		return;
 	
-	GtkTreePath *path = gtk_tree_model_get_path (GTK_TREE_MODEL (self), iter);
-	gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, iter);
-	gtk_tree_path_free (path);
+	/* sorted rows are scattered over the database, read just their pages */
+	if (priv->sort_db) {
+		prefetch_sorted (self, first, last);
+		prefetch_sorted (self, last + 1, last + margin);
+		prefetch_sorted (self, first - margin, first - 1);
+		return;
+	}
+	
+	prefetch_range (self, first, last);
+	prefetch_range (self, last + 1, MIN (last + margin, priv->n_keys - 1));
+	prefetch_range (self, MAX (first - margin, 0), first - 1);
+}
+
+/**
+ * bdb_list_store_enable_write_behind:
+ * @self: A #BdbListStore
+ * @fps: how many times per second views are told about changed rows
+ * @error: location for a #GError or %NULL
+ *
+ * Makes bdb_list_store_set_value() return as soon as the row is queued.
+ * Repeated sets of a row are merged, a writer thread commits the queue
+ * in grouped transactions and row-changed is emitted at most @fps times
+ * a second, once per changed row within the range given to
+ * bdb_list_store_set_visible_range().  Reads see queued values straight
+ * away.  The environment needs locking, as the writer and readers work on
+ * the same pages.  Removing rows, sorting, batches and resyncs wait for
+ * the queue first; bdb_list_store_fetch_range() does not.  The database
+ * (and its environment) must be opened with DB_THREAD, and
+ * g_thread_init() must have been called.
+ **/
+gboolean
+bdb_list_store_enable_write_behind (BdbListStore  *self,
+                                    guint          fps,
+                                    GError       **error)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), FALSE);
+	g_return_val_if_fail (fps > 0, FALSE);
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	g_return_val_if_fail (priv->dbp != NULL, FALSE);
+	g_return_val_if_fail (priv->batch_depth == 0, FALSE);
+	
+	DB_ENV   *env = priv->dbp->get_env (priv->dbp);
+	u_int32_t flags = 0;
+	
+	priv->wb_fps = fps;
+	
+	if (priv->wb_thread)
+		return TRUE;
+	
+	if (!db_is_threaded (priv->dbp)) {
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Write-behind requires a DB opened with DB_THREAD");
+		return FALSE;
+	}
+	
+	/* the writer and the main loop work on the same pages */
+	if (!env || env->get_open_flags (env, &flags) != 0 ||
+	    !(flags & (DB_INIT_LOCK | DB_INIT_CDB)))
+	{
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Write-behind requires an environment with locking");
+		return FALSE;
+	}
+	
+	priv->wb_lock = g_mutex_new ();
+	priv->wb_cond = g_cond_new ();
+	priv->wb_pending = write_table_new ();
+	priv->wb_dirty = g_hash_table_new (g_direct_hash, g_direct_equal);
+	priv->wb_quit = FALSE;
+	
+	if (!(priv->wb_thread = g_thread_create (write_behind_thread, priv, TRUE, error))) {
+		g_hash_table_destroy (priv->wb_pending);
+		g_hash_table_destroy (priv->wb_dirty);
+		g_mutex_free (priv->wb_lock);
+		g_cond_free (priv->wb_cond);
+		priv->wb_pending = NULL;
+		priv->wb_dirty = NULL;
+		priv->wb_lock = NULL;
+		priv->wb_cond = NULL;
+		return FALSE;
+	}
+	
+	return TRUE;
 }
 
+/* writes out and announces what is queued, then stops the writer */
 void
-bdb_list_store_set_value (BdbListStore *self,
-                          GtkTreeIter *iter,
-                          gint column,
-                          GValue *value)
+bdb_list_store_disable_write_behind (BdbListStore *self)
 {
 	g_return_if_fail (BDB_IS_LIST_STORE (self));
 	
 	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
-	g_return_if_fail (priv->stamp == iter->stamp);
-	g_return_if_fail (G_VALUE_HOLDS_STRING (value));
+	g_return_if_fail (priv->batch_depth == 0);
 	
-	DBT key, data;
-	DB_TXN *txn = NULL;
-	db_recno_t recno = GPOINTER_TO_INT (iter->user_data);
-	const gchar *str = g_value_get_string (value);
-	gint ret = 0;
+	if (!priv->wb_thread)
+		return;
 	
-	CLEAR_DBT (key);
-	CLEAR_DBT (value);
+	write_behind_flush (self);
+	write_behind_stop (priv);
+}
+
+/**
+ * bdb_list_store_flush:
+ * @self: A #BdbListStore
+ * @error: location for a #GError or %NULL
+ *
+ * Waits until every queued write has been committed and emits the
+ * row-changed signals still owed, visible or not.  Commits are not
+ * synchronous, see bdb_list_store_sync().  Returns %FALSE if a write
+ * failed since the last flush; such rows are back to their old values.
+ **/
+gboolean
+bdb_list_store_flush (BdbListStore *self, GError **error)
+{
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), FALSE);
 	
-	key.data = &recno;
-	key.size = sizeof (db_recno_t);
-	key.ulen = key.size;
-	key.flags = DB_DBT_USERMEM;
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	g_return_val_if_fail (priv->batch_depth == 0, FALSE);
 	
-	data.data = (void*)str;
-	data.size = strlen (str) + 1;
-	data.ulen = data.size;
-	data.flags = DB_DBT_USERMEM;
+	GError *wb_error;
 	
-	if ((ret = priv->dbp->put (priv->dbp, txn, &key, &data, 0)) != 0)
-		g_warning ("bdb_list_store_set_value: %s", db_strerror (ret));
-	else
-		priv->dirty = TRUE;
+	if (!priv->wb_thread)
+		return TRUE;
 	
-	FREE_DBT (key);
-	FREE_DBT (data);
+	write_behind_flush (self);
 	
-	GtkTreePath *path = gtk_tree_model_get_path (GTK_TREE_MODEL (self), iter);
-	gtk_tree_model_row_changed (GTK_TREE_MODEL (self), path, iter);
-	gtk_tree_path_free (path);
+	g_mutex_lock (priv->wb_lock);
+	wb_error = priv->wb_error;
+	priv->wb_error = NULL;
+	g_mutex_unlock (priv->wb_lock);
+	
+	if (wb_error) {
+		g_propagate_error (error, wb_error);
+		return FALSE;
+	}
+	
+	return TRUE;
 }
 
+/**
+ * bdb_list_store_sync:
+ * @self: A #BdbListStore
+ * @error: location for a #GError or %NULL
+ *
+ * Like bdb_list_store_flush(), and then makes sure what was written is on
+ * disk: the log is flushed in a transactional environment, otherwise the
+ * database itself is synced.
+ **/
 gboolean
-bdb_list_store_remove (BdbListStore *self, GtkTreeIter *iter)
+bdb_list_store_sync (BdbListStore *self, GError **error)
 {
+	g_return_val_if_fail (BDB_IS_LIST_STORE (self), FALSE);
+	
 	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
-	g_return_val_if_fail (priv->stamp == iter->stamp, FALSE);
 	g_return_val_if_fail (priv->dbp != NULL, FALSE);
 	
-	DBT key;
-	DB_TXN *txn = NULL;
-	gint ret = 0;
-	gint flags = 0;
-	GtkTreePath *path;
+	DB_ENV *env = priv->dbp->get_env (priv->dbp);
+	gint    ret;
 	
-	CLEAR_DBT (key);
+	if (!bdb_list_store_flush (self, error))
+		return FALSE;
 	
-	db_recno_t recno = GPOINTER_TO_INT (iter->user_data);
-	key.data = &recno;
-	key.size = sizeof (db_recno_t);
-	key.ulen = key.size;
-	key.flags = DB_DBT_USERMEM;
+	if (db_is_transactional (priv->dbp))
+		ret = env->log_flush (env, NULL);
+	else
+		ret = priv->dbp->sync (priv->dbp, 0);
 	
-	if ((ret = priv->dbp->del (priv->dbp, txn, &key, flags)) != 0)
-		g_warning ("Could not remove ");
+	if (ret != 0) {
+		if (error && *error == NULL)
+			*error = g_error_new (BDB_QUARK, 0, "Cannot sync database: %s",
+			                      db_strerror (ret));
+		return FALSE;
+	}
 	
-	priv->dirty = TRUE;
-	path = get_path (GTK_TREE_MODEL (self), iter);
+	return TRUE;
+}
+
+/*
+ * bdb_list_store_resync() for a sorted store.  Rows still come and go at
+ * the end of the recnos, but they sit anywhere in the view, and the
+ * survivors may have been rewritten into a new order.  The index is
+ * rebuilt before any signal so that views reading rows back see the new
+ * contents, and the old and new positions of every recno tell where the
+ * deleted rows were, how the rest moved and where the new rows go.
+ */
+static void
+resync_sorted (BdbListStore *self, gint n_keys)
+{
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	GtkTreeIter          iter;
+	GtkTreePath         *path;
+	gint                 n_old = priv->n_keys;
+	gint                 n_kept = MIN (n_old, n_keys);
+	gint                *old_positions, *new_positions;
+	gint                *by_old, *by_new, *kept_rank, *new_order;
+	gint                 i, rank;
 	
-	gboolean is_valid = FALSE;
+	old_positions = n_old > 0 ? sort_index_positions (priv) : NULL;
 	
-	if (get_n_keys (self) >= GPOINTER_TO_INT (iter->user_data)) {
-		is_valid = TRUE;
+	priv->n_keys = n_keys;
+	if (!sort_index_build (priv, n_keys)) {
+		g_free (old_positions);
+		priv->n_keys = n_old;
+		return;
 	}
-	else {
-		iter->stamp = 0;
-		iter->user_data = NULL;
+	new_positions = n_keys > 0 ? sort_index_positions (priv) : NULL;
+	
+	/* recno - 1 at each position, before and after */
+	by_old = g_new (gint, MAX (n_old, 1));
+	by_new = g_new (gint, MAX (n_keys, 1));
+	kept_rank = g_new (gint, MAX (n_kept, 1));
+	for (i = 0; i < n_old; i++)
+		by_old[old_positions[i]] = i;
+	for (i = 0; i < n_keys; i++)
+		by_new[new_positions[i]] = i;
+	
+	/* the last position first, so every earlier one still holds */
+	priv->n_keys = n_old;
+	for (i = n_old - 1; i >= 0; i--) {
+		if (by_old[i] < n_keys)
+			continue;
+		path = gtk_tree_path_new_from_indices (i, -1);
+		priv->n_keys--;
+		gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+		gtk_tree_path_free (path);
 	}
 	
-	gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
-	gtk_tree_path_free (path);
+	/* where each surviving row is now that the deleted ones went */
+	for (i = 0, rank = 0; i < n_old; i++)
+		if (by_old[i] < n_keys)
+			kept_rank[by_old[i]] = rank++;
 	
-	FREE_DBT (key);
+	if (n_kept > 1) {
+		new_order = g_new (gint, n_kept);
+		for (i = 0, rank = 0; i < n_keys; i++)
+			if (by_new[i] < n_kept)
+				new_order[rank++] = kept_rank[by_new[i]];
+		
+		for (i = 0; i < n_kept && new_order[i] == i; i++);
+		if (i < n_kept) {
+			path = gtk_tree_path_new ();
+			gtk_tree_model_rows_reordered (GTK_TREE_MODEL (self), path, NULL, new_order);
+			gtk_tree_path_free (path);
+		}
+		g_free (new_order);
+	}
 	
-	return is_valid;
+	/* in view order, so the rows before each are all there already */
+	for (i = 0; i < n_keys; i++) {
+		if (by_new[i] < n_old)
+			continue;
+		priv->n_keys++;
+		iter_set (priv, &iter, by_new[i] + 1, i);
+		path = gtk_tree_path_new_from_indices (i, -1);
+		gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, &iter);
+		gtk_tree_path_free (path);
+	}
+	
+	g_free (old_positions);
+	g_free (new_positions);
+	g_free (by_old);
+	g_free (by_new);
+	g_free (kept_rank);
+}
+
+/**
+ * bdb_list_store_resync:
+ * @self: A #BdbListStore
+ *
+ * The row count is maintained by the store's own mutators.  Call this
+ * after something else wrote to the database: it drops the row cache,
+ * re-reads the count, announces rows that appeared or vanished at the end
+ * and emits row-changed for the visible range.  A sorted store rebuilds
+ * its sort index first and announces those rows at their sorted
+ * positions, with a rows-reordered for the rows whose values moved them.
+ **/
+void
+bdb_list_store_resync (BdbListStore *self)
+{
+	g_return_if_fail (BDB_IS_LIST_STORE (self));
+	
+	BdbListStorePrivate *priv = LIST_STORE_PRIVATE (self);
+	g_return_if_fail (priv->dbp != NULL);
+	g_return_if_fail (priv->batch_depth == 0);
+	
+	GtkTreeIter  iter;
+	GtkTreePath *path;
+	gint         n_keys;
+	gint         first, last;
+	
+	write_behind_flush (self);
+	
+	if ((n_keys = count_keys (priv)) < 0)
+		return;
+	
+	cache_clear (priv);
+	
+	if (priv->sort_db)
+		resync_sorted (self, n_keys);
+	
+	while (priv->n_keys > n_keys) {
+		path = gtk_tree_path_new_from_indices (--priv->n_keys, -1);
+		gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+		gtk_tree_path_free (path);
+	}
+	
+	first = MAX (g_atomic_int_get (&priv->visible_first), 0);
+	last = MIN (g_atomic_int_get (&priv->visible_last), priv->n_keys - 1);
+	
+	if (first <= last) {
+		path = gtk_tree_path_new_from_indices (first, -1);
+		for (; first <= last; first++) {
+			iter_set (priv, &iter, position_to_recno (priv, first), first);
+			gtk_tree_model_row_changed (GTK_TREE_MODEL (self), path, &iter);
+			gtk_tree_path_next (path);
+		}
+		gtk_tree_path_free (path);
+	}
+	
+	if (priv->n_keys < n_keys) {
+		path = gtk_tree_path_new_from_indices (priv->n_keys, -1);
+		while (priv->n_keys < n_keys) {
+			priv->n_keys++;
+			iter_set (priv, &iter, position_to_recno (priv, priv->n_keys - 1), priv->n_keys - 1);
+			gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, &iter);
+			gtk_tree_path_next (path);
+		}
+		gtk_tree_path_free (path);
+	}
+	
+	generation_publish (priv);
 }
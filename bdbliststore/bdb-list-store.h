@@ -3,6 +3,7 @@
 
 #include <glib-object.h>
 #include <gtk/gtktreemodel.h>
+#include <gtk/gtktreesortable.h>
 #include <db.h>
 
 G_BEGIN_DECLS
@@ -35,6 +36,14 @@ G_BEGIN_DECLS
 typedef struct _BdbListStore      BdbListStore;
 typedef struct _BdbListStoreClass BdbListStoreClass;
 
+typedef gboolean (*BdbListStoreFetchFunc) (BdbListStore *store,
+                                           guint         index,
+                                           const guint8 *data,
+                                           gsize         size,
+                                           gpointer      user_data);
+
+typedef struct _BdbListStoreReader BdbListStoreReader;
+
 struct _BdbListStore
 {
 	GObject parent;
@@ -47,15 +56,107 @@ struct _BdbListStoreClass
 
 GType         bdb_list_store_get_type  (void);
 BdbListStore* bdb_list_store_new       (void);
+BdbListStore* bdb_list_store_newv      (gint          n_columns,
+                                        GType        *types);
+void          bdb_list_store_set_column_types (BdbListStore *self,
+                                               gint          n_columns,
+                                               GType        *types);
 
 void          bdb_list_store_append    (BdbListStore *self, GtkTreeIter *iter);
 gboolean      bdb_list_store_remove    (BdbListStore *self, GtkTreeIter *iter);
 gboolean      bdb_list_store_set_db    (BdbListStore *self, DB *db, GError **error);
+gboolean      bdb_list_store_open      (BdbListStore *self,
+                                        DB_ENV       *env,
+                                        const gchar  *file,
+                                        guint32       page_size,
+                                        GError      **error);
+DB_ENV*       bdb_list_store_create_env (const gchar *home,
+                                         guint64      cache_size,
+                                         guint32      flags,
+                                         GError     **error);
+gboolean      bdb_list_store_export_snapshot (BdbListStore *self,
+                                              const gchar  *filename,
+                                              GError      **error);
+gboolean      bdb_list_store_open_snapshot   (BdbListStore *self,
+                                              const gchar  *filename,
+                                              GError      **error);
+gboolean      bdb_list_store_is_snapshot     (BdbListStore *self);
 DB*           bdb_list_store_get_db    (BdbListStore *self);
+void          bdb_list_store_resync    (BdbListStore *self);
 void          bdb_list_store_set_value (BdbListStore *self,
                                         GtkTreeIter  *iter,
                                         gint          column,
                                         GValue       *value);
+void          bdb_list_store_set_valuesv (BdbListStore *self,
+                                          GtkTreeIter  *iter,
+                                          gint         *columns,
+                                          GValue       *values,
+                                          gint          n_values);
+
+void          bdb_list_store_set_cache_size    (BdbListStore *self,
+                                                guint         n_pages,
+                                                guint         page_size);
+void          bdb_list_store_get_cache_stats   (BdbListStore *self,
+                                                guint64      *hits,
+                                                guint64      *misses);
+void          bdb_list_store_reset_cache_stats (BdbListStore *self);
+void          bdb_list_store_set_static_strings (BdbListStore *self,
+                                                 gboolean      static_strings);
+
+gboolean      bdb_list_store_begin_batch       (BdbListStore  *self,
+                                                GError       **error);
+gboolean      bdb_list_store_end_batch         (BdbListStore  *self,
+                                                GError       **error);
+gboolean      bdb_list_store_append_many       (BdbListStore  *self,
+                                                const gchar  **strv,
+                                                gint           n_rows,
+                                                GError       **error);
+
+gboolean      bdb_list_store_enable_prefetch   (BdbListStore  *self,
+                                                guint          margin,
+                                                GError       **error);
+void          bdb_list_store_disable_prefetch  (BdbListStore  *self);
+void          bdb_list_store_set_visible_range (BdbListStore  *self,
+                                                gint           first,
+                                                gint           last);
+
+gboolean      bdb_list_store_enable_write_behind  (BdbListStore  *self,
+                                                   guint          fps,
+                                                   GError       **error);
+void          bdb_list_store_disable_write_behind (BdbListStore  *self);
+gboolean      bdb_list_store_flush                (BdbListStore  *self,
+                                                   GError       **error);
+gboolean      bdb_list_store_sync                 (BdbListStore  *self,
+                                                   GError       **error);
+
+guint         bdb_list_store_fetch_range       (BdbListStore          *self,
+                                                guint                  first,
+                                                guint                  n_rows,
+                                                BdbListStoreFetchFunc  func,
+                                                gpointer               user_data);
+const guint8* bdb_list_store_record_get_data   (BdbListStore          *self,
+                                                const guint8          *record,
+                                                gsize                  size,
+                                                gint                   column,
+                                                gsize                 *len);
+gboolean      bdb_list_store_get_iter_at_index (BdbListStore          *self,
+                                                GtkTreeIter           *iter,
+                                                guint                  index);
+guint         bdb_list_store_iter_get_index    (BdbListStore          *self,
+                                                GtkTreeIter           *iter);
+
+guint               bdb_list_store_get_generation        (BdbListStore          *self,
+                                                          gint                  *n_rows);
+BdbListStoreReader* bdb_list_store_reader_new            (BdbListStore          *self,
+                                                          GError               **error);
+guint               bdb_list_store_reader_get_generation (BdbListStoreReader    *reader);
+guint               bdb_list_store_reader_get_n_rows     (BdbListStoreReader    *reader);
+guint               bdb_list_store_reader_fetch_range    (BdbListStoreReader    *reader,
+                                                          guint                  first,
+                                                          guint                  n_rows,
+                                                          BdbListStoreFetchFunc  func,
+                                                          gpointer               user_data);
+void                bdb_list_store_reader_free           (BdbListStoreReader    *reader);
 
 G_END_DECLS
 
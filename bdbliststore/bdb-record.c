@@ -0,0 +1,251 @@
+#include "bdb-record.h"
+
+#include <string.h>
+
+gboolean
+bdb_record_type_is_supported (GType type)
+{
+	switch (G_TYPE_FUNDAMENTAL (type)) {
+	case G_TYPE_BOOLEAN:
+	case G_TYPE_INT:
+	case G_TYPE_UINT:
+	case G_TYPE_LONG:
+	case G_TYPE_ULONG:
+	case G_TYPE_INT64:
+	case G_TYPE_UINT64:
+	case G_TYPE_FLOAT:
+	case G_TYPE_DOUBLE:
+	case G_TYPE_STRING:
+		return TRUE;
+	default:
+		return type == G_TYPE_BYTE_ARRAY;
+	}
+}
+
+gboolean
+bdb_record_type_is_variable (GType type)
+{
+	return G_TYPE_FUNDAMENTAL (type) == G_TYPE_STRING || type == G_TYPE_BYTE_ARRAY;
+}
+
+static void
+slot_set_value (guint8 *slot, const GValue *value)
+{
+	gint64  i = 0;
+	gdouble d;
+	
+	switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value))) {
+	case G_TYPE_BOOLEAN:
+		i = g_value_get_boolean (value) ? 1 : 0;
+		break;
+	case G_TYPE_INT:
+		i = g_value_get_int (value);
+		break;
+	case G_TYPE_UINT:
+		i = g_value_get_uint (value);
+		break;
+	case G_TYPE_LONG:
+		i = g_value_get_long (value);
+		break;
+	case G_TYPE_ULONG:
+		i = g_value_get_ulong (value);
+		break;
+	case G_TYPE_INT64:
+		i = g_value_get_int64 (value);
+		break;
+	case G_TYPE_UINT64:
+		i = (gint64)g_value_get_uint64 (value);
+		break;
+	case G_TYPE_FLOAT:
+		d = g_value_get_float (value);
+		memcpy (slot, &d, sizeof d);
+		return;
+	case G_TYPE_DOUBLE:
+		d = g_value_get_double (value);
+		memcpy (slot, &d, sizeof d);
+		return;
+	default:
+		g_assert_not_reached ();
+	}
+	
+	memcpy (slot, &i, sizeof i);
+}
+
+static void
+slot_get_value (const guint8 *slot, GValue *value)
+{
+	gint64  i;
+	gdouble d;
+	
+	memcpy (&i, slot, sizeof i);
+	memcpy (&d, slot, sizeof d);
+	
+	switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value))) {
+	case G_TYPE_BOOLEAN:
+		g_value_set_boolean (value, i != 0);
+		break;
+	case G_TYPE_INT:
+		g_value_set_int (value, (gint)i);
+		break;
+	case G_TYPE_UINT:
+		g_value_set_uint (value, (guint)i);
+		break;
+	case G_TYPE_LONG:
+		g_value_set_long (value, (glong)i);
+		break;
+	case G_TYPE_ULONG:
+		g_value_set_ulong (value, (gulong)i);
+		break;
+	case G_TYPE_INT64:
+		g_value_set_int64 (value, i);
+		break;
+	case G_TYPE_UINT64:
+		g_value_set_uint64 (value, (guint64)i);
+		break;
+	case G_TYPE_FLOAT:
+		g_value_set_float (value, (gfloat)d);
+		break;
+	case G_TYPE_DOUBLE:
+		g_value_set_double (value, d);
+		break;
+	default:
+		g_assert_not_reached ();
+	}
+}
+
+/*
+ * Locates the heap bytes of a variable sized column.  Returns FALSE for a
+ * NULL value, a column missing from an older, shorter record, or a slot
+ * pointing outside of the record.
+ */
+gboolean
+bdb_record_get_slice (const guint8  *record,
+                      gsize          size,
+                      gint           column,
+                      const guint8 **data,
+                      guint32       *len)
+{
+	guint32 off;
+	
+	if ((column + 1) * BDB_RECORD_SLOT_SIZE > size)
+		return FALSE;
+	
+	memcpy (&off, record + column * BDB_RECORD_SLOT_SIZE, sizeof off);
+	memcpy (len, record + column * BDB_RECORD_SLOT_SIZE + sizeof off, sizeof *len);
+	
+	if (off == 0 || (gsize)off + *len > size)
+		return FALSE;
+	
+	*data = record + off;
+	
+	return TRUE;
+}
+
+/*
+ * With static_strings the value points into record instead of holding a
+ * copy, so it must not outlive it.
+ */
+void
+bdb_record_get_value (const GType  *types,
+                      const guint8 *record,
+                      gsize         size,
+                      gint          column,
+                      gboolean      static_strings,
+                      GValue       *value)
+{
+	GType         type = types[column];
+	const guint8 *data;
+	guint32       len;
+	
+	g_value_init (value, type);
+	
+	if (G_TYPE_FUNDAMENTAL (type) == G_TYPE_STRING) {
+		if (!bdb_record_get_slice (record, size, column, &data, &len))
+			;
+		else if (static_strings)
+			g_value_set_static_string (value, (const gchar*)data);
+		else
+			g_value_set_string (value, (const gchar*)data);
+	}
+	else if (type == G_TYPE_BYTE_ARRAY) {
+		if (bdb_record_get_slice (record, size, column, &data, &len)) {
+			GByteArray *bytes = g_byte_array_sized_new (len);
+			g_byte_array_append (bytes, data, len);
+			g_value_take_boxed (value, bytes);
+		}
+	}
+	else if ((column + 1) * BDB_RECORD_SLOT_SIZE <= size) {
+		slot_get_value (record + column * BDB_RECORD_SLOT_SIZE, value);
+	}
+}
+
+/*
+ * Builds a new packed record from old (which may be NULL) with the given
+ * columns replaced.  values must already hold the column types.
+ */
+guint8*
+bdb_record_encode (const GType  *types,
+                   gint          n_columns,
+                   const guint8 *old,
+                   gsize         old_size,
+                   const gint   *columns,
+                   const GValue *values,
+                   gint          n_values,
+                   gsize        *size)
+{
+	GByteArray *buf;
+	gint        column, i;
+	
+	buf = g_byte_array_sized_new (n_columns * BDB_RECORD_SLOT_SIZE + 64);
+	g_byte_array_set_size (buf, n_columns * BDB_RECORD_SLOT_SIZE);
+	memset (buf->data, 0, buf->len);
+	
+	for (column = 0; column < n_columns; column++) {
+		const GValue *value = NULL;
+		const guint8 *data = NULL;
+		guint32       len = 0;
+		guint32       off;
+		
+		for (i = 0; i < n_values; i++)
+			if (columns[i] == column)
+				value = &values[i];
+		
+		if (!bdb_record_type_is_variable (types[column])) {
+			if (value)
+				slot_set_value (buf->data + column * BDB_RECORD_SLOT_SIZE, value);
+			else if (old && (column + 1) * BDB_RECORD_SLOT_SIZE <= old_size)
+				memcpy (buf->data + column * BDB_RECORD_SLOT_SIZE,
+				        old + column * BDB_RECORD_SLOT_SIZE, BDB_RECORD_SLOT_SIZE);
+			continue;
+		}
+		
+		if (value && G_VALUE_HOLDS_STRING (value)) {
+			if ((data = (const guint8*)g_value_get_string (value)))
+				len = strlen ((const gchar*)data);
+		}
+		else if (value) {
+			GByteArray *bytes = g_value_get_boxed (value);
+			if (bytes) {
+				data = bytes->data ? bytes->data : (const guint8*)"";
+				len = bytes->len;
+			}
+		}
+		else if (old && !bdb_record_get_slice (old, old_size, column, &data, &len)) {
+			data = NULL;
+		}
+		
+		if (data == NULL)
+			continue;
+		
+		off = buf->len;
+		memcpy (buf->data + column * BDB_RECORD_SLOT_SIZE, &off, sizeof off);
+		memcpy (buf->data + column * BDB_RECORD_SLOT_SIZE + sizeof off, &len, sizeof len);
+		g_byte_array_append (buf, data, len);
+		/* keep strings nul-terminated in place, harmless for blobs */
+		g_byte_array_append (buf, (guint8*)"", 1);
+	}
+	
+	*size = buf->len;
+	
+	return g_byte_array_free (buf, FALSE);
+}
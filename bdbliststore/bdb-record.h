@@ -0,0 +1,44 @@
+#ifndef __BDB_RECORD_H__
+#define __BDB_RECORD_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Rows with column types set are packed as one fixed size slot per column
+ * followed by a heap.  Numeric columns live in their slot, so reading one
+ * is a memcpy from a known offset.  String and blob slots hold a guint32
+ * offset (from the start of the record) and a guint32 length of their
+ * bytes within the heap; strings are stored nul-terminated and an offset
+ * of 0 means NULL.  Everything is in host byte order.
+ *
+ * Shared by BdbListStore and BdbTreeStore, not installed.
+ */
+#define BDB_RECORD_SLOT_SIZE 8
+
+gboolean bdb_record_type_is_supported (GType          type);
+gboolean bdb_record_type_is_variable  (GType          type);
+gboolean bdb_record_get_slice         (const guint8  *record,
+                                       gsize          size,
+                                       gint           column,
+                                       const guint8 **data,
+                                       guint32       *len);
+void     bdb_record_get_value         (const GType   *types,
+                                       const guint8  *record,
+                                       gsize          size,
+                                       gint           column,
+                                       gboolean       static_strings,
+                                       GValue        *value);
+guint8*  bdb_record_encode            (const GType   *types,
+                                       gint           n_columns,
+                                       const guint8  *old,
+                                       gsize          old_size,
+                                       const gint    *columns,
+                                       const GValue  *values,
+                                       gint           n_values,
+                                       gsize         *size);
+
+G_END_DECLS
+
+#endif /* __BDB_RECORD_H__ */
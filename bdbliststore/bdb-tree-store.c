@@ -0,0 +1,898 @@
+#include "bdb-tree-store.h"
+#include "bdb-record.h"
+
+#include <glib.h>
+#include <string.h>
+
+#define CLEAR_DBT(dbt)   (memset(&(dbt), 0, sizeof(dbt)))
+
+static void tree_model_init (GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_EXTENDED (BdbTreeStore, bdb_tree_store, G_TYPE_OBJECT, 0,
+                        G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL, tree_model_init));
+
+#define TREE_STORE_PRIVATE(o)              \
+	(G_TYPE_INSTANCE_GET_PRIVATE ((o), \
+	BDB_TYPE_TREE_STORE,               \
+	BdbTreeStorePrivate))
+
+#define BDB_QUARK (g_quark_from_static_string("bdb-tree-store"))
+
+#define SCRATCH_BUFFER_SIZE  1024
+
+/*
+ * Every row is a node in the nodes btree, keyed by a node id that never
+ * changes.  Its data starts with the id of its parent (0 for toplevel
+ * rows) and its ordinal among its siblings, both big-endian, followed by
+ * a packed record as described in bdb-record.h.
+ *
+ * The children btree is a secondary index of nodes, kept up to date by
+ * Berkeley DB itself.  Its keys are just those first 8 bytes, so the
+ * children of a node sort together by ordinal.  Ordinals are kept dense:
+ * the nth child is the key (parent, n), and the number of children is
+ * one past the ordinal of the last key before (parent + 1, 0).  Both are
+ * a single btree descent, whatever the size of the tree.
+ *
+ * Nothing about the tree is kept in memory.  A GtkTreeView only asks for
+ * the children of rows it expands, so collapsed subtrees are never read.
+ */
+#define NODE_HEADER_SIZE     8
+
+typedef struct _BdbTreeStorePrivate BdbTreeStorePrivate;
+
+struct _BdbTreeStorePrivate
+{
+	gint      stamp;
+	gint      n_columns;
+	GType    *column_types;
+	DB       *nodes;          /* node id -> parent, ordinal, record */
+	DB       *children;       /* parent, ordinal -> node id */
+	gboolean  transactional;
+	guint32   next_id;
+	guint8   *scratch;        /* DB_DBT_USERMEM target of node_get() */
+	guint32   scratch_len;
+};
+
+static void
+child_key_set (guint8 *key, guint32 parent, guint32 ordinal)
+{
+	guint32 be;
+	
+	be = GUINT32_TO_BE (parent);
+	memcpy (key, &be, sizeof be);
+	be = GUINT32_TO_BE (ordinal);
+	memcpy (key + sizeof be, &be, sizeof be);
+}
+
+static void
+child_key_get (const guint8 *key, guint32 *parent, guint32 *ordinal)
+{
+	guint32 be;
+	
+	memcpy (&be, key, sizeof be);
+	*parent = GUINT32_FROM_BE (be);
+	memcpy (&be, key + sizeof be, sizeof be);
+	*ordinal = GUINT32_FROM_BE (be);
+}
+
+/* the secondary key is the head of the primary data, nothing to allocate */
+static int
+children_key_func (DB         *secondary,
+                   const DBT  *key,
+                   const DBT  *data,
+                   DBT        *result)
+{
+	if (data->size < NODE_HEADER_SIZE)
+		return DB_DONOTINDEX;
+	
+	memset (result, 0, sizeof *result);
+	result->data = data->data;
+	result->size = NODE_HEADER_SIZE;
+	
+	return 0;
+}
+
+static void
+iter_set (BdbTreeStorePrivate *priv,
+          GtkTreeIter         *iter,
+          guint32              id,
+          guint32              parent,
+          guint32              ordinal)
+{
+	iter->stamp = priv->stamp;
+	iter->user_data = GUINT_TO_POINTER (id);
+	iter->user_data2 = GUINT_TO_POINTER (parent);
+	iter->user_data3 = GUINT_TO_POINTER (ordinal);
+}
+
+#define ITER_ID(iter)      GPOINTER_TO_UINT ((iter)->user_data)
+#define ITER_PARENT(iter)  GPOINTER_TO_UINT ((iter)->user_data2)
+#define ITER_ORDINAL(iter) GPOINTER_TO_UINT ((iter)->user_data3)
+
+/*
+ * Reads a node into the scratch buffer.  record is only valid until the
+ * next read and may be NULL when only the header is wanted.
+ */
+static gboolean
+node_get (BdbTreeStorePrivate  *priv,
+          DB_TXN               *txn,
+          guint32               id,
+          guint32              *parent,
+          guint32              *ordinal,
+          const guint8        **record,
+          gsize                *size)
+{
+	DBT     key, data;
+	guint32 be = GUINT32_TO_BE (id);
+	gint    ret;
+	
+	if (priv->scratch == NULL) {
+		priv->scratch_len = SCRATCH_BUFFER_SIZE;
+		priv->scratch = g_malloc (priv->scratch_len);
+	}
+	
+	CLEAR_DBT (key);
+	CLEAR_DBT (data);
+	
+	key.data = &be;
+	key.size = sizeof be;
+	
+	for (;;) {
+		data.data = priv->scratch;
+		data.ulen = priv->scratch_len;
+		data.flags = DB_DBT_USERMEM;
+	
+		ret = priv->nodes->get (priv->nodes, txn, &key, &data, 0);
+		if (ret != DB_BUFFER_SMALL)
+			break;
+	
+		priv->scratch_len = (data.size + 1023) & ~1023;
+		priv->scratch = g_realloc (priv->scratch, priv->scratch_len);
+	}
+	
+	if (ret != 0 || data.size < NODE_HEADER_SIZE) {
+		if (ret != 0 && ret != DB_NOTFOUND)
+			g_warning ("node_get: %s", db_strerror (ret));
+		return FALSE;
+	}
+	
+	child_key_get (priv->scratch, parent, ordinal);
+	
+	if (record) {
+		*record = priv->scratch + NODE_HEADER_SIZE;
+		*size = data.size - NODE_HEADER_SIZE;
+	}
+	
+	return TRUE;
+}
+
+/* the children index follows along on its own */
+static gint
+node_put (BdbTreeStorePrivate *priv,
+          DB_TXN              *txn,
+          guint32              id,
+          guint32              parent,
+          guint32              ordinal,
+          const guint8        *record,
+          gsize                size,
+          guint32              flags)
+{
+	DBT     key, data;
+	guint32 be = GUINT32_TO_BE (id);
+	guint8 *buf;
+	gint    ret;
+	
+	buf = g_malloc (NODE_HEADER_SIZE + size);
+	child_key_set (buf, parent, ordinal);
+	memcpy (buf + NODE_HEADER_SIZE, record, size);
+	
+	CLEAR_DBT (key);
+	CLEAR_DBT (data);
+	
+	key.data = &be;
+	key.size = sizeof be;
+	data.data = buf;
+	data.size = NODE_HEADER_SIZE + size;
+	
+	ret = priv->nodes->put (priv->nodes, txn, &key, &data, flags);
+	g_free (buf);
+	
+	return ret;
+}
+
+/* id of the child of parent at ordinal, without reading its data */
+static gboolean
+child_lookup (BdbTreeStorePrivate *priv,
+              DB_TXN              *txn,
+              guint32              parent,
+              guint32              ordinal,
+              guint32             *id)
+{
+	DBT     key, pkey, data;
+	guint8  buf[NODE_HEADER_SIZE];
+	guint32 be;
+	gint    ret;
+	
+	child_key_set (buf, parent, ordinal);
+	
+	CLEAR_DBT (key);
+	CLEAR_DBT (pkey);
+	CLEAR_DBT (data);
+	
+	key.data = buf;
+	key.size = sizeof buf;
+	pkey.data = &be;
+	pkey.ulen = sizeof be;
+	pkey.flags = DB_DBT_USERMEM;
+	data.flags = DB_DBT_USERMEM | DB_DBT_PARTIAL;
+	
+	if ((ret = priv->children->pget (priv->children, txn, &key, &pkey, &data, 0)) != 0) {
+		if (ret != DB_NOTFOUND)
+			g_warning ("child_lookup: %s", db_strerror (ret));
+		return FALSE;
+	}
+	
+	*id = GUINT32_FROM_BE (be);
+	
+	return TRUE;
+}
+
+/* one past the ordinal of the last child, found from the first key after it */
+static guint32
+child_count (BdbTreeStorePrivate *priv, DB_TXN *txn, guint32 parent)
+{
+	DBC     *dbc;
+	DBT      key, data;
+	guint8   buf[NODE_HEADER_SIZE];
+	guint32  key_parent, ordinal;
+	gint     ret;
+	
+	if (priv->children->cursor (priv->children, txn, &dbc, 0) != 0)
+		return 0;
+	
+	child_key_set (buf, parent + 1, 0);
+	
+	CLEAR_DBT (key);
+	CLEAR_DBT (data);
+	
+	key.data = buf;
+	key.size = sizeof buf;
+	key.ulen = sizeof buf;
+	key.flags = DB_DBT_USERMEM;
+	data.flags = DB_DBT_USERMEM | DB_DBT_PARTIAL;
+	
+	ret = dbc->c_get (dbc, &key, &data, DB_SET_RANGE);
+	if (ret == 0)
+		ret = dbc->c_get (dbc, &key, &data, DB_PREV);
+	else if (ret == DB_NOTFOUND)
+		ret = dbc->c_get (dbc, &key, &data, DB_LAST);
+	
+	dbc->c_close (dbc);
+	
+	if (ret != 0 || key.size != NODE_HEADER_SIZE)
+		return 0;
+	
+	child_key_get (buf, &key_parent, &ordinal);
+	
+	return key_parent == parent ? ordinal + 1 : 0;
+}
+
+/* appends the ids of all children of parent to ids */
+static void
+child_collect (BdbTreeStorePrivate *priv, DB_TXN *txn, guint32 parent, GArray *ids)
+{
+	guint32 ordinal, id;
+	
+	for (ordinal = 0; child_lookup (priv, txn, parent, ordinal, &id); ordinal++)
+		g_array_append_val (ids, id);
+}
+
+static DB_TXN*
+txn_begin (BdbTreeStorePrivate *priv)
+{
+	DB_ENV *env = priv->nodes->get_env (priv->nodes);
+	DB_TXN *txn = NULL;
+	gint    ret;
+	
+	if (priv->transactional && (ret = env->txn_begin (env, NULL, &txn, 0)) != 0) {
+		g_warning ("txn_begin: %s", db_strerror (ret));
+		return NULL;
+	}
+	
+	return txn;
+}
+
+static gboolean
+txn_end (DB_TXN *txn, gint ret)
+{
+	if (txn == NULL)
+		return ret == 0;
+	
+	if (ret != 0) {
+		txn->abort (txn);
+		return FALSE;
+	}
+	
+	return txn->commit (txn, 0) == 0;
+}
+
+static void
+bdb_tree_store_finalize (GObject *object)
+{
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (object);
+	
+	/* the secondary goes first */
+	if (priv->children)
+		priv->children->close (priv->children, 0);
+	if (priv->nodes)
+		priv->nodes->close (priv->nodes, 0);
+	
+	g_free (priv->scratch);
+	g_free (priv->column_types);
+	
+	G_OBJECT_CLASS (bdb_tree_store_parent_class)->finalize (object);
+}
+
+static void
+bdb_tree_store_class_init (BdbTreeStoreClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	
+	g_type_class_add_private (klass, sizeof (BdbTreeStorePrivate));
+	
+	object_class->finalize = bdb_tree_store_finalize;
+}
+
+static void
+bdb_tree_store_init (BdbTreeStore *self)
+{
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (self);
+	
+	priv->stamp = g_random_int ();
+	priv->next_id = 1;
+}
+
+static GtkTreeModelFlags
+get_flags (GtkTreeModel *tree_model)
+{
+	return 0;
+}
+
+static gint
+get_n_columns (GtkTreeModel *tree_model)
+{
+	return TREE_STORE_PRIVATE (tree_model)->n_columns;
+}
+
+static GType
+get_column_type (GtkTreeModel *tree_model, gint index)
+{
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (tree_model);
+	
+	g_return_val_if_fail (index >= 0 && index < priv->n_columns, G_TYPE_INVALID);
+	return priv->column_types[index];
+}
+
+static gboolean
+get_iter (GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path)
+{
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (tree_model);
+	gint                *indices = gtk_tree_path_get_indices (path);
+	gint                 depth = gtk_tree_path_get_depth (path);
+	guint32              parent = 0;
+	guint32              id = 0;
+	gint                 i;
+	
+	if (!priv->nodes || depth == 0)
+		return FALSE;
+	
+	for (i = 0; i < depth; i++) {
+		if (i > 0)
+			parent = id;
+		if (indices[i] < 0 || !child_lookup (priv, NULL, parent, indices[i], &id))
+			return FALSE;
+	}
+	
+	iter_set (priv, iter, id, parent, indices[depth - 1]);
+	
+	return TRUE;
+}
+
+/* one lookup per level, the tree is only ever walked upwards */
+static GtkTreePath*
+get_path (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (tree_model);
+	g_return_val_if_fail (priv->stamp == iter->stamp, NULL);
+	
+	GtkTreePath *path = gtk_tree_path_new ();
+	guint32      parent = ITER_PARENT (iter);
+	guint32      ordinal = ITER_ORDINAL (iter);
+	
+	gtk_tree_path_prepend_index (path, ordinal);
+	
+	while (parent != 0) {
+		if (!node_get (priv, NULL, parent, &parent, &ordinal, NULL, NULL)) {
+			gtk_tree_path_free (path);
+			return NULL;
+		}
+		gtk_tree_path_prepend_index (path, ordinal);
+	}
+	
+	return path;
+}
+
+static void
+get_value (GtkTreeModel *tree_model,
+           GtkTreeIter  *iter,
+           gint          column,
+           GValue       *value)
+{
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (tree_model);
+	g_return_if_fail (priv->stamp == iter->stamp);
+	g_return_if_fail (column >= 0 && column < priv->n_columns);
+	
+	const guint8 *record;
+	gsize         size;
+	guint32       parent, ordinal;
+	
+	if (!node_get (priv, NULL, ITER_ID (iter), &parent, &ordinal, &record, &size)) {
+		g_warning ("get_value: no node %u", ITER_ID (iter));
+		g_value_init (value, priv->column_types[column]);
+		return;
+	}
+	
+	bdb_record_get_value (priv->column_types, record, size, column, FALSE, value);
+}
+
+static gboolean
+iter_next (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (tree_model);
+	g_return_val_if_fail (priv->stamp == iter->stamp, FALSE);
+	
+	guint32 parent = ITER_PARENT (iter);
+	guint32 ordinal = ITER_ORDINAL (iter) + 1;
+	guint32 id;
+	
+	if (!child_lookup (priv, NULL, parent, ordinal, &id)) {
+		iter->stamp = 0;
+		return FALSE;
+	}
+	
+	iter_set (priv, iter, id, parent, ordinal);
+	
+	return TRUE;
+}
+
+static gboolean
+iter_nth_child (GtkTreeModel *tree_model,
+                GtkTreeIter  *iter,
+                GtkTreeIter  *parent,
+                gint          n)
+{
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (tree_model);
+	guint32              parent_id = parent ? ITER_ID (parent) : 0;
+	guint32              id;
+	
+	if (parent)
+		g_return_val_if_fail (priv->stamp == parent->stamp, FALSE);
+	
+	if (!priv->nodes || n < 0 || !child_lookup (priv, NULL, parent_id, n, &id))
+		return FALSE;
+	
+	iter_set (priv, iter, id, parent_id, n);
+	
+	return TRUE;
+}
+
+static gboolean
+iter_children (GtkTreeModel *tree_model,
+               GtkTreeIter  *iter,
+               GtkTreeIter  *parent)
+{
+	return iter_nth_child (tree_model, iter, parent, 0);
+}
+
+static gboolean
+iter_has_child (GtkTreeModel *tree_model,
+                GtkTreeIter  *iter)
+{
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (tree_model);
+	g_return_val_if_fail (priv->stamp == iter->stamp, FALSE);
+	
+	guint32 id;
+	
+	/* ordinals are dense, a first child is enough */
+	return child_lookup (priv, NULL, ITER_ID (iter), 0, &id);
+}
+
+static gint
+iter_n_children (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (tree_model);
+	
+	if (iter)
+		g_return_val_if_fail (priv->stamp == iter->stamp, 0);
+	
+	if (!priv->nodes)
+		return 0;
+	
+	return child_count (priv, NULL, iter ? ITER_ID (iter) : 0);
+}
+
+static gboolean
+iter_parent (GtkTreeModel *tree_model,
+             GtkTreeIter  *iter,
+             GtkTreeIter  *child)
+{
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (tree_model);
+	g_return_val_if_fail (priv->stamp == child->stamp, FALSE);
+	
+	guint32 id = ITER_PARENT (child);
+	guint32 parent, ordinal;
+	
+	if (id == 0 || !node_get (priv, NULL, id, &parent, &ordinal, NULL, NULL))
+		return FALSE;
+	
+	iter_set (priv, iter, id, parent, ordinal);
+	
+	return TRUE;
+}
+
+static void
+tree_model_init (GtkTreeModelIface *iface)
+{
+	iface->get_flags       = get_flags;
+	iface->get_iter        = get_iter;
+	iface->get_n_columns   = get_n_columns;
+	iface->get_column_type = get_column_type;
+	iface->iter_next       = iter_next;
+	iface->iter_nth_child  = iter_nth_child;
+	iface->get_value       = get_value;
+	iface->iter_children   = iter_children;
+	iface->iter_has_child  = iter_has_child;
+	iface->iter_n_children = iter_n_children;
+	iface->iter_parent     = iter_parent;
+	iface->get_path        = get_path;
+}
+
+BdbTreeStore*
+bdb_tree_store_newv (gint n_columns, GType *types)
+{
+	g_return_val_if_fail (n_columns > 0, NULL);
+	
+	BdbTreeStore        *self;
+	BdbTreeStorePrivate *priv;
+	gint                 i;
+	
+	for (i = 0; i < n_columns; i++) {
+		if (!bdb_record_type_is_supported (types[i])) {
+			g_warning ("bdb_tree_store_newv: unsupported type %s",
+			           g_type_name (types[i]));
+			return NULL;
+		}
+	}
+	
+	self = g_object_new (BDB_TYPE_TREE_STORE, NULL);
+	priv = TREE_STORE_PRIVATE (self);
+	priv->n_columns = n_columns;
+	priv->column_types = g_memdup (types, n_columns * sizeof (GType));
+	
+	return self;
+}
+
+/**
+ * bdb_tree_store_open:
+ * @self: A #BdbTreeStore
+ * @env: the environment, see bdb_list_store_create_env()
+ * @file: database file within @env, or %NULL for an in-memory one
+ * @error: location for a #GError or %NULL
+ *
+ * Opens, or creates, the "nodes" and "children" databases within @file
+ * and associates them.  Writes are transactional when @env is.
+ **/
+gboolean
+bdb_tree_store_open (BdbTreeStore  *self,
+                     DB_ENV        *env,
+                     const gchar   *file,
+                     GError       **error)
+{
+	g_return_val_if_fail (BDB_IS_TREE_STORE (self), FALSE);
+	g_return_val_if_fail (env != NULL, FALSE);
+	
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (self);
+	g_return_val_if_fail (priv->nodes == NULL, FALSE);
+	
+	DB        *nodes = NULL;
+	DB        *children = NULL;
+	DBC       *dbc;
+	DBT        key, data;
+	guint32    be;
+	u_int32_t  env_flags = 0;
+	u_int32_t  flags = DB_CREATE;
+	gint       ret;
+	
+	if ((ret = env->get_open_flags (env, &env_flags)) != 0)
+		goto error;
+	
+	priv->transactional = (env_flags & DB_INIT_TXN) != 0;
+	if (priv->transactional)
+		flags |= DB_AUTO_COMMIT;
+	flags |= env_flags & DB_THREAD;
+	
+	if ((ret = db_create (&nodes, env, 0)) != 0 ||
+	    (ret = nodes->open (nodes, NULL, file, "nodes", DB_BTREE, flags, 0)) != 0)
+		goto error;
+	
+	if ((ret = db_create (&children, env, 0)) != 0 ||
+	    (ret = children->open (children, NULL, file, "children", DB_BTREE, flags, 0)) != 0)
+		goto error;
+	
+	/* DB_CREATE indexes an existing nodes database the first time */
+	if ((ret = nodes->associate (nodes, NULL, children, children_key_func, DB_CREATE)) != 0)
+		goto error;
+	
+	/* ids are big-endian, so the last key is the highest one */
+	if ((ret = nodes->cursor (nodes, NULL, &dbc, 0)) != 0)
+		goto error;
+	
+	CLEAR_DBT (key);
+	CLEAR_DBT (data);
+	key.data = &be;
+	key.ulen = sizeof be;
+	key.flags = DB_DBT_USERMEM;
+	data.flags = DB_DBT_USERMEM | DB_DBT_PARTIAL;
+	
+	if (dbc->c_get (dbc, &key, &data, DB_LAST) == 0)
+		priv->next_id = GUINT32_FROM_BE (be) + 1;
+	dbc->c_close (dbc);
+	
+	priv->nodes = nodes;
+	priv->children = children;
+	
+	return TRUE;
+	
+error:
+	if (error && *error == NULL)
+		*error = g_error_new (BDB_QUARK, 0, "Cannot open %s: %s",
+		                      file ? file : "tree", db_strerror (ret));
+	if (children)
+		children->close (children, 0);
+	if (nodes)
+		nodes->close (nodes, 0);
+	
+	return FALSE;
+}
+
+/**
+ * bdb_tree_store_append:
+ * @self: A #BdbTreeStore
+ * @iter: set to the new row
+ * @parent: row to append to, or %NULL for a toplevel row
+ *
+ * Appends an empty row as the last child of @parent.
+ **/
+void
+bdb_tree_store_append (BdbTreeStore *self,
+                       GtkTreeIter  *iter,
+                       GtkTreeIter  *parent)
+{
+	g_return_if_fail (BDB_IS_TREE_STORE (self));
+	g_return_if_fail (iter != NULL);
+	
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (self);
+	g_return_if_fail (priv->nodes != NULL);
+	if (parent)
+		g_return_if_fail (priv->stamp == parent->stamp);
+	
+	guint32      parent_id = parent ? ITER_ID (parent) : 0;
+	guint32      id = priv->next_id;
+	guint32      ordinal;
+	guint8      *record;
+	gsize        size = priv->n_columns * BDB_RECORD_SLOT_SIZE;
+	DB_TXN      *txn;
+	GtkTreePath *path;
+	gint         ret;
+	
+	iter->stamp = 0;
+	
+	txn = txn_begin (priv);
+	ordinal = child_count (priv, txn, parent_id);
+	
+	record = g_malloc0 (size);
+	ret = node_put (priv, txn, id, parent_id, ordinal, record, size, DB_NOOVERWRITE);
+	g_free (record);
+	
+	if (!txn_end (txn, ret)) {
+		g_warning ("bdb_tree_store_append: %s", db_strerror (ret));
+		return;
+	}
+	
+	priv->next_id++;
+	
+	iter_set (priv, iter, id, parent_id, ordinal);
+	path = get_path (GTK_TREE_MODEL (self), iter);
+	gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, iter);
+	
+	if (parent && ordinal == 0) {
+		gtk_tree_path_up (path);
+		gtk_tree_model_row_has_child_toggled (GTK_TREE_MODEL (self), path, parent);
+	}
+	
+	gtk_tree_path_free (path);
+}
+
+void
+bdb_tree_store_set_value (BdbTreeStore *self,
+                          GtkTreeIter  *iter,
+                          gint          column,
+                          GValue       *value)
+{
+	bdb_tree_store_set_valuesv (self, iter, &column, value, 1);
+}
+
+/**
+ * bdb_tree_store_set_valuesv:
+ * @self: A #BdbTreeStore
+ * @iter: row to modify
+ * @columns: column numbers to change
+ * @values: new values, converted to the column types if needed
+ * @n_values: length of @columns and @values
+ *
+ * Sets several columns of a row with a single record write.
+ **/
+void
+bdb_tree_store_set_valuesv (BdbTreeStore *self,
+                            GtkTreeIter  *iter,
+                            gint         *columns,
+                            GValue       *values,
+                            gint          n_values)
+{
+	g_return_if_fail (BDB_IS_TREE_STORE (self));
+	
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (self);
+	g_return_if_fail (priv->stamp == iter->stamp);
+	g_return_if_fail (priv->nodes != NULL);
+	
+	GValue       *converted;
+	const guint8 *old;
+	gsize         old_size;
+	guint32       parent, ordinal;
+	guint8       *record;
+	gsize         size;
+	GtkTreePath  *path;
+	gint          ret;
+	gint          i;
+	
+	for (i = 0; i < n_values; i++)
+		g_return_if_fail (columns[i] >= 0 && columns[i] < priv->n_columns);
+	
+	if (!node_get (priv, NULL, ITER_ID (iter), &parent, &ordinal, &old, &old_size))
+		return;
+	
+	converted = g_new0 (GValue, n_values);
+	for (i = 0; i < n_values; i++) {
+		g_value_init (&converted[i], priv->column_types[columns[i]]);
+		if (!g_value_transform (&values[i], &converted[i]))
+			g_warning ("bdb_tree_store_set_valuesv: cannot convert %s to %s",
+			           g_type_name (G_VALUE_TYPE (&values[i])),
+			           g_type_name (priv->column_types[columns[i]]));
+	}
+	
+	record = bdb_record_encode (priv->column_types, priv->n_columns,
+	                            old, old_size, columns, converted,
+	                            n_values, &size);
+	ret = node_put (priv, NULL, ITER_ID (iter), parent, ordinal, record, size, 0);
+	g_free (record);
+	
+	for (i = 0; i < n_values; i++)
+		g_value_unset (&converted[i]);
+	g_free (converted);
+	
+	if (ret != 0) {
+		g_warning ("bdb_tree_store_set_valuesv: %s", db_strerror (ret));
+		return;
+	}
+	
+	if ((path = get_path (GTK_TREE_MODEL (self), iter))) {
+		gtk_tree_model_row_changed (GTK_TREE_MODEL (self), path, iter);
+		gtk_tree_path_free (path);
+	}
+}
+
+/**
+ * bdb_tree_store_remove:
+ * @self: A #BdbTreeStore
+ * @iter: row to remove
+ *
+ * Removes a row and everything below it.  The following siblings move up
+ * one ordinal each, so this costs a write per later sibling.  Returns
+ * %TRUE and points @iter at the next sibling if there is one.
+ **/
+gboolean
+bdb_tree_store_remove (BdbTreeStore *self, GtkTreeIter *iter)
+{
+	g_return_val_if_fail (BDB_IS_TREE_STORE (self), FALSE);
+	
+	BdbTreeStorePrivate *priv = TREE_STORE_PRIVATE (self);
+	g_return_val_if_fail (priv->stamp == iter->stamp, FALSE);
+	g_return_val_if_fail (priv->nodes != NULL, FALSE);
+	
+	guint32       parent = ITER_PARENT (iter);
+	guint32       ordinal = ITER_ORDINAL (iter);
+	guint32       id, sibling;
+	const guint8 *record;
+	gsize         size;
+	guint32       p, o, n;
+	GArray       *ids;
+	DB_TXN       *txn;
+	DBT           key;
+	GtkTreeIter   parent_iter;
+	GtkTreePath  *path;
+	guint         i;
+	gint          ret = 0;
+	
+	if (!(path = get_path (GTK_TREE_MODEL (self), iter)))
+		return FALSE;
+	
+	txn = txn_begin (priv);
+	
+	/* the subtree, breadth first; deleting a node drops its index entry */
+	ids = g_array_new (FALSE, FALSE, sizeof (guint32));
+	id = ITER_ID (iter);
+	g_array_append_val (ids, id);
+	
+	for (i = 0; ret == 0 && i < ids->len; i++) {
+		guint32 be;
+	
+		id = g_array_index (ids, guint32, i);
+		child_collect (priv, txn, id, ids);
+	
+		be = GUINT32_TO_BE (id);
+		CLEAR_DBT (key);
+		key.data = &be;
+		key.size = sizeof be;
+		ret = priv->nodes->del (priv->nodes, txn, &key, 0);
+	}
+	
+	g_array_free (ids, TRUE);
+	
+	/* close the gap so ordinals stay dense */
+	for (o = ordinal + 1; ret == 0 && child_lookup (priv, txn, parent, o, &sibling); o++) {
+		if (!node_get (priv, txn, sibling, &p, &n, &record, &size)) {
+			ret = DB_NOTFOUND;
+			break;
+		}
+		ret = node_put (priv, txn, sibling, parent, o - 1, record, size, 0);
+	}
+	
+	if (!txn_end (txn, ret)) {
+		g_warning ("bdb_tree_store_remove: %s", db_strerror (ret));
+		gtk_tree_path_free (path);
+		return FALSE;
+	}
+	
+	/* ordinals cached in outstanding iters are off now */
+	priv->stamp++;
+	
+	gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+	
+	if (parent != 0 && ordinal == 0 && !child_lookup (priv, NULL, parent, 0, &id) &&
+	    node_get (priv, NULL, parent, &p, &o, NULL, NULL))
+	{
+		iter_set (priv, &parent_iter, parent, p, o);
+		gtk_tree_path_up (path);
+		gtk_tree_model_row_has_child_toggled (GTK_TREE_MODEL (self), path, &parent_iter);
+	}
+	
+	gtk_tree_path_free (path);
+	
+	if (child_lookup (priv, NULL, parent, ordinal, &sibling)) {
+		iter_set (priv, iter, sibling, parent, ordinal);
+		return TRUE;
+	}
+	
+	iter->stamp = 0;
+	return FALSE;
+}
@@ -0,0 +1,72 @@
+#ifndef __BDB_TREE_STORE_H__
+#define __BDB_TREE_STORE_H__
+
+#include <glib-object.h>
+#include <gtk/gtktreemodel.h>
+#include <db.h>
+
+G_BEGIN_DECLS
+
+#define BDB_TYPE_TREE_STORE bdb_tree_store_get_type()
+
+#define BDB_TREE_STORE(obj) ( \
+	G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+	BDB_TYPE_TREE_STORE, \
+	BdbTreeStore))
+
+#define BDB_TREE_STORE_CLASS(klass) ( \
+	G_TYPE_CHECK_CLASS_CAST ((klass), \
+	BDB_TYPE_TREE_STORE, \
+	BdbTreeStoreClass))
+
+#define BDB_IS_TREE_STORE(obj) ( \
+	G_TYPE_CHECK_INSTANCE_TYPE ((obj), \
+	BDB_TYPE_TREE_STORE))
+
+#define BDB_IS_TREE_STORE_CLASS(klass) ( \
+	G_TYPE_CHECK_CLASS_TYPE ((klass), \
+	BDB_TYPE_TREE_STORE))
+
+#define BDB_TREE_STORE_GET_CLASS(obj) ( \
+	G_TYPE_INSTANCE_GET_CLASS ((obj), \
+	BDB_TYPE_TREE_STORE, \
+	BdbTreeStoreClass))
+
+typedef struct _BdbTreeStore      BdbTreeStore;
+typedef struct _BdbTreeStoreClass BdbTreeStoreClass;
+
+struct _BdbTreeStore
+{
+	GObject parent;
+};
+
+struct _BdbTreeStoreClass
+{
+	GObjectClass parent_class;
+};
+
+GType         bdb_tree_store_get_type     (void);
+BdbTreeStore* bdb_tree_store_newv         (gint          n_columns,
+                                           GType        *types);
+gboolean      bdb_tree_store_open         (BdbTreeStore *self,
+                                           DB_ENV       *env,
+                                           const gchar  *file,
+                                           GError      **error);
+void          bdb_tree_store_append       (BdbTreeStore *self,
+                                           GtkTreeIter  *iter,
+                                           GtkTreeIter  *parent);
+gboolean      bdb_tree_store_remove       (BdbTreeStore *self,
+                                           GtkTreeIter  *iter);
+void          bdb_tree_store_set_value    (BdbTreeStore *self,
+                                           GtkTreeIter  *iter,
+                                           gint          column,
+                                           GValue       *value);
+void          bdb_tree_store_set_valuesv  (BdbTreeStore *self,
+                                           GtkTreeIter  *iter,
+                                           gint         *columns,
+                                           GValue       *values,
+                                           gint          n_values);
+
+G_END_DECLS
+
+#endif /* __BDB_TREE_STORE_H__ */
@@ -0,0 +1,278 @@
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+#include <db.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "bdb-list-store.h"
+
+/*
+ * Headless benchmark for BdbListStore.  Loads a DB_RECNO database and
+ * then walks it the way a GtkTreeView does while scrolling, counting the
+ * DB->stat calls the store makes and the allocations made through GLib or
+ * handed back by Berkeley DB along the way.
+ *
+ *   ./bdbliststore-bench [n_rows] [window]
+ */
+
+static int  (*real_stat) (DB *, DB_TXN *, void *, u_int32_t);
+static guint n_stat_calls = 0;
+static guint n_allocs = 0;
+static guint n_changed = 0;
+
+static gpointer
+counting_malloc (gsize n_bytes)
+{
+	n_allocs++;
+	return malloc (n_bytes);
+}
+
+static gpointer
+counting_realloc (gpointer mem, gsize n_bytes)
+{
+	n_allocs++;
+	return realloc (mem, n_bytes);
+}
+
+static GMemVTable counting_vtable = {
+	counting_malloc,
+	counting_realloc,
+	free,
+	NULL,
+	NULL,
+	NULL
+};
+
+static void*
+counting_db_malloc (size_t n_bytes)
+{
+	n_allocs++;
+	return malloc (n_bytes);
+}
+
+static void*
+counting_db_realloc (void *mem, size_t n_bytes)
+{
+	n_allocs++;
+	return realloc (mem, n_bytes);
+}
+
+static int
+counting_stat (DB *db, DB_TXN *txn, void *sp, u_int32_t flags)
+{
+	n_stat_calls++;
+	return real_stat (db, txn, sp, flags);
+}
+
+static DB*
+open_db (const gchar *home)
+{
+	DB_ENV *db_env = NULL;
+	DB     *dbp = NULL;
+	int     ret;
+
+	if ((ret = db_env_create (&db_env, 0)) != 0)
+		g_error ("db_env_create: %s", db_strerror (ret));
+
+	/* covers DB_DBT_MALLOC results and stat buffers */
+	db_env->set_alloc (db_env, counting_db_malloc, counting_db_realloc, free);
+
+	/* locking and DB_THREAD for the write-behind thread */
+	if ((ret = db_env->open (db_env, home, DB_CREATE | DB_INIT_LOCK | DB_INIT_MPOOL |
+	                         DB_PRIVATE | DB_THREAD, 0)) != 0)
+		g_error ("db_env_open: %s", db_strerror (ret));
+
+	if ((ret = db_create (&dbp, db_env, 0)) != 0)
+		g_error ("db_create: %s", db_strerror (ret));
+
+	dbp->set_flags (dbp, DB_RENUMBER);
+
+	if ((ret = dbp->open (dbp, NULL, NULL, NULL, DB_RECNO, DB_CREATE | DB_THREAD, 0)) != 0)
+		g_error ("db_open: %s", db_strerror (ret));
+
+	real_stat = dbp->stat;
+	dbp->stat = counting_stat;
+
+	return dbp;
+}
+
+static void
+report (const gchar *name, GTimer *timer, guint n_ops)
+{
+	gdouble elapsed = g_timer_elapsed (timer, NULL);
+
+	g_print ("%-24s %10u ops %10.1f ns/op %6u stat calls %8.3f allocs/op %8u row-changed\n",
+	         name, n_ops, elapsed * 1e9 / MAX (n_ops, 1), n_stat_calls,
+	         (gdouble)n_allocs / MAX (n_ops, 1), n_changed);
+}
+
+static void
+row_changed_cb (GtkTreeModel *model,
+                GtkTreePath  *path,
+                GtkTreeIter  *iter,
+                gpointer      user_data)
+{
+	n_changed++;
+}
+
+static void
+reset_counters (GTimer *timer)
+{
+	n_stat_calls = 0;
+	n_allocs = 0;
+	n_changed = 0;
+	g_timer_start (timer);
+}
+
+/* scroll top to bottom one window at a time, like an expose per step */
+static guint
+scroll (GtkTreeModel *model, gint n_rows, gint window)
+{
+	GtkTreeIter iter;
+	GValue      value = { 0, };
+	guint       n_ops = 0;
+	gint        i, j;
+
+	for (i = 0; i + window <= n_rows; i += window) {
+		if (!gtk_tree_model_iter_nth_child (model, &iter, NULL, i))
+			break;
+		for (j = 0; j < window; j++) {
+			gtk_tree_model_get_value (model, &iter, 0, &value);
+			g_value_unset (&value);
+			gtk_tree_model_iter_next (model, &iter);
+			n_ops++;
+		}
+	}
+
+	return n_ops;
+}
+
+gint
+main (int argc, char *argv[])
+{
+	GtkTreeModel *model;
+	BdbListStore *store;
+	BdbListStore *mapped;
+	gchar        *snapshot;
+	GtkTreeIter   iter;
+	GValue        value = { 0, };
+	GTimer       *timer;
+	GError       *error = NULL;
+	DB_ENV       *db_env;
+	DB           *dbp;
+	gchar       **rows;
+	gint          n_rows = argc > 1 ? atoi (argv[1]) : 100000;
+	gint          window = argc > 2 ? atoi (argv[2]) : 50;
+	gint          i, j;
+	guint         n_ops;
+
+	/* must come before anything allocates */
+	g_mem_set_vtable (&counting_vtable);
+	g_thread_init (NULL);
+	g_type_init ();
+
+	dbp = open_db (g_get_tmp_dir ());
+	store = bdb_list_store_new ();
+	model = GTK_TREE_MODEL (store);
+	g_signal_connect (model, "row-changed", G_CALLBACK (row_changed_cb), NULL);
+
+	if (!bdb_list_store_set_db (store, dbp, &error))
+		g_error ("%s", error->message);
+
+	timer = g_timer_new ();
+
+	rows = g_new0 (gchar*, n_rows + 1);
+	for (i = 0; i < n_rows; i++)
+		rows[i] = g_strdup_printf ("This is row %d", i + 1);
+
+	reset_counters (timer);
+	bdb_list_store_append_many (store, (const gchar**)rows, n_rows, NULL);
+	report ("append_many", timer, n_rows);
+	g_strfreev (rows);
+
+	reset_counters (timer);
+	n_ops = scroll (model, n_rows, window);
+	report ("scroll", timer, n_ops);
+
+	/* what is left is the page fills, a handful per page of rows */
+	bdb_list_store_set_static_strings (store, TRUE);
+	reset_counters (timer);
+	n_ops = scroll (model, n_rows, window);
+	report ("scroll, static strings", timer, n_ops);
+
+	bdb_list_store_set_cache_size (store, 0, 64);
+	reset_counters (timer);
+	n_ops = scroll (model, n_rows, window);
+	report ("scroll, no page cache", timer, n_ops);
+
+	bdb_list_store_set_cache_size (store, 32, 64);
+	bdb_list_store_set_static_strings (store, FALSE);
+
+	/* the same scroll with a live update to every visible row */
+	n_ops = 0;
+	g_value_init (&value, G_TYPE_STRING);
+	g_value_set_static_string (&value, "updated");
+	reset_counters (timer);
+	for (i = 0; i + window <= n_rows; i += window) {
+		for (j = 0; j < window; j++) {
+			GValue cell = { 0, };
+
+			gtk_tree_model_iter_nth_child (model, &iter, NULL, i + j);
+			bdb_list_store_set_value (store, &iter, 0, &value);
+			gtk_tree_model_get_value (model, &iter, 0, &cell);
+			g_value_unset (&cell);
+			n_ops++;
+		}
+	}
+	report ("scroll + set_value", timer, n_ops);
+
+	/*
+	 * A burst of live updates to the same window of rows, as from a
+	 * status feed.  With write-behind they merge in the queue and the
+	 * flush announces each row once.
+	 */
+	if (!bdb_list_store_enable_write_behind (store, 60, &error))
+		g_error ("%s", error->message);
+
+	n_ops = 0;
+	reset_counters (timer);
+	for (i = 0; i < n_rows; i++) {
+		gtk_tree_model_iter_nth_child (model, &iter, NULL, i % window);
+		bdb_list_store_set_value (store, &iter, 0, &value);
+		n_ops++;
+	}
+	if (!bdb_list_store_flush (store, &error))
+		g_error ("%s", error->message);
+	report ("set_value, write-behind", timer, n_ops);
+
+	bdb_list_store_disable_write_behind (store);
+	g_value_unset (&value);
+
+	/* the same rows again, mapped from a snapshot */
+	snapshot = g_build_filename (g_get_tmp_dir (), "bdbliststore-bench.snap", NULL);
+	if (!bdb_list_store_export_snapshot (store, snapshot, &error))
+		g_error ("%s", error->message);
+
+	mapped = bdb_list_store_new ();
+	if (!bdb_list_store_open_snapshot (mapped, snapshot, &error))
+		g_error ("%s", error->message);
+	bdb_list_store_set_static_strings (mapped, TRUE);
+
+	reset_counters (timer);
+	n_ops = scroll (GTK_TREE_MODEL (mapped), n_rows, window);
+	report ("scroll, snapshot", timer, n_ops);
+
+	g_object_unref (mapped);
+	g_unlink (snapshot);
+	g_free (snapshot);
+
+	g_timer_destroy (timer);
+	g_object_unref (store);
+	db_env = dbp->get_env (dbp);
+	dbp->close (dbp, 0);
+	db_env->close (db_env, 0);
+
+	return 0;
+}
@@ -6,9 +6,15 @@
 #include <stdio.h>
 
 #include "bdb-list-store.h"
+#include "bdb-list-filter.h"
+#include "bdb-tree-store.h"
 
-static BdbListStore *store    = NULL;
-static GtkWidget    *treeview = NULL;
+static BdbListStore  *store    = NULL;
+static BdbListFilter *filter   = NULL;
+static GtkWidget     *treeview = NULL;
+static DB_ENV        *db_env   = NULL;
+static BdbTreeStore  *tree     = NULL;
+static GtkWidget     *treeview2 = NULL;
 
 void
 add_clicked (GtkButton *add)
@@ -34,17 +40,198 @@ remove_clicked (GtkButton *remove)
 	GtkTreeSelection *selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (treeview));
 	
 	if (gtk_tree_selection_get_selected (selection, &model, &iter)) {
-		if (bdb_list_store_remove (store, &iter)) {
+		if (model == GTK_TREE_MODEL (filter)) {
+			GtkTreeIter child;
+			bdb_list_filter_convert_iter_to_child_iter (filter, &child, &iter);
+			bdb_list_store_remove (store, &child);
+		}
+		else if (bdb_list_store_remove (store, &iter)) {
 			gtk_tree_selection_select_iter (selection, &iter);
 		}
 	}
 }
 
+static void
+search_changed (GtkEntry *entry)
+{
+	const gchar *text = gtk_entry_get_text (entry);
+	
+	bdb_list_filter_set_text (filter, text, BDB_LIST_FILTER_SUBSTRING);
+	
+	/* the filter shows rows in storage order, keep the sortable store otherwise */
+	gtk_tree_view_set_model (GTK_TREE_VIEW (treeview),
+	                         *text ? GTK_TREE_MODEL (filter) : GTK_TREE_MODEL (store));
+}
+
+static void
+visible_range_changed (GtkAdjustment *adj)
+{
+	GtkTreePath *start = NULL;
+	GtkTreePath *end = NULL;
+	
+	if (gtk_tree_view_get_model (GTK_TREE_VIEW (treeview)) != GTK_TREE_MODEL (store))
+		return;
+	
+	if (gtk_tree_view_get_visible_range (GTK_TREE_VIEW (treeview), &start, &end)) {
+		bdb_list_store_set_visible_range (store,
+		                                  gtk_tree_path_get_indices (start)[0],
+		                                  gtk_tree_path_get_indices (end)[0]);
+		gtk_tree_path_free (start);
+		gtk_tree_path_free (end);
+	}
+}
+
+/* appends a child to the selected node, or a toplevel node without one */
+static void
+tree_add_clicked (GtkButton *add)
+{
+	GtkTreeIter       iter;
+	GtkTreeIter       parent;
+	GtkTreePath      *path;
+	GtkTreeSelection *selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (treeview2));
+	gboolean          has_parent;
+	gchar            *name;
+	GValue            value = {0,};
+	
+	has_parent = gtk_tree_selection_get_selected (selection, NULL, &parent);
+	bdb_tree_store_append (tree, &iter, has_parent ? &parent : NULL);
+	
+	path = gtk_tree_model_get_path (GTK_TREE_MODEL (tree), &iter);
+	name = gtk_tree_path_to_string (path);
+	g_value_init (&value, G_TYPE_STRING);
+	g_value_take_string (&value, g_strdup_printf ("This is node %s", name));
+	g_free (name);
+	bdb_tree_store_set_value (tree, &iter, 0, &value);
+	g_value_unset (&value);
+	
+	gtk_tree_view_expand_to_path (GTK_TREE_VIEW (treeview2), path);
+	gtk_tree_path_free (path);
+}
+
+static void
+tree_remove_clicked (GtkButton *remove)
+{
+	GtkTreeIter       iter;
+	GtkTreeSelection *selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (treeview2));
+	
+	if (gtk_tree_selection_get_selected (selection, NULL, &iter) &&
+	    bdb_tree_store_remove (tree, &iter))
+		gtk_tree_selection_select_iter (selection, &iter);
+}
+
+/* a second window browsing a BdbTreeStore in the same environment */
+static gboolean
+tree_window_new (GError **error)
+{
+	GtkWidget         *window;
+	GtkWidget         *vbox;
+	GtkWidget         *scroller;
+	GtkTreeViewColumn *column;
+	GtkCellRenderer   *ctext;
+	GtkWidget         *hbox;
+	GtkWidget         *add;
+	GtkWidget         *remove;
+	GType              types[] = { G_TYPE_STRING };
+	
+	tree = bdb_tree_store_newv (G_N_ELEMENTS (types), types);
+	if (!bdb_tree_store_open (tree, db_env, "tree.db", error)) {
+		g_object_unref (tree);
+		tree = NULL;
+		return FALSE;
+	}
+	
+	window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+	gtk_window_set_title (GTK_WINDOW (window), "Tree");
+	gtk_container_set_border_width (GTK_CONTAINER (window), 12);
+	gtk_window_set_default_size (GTK_WINDOW (window), 300, 400);
+	gtk_widget_show (window);
+	
+	vbox = gtk_vbox_new (FALSE, 6);
+	gtk_container_add (GTK_CONTAINER (window), vbox);
+	gtk_widget_show (vbox);
+	
+	scroller = gtk_scrolled_window_new (NULL, NULL);
+	gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scroller),
+					GTK_POLICY_AUTOMATIC,
+					GTK_POLICY_AUTOMATIC);
+	gtk_container_add (GTK_CONTAINER (vbox), scroller);
+	gtk_widget_show (scroller);
+	
+	treeview2 = gtk_tree_view_new_with_model (GTK_TREE_MODEL (tree));
+	g_signal_connect (treeview2, "destroy", G_CALLBACK (gtk_widget_destroyed), &treeview2);
+	gtk_container_add (GTK_CONTAINER (scroller), treeview2);
+	gtk_widget_show (treeview2);
+	
+	column = gtk_tree_view_column_new ();
+	gtk_tree_view_column_set_title (column, "Node");
+	ctext = gtk_cell_renderer_text_new ();
+	gtk_tree_view_column_pack_start (column, ctext, TRUE);
+	gtk_tree_view_column_add_attribute (column, ctext, "text", 0);
+	gtk_tree_view_append_column (GTK_TREE_VIEW (treeview2), column);
+	
+	hbox = gtk_hbox_new (TRUE, 2);
+	gtk_box_pack_start (GTK_BOX (vbox), hbox, FALSE, TRUE, 0);
+	gtk_widget_show (hbox);
+	
+	add = gtk_button_new_from_stock (GTK_STOCK_ADD);
+	g_signal_connect (add, "clicked", G_CALLBACK (tree_add_clicked), NULL);
+	gtk_box_pack_start (GTK_BOX (hbox), add, TRUE, TRUE, 0);
+	gtk_widget_show (add);
+	
+	remove = gtk_button_new_from_stock (GTK_STOCK_REMOVE);
+	g_signal_connect (remove, "clicked", G_CALLBACK (tree_remove_clicked), NULL);
+	gtk_box_pack_start (GTK_BOX (hbox), remove, TRUE, TRUE, 0);
+	gtk_widget_show (remove);
+	
+	return TRUE;
+}
+
+/* hit rate of the shared cache since the last update, for tuning its size */
+static gboolean
+update_stats (GtkLabel *label)
+{
+	static guint64 last_hits = 0;
+	static guint64 last_misses = 0;
+	guint64        hits, misses, evictions, cache_size;
+	guint          page_size;
+	gchar         *text;
+	
+	g_object_get (store,
+	              "mpool-hits", &hits,
+	              "mpool-misses", &misses,
+	              "mpool-evictions", &evictions,
+	              "mpool-cache-size", &cache_size,
+	              "mpool-page-size", &page_size,
+	              NULL);
+	
+	if (hits + misses > last_hits + last_misses) {
+		text = g_strdup_printf ("Cache %" G_GUINT64_FORMAT " KiB, %u byte pages: "
+		                        "%.1f%% hits, %" G_GUINT64_FORMAT " evictions",
+		                        cache_size / 1024, page_size,
+		                        100.0 * (hits - last_hits) /
+		                        (hits - last_hits + misses - last_misses),
+		                        evictions);
+		gtk_label_set_text (label, text);
+		g_free (text);
+	}
+	
+	last_hits = hits;
+	last_misses = misses;
+	
+	return TRUE;
+}
+
 void quit (void)
 {
-	DB *db = bdb_list_store_get_db (store);
-	g_assert (db != NULL);
-	db->close (db, 0);
+	/* the store closes its database once the last reference is gone */
+	gtk_tree_view_set_model (GTK_TREE_VIEW (treeview), NULL);
+	g_object_unref (filter);
+	g_object_unref (store);
+	if (treeview2)
+		gtk_tree_view_set_model (GTK_TREE_VIEW (treeview2), NULL);
+	if (tree)
+		g_object_unref (tree);
+	db_env->close (db_env, 0);
 	gtk_main_quit ();
 }
 
@@ -59,8 +246,13 @@ main (int argc, char *argv[])
 	GtkWidget         *hbox;
 	GtkWidget         *add;
 	GtkWidget         *remove;
+	GtkWidget         *search;
+	GtkWidget         *stats;
 	GError            *error = NULL;
+	guint64            cache_size = argc > 1 ? g_ascii_strtoull (argv[1], NULL, 10) * 1024 : 0;
+	guint              page_size  = argc > 2 ? atoi (argv[2]) : 0;
 	
+	g_thread_init (NULL);
 	gtk_init (&argc, &argv);
 	
 	window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
@@ -73,6 +265,11 @@ main (int argc, char *argv[])
 	gtk_container_add (GTK_CONTAINER (window), vbox);
 	gtk_widget_show (vbox);
 	
+	search = gtk_entry_new ();
+	g_signal_connect (search, "changed", G_CALLBACK (search_changed), NULL);
+	gtk_box_pack_start (GTK_BOX (vbox), search, FALSE, TRUE, 0);
+	gtk_widget_show (search);
+	
 	scroller = gtk_scrolled_window_new (NULL, NULL);
 	gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scroller),
 					GTK_POLICY_AUTOMATIC,
@@ -88,11 +285,16 @@ main (int argc, char *argv[])
 	column = gtk_tree_view_column_new ();
 	gtk_tree_view_column_set_title (column, "Data");
 	gtk_tree_view_column_set_alignment (column, 0.5f);
+	gtk_tree_view_column_set_sizing (column, GTK_TREE_VIEW_COLUMN_FIXED);
 	ctext = gtk_cell_renderer_text_new ();
 	gtk_tree_view_column_pack_start (column, ctext, TRUE);
 	gtk_tree_view_column_add_attribute (column, ctext, "text", 0);
+	gtk_tree_view_column_set_sort_column_id (column, 0);
 	gtk_tree_view_append_column (GTK_TREE_VIEW (treeview), column);
 	
+	/* otherwise the view measures every row up front */
+	gtk_tree_view_set_fixed_height_mode (GTK_TREE_VIEW (treeview), TRUE);
+	
 	hbox = gtk_hbox_new (TRUE, 2);
 	gtk_box_pack_start (GTK_BOX (vbox), hbox, FALSE, TRUE, 0);
 	gtk_widget_show (hbox);
@@ -107,35 +309,23 @@ main (int argc, char *argv[])
 	gtk_box_pack_start (GTK_BOX (hbox), remove, TRUE, TRUE, 0);
 	gtk_widget_show (remove);
 	
-	DB     *dbp          = NULL;
-	DB_ENV *db_env       = NULL;
-	int     ret          = 0;
-	int     db_env_flags = DB_CREATE
-	                     | DB_INIT_LOG
-			     | DB_INIT_LOCK
-			     | DB_INIT_MPOOL
-			     | DB_INIT_TXN
-			     | DB_PRIVATE;
+	stats = gtk_label_new (NULL);
+	gtk_misc_set_alignment (GTK_MISC (stats), 0.0f, 0.5f);
+	gtk_box_pack_start (GTK_BOX (vbox), stats, FALSE, TRUE, 0);
+	gtk_widget_show (stats);
 	
-	if ((ret = db_env_create (&db_env, 0)) != 0)
-		g_error ("db_env_create: %s", db_strerror (ret));
+	/* usage: bdbliststore [cache size in KiB] [page size] */
+	if (!(db_env = bdb_list_store_create_env (".", cache_size, DB_PRIVATE, &error))) {
+		g_printerr ("Could not open environment: %s\n", error->message);
+		g_error_free (error);
+		return EXIT_FAILURE;
+	}
 	
 	db_env->set_errpfx (db_env, "bdbliststore");
 	db_env->set_errfile (db_env, stderr);
 	
-	if ((ret = db_env->open (db_env, ".", db_env_flags, 0)) != 0)
-		g_error ("db_env_open: %s", db_strerror (ret));
-	
-	if ((ret = db_create (&dbp, db_env, 0)) != 0)
-		g_error ("db_create: %s", db_strerror (ret));
-	
-	dbp->set_flags (dbp, DB_RENUMBER);
-
-	if ((ret = dbp->open (dbp, NULL, "test.db", NULL, DB_RECNO, DB_CREATE, 0)) != 0)
-		g_error ("db_open: %s", db_strerror (ret));
-	
 	store = bdb_list_store_new ();
-	if (!bdb_list_store_set_db (store, dbp, &error)) {
+	if (!bdb_list_store_open (store, db_env, "test.db", page_size, &error)) {
 		if (error) {
 			g_printerr ("Could not attach database: %s\n", error->message);
 			g_error_free (error);
@@ -143,7 +333,23 @@ main (int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 	
+	if (!bdb_list_store_enable_prefetch (store, 256, &error)) {
+		g_printerr ("Prefetching disabled: %s\n", error->message);
+		g_clear_error (&error);
+	}
+	
+	g_signal_connect (gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (scroller)),
+	                  "value-changed", G_CALLBACK (visible_range_changed), NULL);
+	
+	filter = bdb_list_filter_new (store, 0);
 	gtk_tree_view_set_model (GTK_TREE_VIEW (treeview), GTK_TREE_MODEL (store));
+	
+	if (!tree_window_new (&error)) {
+		g_printerr ("Could not open tree database: %s\n", error->message);
+		g_clear_error (&error);
+	}
+	
+	g_timeout_add (500, (GSourceFunc)update_stats, stats);
 
 	gtk_main ();
 	
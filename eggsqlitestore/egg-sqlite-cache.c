@@ -0,0 +1,336 @@
+/**
+ * egg-sqlite-cache.c - Byte bounded LRU cache of SQLite rows.
+ *
+ * Copyright (C) 2007   Christian Hergert <chrisian.hergert@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#include <glib.h>
+
+#include "egg-sqlite-cache.h"
+
+typedef struct _EggSqliteCacheEntry EggSqliteCacheEntry;
+
+/*
+ * One cached row.  Entries are linked most recently used first, the hash
+ * table keys point at the entry's own rowid so there is no separate key
+ * to allocate.
+ */
+struct _EggSqliteCacheEntry
+{
+	gint64               rowid;
+	EggSqliteRow        *row;
+	gsize                size;
+	EggSqliteCacheEntry *prev;
+	EggSqliteCacheEntry *next;
+};
+
+struct _EggSqliteCache
+{
+	GHashTable          *entries;  /* gint64* -> EggSqliteCacheEntry* */
+	EggSqliteCacheEntry *head;     /* most recently used */
+	EggSqliteCacheEntry *tail;     /* next to be evicted */
+	gsize                bytes;
+	gsize                max_bytes;
+	guint                hits;
+	guint                misses;
+	guint                evictions;
+};
+
+static guint
+egg_sqlite_cache_hash (gconstpointer key)
+{
+	gint64 v = *(const gint64*)key;
+	return (guint)(v ^ (v >> 32));
+}
+
+static gboolean
+egg_sqlite_cache_equal (gconstpointer a, gconstpointer b)
+{
+	return *(const gint64*)a == *(const gint64*)b;
+}
+
+static void
+egg_sqlite_cache_unlink (EggSqliteCache *cache, EggSqliteCacheEntry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		cache->head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+
+	entry->prev = entry->next = NULL;
+}
+
+static void
+egg_sqlite_cache_push_head (EggSqliteCache *cache, EggSqliteCacheEntry *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->head;
+
+	if (cache->head)
+		cache->head->prev = entry;
+	else
+		cache->tail = entry;
+
+	cache->head = entry;
+}
+
+static void
+egg_sqlite_cache_drop (EggSqliteCache *cache, EggSqliteCacheEntry *entry)
+{
+	egg_sqlite_cache_unlink (cache, entry);
+	g_hash_table_remove (cache->entries, &entry->rowid);
+
+	cache->bytes -= entry->size;
+
+	egg_sqlite_row_free (entry->row);
+	g_slice_free (EggSqliteCacheEntry, entry);
+}
+
+/* evicts from the tail until under budget, always keeping the head */
+static void
+egg_sqlite_cache_trim (EggSqliteCache *cache)
+{
+	while (cache->bytes > cache->max_bytes && cache->tail != cache->head) {
+		egg_sqlite_cache_drop (cache, cache->tail);
+		cache->evictions++;
+	}
+}
+
+/**
+ * egg_sqlite_cache_new:
+ * @max_bytes: The memory ceiling of the cached rows.
+ *
+ * Returns a new, empty row cache.  When the rows exceed @max_bytes the
+ * least recently used are freed.
+ **/
+EggSqliteCache*
+egg_sqlite_cache_new (gsize max_bytes)
+{
+	EggSqliteCache *cache;
+
+	cache = g_new0 (EggSqliteCache, 1);
+	cache->entries = g_hash_table_new (egg_sqlite_cache_hash,
+	                                   egg_sqlite_cache_equal);
+	cache->max_bytes = max_bytes;
+
+	return cache;
+}
+
+/**
+ * egg_sqlite_cache_free:
+ * @cache: A row cache.
+ *
+ * Frees @cache and every row in it.
+ **/
+void
+egg_sqlite_cache_free (EggSqliteCache *cache)
+{
+	if (cache == NULL)
+		return;
+
+	egg_sqlite_cache_clear (cache);
+	g_hash_table_destroy (cache->entries);
+	g_free (cache);
+}
+
+/**
+ * egg_sqlite_cache_lookup:
+ * @cache: A row cache.
+ * @rowid: The rowid of the row.
+ *
+ * Returns the cached row, or NULL on a miss.  The row belongs to the cache
+ * and is only valid until the next insert.
+ **/
+EggSqliteRow*
+egg_sqlite_cache_lookup (EggSqliteCache *cache, gint64 rowid)
+{
+	EggSqliteCacheEntry *entry;
+
+	g_return_val_if_fail (cache != NULL, NULL);
+
+	if (!(entry = g_hash_table_lookup (cache->entries, &rowid))) {
+		cache->misses++;
+		return NULL;
+	}
+
+	cache->hits++;
+
+	if (entry != cache->head) {
+		egg_sqlite_cache_unlink (cache, entry);
+		egg_sqlite_cache_push_head (cache, entry);
+	}
+
+	return entry->row;
+}
+
+/**
+ * egg_sqlite_cache_contains:
+ * @cache: A row cache.
+ * @rowid: The rowid of the row.
+ *
+ * Returns TRUE if the row is cached, without counting a hit or a miss or
+ * touching its place in the LRU order.
+ **/
+gboolean
+egg_sqlite_cache_contains (EggSqliteCache *cache, gint64 rowid)
+{
+	g_return_val_if_fail (cache != NULL, FALSE);
+	return g_hash_table_lookup (cache->entries, &rowid) != NULL;
+}
+
+/**
+ * egg_sqlite_cache_insert:
+ * @cache: A row cache.
+ * @rowid: The rowid of the row.
+ * @row: The row.
+ *
+ * Caches @row as the most recently used, replacing any row already cached
+ * for @rowid.  The cache takes ownership of @row.
+ **/
+void
+egg_sqlite_cache_insert (EggSqliteCache *cache, gint64 rowid, EggSqliteRow *row)
+{
+	EggSqliteCacheEntry *entry;
+
+	g_return_if_fail (cache != NULL);
+	g_return_if_fail (row != NULL);
+
+	if ((entry = g_hash_table_lookup (cache->entries, &rowid)))
+		egg_sqlite_cache_drop (cache, entry);
+
+	entry = g_slice_new0 (EggSqliteCacheEntry);
+	entry->rowid = rowid;
+	entry->row = row;
+	entry->size = sizeof (EggSqliteCacheEntry) + row->size;
+
+	g_hash_table_insert (cache->entries, &entry->rowid, entry);
+	egg_sqlite_cache_push_head (cache, entry);
+	cache->bytes += entry->size;
+
+	egg_sqlite_cache_trim (cache);
+}
+
+/**
+ * egg_sqlite_cache_remove:
+ * @cache: A row cache.
+ * @rowid: The rowid of the row.
+ *
+ * Drops the row cached for @rowid, if any, after it changed or was deleted.
+ **/
+void
+egg_sqlite_cache_remove (EggSqliteCache *cache, gint64 rowid)
+{
+	EggSqliteCacheEntry *entry;
+
+	g_return_if_fail (cache != NULL);
+
+	if ((entry = g_hash_table_lookup (cache->entries, &rowid)))
+		egg_sqlite_cache_drop (cache, entry);
+}
+
+/**
+ * egg_sqlite_cache_clear:
+ * @cache: A row cache.
+ *
+ * Drops every cached row.  The statistics are kept.
+ **/
+void
+egg_sqlite_cache_clear (EggSqliteCache *cache)
+{
+	g_return_if_fail (cache != NULL);
+
+	while (cache->head)
+		egg_sqlite_cache_drop (cache, cache->head);
+}
+
+/**
+ * egg_sqlite_cache_foreach:
+ * @cache: A row cache.
+ * @func: Called with each rowid and row, most recently used first.
+ * @user_data: Passed to @func.
+ *
+ * Visits every cached row without touching its place in the LRU order.
+ * @func must not insert or remove rows.
+ **/
+void
+egg_sqlite_cache_foreach (EggSqliteCache     *cache,
+                          EggSqliteCacheFunc  func,
+                          gpointer            user_data)
+{
+	EggSqliteCacheEntry *entry;
+
+	g_return_if_fail (cache != NULL);
+	g_return_if_fail (func != NULL);
+
+	for (entry = cache->head; entry; entry = entry->next)
+		func (entry->rowid, entry->row, user_data);
+}
+
+/**
+ * egg_sqlite_cache_set_max_bytes:
+ * @cache: A row cache.
+ * @max_bytes: The new memory ceiling.
+ *
+ * Changes the memory ceiling, evicting at once if it shrank.
+ **/
+void
+egg_sqlite_cache_set_max_bytes (EggSqliteCache *cache, gsize max_bytes)
+{
+	g_return_if_fail (cache != NULL);
+
+	cache->max_bytes = max_bytes;
+	egg_sqlite_cache_trim (cache);
+}
+
+gsize
+egg_sqlite_cache_get_max_bytes (EggSqliteCache *cache)
+{
+	g_return_val_if_fail (cache != NULL, 0);
+	return cache->max_bytes;
+}
+
+/**
+ * egg_sqlite_cache_get_stats:
+ * @cache: A row cache.
+ * @hits: Location for the number of lookups that found their row, or NULL.
+ * @misses: Location for the number of lookups that did not, or NULL.
+ * @evictions: Location for the number of rows evicted, or NULL.
+ * @bytes: Location for the bytes currently cached, or NULL.
+ **/
+void
+egg_sqlite_cache_get_stats (EggSqliteCache *cache,
+                            guint          *hits,
+                            guint          *misses,
+                            guint          *evictions,
+                            gsize          *bytes)
+{
+	g_return_if_fail (cache != NULL);
+
+	if (hits)
+		*hits = cache->hits;
+	if (misses)
+		*misses = cache->misses;
+	if (evictions)
+		*evictions = cache->evictions;
+	if (bytes)
+		*bytes = cache->bytes;
+}
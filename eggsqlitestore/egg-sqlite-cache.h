@@ -0,0 +1,56 @@
+/**
+ * egg-sqlite-cache.h - Byte bounded LRU cache of SQLite rows.
+ *
+ * Copyright (C) 2007   Christian Hergert <chrisian.hergert@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+**/
+
+#ifndef __EGG_SQLITE_CACHE_H__
+#define __EGG_SQLITE_CACHE_H__
+
+#include <glib.h>
+
+#include "egg-sqlite.h"
+
+typedef struct _EggSqliteCache EggSqliteCache;
+
+typedef void (*EggSqliteCacheFunc) (gint64 rowid, EggSqliteRow *row, gpointer user_data);
+
+EggSqliteCache* egg_sqlite_cache_new           (gsize           max_bytes);
+void            egg_sqlite_cache_free          (EggSqliteCache *cache);
+EggSqliteRow*   egg_sqlite_cache_lookup        (EggSqliteCache *cache,
+                                                gint64          rowid);
+gboolean        egg_sqlite_cache_contains      (EggSqliteCache *cache,
+                                                gint64          rowid);
+void            egg_sqlite_cache_insert        (EggSqliteCache *cache,
+                                                gint64          rowid,
+                                                EggSqliteRow   *row);
+void            egg_sqlite_cache_remove        (EggSqliteCache *cache,
+                                                gint64          rowid);
+void            egg_sqlite_cache_clear         (EggSqliteCache *cache);
+void            egg_sqlite_cache_foreach       (EggSqliteCache     *cache,
+                                                EggSqliteCacheFunc  func,
+                                                gpointer            user_data);
+void            egg_sqlite_cache_set_max_bytes (EggSqliteCache *cache,
+                                                gsize           max_bytes);
+gsize           egg_sqlite_cache_get_max_bytes (EggSqliteCache *cache);
+void            egg_sqlite_cache_get_stats     (EggSqliteCache *cache,
+                                                guint          *hits,
+                                                guint          *misses,
+                                                guint          *evictions,
+                                                gsize          *bytes);
+
+#endif /* __EGG_SQLITE_CACHE_H__ */
@@ -23,18 +23,72 @@
 
 #include <sqlite3.h>
 
+#include "egg-sqlite.h"
+#include "egg-sqlite-cache.h"
+
 #define EGG_SQLITE_STORE_ERROR g_quark_from_string("EggSqliteStore")
 
+#define EGG_SQLITE_STORE_BLOCK_SIZE 256 /* rows fetched per query */
+#define EGG_SQLITE_STORE_N_BLOCKS   8   /* blocks whose positions are kept */
+#define EGG_SQLITE_STORE_CACHE_SIZE (4 * 1024 * 1024) /* default row cache bytes */
+#define EGG_SQLITE_STORE_RETRIES    3   /* reads of a block that failed */
+
 #define EGG_SQLITE_STORE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE((o), \
                                          EGG_TYPE_SQLITE_STORE,           \
                                          EggSqliteStorePrivate))
 
+/* rowids of consecutive rows, as one query fetched them */
+typedef struct {
+    GArray  *rowids; /* gint64 */
+    gint     first;  /* row offset of the first, -1 if unknown */
+    guint    used;   /* block_clock when last used */
+} EggSqliteBlock;
+
+/* a write to the table another caller made on our connection */
+typedef struct {
+    gint     op;     /* SQLITE_INSERT, SQLITE_DELETE or SQLITE_UPDATE */
+    gint64   rowid;
+} EggSqliteUpdate;
+
 typedef struct _EggSqliteStorePrivate EggSqliteStorePrivate;
 struct _EggSqliteStorePrivate {
+    gchar   *filename;
     gchar   *table;
     sqlite3 *dbh;
-    GTree   *cache;  /* data cache indexed by oid (gchar*)      */
-	GTree   *rcache; /* data cache indexed by row offset (gint) */
+    EggSqliteStatements *stmts; /* cached queries on table */
+    GType   *column_types; /* by column affinity, oid first */
+    EggSqliteCache *cache; /* LRU of rows indexed by rowid */
+    EggSqliteBlock blocks[EGG_SQLITE_STORE_N_BLOCKS]; /* most recently fetched */
+    guint    block_clock;
+    gint     batch_depth;    /* nested begin_batch calls */
+    gboolean batch_failed;   /* a write in the open batch failed */
+    GArray  *batch_appended; /* oids (gint64) appended in the batch, unannounced */
+
+    /* async mode, see egg_sqlite_store_enable_async() */
+    GThreadPool *async_pool;    /* one worker thread */
+    sqlite3  *reader;           /* read-only connection, worker only */
+    EggSqliteStatements *reader_stmts; /* worker only */
+    gint     async_gen;         /* bumped by every write, atomic */
+    GHashTable *loading;        /* block index -> EggSqliteLoad */
+    gboolean index_pending;     /* the worker builds the index, no rows till then */
+    gboolean resyncing;         /* the worker reads the table again */
+    gboolean resync_again;      /* and is to once more when done */
+    guint    async_margin;
+    gint     visible_first;     /* atomic */
+    gint     visible_last;      /* atomic, -1 if never set */
+
+    /* change tracking, see egg_sqlite_store_set_watch_interval() */
+    gint     writing;           /* own writes under way, the hooks skip them */
+    gint     write_base;        /* sqlite3_total_changes() when they began */
+    gint     total_changes;     /* sqlite3_total_changes() accounted for */
+    gint     own_changes;       /* made by own writes since */
+    guint    hooked;            /* update hook calls for others' writes since */
+    gboolean has_unique;        /* REPLACE may delete rows the hook never sees */
+    GArray  *updates;           /* EggSqliteUpdate, not yet announced */
+    gboolean resync_pending;    /* updates were rolled back, compare instead */
+    guint    updates_idle;
+    guint    watch_source;      /* data_version poll */
+    gint     data_version;
 };
 
 /* GObject implementations */
@@ -74,4 +128,33 @@ static gboolean          egg_sqlite_store_iter_parent     (GtkTreeModel      *tr
                                                            GtkTreeIter       *iter,
                                                            GtkTreeIter       *child);
 
+/* change tracking, the hooks are installed by egg_sqlite_store_set_table() */
+static void              egg_sqlite_store_update_hook     (gpointer           data,
+                                                           gint               op,
+                                                           const gchar       *database,
+                                                           const gchar       *table,
+                                                           sqlite3_int64      rowid);
+static void              egg_sqlite_store_rollback_hook   (gpointer           data);
+static gint              egg_sqlite_store_commit_hook     (gpointer           data);
+
+/* async mode, a completed load may announce rows, queue itself, resync,
+ * install the index or refresh cached rows */
+static void              egg_sqlite_store_load            (EggSqliteStore    *self,
+                                                           gint               n,
+                                                           gboolean           announce);
+static void              egg_sqlite_store_emit            (EggSqliteStore    *self,
+                                                           gint64             oid,
+                                                           gboolean           inserted);
+static void              egg_sqlite_store_install_index   (EggSqliteStore    *self,
+                                                           EggSqliteIndex    *index);
+static void              egg_sqlite_store_written         (EggSqliteStorePrivate *priv);
+static void              egg_sqlite_store_announce        (EggSqliteStore    *self,
+                                                           GArray            *deleted,
+                                                           GArray            *inserted);
+static void              egg_sqlite_store_refresh         (EggSqliteStore    *self,
+                                                           GArray            *rowids,
+                                                           GPtrArray         *fresh_rows);
+static gboolean          egg_sqlite_store_flush_updates   (EggSqliteStore    *self);
+static void              egg_sqlite_store_resync          (EggSqliteStore    *self);
+
 #endif /* __EGG_SQLITE_STORE_PRIVATE_H__ */
@@ -22,31 +22,625 @@
 #include <stdlib.h>
 
 #include <glib-object.h>
+#include <gobject/gvaluecollector.h>
 #include <gtk/gtk.h>
 
 #include "egg-sqlite.h"
+#include "egg-sqlite-cache.h"
 #include "egg-sqlite-store.h"
 #include "egg-sqlite-store-private.h"
 
 static GObjectClass *parent_class = NULL;
 
+/*
+ * Iters carry the 64-bit rowid of their row, split over user_data and
+ * user_data2 so it fits where pointers are 32-bit.  The row itself can be
+ * evicted from the cache under an iter and fetched again by rowid.
+ */
+#define ITER_ROWID(i) \
+	((gint64) (((guint64) GPOINTER_TO_UINT ((i)->user_data2) << 32) | \
+	           (guint64) GPOINTER_TO_UINT ((i)->user_data)))
+#define ITER_SET_ROWID(i,r) G_STMT_START {                                   \
+	(i)->user_data  = GUINT_TO_POINTER ((guint32) ((guint64) (r)));          \
+	(i)->user_data2 = GUINT_TO_POINTER ((guint32) ((guint64) (r) >> 32));    \
+} G_STMT_END
+
+/*
+ * Async mode answers positions from the rank index and defers only the
+ * rows themselves, so it needs the index built.  Views are not told of
+ * rows written in a batch until it ends.
+ */
+#define ASYNC(priv) ((priv)->async_pool != NULL && (priv)->batch_depth == 0 && \
+                     egg_sqlite_statements_is_indexed ((priv)->stmts))
+
+typedef enum
+{
+	LOAD_BLOCK,                   /* rows for views */
+	LOAD_INDEX,                   /* the count and rank index, once */
+	LOAD_RESYNC                   /* the index and the cached rows afresh */
+} EggSqliteLoadKind;
+
+typedef struct
+{
+	EggSqliteStore *self;         /* reference held until completion */
+	EggSqliteLoadKind kind;
+	gint            first;        /* position of the block's first row */
+	sqlite3_int64   after;        /* oid before it, the reader seeks past it */
+	gint            gen;          /* async_gen when queued */
+	gboolean        announce;     /* views read its rows empty, tell them */
+	gboolean        failed;       /* the read was tried and failed */
+	guint           attempts;
+	GPtrArray      *rows;         /* result, filled in by the worker */
+	GArray         *oids;         /* of rows, or of those to read for a resync */
+	EggSqliteIndex *index;
+} EggSqliteLoad;
+
+/* rows moved, no block says where any more */
 static void
-g_ptr_array_free_full (gpointer data)
+egg_sqlite_store_invalidate_blocks (EggSqliteStorePrivate *priv)
 {
-	g_ptr_array_free ((GPtrArray*)data, TRUE);
+	gint i;
+
+	for (i = 0; i < EGG_SQLITE_STORE_N_BLOCKS; i++) {
+		g_array_set_size (priv->blocks[i].rowids, 0);
+		priv->blocks[i].first = -1;
+	}
 }
 
-static gint
-g_int_cmp (gpointer x, gpointer y)
+/* the least recently used block, emptied for a fetch to fill */
+static EggSqliteBlock*
+egg_sqlite_store_take_block (EggSqliteStorePrivate *priv)
 {
-	gint x_int, y_int;
-	
-	x_int = GPOINTER_TO_INT (x);
-	y_int = GPOINTER_TO_INT (y);
-	
-	if (x > y) return 1;
-	else if (x < y) return -1;
-	else return 0;
+	EggSqliteBlock *block = &priv->blocks[0];
+	gint            i;
+
+	for (i = 1; i < EGG_SQLITE_STORE_N_BLOCKS; i++)
+		if (priv->blocks[i].used < block->used)
+			block = &priv->blocks[i];
+
+	g_array_set_size (block->rowids, 0);
+	block->first = -1;
+	block->used = ++priv->block_clock;
+
+	return block;
+}
+
+/*
+ * Caches a freshly fetched block of rows, first being its position or -1
+ * if unknown.  block->rowids already holds their rowids, as the fetch
+ * appended them; the rows are the cache's to evict.
+ */
+static void
+egg_sqlite_store_set_block (EggSqliteStorePrivate *priv,
+                            EggSqliteBlock        *block,
+                            GPtrArray             *rows,
+                            gint                   first)
+{
+	guint i;
+
+	for (i = 0; i < rows->len; i++)
+		egg_sqlite_cache_insert (priv->cache,
+		                         g_array_index (block->rowids, gint64, i),
+		                         g_ptr_array_index (rows, i));
+	g_ptr_array_free (rows, TRUE);
+
+	block->first = first;
+}
+
+/* the rowid at position n, if a block knows it */
+static gboolean
+egg_sqlite_store_block_rowid (EggSqliteStorePrivate *priv, gint n, gint64 *rowid)
+{
+	EggSqliteBlock *block;
+	gint            i;
+
+	for (i = 0; i < EGG_SQLITE_STORE_N_BLOCKS; i++) {
+		block = &priv->blocks[i];
+		if (block->first >= 0 && n >= block->first &&
+		    n < block->first + (gint)block->rowids->len)
+		{
+			block->used = ++priv->block_clock;
+			*rowid = g_array_index (block->rowids, gint64, n - block->first);
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* the block holding rowid and its index there, or NULL */
+static EggSqliteBlock*
+egg_sqlite_store_block_find (EggSqliteStorePrivate *priv, gint64 rowid, gint *index)
+{
+	EggSqliteBlock *block;
+	gint64          cur;
+	gint            i, lo, hi, mid;
+
+	for (i = 0; i < EGG_SQLITE_STORE_N_BLOCKS; i++) {
+		block = &priv->blocks[i];
+		lo = 0;
+		hi = (gint)block->rowids->len - 1;
+
+		while (lo <= hi) {
+			mid = (lo + hi) / 2;
+			cur = g_array_index (block->rowids, gint64, mid);
+			if (cur == rowid) {
+				block->used = ++priv->block_clock;
+				*index = mid;
+				return block;
+			}
+			else if (cur < rowid)
+				lo = mid + 1;
+			else
+				hi = mid - 1;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * The rowid at position n, from a block or from a new block of
+ * EGG_SQLITE_STORE_BLOCK_SIZE rows around it.  Blocks start at multiples
+ * of the block size, so scrolling back up hits the same blocks again.
+ */
+static gboolean
+egg_sqlite_store_get_nth (EggSqliteStorePrivate *priv, gint n, gint64 *rowid)
+{
+	EggSqliteBlock *block;
+	GPtrArray      *rows;
+	gint            first;
+
+	if (n < 0)
+		return FALSE;
+
+	if (egg_sqlite_store_block_rowid (priv, n, rowid))
+		return TRUE;
+
+	first = n - n % EGG_SQLITE_STORE_BLOCK_SIZE;
+	block = egg_sqlite_store_take_block (priv);
+	if (!(rows = egg_sqlite_fetch_block_at (priv->stmts, first,
+	                                        EGG_SQLITE_STORE_BLOCK_SIZE,
+	                                        block->rowids)))
+		return FALSE;
+	egg_sqlite_store_set_block (priv, block, rows, first);
+
+	if (n - first >= (gint)block->rowids->len)
+		return FALSE;
+
+	*rowid = g_array_index (block->rowids, gint64, n - first);
+
+	return TRUE;
+}
+
+/* the rowid after the given one, one query per block */
+static gboolean
+egg_sqlite_store_get_next (EggSqliteStorePrivate *priv,
+                           gint64                 after,
+                           gint64                *rowid)
+{
+	EggSqliteBlock *block;
+	GPtrArray      *rows;
+	sqlite3_int64   last = after;
+	gint            first = -1;
+	gint            i;
+
+	if ((block = egg_sqlite_store_block_find (priv, after, &i))) {
+		if (i + 1 < (gint)block->rowids->len) {
+			*rowid = g_array_index (block->rowids, gint64, i + 1);
+			return TRUE;
+		}
+		/* walking off the end of a block, the next one follows on */
+		if (block->first >= 0)
+			first = block->first + i + 1;
+	}
+
+	block = egg_sqlite_store_take_block (priv);
+	if (!(rows = egg_sqlite_fetch_block (priv->stmts, &last,
+	                                     EGG_SQLITE_STORE_BLOCK_SIZE,
+	                                     block->rowids)))
+		return FALSE;
+
+	egg_sqlite_store_set_block (priv, block, rows, first);
+
+	if (block->rowids->len == 0)
+		return FALSE;
+
+	*rowid = g_array_index (block->rowids, gint64, 0);
+
+	return TRUE;
+}
+
+/* the row for rowid, from the cache or fetched into it */
+static EggSqliteRow*
+egg_sqlite_store_get_row (EggSqliteStorePrivate *priv, gint64 rowid)
+{
+	EggSqliteRow *row;
+
+	if ((row = egg_sqlite_cache_lookup (priv->cache, rowid)))
+		return row;
+
+	if ((row = egg_sqlite_fetch_row (priv->stmts, rowid)))
+		egg_sqlite_cache_insert (priv->cache, rowid, row);
+
+	return row;
+}
+
+/*
+ * Points iter at position n.  In async mode the rowid comes from the
+ * rank index and the row is left for the worker to read.
+ */
+static gboolean
+egg_sqlite_store_iter_at (EggSqliteStore *self, GtkTreeIter *iter, gint n)
+{
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	gint64                 rowid;
+
+	/* views are shown no rows until the worker has indexed them */
+	if (n < 0 || priv->index_pending)
+		return FALSE;
+
+	if (ASYNC (priv))
+		rowid = egg_sqlite_statements_rowid_at (priv->stmts, n);
+	else if (!egg_sqlite_store_get_nth (priv, n, &rowid))
+		return FALSE;
+
+	if (rowid < 0)
+		return FALSE;
+
+	iter->stamp = self->stamp;
+	ITER_SET_ROWID (iter, rowid);
+
+	return TRUE;
+}
+
+static void
+egg_sqlite_load_free (EggSqliteLoad *load)
+{
+	if (load->rows) {
+		g_ptr_array_foreach (load->rows, (GFunc) egg_sqlite_row_free, NULL);
+		g_ptr_array_free (load->rows, TRUE);
+	}
+	if (load->oids)
+		g_array_free (load->oids, TRUE);
+	egg_sqlite_index_free (load->index);
+	g_object_unref (load->self);
+	g_slice_free (EggSqliteLoad, load);
+}
+
+/* still worth reading: nothing written since, and near what views show */
+static gboolean
+egg_sqlite_load_wanted (EggSqliteStorePrivate *priv, EggSqliteLoad *load)
+{
+	gint first = g_atomic_int_get (&priv->visible_first) - priv->async_margin;
+	gint last = g_atomic_int_get (&priv->visible_last);
+
+	if (load->gen != g_atomic_int_get (&priv->async_gen))
+		return FALSE;
+
+	/* no visible range given, read whatever views ask for */
+	if (last < 0)
+		return TRUE;
+
+	last += priv->async_margin;
+
+	return load->first + EGG_SQLITE_STORE_BLOCK_SIZE > first && load->first <= last;
+}
+
+/* the block the reader found is the one the rank index expects there */
+static gboolean
+egg_sqlite_load_matches (EggSqliteStorePrivate *priv, EggSqliteLoad *load)
+{
+	gint n, i;
+
+	n = MIN (EGG_SQLITE_STORE_BLOCK_SIZE, egg_sqlite_count_rows (priv->stmts) - load->first);
+	if ((gint)load->oids->len != MAX (n, 0))
+		return FALSE;
+
+	for (i = 0; i < n; i++)
+		if (egg_sqlite_statements_rowid_at (priv->stmts, load->first + i) !=
+		    g_array_index (load->oids, gint64, i))
+			return FALSE;
+
+	return TRUE;
+}
+
+/* reads a load again after its read failed, unless that happened too often */
+static gboolean
+egg_sqlite_load_retry (EggSqliteStorePrivate *priv, EggSqliteLoad *load)
+{
+	if (++load->attempts >= EGG_SQLITE_STORE_RETRIES || !priv->async_pool)
+		return FALSE;
+
+	if (load->kind == LOAD_BLOCK && load->oids) {
+		g_array_free (load->oids, TRUE);
+		load->oids = NULL;
+	}
+	/* what a resync got before it failed */
+	if (load->rows) {
+		g_ptr_array_foreach (load->rows, (GFunc) egg_sqlite_row_free, NULL);
+		g_ptr_array_free (load->rows, TRUE);
+		load->rows = NULL;
+	}
+	egg_sqlite_index_free (load->index);
+	load->index = NULL;
+	load->failed = FALSE;
+	g_thread_pool_push (priv->async_pool, load, NULL);
+
+	return TRUE;
+}
+
+/* main loop: the index arrived, unless a write could not wait for it */
+static gboolean
+egg_sqlite_index_complete (EggSqliteLoad *load)
+{
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (load->self);
+
+	if (!priv->index_pending)
+		return FALSE;
+
+	/* others committed while the worker scanned */
+	if (load->gen != g_atomic_int_get (&priv->async_gen) && priv->async_pool) {
+		egg_sqlite_index_free (load->index);
+		load->index = NULL;
+		load->attempts = 0;
+		load->gen = g_atomic_int_get (&priv->async_gen);
+		g_thread_pool_push (priv->async_pool, load, NULL);
+		return TRUE;
+	}
+
+	if (load->failed && egg_sqlite_load_retry (priv, load))
+		return TRUE;
+
+	egg_sqlite_store_install_index (load->self, load->index);
+	load->index = NULL;
+
+	return FALSE;
+}
+
+/* main loop: the table as the reader found it, unless written since */
+static gboolean
+egg_sqlite_resync_complete (EggSqliteLoad *load)
+{
+	EggSqliteStore        *self = load->self;
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	GArray                *deleted, *inserted;
+	gboolean               stale;
+
+	stale = load->gen != g_atomic_int_get (&priv->async_gen);
+
+	if (!stale && load->failed && egg_sqlite_load_retry (priv, load))
+		return TRUE;
+
+	priv->resyncing = FALSE;
+
+	/* the index views know changed meanwhile, compare with it as it is */
+	if (stale)
+		priv->resync_again = TRUE;
+	else if (load->failed) {
+		/* without the worker it is done here instead */
+		if (priv->async_pool)
+			g_warning ("%s: cannot read the table again", G_STRLOC);
+		else
+			priv->resync_again = TRUE;
+	}
+	else {
+		deleted = g_array_new (FALSE, FALSE, sizeof (EggSqliteChange));
+		inserted = g_array_new (FALSE, FALSE, sizeof (EggSqliteChange));
+
+		egg_sqlite_statements_set_index (priv->stmts, load->index, deleted, inserted);
+		load->index = NULL;
+		egg_sqlite_store_announce (self, deleted, inserted);
+
+		g_array_free (deleted, TRUE);
+		g_array_free (inserted, TRUE);
+
+		egg_sqlite_store_refresh (self, load->oids, load->rows);
+		egg_sqlite_store_written (priv);
+	}
+
+	if (priv->resync_again) {
+		priv->resync_again = FALSE;
+		egg_sqlite_store_resync (self);
+	}
+
+	return FALSE;
+}
+
+/* main loop: a block arrived, was skipped, or could not be read */
+static gboolean
+egg_sqlite_load_complete (gpointer data)
+{
+	EggSqliteLoad         *load = data;
+	EggSqliteStore        *self = load->self;
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	gint                   index = load->first / EGG_SQLITE_STORE_BLOCK_SIZE;
+	gboolean               matches;
+	gboolean               indexed;
+	gint64                 oid;
+	guint                  i;
+
+	if (load->kind == LOAD_INDEX) {
+		if (!egg_sqlite_index_complete (load))
+			egg_sqlite_load_free (load);
+		return FALSE;
+	}
+
+	if (load->kind == LOAD_RESYNC) {
+		if (!egg_sqlite_resync_complete (load))
+			egg_sqlite_load_free (load);
+		return FALSE;
+	}
+
+	if (priv->loading &&
+	    g_hash_table_lookup (priv->loading, GINT_TO_POINTER (index)) == load)
+		g_hash_table_remove (priv->loading, GINT_TO_POINTER (index));
+
+	/*
+	 * Rows views read empty are announced as they arrive.  A stale block
+	 * is read again as the table is now; a skipped one scrolled out of
+	 * view and is asked for afresh if it scrolls back.
+	 */
+	if (load->gen != g_atomic_int_get (&priv->async_gen)) {
+		if (load->announce && priv->async_pool)
+			egg_sqlite_store_load (self, load->first, TRUE);
+	}
+	else if (load->failed) {
+		/* a busy database, most likely; only a failed read is read again */
+		if (!g_hash_table_lookup (priv->loading, GINT_TO_POINTER (index)) &&
+		    egg_sqlite_load_retry (priv, load))
+		{
+			g_hash_table_insert (priv->loading, GINT_TO_POINTER (index), load);
+			return FALSE;
+		}
+		g_warning ("%s: cannot read rows from %d", G_STRLOC, load->first);
+	}
+	else if (load->rows) {
+		matches = egg_sqlite_load_matches (priv, load);
+
+		/* only rows the index has exist for views, the rest wait for a resync */
+		indexed = egg_sqlite_statements_is_indexed (priv->stmts);
+		for (i = 0; i < load->rows->len; i++) {
+			oid = g_array_index (load->oids, gint64, i);
+			if (indexed && !egg_sqlite_statements_has_row (priv->stmts, oid)) {
+				egg_sqlite_row_free (g_ptr_array_index (load->rows, i));
+				continue;
+			}
+			egg_sqlite_cache_insert (priv->cache, oid, g_ptr_array_index (load->rows, i));
+			if (load->announce)
+				egg_sqlite_store_emit (self, oid, FALSE);
+		}
+		g_ptr_array_free (load->rows, TRUE);
+		load->rows = NULL;
+
+		/*
+		 * Rows came or went behind the index's back, so the count is off
+		 * too.  With a transaction open on our connection the reader
+		 * cannot see its rows, and a mismatch says nothing; nor while a
+		 * resync is on its way.
+		 */
+		if (!matches && !priv->resyncing && sqlite3_get_autocommit (priv->dbh) &&
+		    !egg_sqlite_store_flush_updates (self))
+			egg_sqlite_store_resync (self);
+	}
+
+	egg_sqlite_load_free (load);
+
+	return FALSE;
+}
+
+/* worker thread: reads one block by oid, or the index, on the reader */
+static void
+egg_sqlite_load_worker (gpointer data, gpointer user_data)
+{
+	EggSqliteLoad         *load = data;
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (load->self);
+	EggSqliteRow          *row;
+	guint                  i;
+
+	if (load->kind == LOAD_INDEX) {
+		if (!(load->index = egg_sqlite_statements_build_index (priv->reader_stmts)))
+			load->failed = TRUE;
+	}
+	else if (load->kind == LOAD_RESYNC) {
+		/* the index and the rows from the same snapshot */
+		if (!egg_sqlite_begin_read (priv->reader_stmts))
+			load->failed = TRUE;
+		else if (!(load->index = egg_sqlite_statements_build_index (priv->reader_stmts)))
+			load->failed = TRUE;
+		else {
+			/* NULL for the rows that went, a failed read is not one of them */
+			load->rows = g_ptr_array_sized_new (load->oids->len);
+			for (i = 0; i < load->oids->len && !load->failed; i++) {
+				if (!egg_sqlite_lookup_row (priv->reader_stmts,
+				                            g_array_index (load->oids, gint64, i), &row))
+					load->failed = TRUE;
+				else
+					g_ptr_array_add (load->rows, row);
+			}
+		}
+		if (!sqlite3_get_autocommit (priv->reader))
+			egg_sqlite_commit (priv->reader_stmts);
+	}
+	else if (egg_sqlite_load_wanted (priv, load)) {
+		load->oids = g_array_new (FALSE, FALSE, sizeof (gint64));
+		if (!(load->rows = egg_sqlite_fetch_block (priv->reader_stmts, &load->after,
+		                                           EGG_SQLITE_STORE_BLOCK_SIZE,
+		                                           load->oids)))
+			load->failed = TRUE;
+	}
+
+	g_idle_add_full (G_PRIORITY_HIGH_IDLE, egg_sqlite_load_complete, load, NULL);
+}
+
+/* queues the block holding position n, unless it is already on its way */
+static void
+egg_sqlite_store_load (EggSqliteStore *self, gint n, gboolean announce)
+{
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	EggSqliteLoad         *load;
+	sqlite3_int64          first;
+	gint                   index = n / EGG_SQLITE_STORE_BLOCK_SIZE;
+
+	if ((load = g_hash_table_lookup (priv->loading, GINT_TO_POINTER (index))) &&
+	    load->gen == g_atomic_int_get (&priv->async_gen))
+	{
+		load->announce |= announce;
+		return;
+	}
+
+	if ((first = egg_sqlite_statements_rowid_at (priv->stmts,
+	                                             index * EGG_SQLITE_STORE_BLOCK_SIZE)) < 0)
+		return;
+
+	load = g_slice_new0 (EggSqliteLoad);
+	load->self = g_object_ref (self);
+	load->first = index * EGG_SQLITE_STORE_BLOCK_SIZE;
+	load->after = first - 1;
+	load->gen = g_atomic_int_get (&priv->async_gen);
+	load->announce = announce;
+
+	g_hash_table_insert (priv->loading, GINT_TO_POINTER (index), load);
+	g_thread_pool_push (priv->async_pool, load, NULL);
+}
+
+/* a block of rows not cached yet, worth queueing */
+static gboolean
+egg_sqlite_store_block_missing (EggSqliteStorePrivate *priv, gint n)
+{
+	gint64 rowid;
+	gint   last;
+
+	last = MIN (n + EGG_SQLITE_STORE_BLOCK_SIZE, egg_sqlite_count_rows (priv->stmts)) - 1;
+
+	if ((rowid = egg_sqlite_statements_rowid_at (priv->stmts, n)) < 0 ||
+	    !egg_sqlite_cache_contains (priv->cache, rowid))
+		return TRUE;
+
+	return (rowid = egg_sqlite_statements_rowid_at (priv->stmts, last)) < 0 ||
+	       !egg_sqlite_cache_contains (priv->cache, rowid);
+}
+
+/* every write makes blocks read or being read before it stale */
+static void
+egg_sqlite_store_written (EggSqliteStorePrivate *priv)
+{
+	g_atomic_int_inc (&priv->async_gen);
+}
+
+/* own writes, which the hooks skip; the rows they change are counted apart */
+static void
+egg_sqlite_store_write_begin (EggSqliteStorePrivate *priv)
+{
+	if (priv->writing++ == 0)
+		priv->write_base = sqlite3_total_changes (priv->dbh);
+}
+
+static void
+egg_sqlite_store_write_end (EggSqliteStorePrivate *priv)
+{
+	if (--priv->writing == 0)
+		priv->own_changes += sqlite3_total_changes (priv->dbh) - priv->write_base;
 }
 
 GType
@@ -111,6 +705,7 @@ static void
 egg_sqlite_store_init (EggSqliteStore *self)
 {
 	EggSqliteStorePrivate *priv;
+	gint                   i;
 
 	self->n_columns = 0;
 	self->stamp = g_random_int ();
@@ -118,32 +713,66 @@ egg_sqlite_store_init (EggSqliteStore *self)
 	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
 	g_assert (priv);
 
-	priv->cache = g_tree_new_full ((GCompareDataFunc*) strcmp,
-								   NULL, NULL, g_ptr_array_free_full);
+	priv->cache = egg_sqlite_cache_new (EGG_SQLITE_STORE_CACHE_SIZE);
 	g_assert (priv->cache);
 	
-	priv->rcache = g_tree_new ((GCompareDataFunc*) g_int_cmp);
-	g_assert (priv->rcache);
+	for (i = 0; i < EGG_SQLITE_STORE_N_BLOCKS; i++) {
+		priv->blocks[i].rowids = g_array_sized_new (FALSE, FALSE, sizeof (gint64),
+													EGG_SQLITE_STORE_BLOCK_SIZE);
+		priv->blocks[i].first = -1;
+	}
+
+	priv->batch_appended = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+	priv->loading = g_hash_table_new (g_direct_hash, g_direct_equal);
+	priv->visible_last = -1;
+
+	priv->updates = g_array_new (FALSE, FALSE, sizeof (EggSqliteUpdate));
 }
 
 static void
 egg_sqlite_store_finalize (GObject *self)
 {
 	EggSqliteStorePrivate *priv;
+	gint                   i;
 
 	g_return_if_fail (EGG_IS_SQLITE_STORE (self));
 
 	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
 	g_assert (priv);
 
+	/* pending loads hold a reference, none can be queued by now */
+	priv->index_pending = FALSE;
+	egg_sqlite_store_disable_async (EGG_SQLITE_STORE (self));
+
+	if (priv->updates_idle)
+		g_source_remove (priv->updates_idle);
+	if (priv->watch_source)
+		g_source_remove (priv->watch_source);
+
+	/* statements must be finalized before the connection closes */
+	egg_sqlite_statements_free (priv->stmts);
+
 	if (priv->dbh)
 		sqlite3_close (priv->dbh);
 
 	if (priv->table)
 		g_free (priv->table);
 
+	g_free (priv->filename);
+	g_free (priv->column_types);
+
+	if (priv->batch_appended)
+		g_array_free (priv->batch_appended, TRUE);
+
+	for (i = 0; i < EGG_SQLITE_STORE_N_BLOCKS; i++)
+		g_array_free (priv->blocks[i].rowids, TRUE);
+
+	g_hash_table_destroy (priv->loading);
+	g_array_free (priv->updates, TRUE);
+
 	if (priv->cache)
-		g_tree_destroy (priv->cache);
+		egg_sqlite_cache_free (priv->cache);
 
 	G_OBJECT_CLASS (parent_class)->finalize (self);
 }
@@ -172,7 +801,7 @@ egg_sqlite_store_get_column_type (GtkTreeModel *tree_model,
 						  G_TYPE_INVALID);
 	g_return_val_if_fail (index < EGG_SQLITE_STORE (tree_model)->n_columns
 						  && index >= 0, G_TYPE_INVALID);
-	return G_TYPE_STRING;
+	return EGG_SQLITE_STORE_GET_PRIVATE (tree_model)->column_types[index];
 }
 
 static gboolean
@@ -180,49 +809,17 @@ egg_sqlite_store_get_iter (GtkTreeModel *tree_model,
 						   GtkTreeIter  *iter,
 						   GtkTreePath  *path)
 {
-	EggSqliteStore		*self;
-	EggSqliteStorePrivate *priv;
-	GPtrArray				*data;
-	gint				  *indices, depth;
+	gint *indices, depth;
 
 	g_assert (EGG_IS_SQLITE_STORE (tree_model));
 	g_assert (path != NULL);
 
-	self = EGG_SQLITE_STORE (tree_model);
-	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
-	g_assert (priv);
-
 	indices = gtk_tree_path_get_indices (path);
 	depth = gtk_tree_path_get_depth (path);
 
 	g_assert (depth == 1);
 
-	/* lookup the row position b-tree cache */
-	data = g_tree_lookup (priv->rcache, GINT_TO_POINTER (indices[0]));
-	
-	if (!data) {
-		data = egg_sqlite_fetch_nth_row (priv->dbh, priv->table, indices[0]);
-	}
-
-	/* DON'T FREE THE KEY! */
-	gchar *key = g_ptr_array_index (data, 0);
-
-	if (data && key) {
-		if (g_tree_lookup (priv->cache, key) == NULL)
-			g_tree_insert (priv->cache, key, data);
-		if (g_tree_lookup (priv->rcache, GINT_TO_POINTER (indices[0])) == NULL)
-			g_tree_insert (priv->rcache, GINT_TO_POINTER (indices[0]), data);
-	}
-
-	if (!data || data->len < 1)
-		return FALSE;
-
-	iter->stamp = self->stamp;
-	iter->user_data = key;
-	iter->user_data2 = NULL;
-	iter->user_data3 = NULL;
-
-	return TRUE;
+	return egg_sqlite_store_iter_at (EGG_SQLITE_STORE (tree_model), iter, indices[0]);
 }
 
 
@@ -237,13 +834,16 @@ egg_sqlite_store_get_path (GtkTreeModel *tree_model,
 
 	g_return_val_if_fail (EGG_IS_SQLITE_STORE (tree_model), NULL);
 	g_return_val_if_fail (iter != NULL, NULL);
-	g_return_val_if_fail (iter->user_data != NULL, NULL);
 
 	self = EGG_SQLITE_STORE (tree_model);
+	g_return_val_if_fail (iter->stamp == self->stamp, NULL);
+
 	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
 	g_assert (priv);
 
-	pos = egg_sqlite_fetch_row_pos (priv->dbh, priv->table, iter->user_data);
+	/* the row was deleted under the iter */
+	if ((pos = egg_sqlite_fetch_row_pos (priv->stmts, ITER_ROWID (iter))) < 0)
+		return NULL;
 
 	path = gtk_tree_path_new ();
 	gtk_tree_path_append_index (path, pos);
@@ -259,29 +859,35 @@ egg_sqlite_store_get_value (GtkTreeModel *tree_model,
 {
 	EggSqliteStore		*self;
 	EggSqliteStorePrivate *priv;
-	GPtrArray				*data;
+	EggSqliteRow		  *data = NULL;
+	gint64				   rowid;
+	gint				   pos;
 
 	g_return_if_fail (EGG_IS_SQLITE_STORE (tree_model));
-	g_return_if_fail (iter != NULL || iter->user_data != NULL);
+	g_return_if_fail (iter != NULL);
 	g_return_if_fail (column < EGG_SQLITE_STORE (tree_model)->n_columns);
 
 	self = EGG_SQLITE_STORE (tree_model);
 	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
 	g_assert (priv);
 
-	g_value_init (value, G_TYPE_STRING);
+	g_value_init (value, priv->column_types[column]);
 
-	data = g_tree_lookup (priv->cache, iter->user_data);
+	g_return_if_fail (iter->stamp == self->stamp);
 
-	if (!data) {
-		data = egg_sqlite_fetch_row (priv->dbh, priv->table, iter->user_data);
-		
-		/* Cache the results if they were retrieved */
-		if (data) g_tree_insert (priv->cache, iter->user_data, data);
+	if (ASYNC (priv)) {
+		/* the row comes with its block, views are told when it arrives */
+		rowid = ITER_ROWID (iter);
+		if (!(data = egg_sqlite_cache_lookup (priv->cache, rowid)) &&
+		    (pos = egg_sqlite_fetch_row_pos (priv->stmts, rowid)) >= 0)
+			egg_sqlite_store_load (self, pos, TRUE);
 	}
+	else
+		data = egg_sqlite_store_get_row (priv, ITER_ROWID (iter));
 
-	if (data && column < data->len)
-		g_value_set_string (value, g_ptr_array_index (data, column));
+	/* numbers go straight from the row into the GValue, no text between */
+	if (data)
+		egg_sqlite_row_get_value (data, column, value);
 }
 
 static gboolean
@@ -290,38 +896,32 @@ egg_sqlite_store_iter_next (GtkTreeModel *tree_model,
 {
 	EggSqliteStore		  *self;
 	EggSqliteStorePrivate *priv;
-	GPtrArray             *data = NULL;
+	gint64                 rowid;
+	gint                   i;
 
 	g_return_val_if_fail (EGG_IS_SQLITE_STORE (tree_model), FALSE);
 
-	if (iter == NULL || iter->user_data == NULL)
+	self = EGG_SQLITE_STORE (tree_model);
+
+	if (iter == NULL || iter->stamp != self->stamp)
 	  return FALSE;
 
-	self = EGG_SQLITE_STORE (tree_model);
 	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
 
-	/* if a oid is set in iter->user_data, lets convert it to an integer
-	 * and increment it by one. if that value is found in the cache, we
-	 * use it instead of doing a sqlite query. Note that this still isn't
-	 * a good way to do this since cache would never hit if a row was
-	 * removed from the table.
-	 */
-	if (iter->user_data) {
-		gchar *key = g_strdup_printf ("%d", atoi (iter->user_data) + 1);
-		data = g_tree_lookup (priv->cache, key);
-		g_free (key);
-	}
+	rowid = ITER_ROWID (iter);
 
-	if (!data) {
-		data = egg_sqlite_fetch_next (priv->dbh, priv->table, iter->user_data);
-		if (data != NULL && data->len > 0) {
-			g_tree_insert (priv->cache, g_ptr_array_index (data, 0), data);
-		} else return FALSE;
+	/* in async mode walk the rank index, the next block may still be loading */
+	if (ASYNC (priv)) {
+		if ((i = egg_sqlite_fetch_row_pos (priv->stmts, rowid)) < 0)
+			return FALSE;
+		return egg_sqlite_store_iter_at (self, iter, i + 1);
 	}
 
-	iter->user_data = g_ptr_array_index (data, 0);
-	iter->user_data2 = NULL;
-	iter->user_data3 = NULL;
+	/* served from a block, one query per block otherwise */
+	if (!egg_sqlite_store_get_next (priv, rowid, &rowid))
+		return FALSE;
+
+	ITER_SET_ROWID (iter, rowid);
 
 	return TRUE;
 }
@@ -331,38 +931,13 @@ egg_sqlite_store_iter_children (GtkTreeModel *tree_model,
 								GtkTreeIter  *iter,
 								GtkTreeIter  *parent)
 {
-	EggSqliteStore		*self;
-	EggSqliteStorePrivate *priv;
-	GPtrArray				*data;
-	gchar				 *key;
-
 	g_return_val_if_fail (EGG_IS_SQLITE_STORE (tree_model), FALSE);
 
-	self = EGG_SQLITE_STORE (tree_model);
-	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
-	g_assert (priv);
-
-	key = g_strdup ("1");
-	data = g_tree_lookup (priv->cache, key);
-	g_free (key);
+	if (parent)
+		return FALSE;
 
-	if (!data) {
-		data = egg_sqlite_fetch_next (priv->dbh, priv->table, NULL);
-		if (data) {
-			g_tree_insert (priv->cache, g_ptr_array_index (data, 0), data);
-		}
-	}
-
-	if (data) {
-		iter->stamp = self->stamp;
-		iter->user_data = g_ptr_array_index (data, 0);
-		iter->user_data2 = NULL;
-		iter->user_data3 = NULL;
-		return TRUE;
-	}
-
-	return FALSE;
-}
+	return egg_sqlite_store_iter_at (EGG_SQLITE_STORE (tree_model), iter, 0);
+}
 
 static gboolean
 egg_sqlite_store_iter_has_child (GtkTreeModel *tree_model,
@@ -379,14 +954,16 @@ egg_sqlite_store_iter_n_children (GtkTreeModel *tree_model,
 	EggSqliteStorePrivate *priv;
 
 	g_return_val_if_fail (EGG_IS_SQLITE_STORE (tree_model), -1);
-	g_return_val_if_fail (iter == NULL || iter->user_data != NULL, -1);
+	g_return_val_if_fail (iter == NULL || iter->stamp == EGG_SQLITE_STORE (tree_model)->stamp, -1);
 
 	self = EGG_SQLITE_STORE (tree_model);
 	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
 	g_assert (priv);
 
 	if (!iter) {
-		return egg_sqlite_count_rows (priv->dbh, priv->table);
+		if (priv->index_pending)
+			return 0;
+		return egg_sqlite_count_rows (priv->stmts);
 	}
 
 	return 0;
@@ -398,35 +975,12 @@ egg_sqlite_store_iter_nth_child (GtkTreeModel *tree_model,
 								 GtkTreeIter  *parent,
 								 gint		  n)
 {
-	EggSqliteStore		*self;
-	EggSqliteStorePrivate *priv;
-	GPtrArray				*data;
-
 	g_return_val_if_fail (EGG_IS_SQLITE_STORE (tree_model), FALSE);
 
-	self = EGG_SQLITE_STORE (tree_model);
-	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
-	g_assert (priv);
-
 	if (parent)
 		return FALSE;
 
-	iter->stamp = self->stamp;
-	iter->user_data = NULL;
-	iter->user_data2 = NULL;
-	iter->user_data3 = NULL;
-
-	data = egg_sqlite_fetch_nth_row (priv->dbh, priv->table, n);
-
-	if (data && !g_tree_lookup (priv->cache, g_ptr_array_index (data, 0)))
-		g_tree_insert (priv->cache, g_ptr_array_index (data, 0), data);
-
-	if (data) {
-		iter->user_data = g_ptr_array_index (data, 0);
-		return TRUE;
-	}
-
-	return FALSE;
+	return egg_sqlite_store_iter_at (EGG_SQLITE_STORE (tree_model), iter, n);
 }
 
 static gboolean
@@ -477,6 +1031,8 @@ egg_sqlite_store_set_filename (EggSqliteStore  *self,
 							  "Error opening database!");
 		return;
 	}
+
+	priv->filename = g_strdup (filename);
 }
 
 void
@@ -507,7 +1063,16 @@ egg_sqlite_store_set_table (EggSqliteStore  *self,
 	if (priv->table)
 		g_free (priv->table);
 	priv->table = g_strdup (table);
-	self->n_columns = egg_sqlite_fetch_n_columns (priv->dbh, priv->table);
+	priv->stmts = egg_sqlite_statements_new (priv->dbh, priv->table);
+	priv->column_types = egg_sqlite_fetch_column_types (priv->dbh, priv->table,
+														&self->n_columns);
+
+	/* writes others make on the connection are announced as they happen */
+	priv->total_changes = sqlite3_total_changes (priv->dbh);
+	priv->has_unique = egg_sqlite_has_unique_index (priv->dbh, priv->table);
+	sqlite3_update_hook (priv->dbh, egg_sqlite_store_update_hook, self);
+	sqlite3_commit_hook (priv->dbh, egg_sqlite_store_commit_hook, self);
+	sqlite3_rollback_hook (priv->dbh, egg_sqlite_store_rollback_hook, self);
 }
 
 const gchar*
@@ -517,39 +1082,1140 @@ egg_sqlite_store_get_table (EggSqliteStore *self)
 	return EGG_SQLITE_STORE_GET_PRIVATE (self)->table;
 }
 
+/**
+ * egg_sqlite_store_set_cache_size:
+ * @self: A #EggSqliteStore.
+ * @bytes: Memory ceiling of the row cache.
+ *
+ * Bounds the rows kept in memory, the least recently used are dropped and
+ * fetched again when next needed.  Defaults to
+ * EGG_SQLITE_STORE_CACHE_SIZE.
+ **/
+void
+egg_sqlite_store_set_cache_size (EggSqliteStore *self,
+								 gsize			 bytes)
+{
+	g_return_if_fail (EGG_IS_SQLITE_STORE (self));
+	egg_sqlite_cache_set_max_bytes (EGG_SQLITE_STORE_GET_PRIVATE (self)->cache, bytes);
+}
+
+gsize
+egg_sqlite_store_get_cache_size (EggSqliteStore *self)
+{
+	g_return_val_if_fail (EGG_IS_SQLITE_STORE (self), 0);
+	return egg_sqlite_cache_get_max_bytes (EGG_SQLITE_STORE_GET_PRIVATE (self)->cache);
+}
+
+/**
+ * egg_sqlite_store_get_cache_stats:
+ * @self: A #EggSqliteStore.
+ * @hits: Location for the number of rows found in the cache, or NULL.
+ * @misses: Location for the number of rows that were not, or NULL.
+ * @evictions: Location for the number of rows dropped for space, or NULL.
+ * @bytes: Location for the bytes currently cached, or NULL.
+ **/
+void
+egg_sqlite_store_get_cache_stats (EggSqliteStore *self,
+								  guint			 *hits,
+								  guint			 *misses,
+								  guint			 *evictions,
+								  gsize			 *bytes)
+{
+	g_return_if_fail (EGG_IS_SQLITE_STORE (self));
+	egg_sqlite_cache_get_stats (EGG_SQLITE_STORE_GET_PRIVATE (self)->cache,
+								hits, misses, evictions, bytes);
+}
+
+/* index of oid among the rows appended in the open batch, or -1 */
+static gint
+egg_sqlite_store_batch_find (EggSqliteStorePrivate *priv, gint64 oid)
+{
+	gint i;
+
+	if (priv->batch_depth == 0)
+		return -1;
+
+	for (i = (gint)priv->batch_appended->len - 1; i >= 0; i--)
+		if (g_array_index (priv->batch_appended, gint64, i) == oid)
+			return i;
+
+	return -1;
+}
+
+static void
+egg_sqlite_store_emit (EggSqliteStore *self, gint64 oid, gboolean inserted)
+{
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	GtkTreeIter            iter = { 0, };
+	GtkTreePath           *path;
+	gint                   pos;
+
+	/* a row others deleted meanwhile has nothing left to announce */
+	if ((pos = egg_sqlite_fetch_row_pos (priv->stmts, oid)) < 0)
+		return;
+
+	iter.stamp = self->stamp;
+	ITER_SET_ROWID (&iter, oid);
+
+	path = gtk_tree_path_new ();
+	gtk_tree_path_append_index (path, pos);
+
+	if (inserted)
+		gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, &iter);
+	else
+		gtk_tree_model_row_changed (GTK_TREE_MODEL (self), path, &iter);
+
+	gtk_tree_path_free (path);
+}
+
+/* rows at pos and after moved, blocks there no longer say where */
+static void
+egg_sqlite_store_invalidate_from (EggSqliteStorePrivate *priv, gint pos)
+{
+	EggSqliteBlock *block;
+	gint            i;
+
+	for (i = 0; i < EGG_SQLITE_STORE_N_BLOCKS; i++) {
+		block = &priv->blocks[i];
+		if (block->first < 0 || block->first + (gint)block->rowids->len > pos) {
+			g_array_set_size (block->rowids, 0);
+			block->first = -1;
+		}
+	}
+}
+
+static void
+egg_sqlite_store_collect_rowid (gint64 rowid, EggSqliteRow *row, gpointer data)
+{
+	g_array_append_val ((GArray*)data, rowid);
+}
+
+/* rows that came and went, as egg_sqlite_statements_resync() gives them */
+static void
+egg_sqlite_store_announce (EggSqliteStore *self, GArray *deleted, GArray *inserted)
+{
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	EggSqliteChange       *change;
+	GtkTreeIter            iter = { 0, };
+	GtkTreePath           *path;
+	guint                  i;
+
+	if (deleted->len && inserted->len)
+		egg_sqlite_store_invalidate_from (priv, MIN (g_array_index (deleted, EggSqliteChange, 0).pos,
+		                                             g_array_index (inserted, EggSqliteChange, 0).pos));
+	else if (deleted->len)
+		egg_sqlite_store_invalidate_from (priv, g_array_index (deleted, EggSqliteChange, 0).pos);
+	else if (inserted->len)
+		egg_sqlite_store_invalidate_from (priv, g_array_index (inserted, EggSqliteChange, 0).pos);
+
+	/* from the end, so each position is still the one views know */
+	for (i = deleted->len; i > 0; i--) {
+		change = &g_array_index (deleted, EggSqliteChange, i - 1);
+		if (change->oid >= 0)
+			egg_sqlite_cache_remove (priv->cache, change->oid);
+		path = gtk_tree_path_new ();
+		gtk_tree_path_append_index (path, change->pos);
+		gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+		gtk_tree_path_free (path);
+	}
+
+	for (i = 0; i < inserted->len; i++) {
+		change = &g_array_index (inserted, EggSqliteChange, i);
+		if (change->oid >= 0) {
+			iter.stamp = self->stamp;
+			ITER_SET_ROWID (&iter, change->oid);
+		}
+		else if (!egg_sqlite_store_iter_at (self, &iter, change->pos))
+			break;
+		path = gtk_tree_path_new ();
+		gtk_tree_path_append_index (path, change->pos);
+		gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, &iter);
+		gtk_tree_path_free (path);
+	}
+}
+
+/*
+ * Ends the wait for the index in async mode.  Views were shown no rows
+ * until now, so every row is announced; without an index from the worker
+ * it is built here.
+ */
+static void
+egg_sqlite_store_install_index (EggSqliteStore *self, EggSqliteIndex *index)
+{
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	GArray                *deleted, *inserted;
+	EggSqliteChange        change;
+	gint                   n_rows;
+
+	priv->index_pending = FALSE;
+
+	if (!index && !(index = egg_sqlite_statements_build_index (priv->stmts)))
+		return;
+
+	egg_sqlite_statements_set_index (priv->stmts, index, NULL, NULL);
+	egg_sqlite_store_written (priv);
+
+	deleted = g_array_new (FALSE, FALSE, sizeof (EggSqliteChange));
+	inserted = g_array_new (FALSE, FALSE, sizeof (EggSqliteChange));
+
+	n_rows = egg_sqlite_count_rows (priv->stmts);
+	for (change.pos = 0; change.pos < n_rows; change.pos++) {
+		change.oid = egg_sqlite_statements_rowid_at (priv->stmts, change.pos);
+		g_array_append_val (inserted, change);
+	}
+
+	egg_sqlite_store_announce (self, deleted, inserted);
+
+	g_array_free (deleted, TRUE);
+	g_array_free (inserted, TRUE);
+}
+
+/* a write cannot wait for the worker's index, nor be announced without one */
+static void
+egg_sqlite_store_need_index (EggSqliteStore *self)
+{
+	if (EGG_SQLITE_STORE_GET_PRIVATE (self)->index_pending)
+		egg_sqlite_store_install_index (self, NULL);
+}
+
+/*
+ * Compares cached rows, the ones views have been shown, with the same
+ * rows read again; row-changed goes out only for those that differ.
+ * rowids are in cache order, most recently used first, and fresh holds
+ * their rows as read again, NULL for those gone, or is NULL itself to
+ * read them here.
+ */
+static void
+egg_sqlite_store_refresh (EggSqliteStore *self, GArray *rowids, GPtrArray *fresh_rows)
+{
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	EggSqliteRow          *cached, *fresh = NULL;
+	gint64                 rowid;
+	guint                  i;
+
+	/* least recently used first, so the lookups leave the order as it was */
+	for (i = rowids->len; i > 0; i--) {
+		rowid = g_array_index (rowids, gint64, i - 1);
+		if (fresh_rows) {
+			fresh = g_ptr_array_index (fresh_rows, i - 1);
+			g_ptr_array_index (fresh_rows, i - 1) = NULL;
+		}
+		if (!(cached = egg_sqlite_cache_lookup (priv->cache, rowid))) {
+			egg_sqlite_row_free (fresh);
+			continue;
+		}
+		if (!fresh_rows)
+			fresh = egg_sqlite_fetch_row (priv->stmts, rowid);
+		if (!fresh) {
+			egg_sqlite_cache_remove (priv->cache, rowid);
+			continue;
+		}
+		if (egg_sqlite_row_equal (cached, fresh)) {
+			egg_sqlite_row_free (fresh);
+			continue;
+		}
+		egg_sqlite_cache_insert (priv->cache, rowid, fresh);
+		egg_sqlite_store_emit (self, rowid, FALSE);
+	}
+}
+
+/*
+ * Brings views up to date after writes nobody reported row by row: the
+ * rank index before and after gives the rows that came and went, and
+ * cached rows are fetched again and compared for those that changed.  In
+ * async mode the worker does the scan and the fetching, and views hear
+ * of it when it is done.
+ */
+static void
+egg_sqlite_store_resync (EggSqliteStore *self)
+{
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	EggSqliteLoad         *load;
+	GArray                *deleted, *inserted, *rowids;
+
+	if (ASYNC (priv)) {
+		/* one at a time, another is asked for once it is done */
+		if (priv->resyncing) {
+			priv->resync_again = TRUE;
+			return;
+		}
+
+		load = g_slice_new0 (EggSqliteLoad);
+		load->self = g_object_ref (self);
+		load->kind = LOAD_RESYNC;
+		load->gen = g_atomic_int_get (&priv->async_gen);
+		load->oids = g_array_new (FALSE, FALSE, sizeof (gint64));
+		egg_sqlite_cache_foreach (priv->cache, egg_sqlite_store_collect_rowid, load->oids);
+
+		priv->resyncing = TRUE;
+		g_thread_pool_push (priv->async_pool, load, NULL);
+		return;
+	}
+
+	deleted = g_array_new (FALSE, FALSE, sizeof (EggSqliteChange));
+	inserted = g_array_new (FALSE, FALSE, sizeof (EggSqliteChange));
+
+	egg_sqlite_statements_resync (priv->stmts, deleted, inserted);
+	egg_sqlite_store_announce (self, deleted, inserted);
+
+	g_array_free (deleted, TRUE);
+	g_array_free (inserted, TRUE);
+
+	rowids = g_array_new (FALSE, FALSE, sizeof (gint64));
+	egg_sqlite_cache_foreach (priv->cache, egg_sqlite_store_collect_rowid, rowids);
+	egg_sqlite_store_refresh (self, rowids, NULL);
+	g_array_free (rowids, TRUE);
+
+	egg_sqlite_store_written (priv);
+}
+
+/* one write made on our connection by someone else, announced in turn */
+static void
+egg_sqlite_store_apply_update (EggSqliteStore *self, gint op, gint64 rowid)
+{
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	GtkTreePath           *path;
+	gboolean               known;
+	gint                   pos;
+
+	/* the index still has the table as views know it */
+	pos = egg_sqlite_fetch_row_pos (priv->stmts, rowid);
+	known = pos >= 0;
+
+	switch (op) {
+	case SQLITE_INSERT:
+		if (!known) {
+			egg_sqlite_statements_row_inserted (priv->stmts, rowid);
+			egg_sqlite_store_invalidate_from (priv, egg_sqlite_fetch_row_pos (priv->stmts, rowid));
+			egg_sqlite_store_emit (self, rowid, TRUE);
+			break;
+		}
+		/* an INSERT OR REPLACE of a row that was there */
+	case SQLITE_UPDATE:
+		if (known) {
+			egg_sqlite_cache_remove (priv->cache, rowid);
+			egg_sqlite_store_emit (self, rowid, FALSE);
+		}
+		break;
+	case SQLITE_DELETE:
+		if (known) {
+			egg_sqlite_statements_row_deleted (priv->stmts, rowid);
+			egg_sqlite_cache_remove (priv->cache, rowid);
+			egg_sqlite_store_invalidate_from (priv, pos);
+			path = gtk_tree_path_new ();
+			gtk_tree_path_append_index (path, pos);
+			gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+			gtk_tree_path_free (path);
+		}
+		break;
+	default:
+		break;
+	}
+
+	egg_sqlite_store_written (priv);
+}
+
+/*
+ * Announces the writes the hooks noted, unless a batch is open.  Returns
+ * TRUE if that took a resync, or one is left to the worker, so callers
+ * need not resync again.
+ */
+static gboolean
+egg_sqlite_store_flush_updates (EggSqliteStore *self)
+{
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	EggSqliteUpdate        update;
+	gint                   total;
+	guint                  i;
+
+	if (priv->batch_depth > 0)
+		return FALSE;
+
+	/*
+	 * More rows changed than the update hook was told of: a DELETE without
+	 * a WHERE truncates the table unseen.  Rows an INSERT or UPDATE OR
+	 * REPLACE deleted in its way are not even counted, so on a table with
+	 * a unique index any such write is suspect.
+	 */
+	total = sqlite3_total_changes (priv->dbh);
+	if (total - priv->total_changes - priv->own_changes > (gint)priv->hooked)
+		priv->resync_pending = TRUE;
+	priv->total_changes = total;
+	priv->own_changes = 0;
+	priv->hooked = 0;
+
+	for (i = 0; priv->has_unique && i < priv->updates->len; i++)
+		if (g_array_index (priv->updates, EggSqliteUpdate, i).op != SQLITE_DELETE)
+			priv->resync_pending = TRUE;
+
+	/*
+	 * Views know of no rows yet.  Committed writes are in the index the
+	 * worker builds if it starts over; one still open is not, and the
+	 * index is built here instead.
+	 */
+	if (priv->index_pending && sqlite3_get_autocommit (priv->dbh)) {
+		g_array_set_size (priv->updates, 0);
+		priv->resync_pending = FALSE;
+		egg_sqlite_store_written (priv);
+		return TRUE;
+	}
+	egg_sqlite_store_need_index (self);
+
+	/* without the index as it was, only a comparison can tell */
+	if (priv->resync_pending ||
+	    (priv->updates->len && !egg_sqlite_statements_is_indexed (priv->stmts)))
+	{
+		g_array_set_size (priv->updates, 0);
+		priv->resync_pending = FALSE;
+		egg_sqlite_store_resync (self);
+		return TRUE;
+	}
+
+	/* handlers may write too, their updates are appended and taken in turn */
+	for (i = 0; i < priv->updates->len; i++) {
+		update = g_array_index (priv->updates, EggSqliteUpdate, i);
+		egg_sqlite_store_apply_update (self, update.op, update.rowid);
+	}
+
+	g_array_set_size (priv->updates, 0);
+
+	return FALSE;
+}
+
+static gboolean
+egg_sqlite_store_updates_idle (gpointer data)
+{
+	EggSqliteStore        *self = data;
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+
+	priv->updates_idle = 0;
+	egg_sqlite_store_flush_updates (self);
+
+	return FALSE;
+}
+
+static void
+egg_sqlite_store_queue_updates (EggSqliteStore *self)
+{
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+
+	if (!priv->updates_idle)
+		priv->updates_idle = g_idle_add (egg_sqlite_store_updates_idle, self);
+}
+
+/* runs within sqlite3_step(), which must not be reentered, so only notes */
+static void
+egg_sqlite_store_update_hook (gpointer       data,
+                              gint           op,
+                              const gchar   *database,
+                              const gchar   *table,
+                              sqlite3_int64  rowid)
+{
+	EggSqliteStore        *self = data;
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	EggSqliteUpdate        update;
+
+	if (priv->writing)
+		return;
+
+	/* the change counts cover every table, so does the tally */
+	priv->hooked++;
+
+	if (strcmp (database, "main") != 0 ||
+	    g_ascii_strcasecmp (table, priv->table) != 0)
+		return;
+
+	update.op = op;
+	update.rowid = rowid;
+	g_array_append_val (priv->updates, update);
+
+	egg_sqlite_store_queue_updates (self);
+}
+
+/* writes already announced may be undone, compare once it is over */
+static void
+egg_sqlite_store_rollback_hook (gpointer data)
+{
+	EggSqliteStore        *self = data;
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+
+	if (priv->writing)
+		return;
+
+	priv->resync_pending = TRUE;
+	egg_sqlite_store_queue_updates (self);
+}
+
+/* a truncating DELETE calls no update hook, the counts are checked after */
+static gint
+egg_sqlite_store_commit_hook (gpointer data)
+{
+	EggSqliteStore        *self = data;
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+
+	if (!priv->writing)
+		egg_sqlite_store_queue_updates (self);
+
+	return 0;
+}
+
+/* polls for commits made by other connections, which the hooks never see */
+static gboolean
+egg_sqlite_store_watch (gpointer data)
+{
+	EggSqliteStore        *self = data;
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	gint                   version;
+
+	/* our own transaction is open, nobody else can have committed */
+	if (priv->batch_depth > 0)
+		return TRUE;
+
+	version = egg_sqlite_data_version (priv->stmts);
+	if (version == priv->data_version)
+		return TRUE;
+
+	priv->data_version = version;
+
+	/* the worker's index may predate the commit, it starts over */
+	if (priv->index_pending) {
+		egg_sqlite_store_written (priv);
+		return TRUE;
+	}
+
+	/* ours first, while the index still matches them */
+	if (!egg_sqlite_store_flush_updates (self))
+		egg_sqlite_store_resync (self);
+
+	return TRUE;
+}
+
+/**
+ * egg_sqlite_store_set:
+ * @self: A #EggSqliteStore.
+ * @iter: A valid iter for the row being modified.
+ * @Varargs: pairs of column number and value, terminated by -1.
+ *
+ * Sets the values of one or more cells, as gtk_list_store_set() does.
+ * Column 0 is the oid and cannot be set.  Outside of a batch the columns
+ * are written in one transaction.
+ **/
 void
 egg_sqlite_store_set (EggSqliteStore *self,
 					  GtkTreeIter	*iter,
 					  ...)
 {
-#warning egg_sqlite_store_set not implemented
+	EggSqliteStorePrivate *priv;
+	va_list                args;
+	GValue                 value = { 0, };
+	gchar                 *error = NULL;
+	gboolean               own_txn;
+	gboolean               ok = TRUE;
+	gint64                 oid;
+	gint                   column;
+
+	g_return_if_fail (EGG_IS_SQLITE_STORE (self));
+	g_return_if_fail (iter != NULL && iter->stamp == self->stamp);
+
+	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	g_return_if_fail (priv->stmts != NULL);
+
+	egg_sqlite_store_need_index (self);
+	oid = ITER_ROWID (iter);
+
+	egg_sqlite_store_write_begin (priv);
+	own_txn = priv->batch_depth == 0 && egg_sqlite_begin (priv->stmts);
+
+	va_start (args, iter);
+
+	for (column = va_arg (args, gint); column != -1; column = va_arg (args, gint)) {
+		if (column < 1 || column >= self->n_columns) {
+			g_warning ("%s: Invalid column number %d added to iter",
+					   G_STRLOC, column);
+			ok = FALSE;
+			break;
+		}
+
+		g_value_init (&value, priv->column_types[column]);
+		G_VALUE_COLLECT (&value, args, 0, &error);
+		if (error) {
+			g_warning ("%s: %s", G_STRLOC, error);
+			g_free (error);
+			g_value_unset (&value);
+			ok = FALSE;
+			break;
+		}
+
+		if (!egg_sqlite_update_value (priv->stmts, oid, column, &value)) {
+			g_warning ("%s: %s", G_STRLOC, sqlite3_errmsg (priv->dbh));
+			ok = FALSE;
+		}
+
+		g_value_unset (&value);
+	}
+
+	va_end (args);
+
+	/* a row is either set as a whole or not at all */
+	if (own_txn && !(ok && egg_sqlite_commit (priv->stmts))) {
+		egg_sqlite_rollback (priv->stmts);
+		egg_sqlite_store_write_end (priv);
+		return;
+	}
+	egg_sqlite_store_write_end (priv);
+
+	if (!ok && priv->batch_depth > 0)
+		priv->batch_failed = TRUE;
+
+	egg_sqlite_cache_remove (priv->cache, oid);
+	egg_sqlite_store_written (priv);
+
+	/* rows appended in the batch are announced whole when it ends */
+	if (egg_sqlite_store_batch_find (priv, oid) < 0)
+		egg_sqlite_store_emit (self, oid, FALSE);
 }
 
+/**
+ * egg_sqlite_store_clear:
+ * @self: A #EggSqliteStore.
+ *
+ * Deletes every row of the table.
+ **/
 void
 egg_sqlite_store_clear (EggSqliteStore  *self)
 {
-#warning egg_sqlite_store_clear not implemented
+	EggSqliteStorePrivate *priv;
+	GtkTreePath           *path;
+	gint                   n_rows;
+
+	g_return_if_fail (EGG_IS_SQLITE_STORE (self));
+
+	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	g_return_if_fail (priv->stmts != NULL);
+
+	egg_sqlite_store_need_index (self);
+
+	/* rows appended in an open batch were never announced */
+	n_rows = egg_sqlite_count_rows (priv->stmts) - (gint) priv->batch_appended->len;
+
+	egg_sqlite_store_write_begin (priv);
+	if (!egg_sqlite_delete_all (priv->stmts)) {
+		egg_sqlite_store_write_end (priv);
+		g_warning ("%s: %s", G_STRLOC, sqlite3_errmsg (priv->dbh));
+		if (priv->batch_depth > 0)
+			priv->batch_failed = TRUE;
+		return;
+	}
+	egg_sqlite_store_write_end (priv);
+
+	egg_sqlite_cache_clear (priv->cache);
+	egg_sqlite_store_invalidate_blocks (priv);
+	egg_sqlite_store_written (priv);
+	g_array_set_size (priv->batch_appended, 0);
+
+	/* rows others wrote and views were not told of are gone too */
+	g_array_set_size (priv->updates, 0);
+
+	path = gtk_tree_path_new_first ();
+	for (; n_rows > 0; n_rows--)
+		gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+	gtk_tree_path_free (path);
 }
 
+/**
+ * egg_sqlite_store_iter_is_valid:
+ * @self: A #EggSqliteStore.
+ * @iter: A #GtkTreeIter.
+ *
+ * Checks that @iter belongs to @self and its row still exists.  Slow,
+ * it may have to ask SQLite; meant for debugging.
+ **/
 gboolean
 egg_sqlite_store_iter_is_valid (EggSqliteStore *self,
 								GtkTreeIter	*iter)
 {
-#warning egg_sqlite_store_iter_is_valid not Implemented
-	return TRUE;
+	EggSqliteStorePrivate *priv;
+
+	g_return_val_if_fail (EGG_IS_SQLITE_STORE (self), FALSE);
+	g_return_val_if_fail (iter != NULL, FALSE);
+
+	if (iter->stamp != self->stamp)
+		return FALSE;
+
+	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+
+	return egg_sqlite_store_get_row (priv, ITER_ROWID (iter)) != NULL;
 }
 
+/**
+ * egg_sqlite_store_remove:
+ * @self: A #EggSqliteStore.
+ * @iter: A valid iter, invalid afterwards.
+ *
+ * Deletes the row at @iter.
+ **/
 void
 egg_sqlite_store_remove (EggSqliteStore *self,
 						 GtkTreeIter	*iter)
 {
-#warning egg_sqlite_store_remove not Implemented.
+	EggSqliteStorePrivate *priv;
+	GtkTreePath           *path;
+	gint64                 oid;
+	gint                   pos, pending;
+
+	g_return_if_fail (EGG_IS_SQLITE_STORE (self));
+	g_return_if_fail (iter != NULL && iter->stamp == self->stamp);
+
+	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	g_return_if_fail (priv->stmts != NULL);
+
+	egg_sqlite_store_need_index (self);
+	oid = ITER_ROWID (iter);
+	if ((pos = egg_sqlite_fetch_row_pos (priv->stmts, oid)) < 0)
+		return;
+	iter->stamp = 0;
+
+	egg_sqlite_store_write_begin (priv);
+	if (!egg_sqlite_delete_row (priv->stmts, oid)) {
+		egg_sqlite_store_write_end (priv);
+		g_warning ("%s: %s", G_STRLOC, sqlite3_errmsg (priv->dbh));
+		if (priv->batch_depth > 0)
+			priv->batch_failed = TRUE;
+		return;
+	}
+	egg_sqlite_store_write_end (priv);
+
+	egg_sqlite_cache_remove (priv->cache, oid);
+	egg_sqlite_store_invalidate_blocks (priv);
+	egg_sqlite_store_written (priv);
+
+	/* appended and removed within one batch, views never knew of it */
+	if ((pending = egg_sqlite_store_batch_find (priv, oid)) >= 0) {
+		g_array_remove_index (priv->batch_appended, pending);
+		return;
+	}
+
+	path = gtk_tree_path_new ();
+	gtk_tree_path_append_index (path, pos);
+	gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+	gtk_tree_path_free (path);
 }
 
+/**
+ * egg_sqlite_store_append:
+ * @self: A #EggSqliteStore.
+ * @iter: Location for an iter to the new row, or NULL.
+ *
+ * Appends a row of the table's default values.  Within a batch the row
+ * is announced to views when the batch ends.
+ **/
 void
 egg_sqlite_store_append (EggSqliteStore *self,
 						 GtkTreeIter	*iter)
 {
-#warning egg_sqlite_store_append not Implemented.
+	EggSqliteStorePrivate *priv;
+	gint64                 oid;
+
+	g_return_if_fail (EGG_IS_SQLITE_STORE (self));
+
+	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	g_return_if_fail (priv->stmts != NULL);
+
+	egg_sqlite_store_need_index (self);
+
+	egg_sqlite_store_write_begin (priv);
+	oid = egg_sqlite_insert_row (priv->stmts);
+	egg_sqlite_store_write_end (priv);
+
+	if (oid < 0) {
+		g_warning ("%s: %s", G_STRLOC, sqlite3_errmsg (priv->dbh));
+		if (priv->batch_depth > 0)
+			priv->batch_failed = TRUE;
+		if (iter)
+			iter->stamp = 0;
+		return;
+	}
+
+	egg_sqlite_store_written (priv);
+
+	if (iter) {
+		iter->stamp = self->stamp;
+		ITER_SET_ROWID (iter, oid);
+	}
+
+	if (priv->batch_depth > 0)
+		g_array_append_val (priv->batch_appended, oid);
+	else
+		egg_sqlite_store_emit (self, oid, TRUE);
 }
 
+/**
+ * egg_sqlite_store_begin_batch:
+ * @self: A #EggSqliteStore.
+ * @error: location for a #GError or %NULL
+ *
+ * Starts a batch of edits.  Until the matching egg_sqlite_store_end_batch()
+ * every append, set and remove goes through one BEGIN IMMEDIATE
+ * transaction, rather than each paying for its own commit, and appended
+ * rows are not announced to views.  Batches nest.
+ **/
+gboolean
+egg_sqlite_store_begin_batch (EggSqliteStore  *self,
+							  GError		 **error)
+{
+	EggSqliteStorePrivate *priv;
+
+	g_return_val_if_fail (EGG_IS_SQLITE_STORE (self), FALSE);
+
+	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	g_return_val_if_fail (priv->stmts != NULL, FALSE);
+
+	if (priv->batch_depth > 0) {
+		priv->batch_depth++;
+		return TRUE;
+	}
+
+	egg_sqlite_store_need_index (self);
+
+	if (!egg_sqlite_begin (priv->stmts)) {
+		g_set_error (error, EGG_SQLITE_STORE_ERROR, 5,
+					 "Cannot begin transaction: %s", sqlite3_errmsg (priv->dbh));
+		return FALSE;
+	}
+
+	priv->batch_depth = 1;
+	priv->batch_failed = FALSE;
+	g_array_set_size (priv->batch_appended, 0);
+
+	/* a rollback is only announced row by row against the rank index */
+	egg_sqlite_count_rows (priv->stmts);
+	egg_sqlite_fetch_row_pos (priv->stmts, 0);
+
+	return TRUE;
+}
+
+/*
+ * A batch that did not commit.  Views were told of every remove and set
+ * in it, but not of the appends; with those taken out of the index it is
+ * the table as views know it, and comparing it with the rolled back table
+ * announces every row that came back, went again or changed back.
+ */
+static void
+egg_sqlite_store_batch_abort (EggSqliteStore *self)
+{
+	EggSqliteStorePrivate *priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	guint                  i;
+
+	for (i = 0; i < priv->batch_appended->len; i++) {
+		egg_sqlite_statements_row_deleted (priv->stmts,
+		                                   g_array_index (priv->batch_appended, gint64, i));
+		egg_sqlite_cache_remove (priv->cache,
+		                         g_array_index (priv->batch_appended, gint64, i));
+	}
+	g_array_set_size (priv->batch_appended, 0);
+
+	egg_sqlite_store_write_begin (priv);
+	egg_sqlite_rollback (priv->stmts);
+	egg_sqlite_store_write_end (priv);
+
+	/* writes others made on the connection were part of the transaction */
+	g_array_set_size (priv->updates, 0);
+
+	egg_sqlite_store_resync (self);
+}
+
+/**
+ * egg_sqlite_store_end_batch:
+ * @self: A #EggSqliteStore.
+ * @error: location for a #GError or %NULL
+ *
+ * Ends a batch started with egg_sqlite_store_begin_batch().  When the
+ * outermost batch ends the transaction is committed and the appended rows
+ * are announced with row-inserted in a single pass.  If any write within
+ * the batch failed, or the commit does, the transaction is rolled back and
+ * %FALSE returned; rows removed in it are announced again with
+ * row-inserted and rows changed in it with row-changed.
+ **/
+gboolean
+egg_sqlite_store_end_batch (EggSqliteStore  *self,
+							GError		 **error)
+{
+	EggSqliteStorePrivate *priv;
+	gboolean               ok;
+	guint                  i;
+
+	g_return_val_if_fail (EGG_IS_SQLITE_STORE (self), FALSE);
+
+	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	g_return_val_if_fail (priv->batch_depth > 0, FALSE);
+
+	if (--priv->batch_depth > 0)
+		return TRUE;
+
+	if (priv->batch_failed) {
+		egg_sqlite_store_batch_abort (self);
+		g_set_error (error, EGG_SQLITE_STORE_ERROR, 5,
+					 "A write within the batch failed");
+		return FALSE;
+	}
+
+	egg_sqlite_store_write_begin (priv);
+	ok = egg_sqlite_commit (priv->stmts);
+	egg_sqlite_store_write_end (priv);
+
+	if (!ok) {
+		g_set_error (error, EGG_SQLITE_STORE_ERROR, 5,
+					 "Cannot commit batch: %s", sqlite3_errmsg (priv->dbh));
+		egg_sqlite_store_batch_abort (self);
+		return FALSE;
+	}
+
+	/* the reader sees the batch only now it is committed */
+	egg_sqlite_store_written (priv);
+
+	/* in oid order, so each lands after the last */
+	for (i = 0; i < priv->batch_appended->len; i++)
+		egg_sqlite_store_emit (self, g_array_index (priv->batch_appended, gint64, i), TRUE);
+
+	g_array_set_size (priv->batch_appended, 0);
+
+	/* writes others made on the connection meanwhile, held back till now */
+	if (priv->updates->len)
+		egg_sqlite_store_queue_updates (self);
+
+	return TRUE;
+}
+
+/**
+ * egg_sqlite_store_enable_async:
+ * @self: A #EggSqliteStore.
+ * @margin: Rows beyond the visible range worth loading ahead.
+ * @error: location for a #GError or %NULL
+ *
+ * Moves block fetches off the main loop onto a worker thread with its own
+ * read-only connection.  Rows not loaded yet read as empty and are
+ * announced with row-changed once their block arrives.  The database is
+ * switched to WAL so the reader never waits on writes from @self; if it
+ * cannot be, an in-memory database say, %FALSE is returned.
+ * Counts, positions and the rowids iters carry are answered on the main
+ * loop from the cached count and rank index; the reader seeks by oid.
+ * Enabled before the store is first read, the count and index are built
+ * by the worker too: views are shown no rows until they arrive, then
+ * every row is announced with row-inserted.  A write made meanwhile
+ * builds them on the main loop instead.  Within a batch the store reads
+ * synchronously, as the reader cannot see uncommitted rows.
+ **/
+gboolean
+egg_sqlite_store_enable_async (EggSqliteStore  *self,
+							   guint			margin,
+							   GError		  **error)
+{
+	EggSqliteStorePrivate *priv;
+	EggSqliteLoad         *load;
+	sqlite3_stmt          *stmt = NULL;
+	gchar                 *mode = NULL;
+
+	g_return_val_if_fail (EGG_IS_SQLITE_STORE (self), FALSE);
+
+	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	g_return_val_if_fail (priv->stmts != NULL && priv->filename != NULL, FALSE);
+
+	priv->async_margin = margin;
+
+	if (priv->async_pool)
+		return TRUE;
+
+	/*
+	 * The pragma answers with the mode now in force rather than failing;
+	 * in-memory databases and open transactions keep their old one.
+	 */
+	if (SQLITE_OK == sqlite3_prepare_v2 (priv->dbh, "PRAGMA journal_mode=WAL",
+										 -1, &stmt, NULL) &&
+		sqlite3_step (stmt) == SQLITE_ROW)
+		mode = g_strdup ((const gchar*) sqlite3_column_text (stmt, 0));
+	sqlite3_finalize (stmt);
+
+	if (!mode || g_ascii_strcasecmp (mode, "wal") != 0) {
+		g_set_error (error, EGG_SQLITE_STORE_ERROR, 6,
+					 "Cannot enable WAL: %s",
+					 mode ? mode : sqlite3_errmsg (priv->dbh));
+		g_free (mode);
+		return FALSE;
+	}
+	g_free (mode);
+
+	if (SQLITE_OK != sqlite3_open_v2 (priv->filename, &priv->reader,
+									  SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+									  NULL))
+	{
+		g_set_error (error, EGG_SQLITE_STORE_ERROR, 6,
+					 "Cannot open reader: %s", sqlite3_errmsg (priv->reader));
+		sqlite3_close (priv->reader);
+		priv->reader = NULL;
+		return FALSE;
+	}
+
+	priv->reader_stmts = egg_sqlite_statements_new (priv->reader, priv->table);
+
+	if (!(priv->async_pool = g_thread_pool_new (egg_sqlite_load_worker, NULL,
+												1, FALSE, error)))
+	{
+		egg_sqlite_store_disable_async (self);
+		return FALSE;
+	}
+
+	/* nothing asked for yet, so the first count and scan need not block */
+	if (!egg_sqlite_statements_is_indexed (priv->stmts) &&
+		egg_sqlite_statements_get_n_rows (priv->stmts) < 0)
+	{
+		load = g_slice_new0 (EggSqliteLoad);
+		load->self = g_object_ref (self);
+		load->kind = LOAD_INDEX;
+		load->gen = g_atomic_int_get (&priv->async_gen);
+
+		priv->index_pending = TRUE;
+		g_thread_pool_push (priv->async_pool, load, NULL);
+	}
+
+	return TRUE;
+}
+
+/**
+ * egg_sqlite_store_disable_async:
+ * @self: A #EggSqliteStore.
+ *
+ * Waits for the worker to finish the blocks it was given, then goes back
+ * to fetching on the main loop.  Views that read rows empty are still
+ * told when those blocks arrive.
+ **/
+void
+egg_sqlite_store_disable_async (EggSqliteStore *self)
+{
+	EggSqliteStorePrivate *priv;
+
+	g_return_if_fail (EGG_IS_SQLITE_STORE (self));
+
+	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+
+	if (priv->async_pool) {
+		g_thread_pool_free (priv->async_pool, FALSE, TRUE);
+		priv->async_pool = NULL;
+	}
+
+	/* the worker's index arrives too late, views are waiting for rows */
+	egg_sqlite_store_need_index (self);
+
+	/* statements must be finalized before the connection closes */
+	egg_sqlite_statements_free (priv->reader_stmts);
+	priv->reader_stmts = NULL;
+
+	if (priv->reader) {
+		sqlite3_close (priv->reader);
+		priv->reader = NULL;
+	}
+}
+
+/**
+ * egg_sqlite_store_set_visible_range:
+ * @self: A #EggSqliteStore.
+ * @first: Position of the first row on screen.
+ * @last: Position of the last row on screen.
+ *
+ * Tells an async store what the view shows, typically from the
+ * adjustment's value-changed handler.  The blocks covering it and the
+ * margin around it are queued; queued blocks that scrolled out of range
+ * are skipped rather than read.
+ **/
+void
+egg_sqlite_store_set_visible_range (EggSqliteStore *self,
+									gint			first,
+									gint			last)
+{
+	EggSqliteStorePrivate *priv;
+	gint                   n, end;
+
+	g_return_if_fail (EGG_IS_SQLITE_STORE (self));
+	g_return_if_fail (first >= 0 && first <= last);
+
+	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+
+	g_atomic_int_set (&priv->visible_first, first);
+	g_atomic_int_set (&priv->visible_last, last);
+
+	if (!ASYNC (priv))
+		return;
+
+	/* visible blocks first, the worker takes them in order */
+	n = first - first % EGG_SQLITE_STORE_BLOCK_SIZE;
+	end = MIN (last, egg_sqlite_count_rows (priv->stmts) - 1);
+	for (; n <= end; n += EGG_SQLITE_STORE_BLOCK_SIZE)
+		if (egg_sqlite_store_block_missing (priv, n))
+			egg_sqlite_store_load (self, n, FALSE);
+
+	n = MAX (0, first - (gint)priv->async_margin);
+	n -= n % EGG_SQLITE_STORE_BLOCK_SIZE;
+	end = MIN (last + (gint)priv->async_margin,
+			   egg_sqlite_count_rows (priv->stmts) - 1);
+	for (; n <= end; n += EGG_SQLITE_STORE_BLOCK_SIZE)
+		if (egg_sqlite_store_block_missing (priv, n))
+			egg_sqlite_store_load (self, n, FALSE);
+}
+
+/**
+ * egg_sqlite_store_get_handle:
+ * @self: A #EggSqliteStore.
+ *
+ * Returns the store's own connection.  Writes other code makes to the
+ * table through it are announced to views, row by row, from an idle
+ * once the statement is done.  Changes the update hook cannot see, a
+ * DELETE without a WHERE or rows a REPLACE deletes on a table with a
+ * unique index, show up in sqlite3_total_changes() or are suspected from
+ * the write, and the store resyncs instead.  The commit and rollback
+ * hooks of the connection are taken as well.
+ **/
+sqlite3*
+egg_sqlite_store_get_handle (EggSqliteStore *self)
+{
+	g_return_val_if_fail (EGG_IS_SQLITE_STORE (self), NULL);
+	return EGG_SQLITE_STORE_GET_PRIVATE (self)->dbh;
+}
+
+/**
+ * egg_sqlite_store_set_watch_interval:
+ * @self: A #EggSqliteStore.
+ * @msec: How often to look for commits by other connections, 0 for never.
+ *
+ * Polls PRAGMA data_version, which only changes when another connection
+ * or process commits.  On a change the rank index is rebuilt and
+ * compared with the old one, so only the rows that came and went are
+ * announced, and the cached rows are fetched again so that row-changed
+ * goes out only for those that differ.  Rows not in the cache were not
+ * on screen recently and are read afresh when next asked for.  In async
+ * mode the scan and the fetching are done by the worker thread.
+ **/
+void
+egg_sqlite_store_set_watch_interval (EggSqliteStore *self,
+									 guint			 msec)
+{
+	EggSqliteStorePrivate *priv;
+
+	g_return_if_fail (EGG_IS_SQLITE_STORE (self));
+
+	priv = EGG_SQLITE_STORE_GET_PRIVATE (self);
+	g_return_if_fail (priv->stmts != NULL);
+
+	if (priv->watch_source) {
+		g_source_remove (priv->watch_source);
+		priv->watch_source = 0;
+	}
+
+	if (msec == 0)
+		return;
+
+	/* the comparison needs the index of the table as views know it */
+	egg_sqlite_count_rows (priv->stmts);
+	egg_sqlite_fetch_row_pos (priv->stmts, 0);
+
+	priv->data_version = egg_sqlite_data_version (priv->stmts);
+	priv->watch_source = g_timeout_add (msec, egg_sqlite_store_watch, self);
+}
@@ -22,6 +22,7 @@
 #define __EGG_SQLITE_STORE__
 
 #include <gtk/gtk.h>
+#include <sqlite3.h>
 
 #define EGG_TYPE_SQLITE_STORE             (egg_sqlite_store_get_type())
 #define EGG_SQLITE_STORE(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj), \
@@ -60,6 +61,14 @@ void            egg_sqlite_store_set_table     (EggSqliteStore  *self,
                                                 const gchar     *table,
                                                 GError         **error);
 const gchar*    egg_sqlite_store_get_table     (EggSqliteStore  *self);
+void            egg_sqlite_store_set_cache_size  (EggSqliteStore  *self,
+                                                  gsize            bytes);
+gsize           egg_sqlite_store_get_cache_size  (EggSqliteStore  *self);
+void            egg_sqlite_store_get_cache_stats (EggSqliteStore  *self,
+                                                  guint           *hits,
+                                                  guint           *misses,
+                                                  guint           *evictions,
+                                                  gsize           *bytes);
 void            egg_sqlite_store_append        (EggSqliteStore  *self,
                                                 GtkTreeIter     *iter);
 void            egg_sqlite_store_set           (EggSqliteStore  *self,
@@ -70,5 +79,19 @@ void            egg_sqlite_store_remove        (EggSqliteStore  *self,
 void            egg_sqlite_store_clear         (EggSqliteStore  *self);
 gboolean        egg_sqlite_store_iter_is_valid (EggSqliteStore  *self,
                                                 GtkTreeIter     *iter);
+gboolean        egg_sqlite_store_begin_batch   (EggSqliteStore  *self,
+                                                GError         **error);
+gboolean        egg_sqlite_store_end_batch     (EggSqliteStore  *self,
+                                                GError         **error);
+gboolean        egg_sqlite_store_enable_async      (EggSqliteStore  *self,
+                                                    guint            margin,
+                                                    GError         **error);
+void            egg_sqlite_store_disable_async     (EggSqliteStore  *self);
+void            egg_sqlite_store_set_visible_range (EggSqliteStore  *self,
+                                                    gint             first,
+                                                    gint             last);
+sqlite3*        egg_sqlite_store_get_handle         (EggSqliteStore  *self);
+void            egg_sqlite_store_set_watch_interval (EggSqliteStore  *self,
+                                                     guint            msec);
 
 #endif /* __EGG_SQLITE_STORE__ */
@@ -18,266 +18,1854 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 **/
 #include <stdlib.h>
+#include <string.h>
 
 #include <glib.h>
 #include <sqlite3.h>
 
 #include "egg-sqlite.h"
 
+typedef enum
+{
+	STMT_COUNT_ROWS,
+	STMT_FETCH_FIRST,
+	STMT_FETCH_NEXT,
+	STMT_FETCH_ROW,
+	STMT_FETCH_SEEK,
+	STMT_FETCH_ROW_POS,
+	STMT_ROW_EXISTS,
+	STMT_COUNT_RANGE,
+	STMT_SCAN_OIDS,
+	STMT_FETCH_BLOCK_AFTER,
+	STMT_FETCH_BLOCK_SEEK,
+	STMT_INSERT,
+	STMT_DELETE_ROW,
+	STMT_DELETE_ALL,
+	STMT_BEGIN,
+	STMT_BEGIN_READ,
+	STMT_COMMIT,
+	STMT_ROLLBACK,
+	STMT_DATA_VERSION,
+	N_STMTS
+} EggSqliteStmt;
+
+/* %s is the table, which cannot be a bound parameter, where there is one */
+static const gchar *stmt_sql[N_STMTS] = {
+	"SELECT COUNT(oid) FROM %s",
+	"SELECT oid, * FROM %s ORDER BY oid LIMIT 1",
+	"SELECT oid, * FROM %s WHERE oid > ? ORDER BY oid LIMIT 1",
+	"SELECT oid, * FROM %s WHERE oid = ?",
+	"SELECT oid, * FROM %s WHERE oid >= ? ORDER BY oid LIMIT 1 OFFSET ?",
+	"SELECT COUNT(oid) FROM %s WHERE oid < ?",
+	"SELECT 1 FROM %s WHERE oid = ?",
+	"SELECT COUNT(oid) FROM %s WHERE oid >= ? AND oid < ?",
+	"SELECT oid FROM %s WHERE oid > ? ORDER BY oid",
+	"SELECT oid, * FROM %s WHERE oid > ? ORDER BY oid LIMIT ?",
+	"SELECT oid, * FROM %s WHERE oid >= ? ORDER BY oid LIMIT ? OFFSET ?",
+	"INSERT INTO %s DEFAULT VALUES",
+	"DELETE FROM %s WHERE oid = ?",
+	"DELETE FROM %s",
+	"BEGIN IMMEDIATE",
+	"BEGIN",
+	"COMMIT",
+	"ROLLBACK",
+	"PRAGMA data_version",
+};
+
+/*
+ * Every SAMPLE_STRIDE-th oid in oid order, samples[i] being the oid of the
+ * row at position i * SAMPLE_STRIDE.  The nth row is then a seek to the
+ * sample before it and a short OFFSET from there, rather than an OFFSET
+ * walking every row from the start of the table.
+ */
+#define SAMPLE_STRIDE 256
+
+/*
+ * Rank index: one bit per possible oid, in blocks of RANK_BLOCK oids, and
+ * a Fenwick tree over the number of rows in each block.  The position of
+ * an oid is the prefix sum of the blocks before it plus the bits below it
+ * in its own block, the oid at a position is a descent of the tree and a
+ * scan of one block; both without asking SQLite.  Oids are usually dense,
+ * so this costs about a bit per row.  Tables with negative or very large
+ * oids fall back to the samples and SQL.
+ */
+#define RANK_BLOCK    256
+#define RANK_WORDS    (RANK_BLOCK / 32)
+#define RANK_MAX_OID  (G_GINT64_CONSTANT (1) << 26)
+
+typedef enum
+{
+	RANK_UNBUILT,
+	RANK_BUILT,
+	RANK_DISABLED
+} EggSqliteRankState;
+
+typedef struct
+{
+	EggSqliteRankState  state;
+	guint32            *bits;     /* n_blocks * RANK_WORDS */
+	gint               *tree;     /* 1-based Fenwick tree over block counts */
+	guint               n_blocks; /* a power of two */
+} EggSqliteRank;
+
+/*
+ * The queries of one store, each parsed and planned once on first use and
+ * then only reset and rebound.
+ */
+struct _EggSqliteStatements
+{
+	sqlite3      *sqlite;
+	gchar        *table;
+	sqlite3_stmt *stmts[N_STMTS];
+	sqlite3_stmt **updates; /* UPDATE of one column, by column */
+	guint         n_updates;
+	GArray       *samples;  /* sqlite3_int64, only as far as needed so far */
+	EggSqliteRank rank;
+	gint          n_rows;   /* -1 until counted */
+};
+
+/* a row count and rank index, built apart from the statements using them */
+struct _EggSqliteIndex
+{
+	EggSqliteRank rank;
+	gint          n_rows;
+};
+
+/**
+ * egg_sqlite_statements_new:
+ * @sqlite: A sqlite3 handle.
+ * @table: The table the statements select from.
+ *
+ * Returns a new statement cache for @table, to be freed with
+ * egg_sqlite_statements_free() before @sqlite is closed.
+ **/
+EggSqliteStatements*
+egg_sqlite_statements_new (sqlite3 *sqlite, const gchar *table)
+{
+	EggSqliteStatements *stmts;
+
+	g_return_val_if_fail (sqlite != NULL, NULL);
+	g_return_val_if_fail (table != NULL, NULL);
+
+	stmts = g_new0 (EggSqliteStatements, 1);
+	stmts->sqlite = sqlite;
+	stmts->table = g_strdup (table);
+	stmts->samples = g_array_new (FALSE, FALSE, sizeof (sqlite3_int64));
+	stmts->n_rows = -1;
+
+	return stmts;
+}
+
+/**
+ * egg_sqlite_statements_free:
+ * @stmts: A #EggSqliteStatements.
+ *
+ * Finalizes the prepared statements and frees @stmts.
+ **/
+void
+egg_sqlite_statements_free (EggSqliteStatements *stmts)
+{
+	gint i;
+
+	if (stmts == NULL)
+		return;
+
+	for (i = 0; i < N_STMTS; i++)
+		if (stmts->stmts[i])
+			sqlite3_finalize (stmts->stmts[i]);
+
+	for (i = 0; i < stmts->n_updates; i++)
+		if (stmts->updates[i])
+			sqlite3_finalize (stmts->updates[i]);
+	g_free (stmts->updates);
+
+	g_array_free (stmts->samples, TRUE);
+	g_free (stmts->rank.bits);
+	g_free (stmts->rank.tree);
+	g_free (stmts->table);
+	g_free (stmts);
+}
+
+static sqlite3_stmt*
+egg_sqlite_statements_get (EggSqliteStatements *stmts, EggSqliteStmt id)
+{
+	gchar *query;
+
+	if (stmts->stmts[id] == NULL) {
+		query = g_strdup_printf (stmt_sql[id], stmts->table);
+		if (SQLITE_OK != sqlite3_prepare_v2 (stmts->sqlite, query, -1,
+		                                     &stmts->stmts[id], NULL))
+		{
+			g_warning ("%s: %s", query, sqlite3_errmsg (stmts->sqlite));
+			stmts->stmts[id] = NULL;
+		}
+		g_free (query);
+	}
+
+	return stmts->stmts[id];
+}
+
+#define ROW_DATA(row) ((guchar*) &(row)->values[(row)->n_values])
+
+/*
+ * Copies out the row a statement was just stepped to, each value in the
+ * storage class SQLite has it in.  Numbers are never formatted as text;
+ * text and blobs are copied once, into the tail of the row.
+ */
+static EggSqliteRow*
+egg_sqlite_read_row (sqlite3_stmt *stmt)
+{
+	EggSqliteRow   *row;
+	EggSqliteValue *value;
+	gconstpointer   bytes;
+	gsize           size;
+	guint32         offset = 0;
+	gint            n_columns, i;
+
+	n_columns = sqlite3_column_count (stmt);
+	size = G_STRUCT_OFFSET (EggSqliteRow, values)
+	     + MAX (n_columns, 1) * sizeof (EggSqliteValue);
+
+	/* column_text and column_blob before column_bytes, as SQLite asks */
+	for (i = 0; i < n_columns; i++) {
+		switch (sqlite3_column_type (stmt, i)) {
+		case SQLITE_TEXT:
+			sqlite3_column_text (stmt, i);
+			size += sqlite3_column_bytes (stmt, i) + 1;
+			break;
+		case SQLITE_BLOB:
+			sqlite3_column_blob (stmt, i);
+			size += sqlite3_column_bytes (stmt, i) + 1;
+			break;
+		default:
+			break;
+		}
+	}
+
+	row = g_malloc (size);
+	row->size = size;
+	row->n_values = n_columns;
+	row->oid = n_columns > 0 ? sqlite3_column_int64 (stmt, 0) : 0;
+
+	for (i = 0; i < n_columns; i++) {
+		value = &row->values[i];
+		value->len = 0;
+
+		switch (sqlite3_column_type (stmt, i)) {
+		case SQLITE_INTEGER:
+			value->type = EGG_SQLITE_VALUE_INT64;
+			value->u.v_int64 = sqlite3_column_int64 (stmt, i);
+			break;
+		case SQLITE_FLOAT:
+			value->type = EGG_SQLITE_VALUE_DOUBLE;
+			value->u.v_double = sqlite3_column_double (stmt, i);
+			break;
+		case SQLITE_TEXT:
+		case SQLITE_BLOB:
+			if (sqlite3_column_type (stmt, i) == SQLITE_TEXT) {
+				value->type = EGG_SQLITE_VALUE_TEXT;
+				bytes = sqlite3_column_text (stmt, i);
+			}
+			else {
+				value->type = EGG_SQLITE_VALUE_BLOB;
+				bytes = sqlite3_column_blob (stmt, i);
+			}
+			value->len = sqlite3_column_bytes (stmt, i);
+			value->u.offset = offset;
+			if (value->len)
+				memcpy (ROW_DATA (row) + offset, bytes, value->len);
+			ROW_DATA (row)[offset + value->len] = '\0';
+			offset += value->len + 1;
+			break;
+		default:
+			value->type = EGG_SQLITE_VALUE_NULL;
+			break;
+		}
+	}
+
+	return row;
+}
+
+/**
+ * egg_sqlite_row_free:
+ * @row: A row from one of the fetch functions.
+ *
+ * Frees @row and every value in it.
+ **/
+void
+egg_sqlite_row_free (EggSqliteRow *row)
+{
+	g_free (row);
+}
+
+/**
+ * egg_sqlite_row_equal:
+ * @a: A fetched row.
+ * @b: Another fetched row.
+ *
+ * Returns TRUE if @a and @b hold the same values in the same storage
+ * classes.
+ **/
+gboolean
+egg_sqlite_row_equal (EggSqliteRow *a, EggSqliteRow *b)
+{
+	EggSqliteValue *va, *vb;
+	guint           i;
+
+	g_return_val_if_fail (a != NULL && b != NULL, FALSE);
+
+	if (a->n_values != b->n_values)
+		return FALSE;
+
+	for (i = 0; i < a->n_values; i++) {
+		va = &a->values[i];
+		vb = &b->values[i];
+
+		if (va->type != vb->type || va->len != vb->len)
+			return FALSE;
+
+		switch (va->type) {
+		case EGG_SQLITE_VALUE_INT64:
+			if (va->u.v_int64 != vb->u.v_int64)
+				return FALSE;
+			break;
+		case EGG_SQLITE_VALUE_DOUBLE:
+			/* bitwise, so a NaN that stayed a NaN is unchanged */
+			if (memcmp (&va->u.v_double, &vb->u.v_double, sizeof (gdouble)))
+				return FALSE;
+			break;
+		case EGG_SQLITE_VALUE_TEXT:
+		case EGG_SQLITE_VALUE_BLOB:
+			if (memcmp (ROW_DATA (a) + va->u.offset,
+			            ROW_DATA (b) + vb->u.offset, va->len))
+				return FALSE;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * egg_sqlite_row_get_text:
+ * @row: A fetched row.
+ * @column: The column, 0 being the oid.
+ *
+ * Returns the nul-terminated bytes of a text or blob value, owned by
+ * @row, or NULL for a number, a NULL or a column past the end.
+ **/
+const gchar*
+egg_sqlite_row_get_text (EggSqliteRow *row, guint column)
+{
+	EggSqliteValue *value;
+
+	g_return_val_if_fail (row != NULL, NULL);
+
+	if (column >= row->n_values)
+		return NULL;
+
+	value = &row->values[column];
+
+	if (value->type != EGG_SQLITE_VALUE_TEXT && value->type != EGG_SQLITE_VALUE_BLOB)
+		return NULL;
+
+	return (const gchar*)ROW_DATA (row) + value->u.offset;
+}
+
+/**
+ * egg_sqlite_row_get_value:
+ * @row: A fetched row.
+ * @column: The column, 0 being the oid.
+ * @value: A GValue initialized to G_TYPE_INT64, G_TYPE_DOUBLE,
+ *         G_TYPE_STRING or G_TYPE_BYTE_ARRAY.
+ *
+ * Sets @value from the column.  A value already of the requested kind is
+ * set as is; only a value stored in a different class than its column's
+ * affinity, text in an INTEGER column say, is converted.  NULL leaves
+ * @value at its default.
+ **/
+void
+egg_sqlite_row_get_value (EggSqliteRow *row, guint column, GValue *value)
+{
+	EggSqliteValue *v;
+	const gchar    *text;
+	gchar           buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+	g_return_if_fail (row != NULL);
+	g_return_if_fail (G_IS_VALUE (value));
+
+	if (column >= row->n_values)
+		return;
+
+	v = &row->values[column];
+	text = egg_sqlite_row_get_text (row, column);
+
+	/* bytes as they are, nuls and all; numbers as the text SQLite casts them to */
+	if (G_VALUE_HOLDS (value, G_TYPE_BYTE_ARRAY)) {
+		GByteArray *bytes;
+
+		if (v->type == EGG_SQLITE_VALUE_INT64)
+			text = g_strdup_printf ("%" G_GINT64_FORMAT, v->u.v_int64);
+		else if (v->type == EGG_SQLITE_VALUE_DOUBLE)
+			text = g_strdup (g_ascii_formatd (buf, sizeof buf, "%.15g", v->u.v_double));
+		else if (v->type == EGG_SQLITE_VALUE_NULL)
+			return;
+
+		bytes = g_byte_array_sized_new (text ? strlen (text) : 0);
+		if (v->type == EGG_SQLITE_VALUE_TEXT || v->type == EGG_SQLITE_VALUE_BLOB)
+			g_byte_array_append (bytes, ROW_DATA (row) + v->u.offset, v->len);
+		else {
+			g_byte_array_append (bytes, (const guint8*) text, strlen (text));
+			g_free ((gchar*) text);
+		}
+		g_value_take_boxed (value, bytes);
+		return;
+	}
+
+	switch (G_VALUE_TYPE (value)) {
+	case G_TYPE_INT64:
+		if (v->type == EGG_SQLITE_VALUE_INT64)
+			g_value_set_int64 (value, v->u.v_int64);
+		else if (v->type == EGG_SQLITE_VALUE_DOUBLE)
+			g_value_set_int64 (value, (gint64) v->u.v_double);
+		else if (v->type == EGG_SQLITE_VALUE_TEXT)
+			g_value_set_int64 (value, g_ascii_strtoll (text, NULL, 10));
+		break;
+	case G_TYPE_DOUBLE:
+		if (v->type == EGG_SQLITE_VALUE_DOUBLE)
+			g_value_set_double (value, v->u.v_double);
+		else if (v->type == EGG_SQLITE_VALUE_INT64)
+			g_value_set_double (value, (gdouble) v->u.v_int64);
+		else if (v->type == EGG_SQLITE_VALUE_TEXT)
+			g_value_set_double (value, g_ascii_strtod (text, NULL));
+		break;
+	case G_TYPE_STRING:
+		if (text)
+			g_value_set_string (value, text);
+		else if (v->type == EGG_SQLITE_VALUE_INT64)
+			g_value_take_string (value, g_strdup_printf ("%" G_GINT64_FORMAT, v->u.v_int64));
+		else if (v->type == EGG_SQLITE_VALUE_DOUBLE)
+			/* the way SQLite itself renders a REAL as text */
+			g_value_set_string (value, g_ascii_formatd (buf, sizeof buf, "%.15g", v->u.v_double));
+		break;
+	default:
+		g_warning ("Cannot convert SQLite value to %s", G_VALUE_TYPE_NAME (value));
+		break;
+	}
+}
+
+/*
+ * Steps a statement that yields at most one row and copies that row out.
+ * The statement is reset either way, so it holds no read lock in between.
+ */
+static EggSqliteRow*
+egg_sqlite_step_row (sqlite3_stmt *stmt)
+{
+	EggSqliteRow *result = NULL;
+
+	if (sqlite3_step (stmt) == SQLITE_ROW)
+		result = egg_sqlite_read_row (stmt);
+
+	sqlite3_reset (stmt);
+
+	return result;
+}
+
+/*
+ * All the rows a statement yields, in one go.  The oid of each, the first
+ * result column, is appended to oids as an integer if oids is not NULL.
+ * NULL if stepping failed before the last row, SQLITE_BUSY included, so
+ * a short result always means the end of the table.
+ */
+static GPtrArray*
+egg_sqlite_step_rows (sqlite3_stmt *stmt, gint n_rows, GArray *oids)
+{
+	GPtrArray     *rows = g_ptr_array_sized_new (n_rows);
+	sqlite3_int64  oid;
+	guint          n_oids = oids ? oids->len : 0;
+	gint           ret;
+
+	while ((ret = sqlite3_step (stmt)) == SQLITE_ROW) {
+		if (oids) {
+			oid = sqlite3_column_int64 (stmt, 0);
+			g_array_append_val (oids, oid);
+		}
+		g_ptr_array_add (rows, egg_sqlite_read_row (stmt));
+	}
+
+	sqlite3_reset (stmt);
+
+	if (ret != SQLITE_DONE) {
+		g_ptr_array_foreach (rows, (GFunc) egg_sqlite_row_free, NULL);
+		g_ptr_array_free (rows, TRUE);
+		if (oids)
+			g_array_set_size (oids, n_oids);
+		return NULL;
+	}
+
+	return rows;
+}
+
 static gint
-egg_sqlite_count_rows_cb (gpointer   user_data,
-                          gint       n_columns,
-                          gchar    **values,
-                          gchar	   **columns)
+egg_sqlite_step_int (sqlite3_stmt *stmt, gint fallback)
+{
+	gint result = fallback;
+
+	if (sqlite3_step (stmt) == SQLITE_ROW)
+		result = sqlite3_column_int (stmt, 0);
+
+	sqlite3_reset (stmt);
+
+	return result;
+}
+
+/**
+ * egg_sqlite_count_rows:
+ * @stmts: The statements of the table to count.
+ *
+ * Returns the number of rows found in the table or -1 if there was an error.
+ * COUNT walks the whole table, so it is asked once and then kept up to
+ * date by the row_inserted and row_deleted notifications.
+ **/
+gint
+egg_sqlite_count_rows (EggSqliteStatements *stmts)
+{
+	sqlite3_stmt *stmt;
+
+	g_return_val_if_fail (stmts != NULL, -1);
+
+	if (stmts->n_rows >= 0)
+		return stmts->n_rows;
+
+	if (!(stmt = egg_sqlite_statements_get (stmts, STMT_COUNT_ROWS)))
+		return -1;
+
+	return stmts->n_rows = egg_sqlite_step_int (stmt, -1);
+}
+
+/**
+ * egg_sqlite_fetch_next:
+ * @stmts: The statements of the table to select from.
+ * @last_oid: The oid previous to the row desired, or NULL for the first row.
+ *
+ * Returns the row, with oid as the first column, or NULL if there is no
+ * such row.  The row should be freed with egg_sqlite_row_free().
+ **/
+EggSqliteRow*
+egg_sqlite_fetch_next (EggSqliteStatements *stmts, const sqlite3_int64 *last_oid)
+{
+	sqlite3_stmt *stmt;
+
+	g_return_val_if_fail (stmts != NULL, NULL);
+
+	if (last_oid == NULL) {
+		if (!(stmt = egg_sqlite_statements_get (stmts, STMT_FETCH_FIRST)))
+			return NULL;
+	}
+	else {
+		if (!(stmt = egg_sqlite_statements_get (stmts, STMT_FETCH_NEXT)))
+			return NULL;
+		sqlite3_bind_int64 (stmt, 1, *last_oid);
+	}
+
+	return egg_sqlite_step_row (stmt);
+}
+
+/**
+ * egg_sqlite_fetch_row:
+ * @stmts: The statements of the table to select from.
+ * @oid: The oid used to reference the row in SQLite.
+ *
+ * Returns the row, with oid as the first column, or NULL if there is no
+ * such row.  The row should be freed with egg_sqlite_row_free().
+ **/
+EggSqliteRow*
+egg_sqlite_fetch_row (EggSqliteStatements *stmts, sqlite3_int64 oid)
+{
+	sqlite3_stmt *stmt;
+
+	g_return_val_if_fail (stmts != NULL, NULL);
+
+	if (!(stmt = egg_sqlite_statements_get (stmts, STMT_FETCH_ROW)))
+		return NULL;
+
+	sqlite3_bind_int64 (stmt, 1, oid);
+
+	return egg_sqlite_step_row (stmt);
+}
+
+/**
+ * egg_sqlite_lookup_row:
+ * @stmts: The statements of the table to select from.
+ * @oid: The oid used to reference the row in SQLite.
+ * @row: set to the row, or NULL if there is no such row.
+ *
+ * Like egg_sqlite_fetch_row(), but tells a missing row from a read that
+ * failed, SQLITE_BUSY included.
+ *
+ * Returns FALSE if the row could not be read.
+ **/
+gboolean
+egg_sqlite_lookup_row (EggSqliteStatements *stmts, sqlite3_int64 oid, EggSqliteRow **row)
+{
+	sqlite3_stmt *stmt;
+	gint          ret;
+
+	g_return_val_if_fail (stmts != NULL, FALSE);
+	g_return_val_if_fail (row != NULL, FALSE);
+
+	*row = NULL;
+
+	if (!(stmt = egg_sqlite_statements_get (stmts, STMT_FETCH_ROW)))
+		return FALSE;
+
+	sqlite3_bind_int64 (stmt, 1, oid);
+
+	if ((ret = sqlite3_step (stmt)) == SQLITE_ROW)
+		*row = egg_sqlite_read_row (stmt);
+
+	sqlite3_reset (stmt);
+
+	return ret == SQLITE_ROW || ret == SQLITE_DONE;
+}
+
+static guint
+egg_sqlite_bit_count (guint32 v)
+{
+	v = v - ((v >> 1) & 0x55555555);
+	v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+	return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+static guint
+egg_sqlite_rank_block_count (EggSqliteRank *rank, guint block)
+{
+	guint count = 0;
+	guint i;
+
+	for (i = 0; i < RANK_WORDS; i++)
+		count += egg_sqlite_bit_count (rank->bits[block * RANK_WORDS + i]);
+
+	return count;
+}
+
+/* the tree from the block counts, in O(n_blocks) */
+static void
+egg_sqlite_rank_rebuild_tree (EggSqliteRank *rank)
+{
+	guint i, j;
+
+	for (i = 1; i <= rank->n_blocks; i++)
+		rank->tree[i] = egg_sqlite_rank_block_count (rank, i - 1);
+
+	for (i = 1; i <= rank->n_blocks; i++) {
+		j = i + (i & -i);
+		if (j <= rank->n_blocks)
+			rank->tree[j] += rank->tree[i];
+	}
+}
+
+/* makes room for oid, doubling so appends rebuild the tree rarely */
+static void
+egg_sqlite_rank_reserve (EggSqliteRank *rank, sqlite3_int64 oid, gboolean rebuild)
+{
+	guint needed = oid / RANK_BLOCK + 1;
+	guint n_blocks = MAX (rank->n_blocks, 1);
+
+	if (needed <= rank->n_blocks)
+		return;
+
+	while (n_blocks < needed)
+		n_blocks *= 2;
+
+	rank->bits = g_renew (guint32, rank->bits, n_blocks * RANK_WORDS);
+	memset (rank->bits + rank->n_blocks * RANK_WORDS, 0,
+	        (n_blocks - rank->n_blocks) * RANK_WORDS * sizeof (guint32));
+	rank->tree = g_renew (gint, rank->tree, n_blocks + 1);
+	rank->n_blocks = n_blocks;
+
+	if (rebuild)
+		egg_sqlite_rank_rebuild_tree (rank);
+}
+
+static void
+egg_sqlite_rank_disable (EggSqliteRank *rank)
+{
+	g_free (rank->bits);
+	g_free (rank->tree);
+	rank->bits = NULL;
+	rank->tree = NULL;
+	rank->n_blocks = 0;
+	rank->state = RANK_DISABLED;
+}
+
+static void
+egg_sqlite_rank_add (EggSqliteRank *rank, guint block, gint delta)
+{
+	guint i;
+
+	for (i = block + 1; i <= rank->n_blocks; i += i & -i)
+		rank->tree[i] += delta;
+}
+
+/* rows in the blocks before block */
+static gint
+egg_sqlite_rank_prefix (EggSqliteRank *rank, guint block)
+{
+	gint  sum = 0;
+	guint i;
+
+	for (i = MIN (block, rank->n_blocks); i > 0; i -= i & -i)
+		sum += rank->tree[i];
+
+	return sum;
+}
+
+/* one scan of the oids, the first time a position is asked for */
+static gboolean
+egg_sqlite_rank_ensure (EggSqliteStatements *stmts)
+{
+	EggSqliteRank *rank = &stmts->rank;
+	sqlite3_stmt  *stmt;
+	sqlite3_int64  oid;
+	gint           ret;
+
+	if (rank->state != RANK_UNBUILT)
+		return rank->state == RANK_BUILT;
+
+	if (!(stmt = egg_sqlite_statements_get (stmts, STMT_SCAN_OIDS)))
+		return FALSE;
+
+	sqlite3_bind_int64 (stmt, 1, G_MININT64);
+	rank->state = RANK_BUILT;
+
+	while ((ret = sqlite3_step (stmt)) == SQLITE_ROW) {
+		oid = sqlite3_column_int64 (stmt, 0);
+		if (oid < 0 || oid >= RANK_MAX_OID) {
+			egg_sqlite_rank_disable (rank);
+			break;
+		}
+		egg_sqlite_rank_reserve (rank, oid, FALSE);
+		rank->bits[oid / 32] |= 1u << (oid % 32);
+	}
+
+	sqlite3_reset (stmt);
+
+	/* a scan cut short would miss rows, try again when next asked */
+	if (rank->state == RANK_BUILT && ret != SQLITE_DONE) {
+		egg_sqlite_rank_disable (rank);
+		rank->state = RANK_UNBUILT;
+		return FALSE;
+	}
+
+	if (rank->state == RANK_BUILT) {
+		egg_sqlite_rank_reserve (rank, 0, FALSE);
+		egg_sqlite_rank_rebuild_tree (rank);
+
+		/* the scan counted the rows as well */
+		if (stmts->n_rows < 0)
+			stmts->n_rows = egg_sqlite_rank_prefix (rank, rank->n_blocks);
+	}
+
+	return rank->state == RANK_BUILT;
+}
+
+/* the number of rows with a lower oid */
+static gint
+egg_sqlite_rank_of (EggSqliteRank *rank, sqlite3_int64 oid)
+{
+	guint block, word, i;
+	gint  pos;
+
+	if (oid < 0)
+		return 0;
+
+	block = oid / RANK_BLOCK;
+	if (block >= rank->n_blocks)
+		return egg_sqlite_rank_prefix (rank, rank->n_blocks);
+
+	pos = egg_sqlite_rank_prefix (rank, block);
+	word = oid / 32;
+
+	for (i = block * RANK_WORDS; i < word; i++)
+		pos += egg_sqlite_bit_count (rank->bits[i]);
+
+	return pos + egg_sqlite_bit_count (rank->bits[word] & ((1u << (oid % 32)) - 1));
+}
+
+static gboolean
+egg_sqlite_rank_has (EggSqliteRank *rank, sqlite3_int64 oid)
+{
+	if (oid < 0 || oid / RANK_BLOCK >= rank->n_blocks)
+		return FALSE;
+
+	return (rank->bits[oid / 32] & (1u << (oid % 32))) != 0;
+}
+
+/* the oid of the row at position n, or -1 */
+static sqlite3_int64
+egg_sqlite_rank_select (EggSqliteRank *rank, gint n)
+{
+	guint   block = 0;
+	guint   step;
+	guint32 bits;
+	guint   i, b;
+
+	if (n < 0 || rank->n_blocks == 0)
+		return -1;
+
+	/* the last block whose prefix is still <= n */
+	for (step = rank->n_blocks; step > 0; step /= 2) {
+		if (block + step <= rank->n_blocks && rank->tree[block + step] <= n) {
+			block += step;
+			n -= rank->tree[block];
+		}
+	}
+
+	if (block >= rank->n_blocks)
+		return -1;
+
+	for (i = block * RANK_WORDS; i < (block + 1) * RANK_WORDS; i++) {
+		bits = rank->bits[i];
+		if ((gint)egg_sqlite_bit_count (bits) <= n) {
+			n -= egg_sqlite_bit_count (bits);
+			continue;
+		}
+		for (b = 0; b < 32; b++) {
+			if ((bits & (1u << b)) && n-- == 0)
+				return (sqlite3_int64)i * 32 + b;
+		}
+	}
+
+	return -1;
+}
+
+static void
+egg_sqlite_samples_truncate (EggSqliteStatements *stmts, sqlite3_int64 changed)
+{
+	guint len;
+
+	for (len = stmts->samples->len; len > 0; len--)
+		if (g_array_index (stmts->samples, sqlite3_int64, len - 1) < changed)
+			break;
+
+	g_array_set_size (stmts->samples, len);
+}
+
+/**
+ * egg_sqlite_statements_row_inserted:
+ * @stmts: A #EggSqliteStatements.
+ * @id: oid of the new row.
+ *
+ * Updates the row count and position indexes for a row inserted into the
+ * table.  Must be called for every insert, including appends.
+ **/
+void
+egg_sqlite_statements_row_inserted (EggSqliteStatements *stmts, sqlite3_int64 id)
+{
+	EggSqliteRank *rank;
+
+	g_return_if_fail (stmts != NULL);
+
+	rank = &stmts->rank;
+
+	if (stmts->n_rows >= 0)
+		stmts->n_rows++;
+
+	/* rows after it moved down by one, appends move nothing */
+	egg_sqlite_samples_truncate (stmts, id);
+
+	if (rank->state != RANK_BUILT)
+		return;
+
+	if (id < 0 || id >= RANK_MAX_OID) {
+		egg_sqlite_rank_disable (rank);
+		return;
+	}
+
+	egg_sqlite_rank_reserve (rank, id, TRUE);
+
+	if (!(rank->bits[id / 32] & (1u << (id % 32)))) {
+		rank->bits[id / 32] |= 1u << (id % 32);
+		egg_sqlite_rank_add (rank, id / RANK_BLOCK, 1);
+	}
+}
+
+/**
+ * egg_sqlite_statements_row_deleted:
+ * @stmts: A #EggSqliteStatements.
+ * @id: oid of the deleted row.
+ *
+ * Updates the row count and position indexes for a row deleted from the
+ * table.
+ **/
+void
+egg_sqlite_statements_row_deleted (EggSqliteStatements *stmts, sqlite3_int64 id)
+{
+	EggSqliteRank *rank;
+
+	g_return_if_fail (stmts != NULL);
+
+	rank = &stmts->rank;
+
+	if (stmts->n_rows > 0)
+		stmts->n_rows--;
+
+	egg_sqlite_samples_truncate (stmts, id);
+
+	if (rank->state != RANK_BUILT || id < 0 || id / RANK_BLOCK >= rank->n_blocks)
+		return;
+
+	if (rank->bits[id / 32] & (1u << (id % 32))) {
+		rank->bits[id / 32] &= ~(1u << (id % 32));
+		egg_sqlite_rank_add (rank, id / RANK_BLOCK, -1);
+	}
+}
+
+/**
+ * egg_sqlite_statements_invalidate:
+ * @stmts: A #EggSqliteStatements.
+ *
+ * Forgets the row count and position indexes, after changes to the table
+ * that were not reported one row at a time.  They are rebuilt when next
+ * needed.
+ **/
+void
+egg_sqlite_statements_invalidate (EggSqliteStatements *stmts)
+{
+	g_return_if_fail (stmts != NULL);
+
+	g_array_set_size (stmts->samples, 0);
+	egg_sqlite_rank_disable (&stmts->rank);
+	stmts->rank.state = RANK_UNBUILT;
+	stmts->n_rows = -1;
+}
+
+/**
+ * egg_sqlite_statements_is_indexed:
+ * @stmts: A #EggSqliteStatements.
+ *
+ * Returns TRUE if the rank index is built, so positions are answered
+ * from memory as the row_inserted and row_deleted notifications left
+ * them, rather than by asking SQLite about the table as it is now.
+ **/
+gboolean
+egg_sqlite_statements_is_indexed (EggSqliteStatements *stmts)
+{
+	g_return_val_if_fail (stmts != NULL, FALSE);
+	return stmts->rank.state == RANK_BUILT;
+}
+
+/**
+ * egg_sqlite_statements_has_row:
+ * @stmts: A #EggSqliteStatements.
+ * @oid: The oid of a row.
+ *
+ * Returns TRUE if the rank index holds @oid, FALSE if it does not or no
+ * index is built.  Never asks SQLite.
+ **/
+gboolean
+egg_sqlite_statements_has_row (EggSqliteStatements *stmts, sqlite3_int64 oid)
+{
+	g_return_val_if_fail (stmts != NULL, FALSE);
+
+	if (stmts->rank.state != RANK_BUILT)
+		return FALSE;
+
+	return egg_sqlite_rank_has (&stmts->rank, oid);
+}
+
+/**
+ * egg_sqlite_statements_rowid_at:
+ * @stmts: A #EggSqliteStatements.
+ * @n: Position of the row, 0-based.
+ *
+ * Returns the oid of the row at position @n from the rank index, or -1 if
+ * there is no such row or no index is built.  Never asks SQLite, so it is
+ * safe where the connection must not be touched.
+ **/
+sqlite3_int64
+egg_sqlite_statements_rowid_at (EggSqliteStatements *stmts, gint n)
 {
-	gint *count = user_data;
+	g_return_val_if_fail (stmts != NULL, -1);
 
-	if (n_columns > 0)
-		(*count) = atoi (values[0]);
+	if (stmts->rank.state != RANK_BUILT)
+		return -1;
 
-	return SQLITE_OK;
+	return egg_sqlite_rank_select (&stmts->rank, n);
 }
 
-static gint
-egg_sqlite_fetch_row_pos_cb (gpointer   user_data,
-                             gint	    n_columns,
-                             gchar    **values,
-                             gchar    **columns)
+static void
+egg_sqlite_change_append (GArray *changes, sqlite3_int64 oid, gint pos)
 {
-	gint *pos = user_data;
+	EggSqliteChange change;
 
-	if (n_columns > 0)
-		(*pos) = atoi (values[0]);
-
-	return SQLITE_OK;
+	change.oid = oid;
+	change.pos = pos;
+	g_array_append_val (changes, change);
 }
 
-static gint
-egg_sqlite_fetch_n_columns_cb (gpointer   user_data,
-                               gint	      n_columns,
-                               gchar    **values,
-                               gchar    **columns)
+/**
+ * egg_sqlite_statements_get_n_rows:
+ * @stmts: A #EggSqliteStatements.
+ *
+ * Returns the row count as kept, or -1 if the table was not counted yet.
+ * Unlike egg_sqlite_count_rows() it never asks SQLite.
+ **/
+gint
+egg_sqlite_statements_get_n_rows (EggSqliteStatements *stmts)
 {
-	gint *n = user_data;
-	(*n) = (*n) + 1;
-	return SQLITE_OK;
+	g_return_val_if_fail (stmts != NULL, -1);
+	return stmts->n_rows;
 }
 
-static gint
-egg_sqlite_fetch_next_cb (gpointer   user_data,
-                          gint       n_columns,
-                          gchar    **values,
-                          gchar    **columns)
+/**
+ * egg_sqlite_statements_build_index:
+ * @stmts: A #EggSqliteStatements.
+ *
+ * Counts the table and scans its oids into a new index, leaving the count
+ * and index of @stmts as they were.  Built on one connection, the index
+ * can be handed to the statements of another on the same table with
+ * egg_sqlite_statements_set_index(); a worker thread can do the scan.
+ *
+ * Returns the index, or NULL if there was an error.
+ **/
+EggSqliteIndex*
+egg_sqlite_statements_build_index (EggSqliteStatements *stmts)
 {
-	GPtrArray *result = user_data;
-	gchar  *value;
-	gint	i;
+	EggSqliteIndex *index = NULL;
+	EggSqliteRank   rank;
+	gint            n_rows;
 
-	g_return_val_if_fail (result != NULL, SQLITE_ERROR);
+	g_return_val_if_fail (stmts != NULL, NULL);
 
-	for (i = 0; i < n_columns; i++) {
-		value = g_strdup (values[i]);
-		g_ptr_array_add (result, value);
+	rank = stmts->rank;
+	n_rows = stmts->n_rows;
+
+	memset (&stmts->rank, 0, sizeof (EggSqliteRank));
+	stmts->rank.state = RANK_UNBUILT;
+	stmts->n_rows = -1;
+
+	/* the scan counts as it goes, tables it cannot index are counted apart */
+	if (!egg_sqlite_rank_ensure (stmts) && stmts->rank.state == RANK_DISABLED)
+		egg_sqlite_count_rows (stmts);
+
+	if (stmts->rank.state != RANK_UNBUILT && stmts->n_rows >= 0) {
+		index = g_new0 (EggSqliteIndex, 1);
+		index->rank = stmts->rank;
+		index->n_rows = stmts->n_rows;
+	}
+	else {
+		g_free (stmts->rank.bits);
+		g_free (stmts->rank.tree);
 	}
 
-	return SQLITE_OK;
+	stmts->rank = rank;
+	stmts->n_rows = n_rows;
+
+	return index;
 }
 
-static gint
-egg_sqlite_fetch_row_cb (gpointer   user_data,
-                         gint	    n_columns,
-                         gchar    **values,
-                         gchar    **columns)
+/**
+ * egg_sqlite_index_free:
+ * @index: An #EggSqliteIndex not handed to egg_sqlite_statements_set_index().
+ **/
+void
+egg_sqlite_index_free (EggSqliteIndex *index)
 {
-	GPtrArray *result = user_data;
-	gchar  *value;
-	gint	i;
+	if (index == NULL)
+		return;
 
-	g_return_val_if_fail (result != NULL, SQLITE_ERROR);
+	g_free (index->rank.bits);
+	g_free (index->rank.tree);
+	g_free (index);
+}
 
-	for (i = 0; i < n_columns; i++) {
-		value = g_strdup (values[i]);
-		g_ptr_array_add (result, value);
+/*
+ * The rows that came and went between an old index and the current one,
+ * by comparing them a word at a time; most words did not change.
+ */
+static gboolean
+egg_sqlite_statements_compare (EggSqliteStatements *stmts,
+                               EggSqliteRank       *old,
+                               gint                 n_old,
+                               GArray              *deleted,
+                               GArray              *inserted)
+{
+	guint32 was, now;
+	guint   i, b, n_words, old_words, new_words;
+	gint    n_new;
+
+	if (old->state != RANK_BUILT || stmts->rank.state != RANK_BUILT) {
+		if (n_old < 0)
+			return FALSE;
+
+		n_new = egg_sqlite_count_rows (stmts);
+		for (i = 0; i < (guint)n_old; i++)
+			egg_sqlite_change_append (deleted, -1, i);
+		for (i = 0; i < (guint)MAX (n_new, 0); i++)
+			egg_sqlite_change_append (inserted, -1, i);
+
+		return FALSE;
 	}
 
-	return SQLITE_OK;
+	old_words = old->n_blocks * RANK_WORDS;
+	new_words = stmts->rank.n_blocks * RANK_WORDS;
+	n_words = MAX (old_words, new_words);
+
+	for (i = 0; i < n_words; i++) {
+		was = i < old_words ? old->bits[i] : 0;
+		now = i < new_words ? stmts->rank.bits[i] : 0;
+
+		if (was == now)
+			continue;
+
+		for (b = 0; b < 32; b++) {
+			if ((was & ~now) & (1u << b))
+				egg_sqlite_change_append (deleted, (sqlite3_int64)i * 32 + b,
+				                          egg_sqlite_rank_of (old, (sqlite3_int64)i * 32 + b));
+			else if ((now & ~was) & (1u << b))
+				egg_sqlite_change_append (inserted, (sqlite3_int64)i * 32 + b,
+				                          egg_sqlite_rank_of (&stmts->rank, (sqlite3_int64)i * 32 + b));
+		}
+	}
+
+	return TRUE;
 }
 
-static gint
-egg_sqlite_fetch_nth_row_cb (gpointer   user_data,
-                             gint       n_columns,
-                             gchar    **values,
-                             gchar    **columns)
+/**
+ * egg_sqlite_statements_set_index:
+ * @stmts: A #EggSqliteStatements.
+ * @index: An index from egg_sqlite_statements_build_index(), taken over.
+ * @deleted: #GArray of #EggSqliteChange, as for egg_sqlite_statements_resync(),
+ *           or NULL.
+ * @inserted: The same for the rows that came, or NULL.
+ *
+ * Replaces the row count and position indexes of @stmts with @index.  If
+ * @deleted and @inserted are given they are filled in as
+ * egg_sqlite_statements_resync() fills them, from the index replaced.
+ *
+ * Returns TRUE if the changes were worked out row by row.
+ **/
+gboolean
+egg_sqlite_statements_set_index (EggSqliteStatements *stmts,
+                                 EggSqliteIndex      *index,
+                                 GArray              *deleted,
+                                 GArray              *inserted)
 {
-	GPtrArray *result = user_data;
-	gint       i;
+	EggSqliteRank old;
+	gboolean      ret = FALSE;
+	gint          n_old;
+
+	g_return_val_if_fail (stmts != NULL, FALSE);
+	g_return_val_if_fail (index != NULL, FALSE);
+
+	old = stmts->rank;
+	n_old = stmts->n_rows;
 
-	g_return_val_if_fail (result != NULL, SQLITE_ERROR);
+	g_array_set_size (stmts->samples, 0);
+	stmts->rank = index->rank;
+	stmts->n_rows = index->n_rows;
+	g_free (index);
 
-	for (i = 0; i < n_columns; i++)
-		g_ptr_array_add (result, g_strdup (values[i]));
+	if (deleted && inserted)
+		ret = egg_sqlite_statements_compare (stmts, &old, n_old, deleted, inserted);
 
-	return SQLITE_OK;
+	g_free (old.bits);
+	g_free (old.tree);
+
+	return ret;
 }
 
 /**
- * egg_sqlite_count_rows:
- * @sqlite: A sqlite3 handle.
- * @table: The table name to fetch from.
+ * egg_sqlite_statements_resync:
+ * @stmts: A #EggSqliteStatements.
+ * @deleted: #GArray of #EggSqliteChange for the rows that went, in oid order.
+ * @inserted: #GArray of #EggSqliteChange for the rows that came, in oid order.
  *
- * Returns the number of rows found in the table or -1 if there was an error.
+ * Rebuilds the row count and position indexes after the table was changed
+ * by someone else, and works out which rows came and went by comparing
+ * the rank index before and after.  Deleted rows carry their position
+ * before the change, inserted ones their position after it; so deleting
+ * in reverse and then inserting in order takes a view from one to the
+ * other.
+ *
+ * Without a rank index to compare, which tables with negative or very
+ * large oids never have, every old row is reported deleted and every new
+ * one inserted, with an oid of -1.  Nothing is reported if the old row
+ * count was not known either.
+ *
+ * Returns TRUE if the changes were worked out row by row.
+ **/
+gboolean
+egg_sqlite_statements_resync (EggSqliteStatements *stmts,
+                              GArray              *deleted,
+                              GArray              *inserted)
+{
+	EggSqliteIndex *index;
+
+	g_return_val_if_fail (stmts != NULL, FALSE);
+	g_return_val_if_fail (deleted != NULL && inserted != NULL, FALSE);
+
+	/* the table could not be read, it is counted again when next asked */
+	if (!(index = egg_sqlite_statements_build_index (stmts))) {
+		index = g_new0 (EggSqliteIndex, 1);
+		index->rank.state = RANK_UNBUILT;
+		index->n_rows = -1;
+	}
+
+	return egg_sqlite_statements_set_index (stmts, index, deleted, inserted);
+}
+
+/**
+ * egg_sqlite_data_version:
+ * @stmts: A #EggSqliteStatements.
+ *
+ * Returns PRAGMA data_version, which changes whenever another connection
+ * commits to the database, or -1 if there was an error.
  **/
 gint
-egg_sqlite_count_rows (sqlite3 *sqlite, gchar *table)
+egg_sqlite_data_version (EggSqliteStatements *stmts)
 {
-	gchar *query = NULL;
-	gint   count = -1;
+	sqlite3_stmt *stmt;
 
-	g_return_val_if_fail (sqlite != NULL, -1);
-	g_return_val_if_fail (table != NULL,  -1);
+	g_return_val_if_fail (stmts != NULL, -1);
 
-	query = g_strdup_printf ("SELECT COUNT(oid) FROM %s", table);
-	sqlite3_exec (sqlite, query, egg_sqlite_count_rows_cb, &count, NULL);
-	g_free (query);
+	if (!(stmt = egg_sqlite_statements_get (stmts, STMT_DATA_VERSION)))
+		return -1;
 
-	return count;
+	return egg_sqlite_step_int (stmt, -1);
+}
+
+/*
+ * Extends the samples until they cover slot, scanning oids from the last
+ * sample on.  Returns FALSE if the table has no row at that position.
+ */
+static gboolean
+egg_sqlite_samples_extend (EggSqliteStatements *stmts, guint slot)
+{
+	GArray        *samples = stmts->samples;
+	sqlite3_stmt  *stmt;
+	sqlite3_int64  oid;
+	gint64         pos;
+
+	if (slot < samples->len)
+		return TRUE;
+
+	if (!(stmt = egg_sqlite_statements_get (stmts, STMT_SCAN_OIDS)))
+		return FALSE;
+
+	if (samples->len > 0) {
+		pos = (gint64)(samples->len - 1) * SAMPLE_STRIDE;
+		sqlite3_bind_int64 (stmt, 1, g_array_index (samples, sqlite3_int64,
+		                                            samples->len - 1));
+	}
+	else {
+		pos = -1;
+		sqlite3_bind_int64 (stmt, 1, G_MININT64);
+	}
+
+	while (samples->len <= slot && sqlite3_step (stmt) == SQLITE_ROW) {
+		if (++pos % SAMPLE_STRIDE == 0) {
+			oid = sqlite3_column_int64 (stmt, 0);
+			g_array_append_val (samples, oid);
+		}
+	}
+
+	sqlite3_reset (stmt);
+
+	return slot < samples->len;
 }
 
 /**
- * egg_sqlite_fetch_next:
- * @sqlite: A sqlite3 handle.
- * @table: Name of the table to select from.
- * @last_oid: The oid previous to the row desired, or NULL for the first row.
+ * egg_sqlite_fetch_nth_row:
+ * @stmts: The statements of the table to select from.
+ * @index: nth row to return, 0-based. therefore, to get the first row,
+ *		 you would pass 0.
  *
- * Returns a GPtrArray* of column values, with oid as the first column. The
- * array should be freed with g_array_free().
+ * Returns the row as egg_sqlite_fetch_row() does, or NULL.  The oid of
+ * the row comes from the rank index, or where there is none from a seek
+ * to the nearest sampled oid and an OFFSET of less than SAMPLE_STRIDE
+ * rows from there.
  **/
-GPtrArray*
-egg_sqlite_fetch_next (sqlite3 *sqlite, gchar *table, gchar *last_oid)
+EggSqliteRow*
+egg_sqlite_fetch_nth_row (EggSqliteStatements *stmts, gint index)
 {
-	GPtrArray *result;
-	gchar  *query;
+	sqlite3_stmt *stmt;
+	guint         slot;
 
-	g_return_val_if_fail (sqlite != NULL, NULL);
-	g_return_val_if_fail (table != NULL, NULL);
+	g_return_val_if_fail (stmts != NULL, NULL);
 
-	result = g_ptr_array_sized_new (2);
+	if (index < 0)
+		return NULL;
 
-	if (last_oid == NULL)
-		query = g_strdup_printf (
-			"SELECT oid, * FROM %s ORDER BY oid LIMIT 1", table);
-	else
-	  	query = g_strdup_printf (
-			"SELECT oid, * FROM %s WHERE oid > %s ORDER BY oid LIMIT 1",
-			table, last_oid);
+	if (egg_sqlite_rank_ensure (stmts)) {
+		sqlite3_int64 oid = egg_sqlite_rank_select (&stmts->rank, index);
 
-	if (SQLITE_OK !=
-		sqlite3_exec (sqlite, query, egg_sqlite_fetch_next_cb, result, NULL))
-	{
-		g_ptr_array_free (result, FALSE);
-		result = NULL;
+		if (oid < 0 || !(stmt = egg_sqlite_statements_get (stmts, STMT_FETCH_ROW)))
+			return NULL;
+
+		sqlite3_bind_int64 (stmt, 1, oid);
+		return egg_sqlite_step_row (stmt);
 	}
 
-	g_free (query);
-	return result;
+	slot = index / SAMPLE_STRIDE;
+
+	if (!egg_sqlite_samples_extend (stmts, slot) ||
+	    !(stmt = egg_sqlite_statements_get (stmts, STMT_FETCH_SEEK)))
+		return NULL;
+
+	sqlite3_bind_int64 (stmt, 1, g_array_index (stmts->samples, sqlite3_int64, slot));
+	sqlite3_bind_int (stmt, 2, index % SAMPLE_STRIDE);
+
+	return egg_sqlite_step_row (stmt);
 }
 
 /**
- * egg_sqlite_fetch_row:
- * @sqlite: A sqlite3 handle.
- * @table: Name of the table to select from.
- * @oid: The oid used to reference the row in SQLite.
+ * egg_sqlite_fetch_block:
+ * @stmts: The statements of the table to select from.
+ * @last_oid: The oid previous to the first row desired, or NULL to start
+ *            with the first row.
+ * @n_rows: The maximum number of rows to fetch.
+ * @oids: A GArray of sqlite3_int64 the oid of each row is appended to, or
+ *        NULL.
+ *
+ * Fetches up to @n_rows consecutive rows with a single stepped statement.
  *
- * Returns a GPtrArray* of column values, with oid as the first column. The
- * array should be freed with g_array_free().
+ * Returns a GPtrArray* of EggSqliteRow*, each as egg_sqlite_fetch_row()
+ * returns them, empty past the end of the table, or NULL if there was an
+ * error; a busy database is an error too.
  **/
 GPtrArray*
-egg_sqlite_fetch_row  (sqlite3 *sqlite, gchar *table, gchar *oid)
+egg_sqlite_fetch_block (EggSqliteStatements *stmts,
+                        const sqlite3_int64 *last_oid,
+                        gint                 n_rows,
+                        GArray              *oids)
 {
-	GPtrArray *result;
-	gchar  *query;
+	sqlite3_stmt *stmt;
 
-	g_return_val_if_fail (sqlite != NULL, NULL);
-	g_return_val_if_fail (table != NULL, NULL);
-	g_return_val_if_fail (oid != NULL, NULL);
+	g_return_val_if_fail (stmts != NULL, NULL);
 
-	query = g_strdup_printf ("SELECT oid, * FROM %s WHERE oid = %s", table, oid);
-	result = g_ptr_array_sized_new (2);
+	if (!(stmt = egg_sqlite_statements_get (stmts, STMT_FETCH_BLOCK_AFTER)))
+		return NULL;
 
-	if (SQLITE_OK !=
-		sqlite3_exec (sqlite, query, egg_sqlite_fetch_row_cb, result, NULL))
-		result = NULL;
+	sqlite3_bind_int64 (stmt, 1, last_oid ? *last_oid : G_MININT64);
+	sqlite3_bind_int (stmt, 2, n_rows);
 
-	g_free (query);
-	return result;
+	return egg_sqlite_step_rows (stmt, n_rows, oids);
 }
 
 /**
- * egg_sqlite_fetch_nth_row:
- * @sqlite: A sqlite3 handle.
- * @table: Name of table to select from.
- * @index: nth row to return, 0-based. therefore, to get the first row,
- *		 you would pass 0.
+ * egg_sqlite_fetch_block_at:
+ * @stmts: The statements of the table to select from.
+ * @index: Position of the first row to fetch.
+ * @n_rows: The maximum number of rows to fetch.
+ * @oids: As for egg_sqlite_fetch_block().
+ *
+ * Like egg_sqlite_fetch_block(), but starting at a position, found the
+ * way egg_sqlite_fetch_nth_row() finds it.
  **/
 GPtrArray*
-egg_sqlite_fetch_nth_row (sqlite3 *sqlite, gchar *table, gint index)
+egg_sqlite_fetch_block_at (EggSqliteStatements *stmts,
+                           gint                 index,
+                           gint                 n_rows,
+                           GArray              *oids)
 {
-	GPtrArray *result;
-	gchar  *query;
+	sqlite3_stmt  *stmt;
+	sqlite3_int64  oid;
+	gint           offset;
+
+	g_return_val_if_fail (stmts != NULL, NULL);
+	g_return_val_if_fail (index >= 0, NULL);
+
+	if (egg_sqlite_rank_ensure (stmts)) {
+		if ((oid = egg_sqlite_rank_select (&stmts->rank, index)) < 0)
+			return g_ptr_array_new ();
+		offset = 0;
+	}
+	else {
+		if (!egg_sqlite_samples_extend (stmts, index / SAMPLE_STRIDE))
+			return g_ptr_array_new ();
+		oid = g_array_index (stmts->samples, sqlite3_int64, index / SAMPLE_STRIDE);
+		offset = index % SAMPLE_STRIDE;
+	}
 
-	query = g_strdup_printf ("SELECT oid, * FROM %s LIMIT 1 OFFSET %d",
-							 table, index);
-	result = g_ptr_array_sized_new (2);
+	if (!(stmt = egg_sqlite_statements_get (stmts, STMT_FETCH_BLOCK_SEEK)))
+		return NULL;
 
-	if (SQLITE_OK !=
-		sqlite3_exec (sqlite, query, egg_sqlite_fetch_nth_row_cb, result, NULL))
-		result = NULL;
+	sqlite3_bind_int64 (stmt, 1, oid);
+	sqlite3_bind_int (stmt, 2, n_rows);
+	sqlite3_bind_int (stmt, 3, offset);
 
-	g_free (query);
-	return result;
+	return egg_sqlite_step_rows (stmt, n_rows, oids);
 }
 
 /**
  * egg_sqlite_fetch_row_pos:
- * @sqlite: A sqlite3 handle.
- * @table: Name of table to select from.
- * @oid: oid of row to find position of.
+ * @stmts: The statements of the table to select from.
+ * @target: oid of row to find position of.
  *
- * Retuns the rows offset from 0, or -1 if the row was not found.
+ * Retuns the rows offset from 0, or -1 if the row was not found.  Comes
+ * from the rank index in O(log n) where there is one, without SQLite;
+ * otherwise the row is looked up by oid before its position is counted.
  **/
 gint
-egg_sqlite_fetch_row_pos (sqlite3 *sqlite, gchar *table, gchar *oid)
+egg_sqlite_fetch_row_pos (EggSqliteStatements *stmts, sqlite3_int64 target)
 {
-	gint   pos = 0;
-	gchar *query;
+	sqlite3_stmt  *stmt;
+	GArray        *samples;
+	guint          lo, hi, mid;
+	gint           count;
 
-	query = g_strdup_printf ("SELECT COUNT(oid) FROM %s WHERE oid < %s",
-							 table, oid);
-	if (SQLITE_OK !=
-		sqlite3_exec (sqlite, query, egg_sqlite_fetch_row_pos_cb, &pos, NULL))
-		pos = -1;
+	g_return_val_if_fail (stmts != NULL, -1);
+
+	samples = stmts->samples;
+
+	if (egg_sqlite_rank_ensure (stmts)) {
+		if (!egg_sqlite_rank_has (&stmts->rank, target))
+			return -1;
+		return egg_sqlite_rank_of (&stmts->rank, target);
+	}
+
+	if (!(stmt = egg_sqlite_statements_get (stmts, STMT_ROW_EXISTS)))
+		return -1;
+	sqlite3_bind_int64 (stmt, 1, target);
+	if (egg_sqlite_step_int (stmt, 0) != 1)
+		return -1;
+
+	if (samples->len == 0 || g_array_index (samples, sqlite3_int64, 0) > target) {
+		if (!(stmt = egg_sqlite_statements_get (stmts, STMT_FETCH_ROW_POS)))
+			return -1;
+		sqlite3_bind_int64 (stmt, 1, target);
+		return egg_sqlite_step_int (stmt, -1);
+	}
+
+	/* the last sample at or before oid, then count the rest of the way */
+	lo = 0;
+	hi = samples->len;
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (g_array_index (samples, sqlite3_int64, mid) <= target)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	if (!(stmt = egg_sqlite_statements_get (stmts, STMT_COUNT_RANGE)))
+		return -1;
+
+	sqlite3_bind_int64 (stmt, 1, g_array_index (samples, sqlite3_int64, lo));
+	sqlite3_bind_int64 (stmt, 2, target);
+
+	if ((count = egg_sqlite_step_int (stmt, -1)) < 0)
+		return -1;
+
+	return lo * SAMPLE_STRIDE + count;
+}
+
+/* steps a statement that yields no rows, TRUE if it ran to completion */
+static gboolean
+egg_sqlite_step_done (sqlite3_stmt *stmt)
+{
+	gint ret = sqlite3_step (stmt);
+
+	sqlite3_reset (stmt);
+
+	return ret == SQLITE_DONE;
+}
+
+static gboolean
+egg_sqlite_exec (EggSqliteStatements *stmts, EggSqliteStmt id)
+{
+	sqlite3_stmt *stmt;
+
+	if (!(stmt = egg_sqlite_statements_get (stmts, id)))
+		return FALSE;
+
+	return egg_sqlite_step_done (stmt);
+}
+
+/* binds a GValue in the storage class closest to its type */
+static void
+egg_sqlite_bind_value (sqlite3_stmt *stmt, gint index, const GValue *value)
+{
+	GValue      text = { 0, };
+	GByteArray *bytes;
+
+	if (G_VALUE_HOLDS (value, G_TYPE_BYTE_ARRAY)) {
+		if ((bytes = g_value_get_boxed (value)))
+			sqlite3_bind_blob (stmt, index, bytes->data, bytes->len, SQLITE_TRANSIENT);
+		else
+			sqlite3_bind_null (stmt, index);
+		return;
+	}
+
+	switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value))) {
+	case G_TYPE_BOOLEAN:
+		sqlite3_bind_int (stmt, index, g_value_get_boolean (value));
+		break;
+	case G_TYPE_INT:
+		sqlite3_bind_int64 (stmt, index, g_value_get_int (value));
+		break;
+	case G_TYPE_UINT:
+		sqlite3_bind_int64 (stmt, index, g_value_get_uint (value));
+		break;
+	case G_TYPE_LONG:
+		sqlite3_bind_int64 (stmt, index, g_value_get_long (value));
+		break;
+	case G_TYPE_ULONG:
+		sqlite3_bind_int64 (stmt, index, g_value_get_ulong (value));
+		break;
+	case G_TYPE_INT64:
+		sqlite3_bind_int64 (stmt, index, g_value_get_int64 (value));
+		break;
+	case G_TYPE_UINT64:
+		sqlite3_bind_int64 (stmt, index, (sqlite3_int64) g_value_get_uint64 (value));
+		break;
+	case G_TYPE_FLOAT:
+		sqlite3_bind_double (stmt, index, g_value_get_float (value));
+		break;
+	case G_TYPE_DOUBLE:
+		sqlite3_bind_double (stmt, index, g_value_get_double (value));
+		break;
+	case G_TYPE_STRING:
+		if (g_value_get_string (value))
+			sqlite3_bind_text (stmt, index, g_value_get_string (value), -1, SQLITE_TRANSIENT);
+		else
+			sqlite3_bind_null (stmt, index);
+		break;
+	default:
+		g_value_init (&text, G_TYPE_STRING);
+		if (g_value_transform (value, &text) && g_value_get_string (&text))
+			sqlite3_bind_text (stmt, index, g_value_get_string (&text), -1, SQLITE_TRANSIENT);
+		else
+			sqlite3_bind_null (stmt, index);
+		g_value_unset (&text);
+		break;
+	}
+}
+
+/* the UPDATE of one column, 1 being the first after the oid */
+static sqlite3_stmt*
+egg_sqlite_statements_get_update (EggSqliteStatements *stmts, guint column)
+{
+	sqlite3_stmt *names = NULL;
+	const gchar  *name;
+	gchar        *query;
+
+	if (column >= stmts->n_updates) {
+		stmts->updates = g_renew (sqlite3_stmt*, stmts->updates, column + 1);
+		memset (stmts->updates + stmts->n_updates, 0,
+		        (column + 1 - stmts->n_updates) * sizeof (sqlite3_stmt*));
+		stmts->n_updates = column + 1;
+	}
+
+	if (stmts->updates[column])
+		return stmts->updates[column];
+
+	/* the column names, without running the query */
+	query = g_strdup_printf ("SELECT * FROM %s LIMIT 0", stmts->table);
+	if (SQLITE_OK != sqlite3_prepare_v2 (stmts->sqlite, query, -1, &names, NULL)) {
+		g_warning ("%s: %s", query, sqlite3_errmsg (stmts->sqlite));
+		g_free (query);
+		return NULL;
+	}
 	g_free (query);
 
-	return pos;
+	if (column < 1 || column > (guint) sqlite3_column_count (names) ||
+	    !(name = sqlite3_column_name (names, column - 1))) {
+		sqlite3_finalize (names);
+		return NULL;
+	}
+
+	/* %w doubles any quote in the column name */
+	query = sqlite3_mprintf ("UPDATE %s SET \"%w\" = ? WHERE oid = ?",
+	                         stmts->table, name);
+	sqlite3_finalize (names);
+
+	if (SQLITE_OK != sqlite3_prepare_v2 (stmts->sqlite, query, -1,
+	                                     &stmts->updates[column], NULL))
+	{
+		g_warning ("%s: %s", query, sqlite3_errmsg (stmts->sqlite));
+		stmts->updates[column] = NULL;
+	}
+	sqlite3_free (query);
+
+	return stmts->updates[column];
+}
+
+/**
+ * egg_sqlite_insert_row:
+ * @stmts: The statements of the table to insert into.
+ *
+ * Inserts a row of default values and updates the position indexes.
+ *
+ * Returns the oid of the new row, or -1 if the insert failed.
+ **/
+sqlite3_int64
+egg_sqlite_insert_row (EggSqliteStatements *stmts)
+{
+	sqlite3_int64 oid;
+
+	g_return_val_if_fail (stmts != NULL, -1);
+
+	if (!egg_sqlite_exec (stmts, STMT_INSERT))
+		return -1;
+
+	oid = sqlite3_last_insert_rowid (stmts->sqlite);
+	egg_sqlite_statements_row_inserted (stmts, oid);
+
+	return oid;
+}
+
+/**
+ * egg_sqlite_update_value:
+ * @stmts: The statements of the table to update.
+ * @oid: oid of the row to change.
+ * @column: The column, 1 being the first after the oid.
+ * @value: The new value.
+ *
+ * Sets one column of one row.  Each column's UPDATE is prepared once.
+ *
+ * Returns TRUE if the update ran.
+ **/
+gboolean
+egg_sqlite_update_value (EggSqliteStatements *stmts,
+                         sqlite3_int64        oid,
+                         guint                column,
+                         const GValue        *value)
+{
+	sqlite3_stmt *stmt;
+
+	g_return_val_if_fail (stmts != NULL, FALSE);
+	g_return_val_if_fail (G_IS_VALUE (value), FALSE);
+
+	if (!(stmt = egg_sqlite_statements_get_update (stmts, column)))
+		return FALSE;
+
+	egg_sqlite_bind_value (stmt, 1, value);
+	sqlite3_bind_int64 (stmt, 2, oid);
+
+	return egg_sqlite_step_done (stmt);
+}
+
+/**
+ * egg_sqlite_delete_row:
+ * @stmts: The statements of the table to delete from.
+ * @oid: oid of the row to delete.
+ *
+ * Deletes a row and updates the position indexes.
+ *
+ * Returns TRUE if the delete ran.
+ **/
+gboolean
+egg_sqlite_delete_row (EggSqliteStatements *stmts, sqlite3_int64 oid)
+{
+	sqlite3_stmt *stmt;
+
+	g_return_val_if_fail (stmts != NULL, FALSE);
+
+	if (!(stmt = egg_sqlite_statements_get (stmts, STMT_DELETE_ROW)))
+		return FALSE;
+
+	sqlite3_bind_int64 (stmt, 1, oid);
+
+	if (!egg_sqlite_step_done (stmt))
+		return FALSE;
+
+	if (sqlite3_changes (stmts->sqlite) > 0)
+		egg_sqlite_statements_row_deleted (stmts, oid);
+
+	return TRUE;
+}
+
+/**
+ * egg_sqlite_delete_all:
+ * @stmts: The statements of the table to empty.
+ *
+ * Deletes every row.
+ *
+ * Returns TRUE if the delete ran.
+ **/
+gboolean
+egg_sqlite_delete_all (EggSqliteStatements *stmts)
+{
+	gboolean ret;
+
+	g_return_val_if_fail (stmts != NULL, FALSE);
+
+	ret = egg_sqlite_exec (stmts, STMT_DELETE_ALL);
+	egg_sqlite_statements_invalidate (stmts);
+
+	/* an empty table is indexed without asking, which change tracking needs */
+	if (ret) {
+		stmts->n_rows = 0;
+		egg_sqlite_rank_ensure (stmts);
+	}
+
+	return ret;
+}
+
+/**
+ * egg_sqlite_begin:
+ * @stmts: A #EggSqliteStatements.
+ *
+ * Starts a transaction with BEGIN IMMEDIATE, taking the write lock up
+ * front so the commit cannot fail for want of it.
+ **/
+gboolean
+egg_sqlite_begin (EggSqliteStatements *stmts)
+{
+	g_return_val_if_fail (stmts != NULL, FALSE);
+	return egg_sqlite_exec (stmts, STMT_BEGIN);
+}
+
+/**
+ * egg_sqlite_begin_read:
+ * @stmts: A #EggSqliteStatements.
+ *
+ * Starts a deferred transaction, for reading.  Everything read until
+ * egg_sqlite_commit() sees the table as of the first read, which also
+ * works on a read-only connection.
+ **/
+gboolean
+egg_sqlite_begin_read (EggSqliteStatements *stmts)
+{
+	g_return_val_if_fail (stmts != NULL, FALSE);
+	return egg_sqlite_exec (stmts, STMT_BEGIN_READ);
+}
+
+/**
+ * egg_sqlite_commit:
+ * @stmts: A #EggSqliteStatements.
+ *
+ * Commits the open transaction.  If it fails the transaction may still
+ * be open, or SQLite may have rolled it back already; either way
+ * egg_sqlite_rollback() ends it.
+ **/
+gboolean
+egg_sqlite_commit (EggSqliteStatements *stmts)
+{
+	g_return_val_if_fail (stmts != NULL, FALSE);
+	return egg_sqlite_exec (stmts, STMT_COMMIT);
 }
 
 /**
- * egg_sqlite_fetch_n_columns:
+ * egg_sqlite_rollback:
+ * @stmts: A #EggSqliteStatements.
+ *
+ * Rolls back the open transaction.  The position indexes followed its
+ * changes and still do; egg_sqlite_statements_resync() brings them back
+ * to the table and tells which rows came back or went again.
+ **/
+gboolean
+egg_sqlite_rollback (EggSqliteStatements *stmts)
+{
+	g_return_val_if_fail (stmts != NULL, FALSE);
+	return egg_sqlite_exec (stmts, STMT_ROLLBACK);
+}
+
+/*
+ * The GType a declared column type maps to, by SQLite's affinity rules
+ * and in their order.  Columns of NUMERIC affinity can hold text that is
+ * not a number, a DATE say, so they are strings.  Declared BLOB columns
+ * hold bytes that need not be text, nuls included, and are GByteArrays.
+ * Columns declared with no type at all usually hold text and stay
+ * strings.
+ */
+static GType
+egg_sqlite_affinity_type (const gchar *decl)
+{
+	gchar *upper;
+	GType  type;
+
+	if (!decl || !*decl)
+		return G_TYPE_STRING;
+
+	upper = g_ascii_strup (decl, -1);
+
+	if (strstr (upper, "INT"))
+		type = G_TYPE_INT64;
+	else if (strstr (upper, "CHAR") || strstr (upper, "CLOB") || strstr (upper, "TEXT"))
+		type = G_TYPE_STRING;
+	else if (strstr (upper, "BLOB"))
+		type = G_TYPE_BYTE_ARRAY;
+	else if (strstr (upper, "REAL") || strstr (upper, "FLOA") || strstr (upper, "DOUB"))
+		type = G_TYPE_DOUBLE;
+	else
+		type = G_TYPE_STRING;
+
+	g_free (upper);
+
+	return type;
+}
+
+/**
+ * egg_sqlite_fetch_column_types:
  * @sqlite: A sqlite3 handle.
  * @table: Name of table to select from.
+ * @n_columns: Location for the number of columns, including oid.
  *
- * Retuns the number of columns found in table, including oid.
+ * Returns the GType of each column in table, from its declared type, the
+ * oid first as G_TYPE_INT64.  Free with g_free().  Only run once per
+ * store, so the statement is not cached.
  **/
-gint
-egg_sqlite_fetch_n_columns (sqlite3 *sqlite, gchar *table)
+GType*
+egg_sqlite_fetch_column_types (sqlite3 *sqlite, const gchar *table, gint *n_columns)
 {
-	gint   n = 0;
-	gchar *query;
+	sqlite3_stmt *stmt = NULL;
+	GArray       *types;
+	GType         type;
+	gchar        *query;
+
+	g_return_val_if_fail (n_columns != NULL, NULL);
+
+	types = g_array_new (FALSE, FALSE, sizeof (GType));
+
+	type = G_TYPE_INT64; /* oid */
+	g_array_append_val (types, type);
 
 	query = g_strdup_printf ("PRAGMA table_info('%s')", table);
-	sqlite3_exec (sqlite, query, egg_sqlite_fetch_n_columns_cb, &n, NULL);
+	if (SQLITE_OK == sqlite3_prepare_v2 (sqlite, query, -1, &stmt, NULL)) {
+		/* cid, name, type, notnull, dflt_value, pk */
+		while (sqlite3_step (stmt) == SQLITE_ROW) {
+			type = egg_sqlite_affinity_type ((const gchar*)sqlite3_column_text (stmt, 2));
+			g_array_append_val (types, type);
+		}
+		sqlite3_finalize (stmt);
+	}
+	g_free (query);
+
+	*n_columns = types->len;
+	return (GType*)g_array_free (types, FALSE);
+}
+
+/**
+ * egg_sqlite_has_unique_index:
+ * @sqlite: A sqlite3 handle.
+ * @table: Name of the table.
+ *
+ * Returns TRUE if @table has a UNIQUE or non-integer PRIMARY KEY index.
+ * An INSERT or UPDATE OR REPLACE conflicting on one deletes the rows in
+ * its way, and neither the update hook nor the change counts see those.
+ **/
+gboolean
+egg_sqlite_has_unique_index (sqlite3 *sqlite, const gchar *table)
+{
+	sqlite3_stmt *stmt = NULL;
+	gboolean      unique = FALSE;
+	gchar        *query;
+
+	query = g_strdup_printf ("PRAGMA index_list('%s')", table);
+	if (SQLITE_OK == sqlite3_prepare_v2 (sqlite, query, -1, &stmt, NULL)) {
+		/* seq, name, unique, origin, partial */
+		while (!unique && sqlite3_step (stmt) == SQLITE_ROW)
+			unique = sqlite3_column_int (stmt, 2) != 0;
+		sqlite3_finalize (stmt);
+	}
 	g_free (query);
 
-	n += 1; /* oid */
-	return n;
+	return unique;
 }
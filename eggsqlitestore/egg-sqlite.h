@@ -23,12 +23,101 @@
 
 #include <sqlite3.h>
 #include <glib.h>
+#include <glib-object.h>
 
-gint    egg_sqlite_count_rows      (sqlite3 *sqlite, gchar *table);
-gint    egg_sqlite_fetch_row_pos   (sqlite3 *sqlite, gchar *table, gchar *oid);
-GPtrArray* egg_sqlite_fetch_next      (sqlite3 *sqlite, gchar *table, gchar *last_oid);
-GPtrArray* egg_sqlite_fetch_row       (sqlite3 *sqlite, gchar *table, gchar *oid);
-GPtrArray* egg_sqlite_fetch_nth_row   (sqlite3 *sqlite, gchar *table, gint index);
-gint    egg_sqlite_fetch_n_columns (sqlite3 *sqlite, gchar *table);
+typedef struct _EggSqliteStatements EggSqliteStatements;
+typedef struct _EggSqliteIndex      EggSqliteIndex;
+
+typedef enum
+{
+	EGG_SQLITE_VALUE_NULL,
+	EGG_SQLITE_VALUE_INT64,
+	EGG_SQLITE_VALUE_DOUBLE,
+	EGG_SQLITE_VALUE_TEXT,
+	EGG_SQLITE_VALUE_BLOB
+} EggSqliteValueType;
+
+typedef struct
+{
+	guint32 type;            /* EggSqliteValueType */
+	guint32 len;             /* bytes of a text or blob slice */
+	union {
+		gint64  v_int64;
+		gdouble v_double;
+		guint32 offset;      /* of a text or blob slice in the row's data */
+	} u;
+} EggSqliteValue;
+
+/*
+ * A fetched row as one allocation: the values as SQLite returned them,
+ * then the bytes of every text and blob value, each followed by a nul.
+ */
+typedef struct
+{
+	gsize          size;     /* bytes allocated, for cache accounting */
+	sqlite3_int64  oid;
+	guint          n_values; /* values[0] is the oid */
+	EggSqliteValue values[1];
+} EggSqliteRow;
+
+/* a row that came or went, see egg_sqlite_statements_resync() */
+typedef struct
+{
+	sqlite3_int64 oid;
+	gint          pos;
+} EggSqliteChange;
+
+void          egg_sqlite_row_free       (EggSqliteRow *row);
+gboolean      egg_sqlite_row_equal      (EggSqliteRow *a, EggSqliteRow *b);
+const gchar*  egg_sqlite_row_get_text   (EggSqliteRow *row, guint column);
+void          egg_sqlite_row_get_value  (EggSqliteRow *row, guint column, GValue *value);
+
+EggSqliteStatements* egg_sqlite_statements_new  (sqlite3 *sqlite, const gchar *table);
+void                 egg_sqlite_statements_free (EggSqliteStatements *stmts);
+void                 egg_sqlite_statements_row_inserted (EggSqliteStatements *stmts,
+                                                         sqlite3_int64        id);
+void                 egg_sqlite_statements_row_deleted  (EggSqliteStatements *stmts,
+                                                         sqlite3_int64        id);
+void                 egg_sqlite_statements_invalidate   (EggSqliteStatements *stmts);
+gboolean             egg_sqlite_statements_is_indexed   (EggSqliteStatements *stmts);
+gboolean             egg_sqlite_statements_has_row      (EggSqliteStatements *stmts,
+                                                         sqlite3_int64        oid);
+sqlite3_int64        egg_sqlite_statements_rowid_at     (EggSqliteStatements *stmts,
+                                                         gint                 n);
+gboolean             egg_sqlite_statements_resync       (EggSqliteStatements *stmts,
+                                                         GArray              *deleted,
+                                                         GArray              *inserted);
+gint                 egg_sqlite_statements_get_n_rows   (EggSqliteStatements *stmts);
+EggSqliteIndex*      egg_sqlite_statements_build_index  (EggSqliteStatements *stmts);
+gboolean             egg_sqlite_statements_set_index    (EggSqliteStatements *stmts,
+                                                         EggSqliteIndex      *index,
+                                                         GArray              *deleted,
+                                                         GArray              *inserted);
+void                 egg_sqlite_index_free              (EggSqliteIndex      *index);
+
+gint          egg_sqlite_count_rows         (EggSqliteStatements *stmts);
+gint          egg_sqlite_fetch_row_pos      (EggSqliteStatements *stmts, sqlite3_int64 target);
+EggSqliteRow* egg_sqlite_fetch_next         (EggSqliteStatements *stmts, const sqlite3_int64 *last_oid);
+EggSqliteRow* egg_sqlite_fetch_row          (EggSqliteStatements *stmts, sqlite3_int64 oid);
+gboolean      egg_sqlite_lookup_row         (EggSqliteStatements *stmts, sqlite3_int64 oid,
+                                             EggSqliteRow **row);
+EggSqliteRow* egg_sqlite_fetch_nth_row      (EggSqliteStatements *stmts, gint index);
+GPtrArray*    egg_sqlite_fetch_block        (EggSqliteStatements *stmts, const sqlite3_int64 *last_oid,
+                                             gint n_rows, GArray *oids);
+GPtrArray*    egg_sqlite_fetch_block_at     (EggSqliteStatements *stmts, gint index,
+                                             gint n_rows, GArray *oids);
+sqlite3_int64 egg_sqlite_insert_row         (EggSqliteStatements *stmts);
+gboolean      egg_sqlite_update_value       (EggSqliteStatements *stmts, sqlite3_int64 oid,
+                                             guint column, const GValue *value);
+gboolean      egg_sqlite_delete_row         (EggSqliteStatements *stmts, sqlite3_int64 oid);
+gboolean      egg_sqlite_delete_all         (EggSqliteStatements *stmts);
+gboolean      egg_sqlite_begin              (EggSqliteStatements *stmts);
+gboolean      egg_sqlite_begin_read         (EggSqliteStatements *stmts);
+gboolean      egg_sqlite_commit             (EggSqliteStatements *stmts);
+gboolean      egg_sqlite_rollback           (EggSqliteStatements *stmts);
+gint          egg_sqlite_data_version       (EggSqliteStatements *stmts);
+
+GType*        egg_sqlite_fetch_column_types (sqlite3 *sqlite, const gchar *table, gint *n_columns);
+gboolean      egg_sqlite_has_unique_index   (sqlite3 *sqlite, const gchar *table);
 
 #endif /* __EGG_SQLITE_H__ */
@@ -0,0 +1,506 @@
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+#include <db.h>
+#include <sqlite3.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bdb-list-store.h"
+#include "egg-sqlite-store.h"
+
+/*
+ * Headless benchmark for the GtkTreeModel backends in this tree.  Each
+ * backend is loaded with the same rows and then driven through the model
+ * interface directly, no display or view involved:
+ *
+ *   get_iter, iter_next, iter_nth_child, get_value and get_path
+ *
+ * each under three access patterns:
+ *
+ *   sequential  the first rows, in order
+ *   random      uniformly spread rows, the same seed for every backend
+ *   scroll      windows of consecutive rows spread over the whole list,
+ *               as a GtkTreeView sees them while dragging the scrollbar
+ *
+ * Iters are resolved before the clock starts, so each number is the cost
+ * of the one call.  A measurement stops after MAX_OPS calls or
+ * TIME_BUDGET seconds, whichever comes first, so slow backends still
+ * finish at 10^7 rows.  Allocations are those made through GLib; SQLite
+ * and Berkeley DB allocate on their own and show up in the RSS instead.
+ *
+ * The results are written to stdout as JSON:
+ *
+ *   ./treemodelbench [--backend=NAME] [n_rows ...] > results.json
+ */
+
+#define MAX_OPS      100000
+#define WINDOW       50
+#define TIME_BUDGET  1.0
+#define CHECK_EVERY  16
+
+typedef enum
+{
+	PATTERN_SEQUENTIAL,
+	PATTERN_RANDOM,
+	PATTERN_SCROLL,
+	N_PATTERNS
+} Pattern;
+
+typedef enum
+{
+	OP_GET_ITER,
+	OP_ITER_NEXT,
+	OP_ITER_NTH_CHILD,
+	OP_GET_VALUE,
+	OP_GET_PATH,
+	N_OPS
+} Op;
+
+static const gchar *pattern_names[N_PATTERNS] = { "sequential", "random", "scroll" };
+static const gchar *op_names[N_OPS] = {
+	"get_iter", "iter_next", "iter_nth_child", "get_value", "get_path"
+};
+
+typedef struct
+{
+	const gchar  *name;
+	GtkTreeModel* (*load) (const gchar *dir, gint n_rows);
+	gint          column;     /* the text column */
+} Backend;
+
+static guint64  n_allocs = 0;
+static DB_ENV  *bdb_env = NULL;  /* outlives the store, closed by run() */
+
+static gpointer
+counting_malloc (gsize n_bytes)
+{
+	n_allocs++;
+	return malloc (n_bytes);
+}
+
+static gpointer
+counting_realloc (gpointer mem, gsize n_bytes)
+{
+	n_allocs++;
+	return realloc (mem, n_bytes);
+}
+
+static GMemVTable counting_vtable = {
+	counting_malloc,
+	counting_realloc,
+	free,
+	NULL,
+	NULL,
+	NULL
+};
+
+/* resident set size in kilobytes, 0 where /proc is not available */
+static guint64
+rss_kb (void)
+{
+	gchar   *contents = NULL;
+	guint64  pages = 0;
+	gchar  **fields;
+
+	if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+		return 0;
+
+	fields = g_strsplit (contents, " ", 3);
+	if (fields[0] && fields[1])
+		pages = g_ascii_strtoull (fields[1], NULL, 10);
+	g_strfreev (fields);
+	g_free (contents);
+
+	return pages * sysconf (_SC_PAGESIZE) / 1024;
+}
+
+static gchar*
+row_text (gint i)
+{
+	return g_strdup_printf ("This is row %d", i + 1);
+}
+
+static GtkTreeModel*
+load_gtk_list_store (const gchar *dir, gint n_rows)
+{
+	GtkListStore *store = gtk_list_store_new (1, G_TYPE_STRING);
+	gint          i;
+
+	for (i = 0; i < n_rows; i++) {
+		gchar *text = row_text (i);
+		gtk_list_store_insert_with_values (store, NULL, -1, 0, text, -1);
+		g_free (text);
+	}
+
+	return GTK_TREE_MODEL (store);
+}
+
+/*
+ * A plain environment, like bench.c in bdbliststore: no logs to write
+ * while loading, and a database file so the cache does not have to hold
+ * all of it.
+ */
+static GtkTreeModel*
+load_bdb_list_store (const gchar *dir, gint n_rows)
+{
+	BdbListStore  *store;
+	GError        *error = NULL;
+	const gchar  **strv;
+	gchar        **chunk;
+	gint           i, j, n;
+	gint           ret;
+
+	if ((ret = db_env_create (&bdb_env, 0)) != 0)
+		g_error ("db_env_create: %s", db_strerror (ret));
+
+	bdb_env->set_cachesize (bdb_env, 0, 32 * 1024 * 1024, 1);
+
+	if ((ret = bdb_env->open (bdb_env, dir, DB_CREATE | DB_INIT_LOCK | DB_INIT_MPOOL |
+	                          DB_PRIVATE | DB_THREAD, 0)) != 0)
+		g_error ("db_env_open: %s", db_strerror (ret));
+
+	store = bdb_list_store_new ();
+	if (!bdb_list_store_open (store, bdb_env, "bdbliststore.db", 0, &error))
+		g_error ("%s", error->message);
+
+	chunk = g_new0 (gchar*, 10000);
+	strv = (const gchar**)chunk;
+
+	for (i = 0; i < n_rows; i += n) {
+		n = MIN (10000, n_rows - i);
+		for (j = 0; j < n; j++)
+			chunk[j] = row_text (i + j);
+		if (!bdb_list_store_append_many (store, strv, n, &error))
+			g_error ("%s", error->message);
+		for (j = 0; j < n; j++)
+			g_free (chunk[j]);
+	}
+
+	g_free (chunk);
+
+	return GTK_TREE_MODEL (store);
+}
+
+static GtkTreeModel*
+load_egg_sqlite_store (const gchar *dir, gint n_rows)
+{
+	GtkTreeModel *store;
+	sqlite3      *db = NULL;
+	sqlite3_stmt *stmt = NULL;
+	GError       *error = NULL;
+	gchar        *filename;
+	gint          i;
+
+	filename = g_build_filename (dir, "eggsqlitestore.db", NULL);
+
+	if (sqlite3_open (filename, &db) != SQLITE_OK ||
+	    sqlite3_exec (db, "CREATE TABLE rows (text TEXT)", NULL, NULL, NULL) != SQLITE_OK ||
+	    sqlite3_exec (db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2 (db, "INSERT INTO rows (text) VALUES (?)", -1, &stmt, NULL) != SQLITE_OK)
+		g_error ("sqlite: %s", sqlite3_errmsg (db));
+
+	for (i = 0; i < n_rows; i++) {
+		gchar *text = row_text (i);
+		sqlite3_bind_text (stmt, 1, text, -1, g_free);
+		if (sqlite3_step (stmt) != SQLITE_DONE)
+			g_error ("sqlite: %s", sqlite3_errmsg (db));
+		sqlite3_reset (stmt);
+	}
+
+	sqlite3_finalize (stmt);
+	if (sqlite3_exec (db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+		g_error ("sqlite: %s", sqlite3_errmsg (db));
+	sqlite3_close (db);
+
+	store = egg_sqlite_store_new ();
+	egg_sqlite_store_set_filename (EGG_SQLITE_STORE (store), filename, &error);
+	if (error == NULL)
+		egg_sqlite_store_set_table (EGG_SQLITE_STORE (store), "rows", &error);
+	if (error != NULL)
+		g_error ("%s", error->message);
+
+	g_free (filename);
+
+	return store;
+}
+
+static const Backend backends[] = {
+	{ "GtkListStore",   load_gtk_list_store,   0 },
+	{ "BdbListStore",   load_bdb_list_store,   0 },
+	/* column 0 is the oid */
+	{ "EggSqliteStore", load_egg_sqlite_store, 1 },
+};
+
+static gint
+pattern_fill (Pattern pattern, gint n_rows, gint *indices)
+{
+	GRand *rand;
+	gint   n_ops = MIN (n_rows, MAX_OPS);
+	gint   n_windows, first;
+	gint   i, w;
+
+	switch (pattern) {
+	case PATTERN_SEQUENTIAL:
+		for (i = 0; i < n_ops; i++)
+			indices[i] = i;
+		break;
+
+	case PATTERN_RANDOM:
+		rand = g_rand_new_with_seed (0x7265);
+		for (i = 0; i < n_ops; i++)
+			indices[i] = g_rand_int_range (rand, 0, n_rows);
+		g_rand_free (rand);
+		break;
+
+	case PATTERN_SCROLL:
+		if (n_rows < WINDOW) {
+			for (i = 0; i < n_ops; i++)
+				indices[i] = i;
+			break;
+		}
+		n_windows = n_ops / WINDOW;
+		n_ops = n_windows * WINDOW;
+		for (w = 0; w < n_windows; w++) {
+			first = (gint64)w * (n_rows - WINDOW) / MAX (n_windows - 1, 1);
+			for (i = 0; i < WINDOW; i++)
+				indices[w * WINDOW + i] = first + i;
+		}
+		break;
+
+	default:
+		g_assert_not_reached ();
+	}
+
+	return n_ops;
+}
+
+/* within the time budget too, nth_child is what is slow on some backends */
+static gint
+resolve_iters (GtkTreeModel *model,
+               const gint   *indices,
+               gint          n_ops,
+               GtkTreeIter  *iters)
+{
+	GTimer *timer = g_timer_new ();
+	gint    i;
+
+	for (i = 0; i < n_ops; i++) {
+		if (!gtk_tree_model_iter_nth_child (model, &iters[i], NULL, indices[i]))
+			g_error ("no row %d", indices[i]);
+		if (i % CHECK_EVERY == 0 && g_timer_elapsed (timer, NULL) > TIME_BUDGET * 4)
+			break;
+	}
+
+	g_timer_destroy (timer);
+
+	return i;
+}
+
+static void
+measure (GtkTreeModel *model,
+         gint          column,
+         Op            op,
+         const gint   *indices,
+         GtkTreeIter  *iters,
+         gint          n_ops,
+         gboolean      first)
+{
+	GTimer      *timer = g_timer_new ();
+	GtkTreePath *path = gtk_tree_path_new_first ();
+	GtkTreeIter  iter;
+	GValue       value = { 0, };
+	gdouble      elapsed;
+	guint64      allocs;
+	gint         i;
+
+	n_allocs = 0;
+	g_timer_start (timer);
+
+	for (i = 0; i < n_ops; i++) {
+		switch (op) {
+		case OP_GET_ITER:
+			/* one path reused in place, so the path itself costs nothing */
+			gtk_tree_path_get_indices (path)[0] = indices[i];
+			gtk_tree_model_get_iter (model, &iter, path);
+			break;
+		case OP_ITER_NEXT:
+			iter = iters[i];
+			gtk_tree_model_iter_next (model, &iter);
+			break;
+		case OP_ITER_NTH_CHILD:
+			gtk_tree_model_iter_nth_child (model, &iter, NULL, indices[i]);
+			break;
+		case OP_GET_VALUE:
+			gtk_tree_model_get_value (model, &iters[i], column, &value);
+			g_value_unset (&value);
+			break;
+		case OP_GET_PATH:
+			gtk_tree_path_free (gtk_tree_model_get_path (model, &iters[i]));
+			break;
+		default:
+			g_assert_not_reached ();
+		}
+
+		if (i % CHECK_EVERY == 0 && g_timer_elapsed (timer, NULL) > TIME_BUDGET) {
+			i++;
+			break;
+		}
+	}
+
+	elapsed = g_timer_elapsed (timer, NULL);
+	allocs = n_allocs;
+
+	g_print ("%s        { \"op\": \"%s\", \"n_ops\": %d, \"ns_per_op\": %.1f, "
+	         "\"allocs_per_op\": %.3f }",
+	         first ? "" : ",\n", op_names[op], i,
+	         elapsed * 1e9 / MAX (i, 1), (gdouble)allocs / MAX (i, 1));
+
+	gtk_tree_path_free (path);
+	g_timer_destroy (timer);
+}
+
+/* along with whatever the backend left in it */
+static void
+remove_dir (const gchar *dir)
+{
+	GDir        *gdir;
+	const gchar *name;
+	gchar       *path;
+
+	if ((gdir = g_dir_open (dir, 0, NULL))) {
+		while ((name = g_dir_read_name (gdir))) {
+			path = g_build_filename (dir, name, NULL);
+			g_unlink (path);
+			g_free (path);
+		}
+		g_dir_close (gdir);
+	}
+
+	g_rmdir (dir);
+}
+
+static void
+run (const Backend *backend, gint n_rows, gboolean first)
+{
+	GtkTreeModel *model;
+	GTimer       *timer;
+	GtkTreeIter  *iters;
+	gint         *indices;
+	gchar        *dir;
+	gdouble       load_time;
+	guint64       load_allocs;
+	guint64       rss_before, rss_loaded;
+	Pattern       pattern;
+	Op            op;
+	gint          n_ops;
+
+	dir = g_build_filename (g_get_tmp_dir (), "treemodelbench-XXXXXX", NULL);
+	if (!mkdtemp (dir))
+		g_error ("Cannot create %s", dir);
+
+	rss_before = rss_kb ();
+	timer = g_timer_new ();
+	n_allocs = 0;
+
+	model = backend->load (dir, n_rows);
+
+	load_time = g_timer_elapsed (timer, NULL);
+	load_allocs = n_allocs;
+	rss_loaded = rss_kb ();
+
+	g_print ("%s    {\n"
+	         "      \"backend\": \"%s\",\n"
+	         "      \"n_rows\": %d,\n"
+	         "      \"load_ns_per_row\": %.1f,\n"
+	         "      \"load_allocs_per_row\": %.3f,\n"
+	         "      \"rss_kb\": %" G_GUINT64_FORMAT ",\n"
+	         "      \"rss_growth_kb\": %" G_GINT64_FORMAT ",\n"
+	         "      \"patterns\": {\n",
+	         first ? "" : ",\n", backend->name, n_rows,
+	         load_time * 1e9 / MAX (n_rows, 1),
+	         (gdouble)load_allocs / MAX (n_rows, 1),
+	         rss_loaded, (gint64)rss_loaded - (gint64)rss_before);
+
+	indices = g_new (gint, MIN (n_rows, MAX_OPS));
+	iters = g_new (GtkTreeIter, MIN (n_rows, MAX_OPS));
+
+	for (pattern = 0; pattern < N_PATTERNS; pattern++) {
+		n_ops = pattern_fill (pattern, n_rows, indices);
+		n_ops = resolve_iters (model, indices, n_ops, iters);
+
+		g_print ("%s      \"%s\": [\n", pattern == 0 ? "" : ",\n",
+		         pattern_names[pattern]);
+		for (op = 0; op < N_OPS; op++)
+			measure (model, backend->column, op, indices, iters, n_ops, op == 0);
+		g_print ("\n      ]");
+	}
+
+	g_print ("\n      },\n      \"rss_after_kb\": %" G_GUINT64_FORMAT "\n    }",
+	         rss_kb ());
+
+	g_free (iters);
+	g_free (indices);
+	g_timer_destroy (timer);
+	g_object_unref (model);
+
+	/* the store has closed its database by now */
+	if (bdb_env) {
+		bdb_env->close (bdb_env, 0);
+		bdb_env = NULL;
+	}
+
+	remove_dir (dir);
+	g_free (dir);
+}
+
+gint
+main (int argc, char *argv[])
+{
+	const gchar *only = NULL;
+	GArray      *sizes;
+	gboolean     first = TRUE;
+	guint        i, b;
+
+	/* must come before anything allocates */
+	g_mem_set_vtable (&counting_vtable);
+	g_thread_init (NULL);
+	g_type_init ();
+
+	sizes = g_array_new (FALSE, FALSE, sizeof (gint));
+
+	for (i = 1; i < (guint)argc; i++) {
+		if (g_str_has_prefix (argv[i], "--backend="))
+			only = argv[i] + strlen ("--backend=");
+		else {
+			gint n_rows = atoi (argv[i]);
+			if (n_rows > 0)
+				g_array_append_val (sizes, n_rows);
+		}
+	}
+
+	if (sizes->len == 0) {
+		gint defaults[] = { 10000, 100000, 1000000 };
+		g_array_append_vals (sizes, defaults, G_N_ELEMENTS (defaults));
+	}
+
+	g_print ("{\n  \"max_ops\": %d,\n  \"window\": %d,\n  \"time_budget_s\": %.1f,\n"
+	         "  \"results\": [\n", MAX_OPS, WINDOW, TIME_BUDGET);
+
+	for (i = 0; i < sizes->len; i++) {
+		for (b = 0; b < G_N_ELEMENTS (backends); b++) {
+			if (only && g_ascii_strcasecmp (only, backends[b].name) != 0)
+				continue;
+			run (&backends[b], g_array_index (sizes, gint, i), first);
+			first = FALSE;
+		}
+	}
+
+	g_print ("\n  ]\n}\n");
+
+	g_array_free (sizes, TRUE);
+
+	return 0;
+}